@@ -5,53 +5,63 @@
 // Created by Cameron McEleney on 08 Mar 24
 //
 
-#define NS_PRIVATE_IMPLEMENTATION
-#define CA_PRIVATE_IMPLEMENTATION
-#define MTL_PRIVATE_IMPLEMENTATION
+// Foundation, Metal, QuartzCore and AppKit symbols come from small_test_compute (device/MetalCppImpl.cpp)
 #define MTK_PRIVATE_IMPLEMENTATION
 
 // Local
 #include "src/projects/checks_examples/check_for_metal_device.h"
 #include "src/projects/Small_test_compute/ArrayAdder.h"
+#include "src/projects/Small_test_compute/tuning/Autotuner.h"
 #include "src/projects/graphical_implementation_example/graphical_example_m.h"
 #include "src/projects/compute_function_examples/compute_function_examples.h"
 
 // Include here for ease while building program
+#include <cstdlib>
 #include <random>
 #include <vector>
 
-std::vector<float> getRandomVector(size_t size) {
+// Uniform [0, 1), generated in parallel straight into the vector. The values depend only on the seed and stream (see
+// Philox), so a printed seed reproduces a run.
+std::vector<float> getRandomVector(size_t size, uint64_t seed, uint64_t stream) {
     std::vector<float> vec(size);
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<> dis(0.0, 1.0);
-
-    for (auto& el : vec) {
-        el = static_cast<float>(dis(gen));
-    }
-
+    Philox(seed, stream).fillUniform(vec.data(), vec.size());
     return vec;
 }
 
 int main() {
     // DeviceChecks::checkForDevice();
     DeviceChecks::printDeviceInfo();
+
+    // HELLO_METAL_AUTOTUNE=1 measures chunk/in-flight/threadgroup sizes for this machine and writes them to
+    // TuningProfile::defaultPath(), which ArrayAdder reads on later runs.
+    if (std::getenv("HELLO_METAL_AUTOTUNE")) {
+        Autotuner::tuneAndSave(compute::ComputeSession::shared(), Autotuner::Options());
+    }
     // GraphicalExamples::generateSquare();
 
-    // Written explicitly so I can check the results by hand. Keep below 1 billion elements without chunking!
+    // Keep below 1 billion elements without chunking!
+    // Larger vectors belong in files: see ArrayAdder::addArraysStreaming, which keeps resident memory bounded.
     const size_t vectorSize = static_cast<int>(1e7);
-    std::vector<float> vec1 = getRandomVector(vectorSize);
-    std::vector<float> vec2 = getRandomVector(vectorSize);
+    const uint64_t seed = std::random_device()();
+    std::cout << "seed: " << seed << std::endl;
+    std::vector<float> vec1 = getRandomVector(vectorSize, seed, 0);
+    std::vector<float> vec2 = getRandomVector(vectorSize, seed, 1);
     std::cout << "len vec1: " << vec1.size() << " ! len vec2: " << vec2.size() << std::endl;
     std::vector<float> resultGPU(vec1.size());
     std::vector<float> resultCPU(vec1.size());
 
-    ArrayAdder::addArraysComplexCPU(vec1, vec2, resultCPU);
+    // ArrayAdder::addArraysComplexCPU(vec1, vec2, resultCPU);
+    ArrayAdder::addArraysCPUParallel(vec1, vec2, resultCPU, true);
     // ArrayAdder::addArraysGPU(vec1, vec2, resultGPU, true);
     // ArrayAdder::addArraysGpuWithChunking(vec1, vec2, resultGPU, true, false);
     ArrayAdder arrayAdder;
     arrayAdder.lengthVector = vectorSize;
-    arrayAdder.addArraysGpuChunkingDynamicBufferAsync(vec1, vec2, resultGPU, true, false);
+    arrayAdder.addArraysGpuChunkingDynamicBufferAsync(vec1, vec2, resultGPU, true, true);
+    // Use the CPU and GPU together on one operation:
+    // ArrayAdder::addArraysHeterogeneous(vec1, vec2, resultGPU, true, {&compute::ComputeSession::shared()});
+
+    // Checks every element of the GPU result against the CPU one, in ULPs; the first mismatches are listed.
+    ResultVerifier::compare(resultCPU, resultGPU).print();
 
     //ComputeFunctionExamples computeFunctionExamples;
     //computeFunctionExamples.sumSimpleVectors();
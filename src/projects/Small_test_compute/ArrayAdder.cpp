@@ -0,0 +1,1408 @@
+
+#include "ArrayAdder.h"
+#include "cpu/TypedKernels.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+template<ElementwiseOp Op>
+void ArrayAdder::elementwiseCPU(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC) {
+    Timer cpuTimer;
+    cpuTimer.setName("CPU Timer");
+
+    cpuTimer.start();
+    TypedKernels<float>::apply<Op>(inA.data(), inB.data(), outC.data(), inA.size());
+    cpuTimer.stop();
+
+    cpuTimer.print();
+}
+
+template void ArrayAdder::elementwiseCPU<ElementwiseOp::Add>(const std::vector<float>&, const std::vector<float>&, std::vector<float>&);
+template void ArrayAdder::elementwiseCPU<ElementwiseOp::Complex>(const std::vector<float>&, const std::vector<float>&, std::vector<float>&);
+
+void ArrayAdder::addArraysCPU(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC) {
+    elementwiseCPU<ElementwiseOp::Add>(inA, inB, outC);
+}
+
+void ArrayAdder::addArraysComplexCPU(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC) {
+    elementwiseCPU<ElementwiseOp::Complex>(inA, inB, outC);
+}
+
+void ArrayAdder::addArraysCPUParallel(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC,
+                                      bool complexAddition, ThreadPool::Partitioning partitioning) {
+    addArraysCPUParallel(inA, inB, outC, complexAddition, ThreadPool::shared(), partitioning);
+}
+
+void ArrayAdder::addArraysCPUParallel(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC,
+                                      bool complexAddition, ThreadPool& pool, ThreadPool::Partitioning partitioning) {
+    Timer cpuTimer;
+    cpuTimer.setName("CPU Timer (parallel, " + std::to_string(pool.threadCount()) + " threads)");
+
+    const float* a = inA.data();
+    const float* b = inB.data();
+    float* c = outC.data();
+
+    cpuTimer.start();
+    visitElementwiseOp(elementwiseOp(complexAddition), [&](auto op) {
+        pool.parallelFor(inA.size(), [=](size_t begin, size_t end) {
+            TypedKernels<float>::apply<decltype(op)::value>(a + begin, b + begin, c + begin, end - begin);
+        }, partitioning);
+    });
+    cpuTimer.stop();
+
+    cpuTimer.print();
+}
+
+void ArrayAdder::setCpuThreadCount(size_t numThreads) {
+    ThreadPool::resizeShared(numThreads);
+}
+
+bool ArrayAdder::tuningFor(compute::ComputeSession& session, const std::string& kernelName, size_t vectorSize,
+                           const compute::ComputePipelineState& pipelineState, TuningParameters& parameters) {
+    const bool tuned = TuningProfile::active()->lookup(TuningProfile::machineKey(session.device()), kernelName, vectorSize, parameters);
+    if (!tuned) {
+        parameters = TuningParameters();
+        parameters.chunkSize = defaultChunkSize;
+        parameters.inFlight = defaultInFlight;
+        parameters.threadgroupSize = pipelineState.threadExecutionWidth();
+    }
+
+    // A profile copied from another device could ask for more than this one allows
+    const size_t maxChunkSize = std::max<size_t>(1, session.device().maxBufferLength() / sizeof(float));
+    parameters.chunkSize = std::min(parameters.chunkSize, maxChunkSize);
+    parameters.threadgroupSize = std::max<size_t>(1, std::min(parameters.threadgroupSize, pipelineState.maxTotalThreadsPerThreadgroup()));
+    parameters.inFlight = std::max<size_t>(1, parameters.inFlight);
+    return tuned;
+}
+
+void ArrayAdder::addArraysGPU(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC, bool complexAddition) {
+    addArraysGPU(inA, inB, outC, complexAddition, compute::ComputeSession::shared());
+}
+
+void ArrayAdder::addArraysGPU(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC,
+                              bool complexAddition, compute::ComputeSession& session) {
+    const auto callStart = std::chrono::steady_clock::now();
+
+    Timer gpuTimer;
+    gpuTimer.setName("GPU Timer (compute)");
+
+    // Device, queue and library belong to the session; the pipeline is only built on the first call for this kernel
+    const compute::KernelId kernel = elementwiseKernelId<float>(elementwiseOp(complexAddition));
+    const std::string kernelName(compute::kernelName(kernel));
+    auto computePipelineState = session.pipeline(kernel);
+    if (!computePipelineState) {
+        return;
+    }
+
+    // Create buffers for input and output (recycled from previous calls where possible)
+    const size_t byteLength = inA.size() * sizeof(float);
+    auto bufferA = session.acquireBuffer(byteLength);
+    auto bufferB = session.acquireBuffer(byteLength);
+    auto bufferC = session.acquireBuffer(byteLength);
+    if (!bufferA || !bufferB || !bufferC) {
+        std::cerr << "addArraysGPU: failed to create one or more buffers." << std::endl;
+        session.recycleBuffer(std::move(bufferA));
+        session.recycleBuffer(std::move(bufferB));
+        session.recycleBuffer(std::move(bufferC));
+        return;
+    }
+    memcpy(bufferA->contents(), inA.data(), byteLength);
+    memcpy(bufferB->contents(), inB.data(), byteLength);
+
+    // Encoding commands
+    auto commandBuffer = session.queue().commandBuffer();
+    auto computeCommandEncoder = commandBuffer->computeCommandEncoder();
+    computeCommandEncoder->setComputePipelineState(computePipelineState);
+    computeCommandEncoder->setBuffer(bufferA.get(), 0, 0);
+    computeCommandEncoder->setBuffer(bufferB.get(), 0, 1);
+    computeCommandEncoder->setBuffer(bufferC.get(), 0, 2);
+
+    bool simpleThreadGroupSize = false;
+
+    if (simpleThreadGroupSize)
+    {
+        compute::Size gridSize = {inA.size(), 1, 1};
+        compute::Size threadgroupSize = {
+                std::min(computePipelineState->maxTotalThreadsPerThreadgroup(), inA.size()),
+                1,
+                1
+        };
+        computeCommandEncoder->dispatchThreads(gridSize, threadgroupSize);
+    }
+    else
+    {
+        // Obtain thread execution width (or the tuned threadgroup size) and max total threads per threadgroup
+        TuningParameters tuning;
+        tuningFor(session, kernelName, inA.size(), *computePipelineState, tuning);
+        size_t threadExecutionWidth = tuning.threadgroupSize;
+
+        // One thread per element, so a 1D threadgroup of the execution width
+        compute::Size threadgroupSize = {threadExecutionWidth, 1, 1};
+
+
+        // Calculate the total number of threads in the grid
+        // In this case, we are assuming a 1D data structure, so height and depth are set to 1
+        compute::Size gridSize = {inA.size(), 1, 1};
+
+        // Dispatch threads using nonuniform thread groups
+        computeCommandEncoder->dispatchThreads(gridSize, threadgroupSize);
+    }
+    computeCommandEncoder->endEncoding();
+
+    gpuTimer.start();
+    // Initiate the computation on the GPU
+    commandBuffer->commit();
+    // Ensure that the CPU checks that the GPU is finished before continuing
+    commandBuffer->waitUntilCompleted();
+    gpuTimer.stop();
+    gpuTimer.print();
+
+    gpuTimer.setName("GPU Timer (copy memory)");
+    gpuTimer.start();
+    // Retrieve the result
+    memcpy(outC.data(), bufferC->contents(), inA.size() * sizeof(float));
+    gpuTimer.stop();
+    gpuTimer.print();
+
+    // Hand the buffers back to the session for the next call
+    session.recycleBuffer(std::move(bufferA));
+    session.recycleBuffer(std::move(bufferB));
+    session.recycleBuffer(std::move(bufferC));
+
+    session.recordCall("addArraysGPU/" + kernelName, std::chrono::steady_clock::now() - callStart);
+}
+
+void ArrayAdder::addArraysGpuWithChunking( const std::vector<float>& inA, const std::vector<float>& inB,
+                                           std::vector<float>& outC, bool complexAddition, bool onlyOutputToCpu) {
+    addArraysGpuWithChunking(inA, inB, outC, complexAddition, onlyOutputToCpu, compute::ComputeSession::shared());
+}
+
+void ArrayAdder::addArraysGpuWithChunking( const std::vector<float>& inA, const std::vector<float>& inB,
+                                           std::vector<float>& outC, bool complexAddition, bool onlyOutputToCpu,
+                                           compute::ComputeSession& session) {
+    /*
+     *
+Given the specifications of your Apple M3 Pro system and the sizes of your vectors (10 billion elements for a large example and 12,000 elements for a small example), let's break down how to structure your workgroups for optimal performance. The approach to chunking and workgroup organization is critical in leveraging the GPU efficiently.
+
+Understanding Your System's Constraints
+
+     Max Threads Per Threadgroup (1024):
+                                    This is the upper limit of threads you can have in a single threadgroup.
+
+     Thread Execution Width (32):
+                                    This indicates the optimal number of threads that can be executed in parallel for a single threadgroup.
+
+     Max Buffer Length (9,663,676,416 bytes):
+                                    Maximum size of a buffer that can be allocated,
+                                        important for understanding how much data you can work with in a single operation.
+
+     Unified Memory:
+                                    Simplifies memory management but still requires efficient use of memory to avoid performance bottlenecks.
+Strategy for Large Vectors (10 Billion Elements)
+
+     Chunking Data:
+
+     Given the vector's size far exceeds the Max Buffer Length, you'll need to chunk the data.
+
+     Determine an appropriate chunk size based on the Max Buffer Length and the size of a float (4 bytes).
+     However, processing 10 billion elements in a single pass isn't feasible due to memory constraints,
+        so decide on a chunk size that balances memory use and performance. For instance, processing 1 million elements per chunk would require 4MB per buffer (since each float is 4 bytes), which is well within your buffer limit.
+
+     Configuring Workgroups:
+            With a Thread Execution Width of 32, configure each workgroup to handle a segment of the chunk efficiently.
+            If processing 1 million elements per chunk, divide this work among several threadgroups.
+
+            You might not use the maximum of 1024 threads per threadgroup if it doesn't divide evenly into your chunk size.
+            Aim for full utilization of the 32-thread execution width. For example, you could have workgroups of 32 threads each.
+
+Example Calculation for Small and Large Vectors:
+
+     Large Vector (10 Billion Elements):
+                                    If you're processing in chunks of 1 million elements, that's 10,000 chunks in total.
+                                    Each thread could process multiple elements to match the execution width and threads per threadgroup.
+
+     Small Vector (12,000 Elements):
+                                    This can be processed in a single chunk.
+                                    You could use 375 threads (12,000 elements / 32 = 375), fitting within the 1024 thread per threadgroup limit.
+                                    If you opt for an exact match to the execution width, consider structuring your kernel to handle this efficiently,
+                                        possibly by making each thread process multiple elements if necessary.
+     */
+    const auto callStart = std::chrono::steady_clock::now();
+
+    Timer gpuTimer;
+    gpuTimer.setName("GPU Timer (compute)");
+
+    size_t vectorSize = inA.size();
+
+    auto& commandQueue = session.queue();
+    const compute::KernelId kernel = elementwiseKernelId<float>(elementwiseOp(complexAddition));
+    const std::string kernelName(compute::kernelName(kernel));
+    auto computePipelineState = session.pipeline(kernel);
+
+    if (!computePipelineState) {
+        std::cerr << "Failed to initialize GPU resources." << std::endl;
+        return;
+    }
+
+    // Chunk and threadgroup sizes come from the tuning profile. This path keeps one chunk in flight while the next is
+    // staged, so the tuned in-flight depth does not apply.
+    TuningParameters tuning;
+    tuningFor(session, kernelName, vectorSize, *computePipelineState, tuning);
+    const size_t maxChunkSize = tuning.chunkSize;
+
+    // Create buffers for input and output. Use A/B/C and D/E/F sets of buffers to enable async processing
+    auto bufferA = session.acquireBuffer(maxChunkSize * sizeof(float));
+    auto bufferB = session.acquireBuffer(maxChunkSize * sizeof(float));
+    auto bufferC = session.acquireBuffer(maxChunkSize * sizeof(float));
+    auto bufferD = session.acquireBuffer(maxChunkSize * sizeof(float));
+    auto bufferE = session.acquireBuffer(maxChunkSize * sizeof(float));
+    auto bufferF = session.acquireBuffer(maxChunkSize * sizeof(float));
+
+    // Error handling example for buffer creation
+    if (!bufferA || !bufferB || !bufferC || !bufferD || !bufferE || !bufferF) {
+        std::cerr << "Failed to create one or more buffers." << std::endl;
+        std::exit(1);
+    }
+
+    // Load the first chunk into bufferA and bufferB
+    size_t chunkSize = std::min(vectorSize, maxChunkSize);
+    memcpy(bufferA->contents(), inA.data(), chunkSize * sizeof(float));
+    memcpy(bufferB->contents(), inB.data(), chunkSize * sizeof(float));
+
+    size_t processedChunks = 0; // Keep track of the number of chunks processed
+
+    gpuTimer.start();
+
+    // Use a semaphore for synchronization between CPU and GPU; allows a single one to be made
+    compute::Semaphore semaphore(1);
+
+    for (size_t start = 0; start < vectorSize; start += maxChunkSize) {
+        semaphore.wait();
+
+        size_t currentChunkSize = std::min(vectorSize - start, maxChunkSize);
+
+        // Preparing command buffer and command encoder
+        auto commandBuffer = commandQueue.commandBuffer();
+
+        // Ensure commandBuffer and computeCommandEncoder creation succeeded
+        auto computeCommandEncoder = commandBuffer ? commandBuffer->computeCommandEncoder() : nullptr;
+        if (!commandBuffer || !computeCommandEncoder) {
+            std::cerr << "Failed to create command buffer or encoder." << std::endl;
+            std::exit(1);
+        }
+
+        computeCommandEncoder->setComputePipelineState(computePipelineState);
+
+        // Encoding commands
+        computeCommandEncoder->setBuffer(bufferA.get(), 0, 0);
+        computeCommandEncoder->setBuffer(bufferB.get(), 0, 1);
+        computeCommandEncoder->setBuffer(bufferC.get(), 0, 2);
+
+        compute::Size gridSize = {currentChunkSize, 1, 1};
+        compute::Size threadgroupSize = {std::min(tuning.threadgroupSize, gridSize.width), 1, 1};
+        computeCommandEncoder->dispatchThreads(gridSize, threadgroupSize);
+        computeCommandEncoder->endEncoding();
+
+        // Hand the semaphore back once this chunk is done
+        commandBuffer->addCompletedHandler([&semaphore](compute::CommandBuffer*) {
+            semaphore.signal();
+        });
+
+        // Submit current chunk for processing
+        commandBuffer->commit();
+
+        // Prepare the next chunk asynchronously while the GPU works
+        if (start + maxChunkSize < vectorSize) {
+            size_t nextChunkSize = std::min(vectorSize - (start + maxChunkSize), maxChunkSize);
+            memcpy(bufferD->contents(), inA.data() + start + maxChunkSize, nextChunkSize * sizeof(float));
+            memcpy(bufferE->contents(), inB.data() + start + maxChunkSize, nextChunkSize * sizeof(float));
+        }
+
+        if (start != 0 && onlyOutputToCpu) {
+            // Copy results back to the CPU from the previous iteration's output buffer while the GPU works
+            memcpy(outC.data() + start - maxChunkSize, bufferF->contents(), maxChunkSize * sizeof(float));
+        }
+
+        commandBuffer->waitUntilCompleted();
+
+        if (start + maxChunkSize < vectorSize) {
+            // Swap buffers for the next iteration if there exists a next iteration
+            std::swap(bufferA, bufferD);
+            std::swap(bufferB, bufferE);
+            std::swap(bufferC, bufferF);
+        } else {
+            // This is the final iteration so we do clean-up of the data
+            if (onlyOutputToCpu) {
+                if ( vectorSize % maxChunkSize > 0 ) { // Check if there's a remainder chunk
+                    size_t remainderSize = vectorSize % maxChunkSize;
+                    memcpy(outC.data() + vectorSize - remainderSize, bufferC->contents(), remainderSize * sizeof(float));
+                } else { // Full chunk
+                    memcpy(outC.data() + vectorSize - maxChunkSize, bufferC->contents(), maxChunkSize * sizeof(float));
+                }
+            }
+        }
+
+        processedChunks++;
+    }
+    gpuTimer.stop();
+
+    gpuTimer.print();
+
+    // Ensure all command buffers are completed before exiting the function
+    semaphore.wait();
+
+    // Hand the buffers back to the session for the next call
+    for (auto* buffer : {&bufferA, &bufferB, &bufferC, &bufferD, &bufferE, &bufferF}) {
+        session.recycleBuffer(std::move(*buffer));
+    }
+
+    session.recordCall("addArraysGpuWithChunking/" + kernelName, std::chrono::steady_clock::now() - callStart);
+}
+
+bool ArrayAdder::addArraysZeroCopy(const PageAlignedVector<float>& inA, const PageAlignedVector<float>& inB,
+                                   PageAlignedVector<float>& outC, bool complexAddition, compute::ComputeSession& session) {
+    const auto callStart = std::chrono::steady_clock::now();
+
+    Timer gpuTimer;
+    gpuTimer.setName("GPU Timer (zero-copy)");
+
+    const size_t vectorSize = inA.size();
+    if (inB.size() != vectorSize || outC.size() != vectorSize) {
+        std::cerr << "addArraysZeroCopy: vectors must all have the same length." << std::endl;
+        return false;
+    }
+    if (vectorSize == 0) {
+        return true;
+    }
+
+    const compute::KernelId kernel = elementwiseKernelId<float>(elementwiseOp(complexAddition));
+    const std::string kernelName(compute::kernelName(kernel));
+    auto computePipelineState = session.pipeline(kernel);
+    if (!computePipelineState) {
+        std::cerr << "addArraysZeroCopy: " << kernelName << " is not available on this backend." << std::endl;
+        return false;
+    }
+
+    // Each piece must start on a page boundary, so it holds a whole number of pages
+    const size_t elementsPerPage = pageSize() / sizeof(float);
+    const size_t maxPieceBytes = session.device().maxBufferLength() / pageSize() * pageSize();
+    const size_t maxPieceSize = std::max(elementsPerPage, maxPieceBytes / sizeof(float));
+
+    // The data pointers are wrapped, not copied. Inputs are only read by the kernel.
+    auto* a = const_cast<float*>(inA.data());
+    auto* b = const_cast<float*>(inB.data());
+    float* c = outC.data();
+
+    gpuTimer.start();
+    // Every piece is wrapped before any is committed: bailing out after a commit would free buffers the device is
+    // still using.
+    struct Piece {
+        size_t size;
+        std::unique_ptr<compute::Buffer> bufferA, bufferB, bufferC;
+    };
+    std::vector<Piece> pieces;
+    for (size_t start = 0; start < vectorSize; start += maxPieceSize) {
+        const size_t pieceSize = std::min(vectorSize - start, maxPieceSize);
+        // PageAlignedAllocator always allocates whole pages, so rounding the length up stays inside the allocation
+        const size_t pieceBytes = roundUpToPageSize(pieceSize * sizeof(float));
+
+        Piece piece{pieceSize, session.device().newBufferNoCopy(a + start, pieceBytes),
+                    session.device().newBufferNoCopy(b + start, pieceBytes), session.device().newBufferNoCopy(c + start, pieceBytes)};
+        if (!piece.bufferA || !piece.bufferB || !piece.bufferC) {
+            std::cerr << "addArraysZeroCopy: the device refused to wrap the vectors' memory." << std::endl;
+            return false;
+        }
+        pieces.push_back(std::move(piece));
+    }
+
+    std::vector<std::shared_ptr<compute::CommandBuffer>> commandBuffers;
+    for (auto& piece : pieces) {
+        auto commandBuffer = session.queue().commandBuffer();
+        auto computeCommandEncoder = commandBuffer->computeCommandEncoder();
+        computeCommandEncoder->setComputePipelineState(computePipelineState);
+        computeCommandEncoder->setBuffer(piece.bufferA.get(), 0, 0);
+        computeCommandEncoder->setBuffer(piece.bufferB.get(), 0, 1);
+        computeCommandEncoder->setBuffer(piece.bufferC.get(), 0, 2);
+
+        compute::Size gridSize = {piece.size, 1, 1};
+        compute::Size threadgroupSize = {std::min(computePipelineState->threadExecutionWidth(), gridSize.width), 1, 1};
+        computeCommandEncoder->dispatchThreads(gridSize, threadgroupSize);
+        computeCommandEncoder->endEncoding();
+        commandBuffer->commit();
+        commandBuffers.push_back(commandBuffer);
+    }
+
+    for (auto& commandBuffer : commandBuffers) {
+        commandBuffer->waitUntilCompleted();
+    }
+    gpuTimer.stop();
+    gpuTimer.print();
+
+    session.recordCall("addArraysZeroCopy/" + kernelName, std::chrono::steady_clock::now() - callStart);
+    return true;
+}
+
+bool ArrayAdder::addArraysStreaming(const std::string& pathA, const std::string& pathB, const std::string& outPath,
+                                    bool complexAddition, const StreamingOptions& options, compute::ComputeSession& session) {
+    auto inA = MappedFile::open(pathA);
+    auto inB = MappedFile::open(pathB);
+    if (!inA || !inB) {
+        return false;
+    }
+    auto outC = MappedFile::create(outPath, inA->size());
+    if (!outC) {
+        return false;
+    }
+    return addArraysStreaming(*inA, *inB, *outC, complexAddition, options, session);
+}
+
+bool ArrayAdder::addArraysStreaming(MappedFile& inA, MappedFile& inB, MappedFile& outC, bool complexAddition,
+                                    const StreamingOptions& options, compute::ComputeSession& session) {
+    const auto callStart = std::chrono::steady_clock::now();
+
+    Timer gpuTimer;
+    gpuTimer.setName("GPU Timer (streaming)");
+
+    if (inA.size() != inB.size() || outC.size() < inA.size() || inA.size() % sizeof(float) != 0) {
+        std::cerr << "addArraysStreaming: inputs must be float files of equal length, and the output at least as long." << std::endl;
+        return false;
+    }
+    if (!outC.writable()) {
+        std::cerr << "addArraysStreaming: the output file is not mapped for writing." << std::endl;
+        return false;
+    }
+    const size_t vectorSize = inA.size() / sizeof(float);
+    if (vectorSize == 0) {
+        return true;
+    }
+
+    const compute::KernelId kernel = elementwiseKernelId<float>(elementwiseOp(complexAddition));
+    const std::string kernelName(compute::kernelName(kernel));
+    auto computePipelineState = session.pipeline(kernel);
+    if (!computePipelineState) {
+        return false;
+    }
+    const auto reference = visitElementwiseOp(elementwiseOp(complexAddition), [](auto constant) {
+        return SimdKernels::active().*simdElementwise<decltype(constant)::value>;
+    });
+
+    TuningParameters tuning;
+    tuningFor(session, kernelName, vectorSize, *computePipelineState, tuning);
+    const size_t inFlight = options.inFlight > 0 ? options.inFlight : tuning.inFlight;
+    // Whole pages per chunk, so evicting one chunk never drops pages a neighbouring chunk is still using
+    const size_t elementsPerPage = pageSize() / sizeof(float);
+    size_t chunkSize = options.chunkSize > 0 ? options.chunkSize : tuning.chunkSize;
+    chunkSize = std::max(elementsPerPage, (chunkSize + elementsPerPage - 1) / elementsPerPage * elementsPerPage);
+    const size_t chunkBytes = chunkSize * sizeof(float);
+    const size_t numChunks = (vectorSize + chunkSize - 1) / chunkSize;
+
+    const auto* a = static_cast<const float*>(inA.data());
+    const auto* b = static_cast<const float*>(inB.data());
+    auto* c = static_cast<float*>(outC.data());
+
+    inA.adviseSequential();
+    inB.adviseSequential();
+    outC.adviseSequential();
+    for (size_t chunk = 0; chunk < std::min(numChunks, options.readAheadChunks + 1); ++chunk) {
+        inA.willNeed(chunk * chunkBytes, chunkBytes);
+        inB.willNeed(chunk * chunkBytes, chunkBytes);
+    }
+
+    gpuTimer.start();
+    {
+        compute::ChunkPipeline chunkPipeline(session, inFlight, buffersPerChunk, chunkBytes);
+        if (!chunkPipeline.valid()) {
+            std::cerr << "Failed to create one or more buffers." << std::endl;
+            return false;
+        }
+
+        for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+            const size_t start = chunk * chunkSize;
+            const size_t currentChunkSize = std::min(vectorSize - start, chunkSize);
+
+            // Reusing a slot means the chunk that last held it has completed, so its output can be written back
+            auto& slot = chunkPipeline.acquire();
+            if (chunk >= inFlight) {
+                outC.evict((chunk - inFlight) * chunkBytes, chunkBytes);
+            }
+
+            const size_t prefetch = chunk + options.readAheadChunks;
+            if (options.readAheadChunks > 0 && prefetch < numChunks) {
+                inA.willNeed(prefetch * chunkBytes, chunkBytes);
+                inB.willNeed(prefetch * chunkBytes, chunkBytes);
+            }
+
+            memcpy(slot.buffer(0)->contents(), a + start, currentChunkSize * sizeof(float));
+            memcpy(slot.buffer(1)->contents(), b + start, currentChunkSize * sizeof(float));
+            // The inputs for this chunk are staged; their pages are no longer needed
+            inA.evict(start * sizeof(float), currentChunkSize * sizeof(float));
+            inB.evict(start * sizeof(float), currentChunkSize * sizeof(float));
+
+            auto commandBuffer = session.queue().commandBuffer();
+            auto computeCommandEncoder = commandBuffer->computeCommandEncoder();
+            computeCommandEncoder->setComputePipelineState(computePipelineState);
+            computeCommandEncoder->setBuffer(slot.buffer(0), 0, 0);
+            computeCommandEncoder->setBuffer(slot.buffer(1), 0, 1);
+            computeCommandEncoder->setBuffer(slot.buffer(2), 0, 2);
+
+            compute::Size gridSize = {currentChunkSize, 1, 1};
+            compute::Size threadgroupSize = {std::min(tuning.threadgroupSize, gridSize.width), 1, 1};
+            computeCommandEncoder->dispatchThreads(gridSize, threadgroupSize);
+            computeCommandEncoder->endEncoding();
+
+            float* destination = c + start;
+            chunkPipeline.releaseOnCompletion(*commandBuffer, slot, [destination, start, currentChunkSize, &options, reference](compute::ChunkPipeline::Slot& done) {
+                memcpy(destination, done.buffer(2)->contents(), currentChunkSize * sizeof(float));
+                if (options.verifier) {
+                    // The slot still holds the staged inputs, so the reference needs no second read of the files
+                    thread_local std::vector<float> expected;
+                    expected.resize(currentChunkSize);
+                    reference(static_cast<const float*>(done.buffer(0)->contents()), static_cast<const float*>(done.buffer(1)->contents()),
+                              expected.data(), currentChunkSize);
+                    options.verifier->add(start, expected.data(), static_cast<const float*>(done.buffer(2)->contents()), currentChunkSize);
+                }
+            });
+            commandBuffer->commit();
+        }
+        chunkPipeline.drain();
+    }
+
+    // Write back the chunks that were still in flight when the loop ended
+    const size_t firstUnevicted = numChunks > inFlight ? numChunks - inFlight : 0;
+    outC.evict(firstUnevicted * chunkBytes, (numChunks - firstUnevicted) * chunkBytes);
+    gpuTimer.stop();
+    gpuTimer.print();
+
+    session.recordCall("addArraysStreaming/" + kernelName, std::chrono::steady_clock::now() - callStart);
+    return true;
+}
+
+std::vector<HeterogeneousScheduler::ExecutorReport> ArrayAdder::addArraysHeterogeneous(
+        const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC, bool complexAddition,
+        const std::vector<compute::ComputeSession*>& devices, bool useHostCpu) {
+    const auto callStart = std::chrono::steady_clock::now();
+
+    Timer timer;
+    timer.setName("Heterogeneous Timer (host + " + std::to_string(devices.size()) + " devices)");
+
+    const size_t vectorSize = std::min({inA.size(), inB.size(), outC.size()});
+    const std::string kernelName = complexAddition ? "complex_operation" : "add_arrays";
+
+    HeterogeneousScheduler::Options options;
+    options.useHost = useHostCpu;
+    HeterogeneousScheduler scheduler(devices, options);
+
+    timer.start();
+    auto reports = scheduler.run(kernelName, inA.data(), inB.data(), outC.data(), vectorSize);
+    timer.stop();
+    timer.print();
+
+    for (const auto& report : reports) {
+        std::cout << "\t" << report.name << ": " << report.elements << " elements in " << report.chunks << " chunks ("
+                  << (vectorSize ? 100.0 * report.elements / vectorSize : 0.0) << "%) | "
+                  << report.elementsPerSecond / 1e6 << " M elements/s" << std::endl;
+    }
+
+    for (auto* session : devices) {
+        session->recordCall("addArraysHeterogeneous/" + kernelName, std::chrono::steady_clock::now() - callStart);
+    }
+    return reports;
+}
+
+void ArrayAdder::addArraysBatchedCPU(const VectorBatch& batch, bool complexAddition, ThreadPool& pool) {
+    Timer cpuTimer;
+    cpuTimer.setName("CPU Timer (batched, " + std::to_string(batch.size()) + " vectors, "
+                     + std::to_string(pool.threadCount()) + " threads)");
+
+    cpuTimer.start();
+    visitElementwiseOp(elementwiseOp(complexAddition), [&](auto op) {
+        pool.parallelFor(batch.totalElements(), [&batch](size_t begin, size_t end) {
+            batch.forEachPiece(begin, end - begin, [](const BatchItem& item, size_t itemOffset, size_t, size_t count) {
+                TypedKernels<float>::apply<decltype(op)::value>(item.inA + itemOffset, item.inB + itemOffset,
+                                                                item.outC + itemOffset, count);
+            });
+        });
+    });
+    cpuTimer.stop();
+
+    cpuTimer.print();
+}
+
+bool ArrayAdder::addArraysBatchedGpu(const VectorBatch& batch, bool complexAddition) {
+    const auto callStart = std::chrono::steady_clock::now();
+    if (batch.totalElements() == 0) {
+        return true;
+    }
+
+    Timer gpuTimer;
+    gpuTimer.setName("GPU Timer (batched, " + std::to_string(batch.size()) + " vectors)");
+
+    const compute::KernelId kernel = elementwiseKernelId<float>(elementwiseOp(complexAddition));
+    const std::string kernelName(compute::kernelName(kernel));
+    lengthVector = static_cast<long long>(batch.totalElements());
+    if (!initializeResources(kernel, defaultChunkSize)) {
+        return false;
+    }
+
+    gpuTimer.start();
+    PipelineMetrics& metrics = session->pipelineMetrics();
+    processChunks(batch.totalElements(), [&batch, &metrics](compute::ChunkPipeline::Slot& slot, size_t start, size_t currentChunkSize) {
+        batch.gather(start, currentChunkSize, static_cast<float*>(slot.buffer(0)->contents()),
+                     static_cast<float*>(slot.buffer(1)->contents()));
+        metrics.bytesStaged(2 * currentChunkSize * sizeof(float));
+    }, [&batch](compute::ChunkPipeline::Slot& done, size_t start, size_t currentChunkSize) {
+        batch.scatter(start, currentChunkSize, static_cast<const float*>(done.buffer(2)->contents()));
+    });
+    chunkPipelineAsync->drain();
+    gpuTimer.stop();
+    gpuTimer.print();
+
+    releaseResources();
+    session->recordCall("addArraysBatchedGpu/" + kernelName, std::chrono::steady_clock::now() - callStart);
+    return true;
+}
+
+bool ArrayAdder::addRandomArraysGpuChunked(size_t vectorSize, const Philox& randomA, const Philox& randomB, bool complexAddition,
+                                           const ChunkOutput& onOutput) {
+    const auto callStart = std::chrono::steady_clock::now();
+    if (vectorSize == 0) {
+        return true;
+    }
+
+    Timer gpuTimer;
+    gpuTimer.setName("GPU Timer (random inputs)");
+
+    const compute::KernelId kernel = elementwiseKernelId<float>(elementwiseOp(complexAddition));
+    const std::string kernelName(compute::kernelName(kernel));
+    lengthVector = static_cast<long long>(vectorSize);
+    if (!initializeResources(kernel, defaultChunkSize)) {
+        return false;
+    }
+
+    gpuTimer.start();
+    PipelineMetrics& metrics = session->pipelineMetrics();
+    processChunks(vectorSize, [&randomA, &randomB, &metrics](compute::ChunkPipeline::Slot& slot, size_t start, size_t currentChunkSize) {
+        randomA.uniform(start, static_cast<float*>(slot.buffer(0)->contents()), currentChunkSize);
+        randomB.uniform(start, static_cast<float*>(slot.buffer(1)->contents()), currentChunkSize);
+        metrics.bytesStaged(2 * currentChunkSize * sizeof(float));
+    }, [&onOutput](compute::ChunkPipeline::Slot& done, size_t start, size_t currentChunkSize) {
+        onOutput(start, static_cast<const float*>(done.buffer(2)->contents()), currentChunkSize);
+    });
+    chunkPipelineAsync->drain();
+    gpuTimer.stop();
+    gpuTimer.print();
+
+    releaseResources();
+    session->recordCall("addRandomArraysGpuChunked/" + kernelName, std::chrono::steady_clock::now() - callStart);
+    return true;
+}
+
+bool ArrayAdder::initializeResources(compute::KernelId kernel, size_t untunedChunkSize, size_t elementSize) {
+    // Device, queue and pipeline are owned (and cached) by the session
+    deviceAsync = &session->device();
+    commandQueueAsync = &session->queue();
+    computePipelineStateAsync = session->pipeline(kernel);
+    if (!computePipelineStateAsync) {
+        std::cerr << compute::kernelName(kernel) << " is not available on this backend." << std::endl;
+        releaseResources();
+        return false;
+    }
+
+    /*
+     * Selecting chunk size (made easy)
+     *      1. Get the vector's length
+     *      2. Divide the vector by 32 (this is threadExecutionWith)
+     *          a. If this result is not an int, decrement the variable holding the vector-length and continue until an
+     *          int result is found
+ *          3. Take the result and divide by 1024 (this is maxThreadsPerGroup)
+     */
+    if (lengthVector <= 0) {
+        std::cerr << "lengthVector must be set to the number of elements before a chunked call." << std::endl;
+        releaseResources();
+        return false;
+    }
+
+    const size_t threadExecutionWidth = computePipelineStateAsync->threadExecutionWidth();
+    const size_t maxThreadsPerGroup = computePipelineStateAsync->maxTotalThreadsPerThreadgroup();
+
+    // Find the largest possible value X where X / 32 is an integer, starting with X = lengthOfVector.
+    // size_t X = lengthVector - (lengthVector % threadExecutionWidth);
+
+    // Ensure threadsPerGroup is a multiple of threadExecution for best performance
+    size_t threadsPerGroup = maxThreadsPerGroup;
+    /*
+    while (X % (threadExecutionWidth * threadsPerGroup) != 0 && threadsPerGroup > 0) {
+        threadsPerGroup -= 1;
+    }
+     */
+    if (threadsPerGroup % threadExecutionWidth != 0) {
+        threadsPerGroup = (threadsPerGroup / threadExecutionWidth) * threadExecutionWidth;
+    }
+
+    auto totalThreadGroups = static_cast<size_t>(std::ceil(static_cast<double>(lengthVector) / static_cast<double>(threadsPerGroup)));
+
+    // Resulting values to use, unless the tuning profile has measured better ones for this machine
+    // maxChunkSizeAsync = threadExecutionWidth * threadsPerGroup;
+    TuningParameters tuning;
+    const bool tuned = tuningFor(*session, std::string(compute::kernelName(kernel)), static_cast<size_t>(lengthVector), *computePipelineStateAsync, tuning);
+    const bool derived = !tuned && untunedChunkSize == 0;
+    maxChunkSizeAsync = tuned ? tuning.chunkSize
+                              : derived ? threadsPerGroup : std::min(untunedChunkSize, static_cast<size_t>(lengthVector));
+    inFlightAsync = maxChunksInFlight > 0 ? maxChunksInFlight : tuning.inFlight;
+    threadgroupSizeAsync = tuned ? tuning.threadgroupSize : threadExecutionWidth;
+    tunedAsync = tuned;
+    chunkAlignmentAsync = 1;
+    elementsPerThreadAsync = 1;
+    elementSizeAsync = elementSize;
+    // size_t numChunks = X / maxChunkSizeAsync;
+    size_t numChunks = (static_cast<size_t>(lengthVector) + maxChunkSizeAsync - 1) / maxChunkSizeAsync;
+
+
+    if (verbose) {
+        std::cout << "Threads per group: " << threadsPerGroup << std::endl;
+        std::cout << "Total thread groups needed: " << totalThreadGroups << std::endl;
+        std::cout << "maxChunkSizeAsync: " << maxChunkSizeAsync << std::endl;
+        std::cout << "Number of Chunks: " << numChunks << std::endl;
+        std::cout << "Chunks in flight: " << inFlightAsync
+                  << (maxChunksInFlight > 0 ? " (set)" : tuned ? " (tuned)" : " (default)") << std::endl;
+    }
+
+
+    // std::cout << "threadsPerGroup: " << threadsPerGroup << std::endl;
+    // std::cout << "Chunk Size: " << maxChunkSizeAsync << std::endl;
+    // std::cout << "Number of Chunks: " << numChunks << std::endl;
+
+    if (derived && maxChunkSizeAsync > deviceAsync->maxArgumentBufferSamplerCount()) {
+        std::cerr << "Calculated number of chunks is larger than MaxArgumentBufferSamplerCount" << std::endl;
+        releaseResources();
+        return false;
+    }
+
+    if (maxChunkSizeAsync * elementSizeAsync > deviceAsync->maxBufferLength()) {
+        std::cerr << "Each chunk has a ByteSize that is larger than maxBufferLength" << std::endl;
+        releaseResources();
+        return false;
+    }
+
+    if ( sizeof(float) * threadsPerGroup > deviceAsync->maxThreadgroupMemoryLength()) {
+        std::cerr << "Total shared memory of Thread Groups is larger than maxThreadGroupsMemoryLane" << std::endl;
+        releaseResources();
+        return false;
+    }
+
+    if (verbose) {
+        std::cout << "Recommended max working size: " << deviceAsync->recommendedMaxWorkingSetSize() << std::endl;
+        std::cout << "computePipelineStateAsync || " << "threadExecutionWidth: " << computePipelineStateAsync->threadExecutionWidth()
+                  << " | maxTotalThreadsPerThreadgroup: " << computePipelineStateAsync->maxTotalThreadsPerThreadgroup()
+                  << " | staticThreadgroupMemoryLength: " << computePipelineStateAsync->staticThreadgroupMemoryLength() << std::endl;
+    }
+
+    // One inA/inB/outC staging set per chunk in flight; a set is reused only once its chunk has completed.
+    chunkPipelineAsync = std::make_unique<compute::ChunkPipeline>(*session, inFlightAsync, buffersPerChunk,
+                                                                  maxChunkSizeAsync * elementSizeAsync);
+    if (!chunkPipelineAsync->valid()) {
+        std::cerr << "Failed to create one or more buffers." << std::endl;
+        releaseResources();
+        return false;
+    }
+    return true;
+}
+
+void ArrayAdder::releaseResources() {
+    // Waits for any chunk still in flight, then returns the staging buffers to the session
+    chunkPipelineAsync.reset();
+    computePipelineStateAsync = nullptr;
+    commandQueueAsync = nullptr;
+    deviceAsync = nullptr;
+}
+
+void ArrayAdder::processChunks(const std::vector<float>& inA, const std::vector<float>& inB,
+                               std::vector<float>& outC, bool onlyOutputToCpu) {
+    processChunks(inA.data(), inB.data(), inA.size(), [&outC, onlyOutputToCpu](compute::ChunkPipeline::Slot& done, size_t start, size_t currentChunkSize) {
+        // Upon completion of the GPU for this iteration
+        if (onlyOutputToCpu) {
+            // copy data from the output buffer to the CPU.
+            memcpy(outC.data() + start, done.buffer(2)->contents(), currentChunkSize * sizeof(float));
+        }
+        // The slot is returned to the ring (free for reuse) once this handler finishes.
+    });
+}
+
+void ArrayAdder::processChunks(const void* inA, const void* inB, size_t vectorSize, const ChunkCompletion& onChunkCompleted,
+                               const void* constants, size_t constantsLength) {
+    const size_t elementSize = elementSizeAsync;
+    PipelineMetrics& metrics = session->pipelineMetrics();
+    processChunks(vectorSize, [inA, inB, elementSize, &metrics](compute::ChunkPipeline::Slot& slot, size_t start, size_t currentChunkSize) {
+        const size_t offsetBytes = start * elementSize;
+        memcpy(slot.buffer(0)->contents(), static_cast<const char*>(inA) + offsetBytes, currentChunkSize * elementSize);
+        if (inB) {
+            memcpy(slot.buffer(1)->contents(), static_cast<const char*>(inB) + offsetBytes, currentChunkSize * elementSize);
+        }
+        metrics.bytesStaged((inB ? 2 : 1) * currentChunkSize * elementSize);
+    }, onChunkCompleted, constants, constantsLength);
+}
+
+void ArrayAdder::processChunks(size_t vectorSize, const ChunkStaging& stageChunk, const ChunkCompletion& onChunkCompleted,
+                               const void* constants, size_t constantsLength) {
+    // Assuming initialization has already been done.
+    if (verbose) {
+        std::cout << "Current allocated size: " << deviceAsync->currentAllocatedSize() << std::endl;
+    }
+
+    if ( deviceAsync->currentAllocatedSize() > deviceAsync->recommendedMaxWorkingSetSize() ) {
+        std::cerr << "WARNING. Current allocated memory [" << deviceAsync->currentAllocatedSize()/(1024*1024)
+                  << " MiB] is greater than recommended max working size ["
+                  << deviceAsync->recommendedMaxWorkingSetSize()/(1024*1024) << " MiB]." << std::endl;
+    }
+
+    TaskScheduler& scheduler = TaskScheduler::shared();
+    // Waiting below would park a worker that the stages themselves need; enough such callers deadlock the pool
+    if (scheduler.isWorkerThread()) {
+        throw std::logic_error("ArrayAdder: synchronous chunked calls cannot run on a TaskScheduler worker (such as a "
+                               "ComputeFuture::then continuation); use addArraysAsync and co_await it instead");
+    }
+
+    TraceScope trace("processChunks", "ArrayAdder", {"elements", static_cast<int64_t>(vectorSize)});
+    scheduler.spawn(streamChunks(vectorSize, stageChunk, onChunkCompleted, constants, constantsLength, scheduler)).get();
+}
+
+Task<> ArrayAdder::streamChunks(size_t vectorSize, ChunkStaging stageChunk, ChunkCompletion onChunkCompleted,
+                                const void* constants, size_t constantsLength, TaskScheduler& scheduler) {
+    AsyncQueue<CompletedChunk> completed(scheduler);
+    StageProgress progress;
+    auto copyAndCompute = scheduler.spawn(stageChunks(vectorSize, std::move(stageChunk), &completed, &progress,
+                                                      constants, constantsLength, scheduler));
+
+    // Readback. The queue is fed by the completion handlers, which run in commit order, so chunks come back in order.
+    // The end marker can overtake chunks still on the device, so the loop runs until it has seen the marker and every
+    // chunk committed before it.
+    PipelineMetrics& metrics = session->pipelineMetrics();
+    std::exception_ptr error;
+    bool stagingDone = false;
+    size_t received = 0;
+    while (!stagingDone || received < progress.committed) {
+        CompletedChunk done = co_await completed.pop();
+        if (!done.slot) {
+            stagingDone = true;
+            continue;
+        }
+        const size_t chunk = received++;
+
+        // After a failure the rest are only drained, so their slots go back to the ring
+        if (error) {
+            chunkPipelineAsync->release(*done.slot);
+            if (done.traceId)
+                Trace::asyncEnd("chunk", "chunk", done.traceId);
+            continue;
+        }
+
+        const uint64_t readbackStart = Trace::now();
+        {
+            TraceScope trace("read back", "chunk", {"chunk", static_cast<int64_t>(chunk)}, {"elements", static_cast<int64_t>(done.size)});
+            try {
+                onChunkCompleted(*done.slot, done.start, done.size);
+            } catch (...) {
+                error = std::current_exception();
+                progress.cancelled.store(true, std::memory_order_release);
+            }
+            chunkPipelineAsync->release(*done.slot);
+        }
+        const uint64_t readbackEnd = Trace::now();
+        metrics.chunkReadBack(done.size * elementSizeAsync, readbackEnd - readbackStart);
+        metrics.chunkFinished(readbackEnd - done.startedAt);
+        if (done.traceId)
+            Trace::asyncEnd("chunk", "chunk", done.traceId);
+    }
+
+    // Rethrows a staging failure, unless a readback failed first
+    try {
+        co_await copyAndCompute;
+    } catch (...) {
+        if (!error)
+            error = std::current_exception();
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+Task<> ArrayAdder::stageChunks(size_t vectorSize, ChunkStaging stageChunk, AsyncQueue<CompletedChunk>* completed, StageProgress* progress,
+                               const void* constants, size_t constantsLength, TaskScheduler& scheduler) {
+    // One trace id per chunk; the scopes below may run on different scheduler threads, the async spans tie them together
+    const size_t chunkCount = (vectorSize + maxChunkSizeAsync - 1) / maxChunkSizeAsync;
+    const uint64_t firstTraceId = Trace::enabled() ? Trace::newIds(chunkCount) : 0;
+    PipelineMetrics& metrics = session->pipelineMetrics();
+    std::exception_ptr error;
+
+    for (size_t start = 0; start < vectorSize; start += maxChunkSizeAsync) {
+        const size_t currentChunkSize = std::min(vectorSize - start, maxChunkSizeAsync);
+        const int64_t chunk = static_cast<int64_t>(start / maxChunkSizeAsync);
+        const uint64_t traceId = firstTraceId ? firstTraceId + static_cast<uint64_t>(chunk) : 0;
+        const uint64_t startedAt = Trace::now();
+        if (traceId) {
+            Trace::asyncBegin("chunk", "chunk", traceId, {"chunk", chunk}, {"elements", static_cast<int64_t>(currentChunkSize)});
+            Trace::asyncBegin("wait for slot", "chunk", traceId);
+        }
+        // Suspends while inFlightAsync chunks are still on the device
+        auto* slot = co_await awaitCallback<compute::ChunkPipeline::Slot*>(scheduler, [this](auto done) {
+            chunkPipelineAsync->acquireAsync([done](compute::ChunkPipeline::Slot& free) { done(&free); });
+        });
+        if (traceId)
+            Trace::asyncEnd("wait for slot", "chunk", traceId);
+
+        if (progress->cancelled.load(std::memory_order_acquire)) {
+            chunkPipelineAsync->release(*slot);
+            if (traceId)
+                Trace::asyncEnd("chunk", "chunk", traceId);
+            break;
+        }
+
+        try {
+            {
+                TraceScope trace("stage", "chunk", {"chunk", chunk}, {"elements", static_cast<int64_t>(currentChunkSize)});
+                const uint64_t stageStart = Trace::now();
+                stageChunk(*slot, start, currentChunkSize);
+                metrics.chunkStaged(Trace::now() - stageStart);
+            }
+
+            std::shared_ptr<compute::CommandBuffer> commandBuffer;
+            {
+                TraceScope trace("encode", "chunk", {"chunk", chunk});
+                commandBuffer = encodeChunk(*slot, currentChunkSize, constants, constantsLength);
+            }
+            const uint64_t committedAt = Trace::now();
+            commandBuffer->addCompletedHandler([completed, slot, start, currentChunkSize, traceId, startedAt, committedAt, &metrics](compute::CommandBuffer*) {
+                metrics.deviceCompleted(Trace::now() - committedAt);
+                if (traceId)
+                    Trace::asyncEnd("device", "chunk", traceId);
+                completed->push({slot, start, currentChunkSize, traceId, startedAt});
+            });
+
+            TraceScope trace("commit", "chunk", {"chunk", chunk});
+            if (traceId)
+                Trace::asyncBegin("device", "chunk", traceId);
+            commandBuffer->commit();
+            // The device works on this chunk while the next one is staged, up to the ring's depth
+        } catch (...) {
+            // Nothing was committed for this slot, so it goes straight back
+            error = std::current_exception();
+            chunkPipelineAsync->release(*slot);
+            if (traceId)
+                Trace::asyncEnd("chunk", "chunk", traceId);
+            break;
+        }
+        progress->committed++;
+    }
+
+    // streamChunks may return as soon as it has this, so the queue and progress are not touched after the push
+    completed->push({nullptr, 0, 0, 0, 0});
+    if (error)
+        std::rethrow_exception(error);
+}
+
+std::shared_ptr<compute::CommandBuffer> ArrayAdder::encodeChunk(compute::ChunkPipeline::Slot& slot, size_t currentChunkSize,
+                                                               const void* constants, size_t constantsLength) {
+    auto* inputBufferA = slot.buffer(0);
+    auto* inputBufferB = slot.buffer(1);
+    auto* outputBuffer = slot.buffer(2);
+
+    // Only the last chunk can need padding; maxChunkSizeAsync is kept a multiple of chunkAlignmentAsync
+    const size_t paddedChunkSize = (currentChunkSize + chunkAlignmentAsync - 1) / chunkAlignmentAsync * chunkAlignmentAsync;
+    if (paddedChunkSize > currentChunkSize) {
+        const size_t paddingBytes = (paddedChunkSize - currentChunkSize) * elementSizeAsync;
+        memset(static_cast<char*>(inputBufferA->contents()) + currentChunkSize * elementSizeAsync, 0, paddingBytes);
+        memset(static_cast<char*>(inputBufferB->contents()) + currentChunkSize * elementSizeAsync, 0, paddingBytes);
+    }
+
+    auto commandBuffer = commandQueueAsync->commandBuffer();
+    auto computeCommandEncoder = commandBuffer->computeCommandEncoder();
+    computeCommandEncoder->setComputePipelineState(computePipelineStateAsync);
+    computeCommandEncoder->setBuffer(inputBufferA, 0, 0);
+    computeCommandEncoder->setBuffer(inputBufferB, 0, 1);
+    computeCommandEncoder->setBuffer(outputBuffer, 0, 2);
+    if (constants) {
+        computeCommandEncoder->setBytes(constants, constantsLength, 3);
+    }
+
+    compute::Size gridSize = {paddedChunkSize / elementsPerThreadAsync, 1, 1};
+    compute::Size threadgroupSize = {std::min(threadgroupSizeAsync, gridSize.width), 1, 1};
+    computeCommandEncoder->dispatchThreads(gridSize, threadgroupSize);
+    computeCommandEncoder->endEncoding();
+    return commandBuffer;
+}
+
+void ArrayAdder::addArraysGpuChunkingDynamicBufferAsync(const std::vector<float>& inA, const std::vector<float>& inB,
+                                                        std::vector<float>& outC, bool complexAddition, bool onlyOutputToCpu) {
+    const auto callStart = std::chrono::steady_clock::now();
+
+    Timer gpuTimer;
+    gpuTimer.setName("GPU Timer (compute)");
+
+    const compute::KernelId kernel = elementwiseKernelId<float>(elementwiseOp(complexAddition));
+    const std::string kernelName(compute::kernelName(kernel));
+    if (!initializeResources(kernel)) {
+        std::exit(1);
+    }
+
+    gpuTimer.start();
+    processChunks(inA, inB, outC, onlyOutputToCpu);
+    gpuTimer.stop();
+    gpuTimer.print();
+
+    // Wait for all GPU tasks to complete before releasing resources.
+    chunkPipelineAsync->drain();
+    if (verbose) {
+        std::cout << "Backpressure wait: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(chunkPipelineAsync->backpressureWait()).count()
+                  << " [milliseconds]" << std::endl;
+    }
+
+    releaseResources();
+    session->recordCall("addArraysGpuChunkingDynamicBufferAsync/" + kernelName, std::chrono::steady_clock::now() - callStart);
+}
+
+ComputeFuture<std::vector<float>> ArrayAdder::addArraysAsync(std::vector<float> inA, std::vector<float> inB, bool complexAddition) {
+    return addArraysAsync(std::make_shared<const std::vector<float>>(std::move(inA)),
+                          std::make_shared<const std::vector<float>>(std::move(inB)), complexAddition);
+}
+
+ComputeFuture<std::vector<float>> ArrayAdder::addArraysAsync(std::shared_ptr<const std::vector<float>> inA,
+                                                             std::shared_ptr<const std::vector<float>> inB, bool complexAddition) {
+    const auto callStart = std::chrono::steady_clock::now();
+    if (!inA || !inB || inA->size() != inB->size()) {
+        return makeExceptionalFuture<std::vector<float>>(std::make_exception_ptr(std::invalid_argument(
+                "addArraysAsync: inA and inB must have the same length (" + std::to_string(inA ? inA->size() : 0) + " and "
+                + std::to_string(inB ? inB->size() : 0) + " elements)")));
+    }
+    if (inA->empty()) {
+        return makeReadyFuture(std::vector<float>());
+    }
+
+    // A private ArrayAdder gives the operation its own chunk ring, leaving this one free for other calls. It is set up
+    // inside the task, so the caller's thread never waits on pipeline creation or tuning lookups.
+    auto adder = std::make_shared<ArrayAdder>(*session);
+    adder->setMaxChunksInFlight(maxChunksInFlight);
+    adder->setVerbose(verbose);
+    return TaskScheduler::shared().spawn(addArraysTask(std::move(adder), std::move(inA), std::move(inB), complexAddition, callStart));
+}
+
+Task<std::vector<float>> ArrayAdder::addArraysTask(std::shared_ptr<ArrayAdder> adder, std::shared_ptr<const std::vector<float>> inA,
+                                                   std::shared_ptr<const std::vector<float>> inB, bool complexAddition,
+                                                   std::chrono::steady_clock::time_point callStart) {
+    const size_t vectorSize = inA->size();
+    const compute::KernelId kernel = elementwiseKernelId<float>(elementwiseOp(complexAddition));
+    const std::string kernelName(compute::kernelName(kernel));
+    adder->lengthVector = static_cast<long long>(vectorSize);
+    if (!adder->initializeResources(kernel)) {
+        throw std::runtime_error("addArraysAsync: could not set up " + kernelName + " on the session's device");
+    }
+    std::vector<float> outC(vectorSize);
+
+    PipelineMetrics& metrics = adder->session->pipelineMetrics();
+    co_await adder->streamChunks(vectorSize, [&inA, &inB, &metrics](compute::ChunkPipeline::Slot& slot, size_t start, size_t currentChunkSize) {
+        memcpy(slot.buffer(0)->contents(), inA->data() + start, currentChunkSize * sizeof(float));
+        memcpy(slot.buffer(1)->contents(), inB->data() + start, currentChunkSize * sizeof(float));
+        metrics.bytesStaged(2 * currentChunkSize * sizeof(float));
+    }, [&outC](compute::ChunkPipeline::Slot& done, size_t start, size_t currentChunkSize) {
+        memcpy(outC.data() + start, done.buffer(2)->contents(), currentChunkSize * sizeof(float));
+    }, nullptr, 0, TaskScheduler::shared());
+
+    adder->releaseResources();
+    adder->session->recordCall("addArraysAsync/" + kernelName, std::chrono::steady_clock::now() - callStart);
+    co_return outC;
+}
+
+double ArrayAdder::reduceArraysGpuChunked(ReductionOp op, const std::vector<float>& inA, const std::vector<float>& inB,
+                                          ReductionMode mode) {
+    const auto callStart = std::chrono::steady_clock::now();
+
+    Timer gpuTimer;
+    gpuTimer.setName(std::string("GPU Timer (reduce ") + Reduction::name(op) + ")");
+
+    const size_t vectorSize = op == ReductionOp::Dot ? std::min(inA.size(), inB.size()) : inA.size();
+    if (vectorSize == 0) {
+        return Reduction::finish(op, Reduction::identity(op));
+    }
+
+    const bool leaves = Reduction::usesLeaves(op, mode);
+    const compute::KernelId kernel = leaves ? Reduction::leafKernel(op, mode) : Reduction::kernel(op);
+    const std::string kernelName(compute::kernelName(kernel));
+    lengthVector = static_cast<long long>(vectorSize);
+    // Reductions only bring back one partial per threadgroup, so large chunks are cheap
+    if (!initializeResources(kernel, defaultChunkSize)) {
+        throw std::runtime_error("reduceArraysGpuChunked: could not set up " + kernelName + " on the session's device");
+    }
+
+    // The tree in reduction.metal needs a power-of-two threadgroup of at most 1024 threads
+    const size_t maxGroupSize = std::min<size_t>(computePipelineStateAsync->maxTotalThreadsPerThreadgroup(), 1024);
+    size_t groupSize = 1;
+    while (groupSize * 2 <= maxGroupSize) {
+        groupSize *= 2;
+    }
+    threadgroupSizeAsync = groupSize;
+
+    if (leaves) {
+        // Chunks start on leaf boundaries and the last one is zero-padded to a whole leaf, which adds nothing
+        maxChunkSizeAsync -= maxChunkSizeAsync % Reduction::leafSize;
+        if (maxChunkSizeAsync == 0 || groupSize < Reduction::leafLanes) {
+            std::cerr << "Chunks or threadgroups are too small for " << kernelName << std::endl;
+            releaseResources();
+            return std::nan("");
+        }
+        chunkAlignmentAsync = Reduction::leafSize;
+        elementsPerThreadAsync = Reduction::leafSize / Reduction::leafLanes;
+    }
+
+    // Completion handlers fold each chunk's partials in double; leaf values are kept at their global index instead
+    std::mutex resultMutex;
+    double result = Reduction::identity(op);
+    std::vector<double> leafValues(leaves ? (vectorSize + Reduction::leafSize - 1) / Reduction::leafSize : 0);
+    const bool compensated = mode == ReductionMode::Compensated;
+
+    gpuTimer.start();
+    processChunks(inA.data(), op == ReductionOp::Dot ? inB.data() : nullptr, vectorSize,
+                  [op, groupSize, leaves, compensated, &leafValues, &resultMutex, &result](compute::ChunkPipeline::Slot& done, size_t start, size_t currentChunkSize) {
+        const auto* partials = static_cast<const float*>(done.buffer(2)->contents());
+
+        if (leaves) {
+            // Chunks never share a leaf, so no lock is needed
+            const size_t firstLeaf = start / Reduction::leafSize;
+            const size_t numLeaves = (currentChunkSize + Reduction::leafSize - 1) / Reduction::leafSize;
+            for (size_t i = 0; i < numLeaves; ++i) {
+                leafValues[firstLeaf + i] = compensated
+                        ? static_cast<double>(partials[2 * i]) + static_cast<double>(partials[2 * i + 1])
+                        : static_cast<double>(partials[i]);
+            }
+            return;
+        }
+
+        const size_t chunkGroupSize = std::min(groupSize, currentChunkSize);
+        const size_t numPartials = (currentChunkSize + chunkGroupSize - 1) / chunkGroupSize;
+
+        double chunkResult = Reduction::identity(op);
+        for (size_t i = 0; i < numPartials; ++i) {
+            chunkResult = Reduction::combine(op, chunkResult, partials[i]);
+        }
+
+        std::lock_guard<std::mutex> lock(resultMutex);
+        result = Reduction::combine(op, result, chunkResult);
+    });
+    chunkPipelineAsync->drain();
+    if (leaves) {
+        result = Reduction::pairwiseSum(leafValues);
+    }
+    gpuTimer.stop();
+    gpuTimer.print();
+
+    releaseResources();
+    session->recordCall("reduceArraysGpuChunked/" + kernelName, std::chrono::steady_clock::now() - callStart);
+    return Reduction::finish(op, result);
+}
+
+void ArrayAdder::scanArraysGpuChunked(ScanKind kind, const std::vector<float>& in, std::vector<float>& out) {
+    const auto callStart = std::chrono::steady_clock::now();
+
+    Timer gpuTimer;
+    gpuTimer.setName(kind == ScanKind::Inclusive ? "GPU Timer (inclusive scan)" : "GPU Timer (exclusive scan)");
+
+    out.resize(in.size());
+    if (in.empty()) {
+        return;
+    }
+
+    const compute::KernelId kernel = compute::KernelId::ScanThreadgroups;
+    const std::string kernelName(compute::kernelName(kernel));
+    lengthVector = static_cast<long long>(in.size());
+    if (!initializeResources(kernel, defaultChunkSize)) {
+        throw std::runtime_error("scanArraysGpuChunked: could not set up " + kernelName + " on the session's device");
+    }
+    // The scan in scan.metal keeps a threadgroup in threadgroup memory of at most 1024 entries. Untuned, use the
+    // largest group the pipeline allows: the device then does most of the work, and the host only stitches groups.
+    if (!tunedAsync) {
+        threadgroupSizeAsync = computePipelineStateAsync->maxTotalThreadsPerThreadgroup();
+    }
+    threadgroupSizeAsync = std::min<size_t>(threadgroupSizeAsync, 1024);
+    const size_t groupSize = threadgroupSizeAsync;
+
+    // Sum of everything before the threadgroup being copied out. Handlers run in commit order, one chunk at a time.
+    // Each group's total is the last element of its device scan; the carry across groups is kept in double, since
+    // float running sums over thousands of groups would drift.
+    std::mutex carryMutex;
+    double carry = 0.0;
+
+    gpuTimer.start();
+    processChunks(in.data(), nullptr, in.size(),
+                  [kind, groupSize, &out, &carryMutex, &carry](compute::ChunkPipeline::Slot& done, size_t start, size_t currentChunkSize) {
+        const auto* local = static_cast<const float*>(done.buffer(2)->contents());
+        float* destination = out.data() + start;
+
+        std::lock_guard<std::mutex> lock(carryMutex);
+        for (size_t first = 0; first < currentChunkSize; first += groupSize) {
+            const size_t last = std::min(first + groupSize, currentChunkSize);
+            if (kind == ScanKind::Inclusive) {
+                for (size_t i = first; i < last; ++i) {
+                    destination[i] = static_cast<float>(carry + local[i]);
+                }
+            } else {
+                destination[first] = static_cast<float>(carry);
+                for (size_t i = first + 1; i < last; ++i) {
+                    destination[i] = static_cast<float>(carry + local[i - 1]);
+                }
+            }
+            carry += local[last - 1];
+        }
+    });
+    chunkPipelineAsync->drain();
+    gpuTimer.stop();
+    gpuTimer.print();
+
+    releaseResources();
+    session->recordCall("scanArraysGpuChunked/" + kernelName, std::chrono::steady_clock::now() - callStart);
+}
+
+size_t ArrayAdder::filterArraysGpuChunked(const std::vector<float>& in, std::vector<float>& out, const FilterPredicate& predicate) {
+    const auto callStart = std::chrono::steady_clock::now();
+
+    Timer gpuTimer;
+    gpuTimer.setName("GPU Timer (filter)");
+
+    out.resize(in.size());
+    if (in.empty()) {
+        return 0;
+    }
+
+    const compute::KernelId kernel = compute::KernelId::FilterThreadgroups;
+    const std::string kernelName(compute::kernelName(kernel));
+    lengthVector = static_cast<long long>(in.size());
+    if (!initializeResources(kernel, defaultChunkSize)) {
+        throw std::runtime_error("filterArraysGpuChunked: could not set up " + kernelName + " on the session's device");
+    }
+    // Larger groups mean fewer runs for the host to append (see scanArraysGpuChunked)
+    if (!tunedAsync) {
+        threadgroupSizeAsync = computePipelineStateAsync->maxTotalThreadsPerThreadgroup();
+    }
+    threadgroupSizeAsync = std::min<size_t>(threadgroupSizeAsync, 1024);
+    const size_t groupSize = threadgroupSizeAsync;
+
+    // Elements kept so far; each threadgroup's run is appended after them. Handlers run in commit order.
+    std::mutex keptMutex;
+    size_t kept = 0;
+
+    gpuTimer.start();
+    // Buffer 1 is not staged (no inB), so the kernel writes the per-threadgroup counts there
+    processChunks(in.data(), nullptr, in.size(),
+                  [groupSize, &out, &keptMutex, &kept](compute::ChunkPipeline::Slot& done, size_t, size_t currentChunkSize) {
+        const auto* compacted = static_cast<const float*>(done.buffer(2)->contents());
+        const auto* counts = static_cast<const uint32_t*>(done.buffer(1)->contents());
+
+        std::lock_guard<std::mutex> lock(keptMutex);
+        for (size_t first = 0, group = 0; first < currentChunkSize; first += groupSize, ++group) {
+            memcpy(out.data() + kept, compacted + first, counts[group] * sizeof(float));
+            kept += counts[group];
+        }
+    }, &predicate, sizeof(predicate));
+    chunkPipelineAsync->drain();
+    gpuTimer.stop();
+    gpuTimer.print();
+
+    releaseResources();
+    out.resize(kept);
+    session->recordCall("filterArraysGpuChunked/" + kernelName, std::chrono::steady_clock::now() - callStart);
+    return kept;
+}
+
+template<typename Storage, typename Compute>
+bool ArrayAdder::addArraysTypedCPU(const std::vector<Storage>& inA, const std::vector<Storage>& inB, std::vector<Storage>& outC,
+                                   bool complexAddition, ThreadPool& pool) {
+    const ElementwiseOp op = elementwiseOp(complexAddition);
+    const std::string kernelName = typedKernelName<Storage, Compute>(elementwiseOpName(op));
+    if (!supportsElementwise<Compute>(op)) {
+        std::cerr << kernelName << ": " << elementwiseOpName(op) << " needs a floating-point compute type." << std::endl;
+        return false;
+    }
+
+    Timer cpuTimer;
+    cpuTimer.setName("CPU Timer (" + kernelName + ", " + std::to_string(pool.threadCount()) + " threads)");
+
+    outC.resize(inA.size());
+    const Storage* a = inA.data();
+    const Storage* b = inB.data();
+    Storage* c = outC.data();
+
+    cpuTimer.start();
+    visitElementwiseOp(op, [&](auto constant) {
+        constexpr ElementwiseOp Op = decltype(constant)::value;
+        if constexpr (TypedKernels<Storage, Compute>::template supports<Op>) {
+            pool.parallelFor(inA.size(), [=](size_t begin, size_t end) {
+                TypedKernels<Storage, Compute>::template apply<Op>(a + begin, b + begin, c + begin, end - begin);
+            });
+        }
+    });
+    cpuTimer.stop();
+
+    cpuTimer.print();
+    return true;
+}
+
+template<typename Storage, typename Compute>
+bool ArrayAdder::addArraysTypedGpuChunked(const std::vector<Storage>& inA, const std::vector<Storage>& inB, std::vector<Storage>& outC,
+                                          bool complexAddition) {
+    const auto callStart = std::chrono::steady_clock::now();
+
+    const ElementwiseOp op = elementwiseOp(complexAddition);
+    const std::string kernelName = typedKernelName<Storage, Compute>(elementwiseOpName(op));
+    if (!supportsElementwise<Compute>(op)) {
+        std::cerr << kernelName << ": " << elementwiseOpName(op) << " needs a floating-point compute type." << std::endl;
+        return false;
+    }
+    const compute::KernelId kernel = elementwiseKernelId<Storage, Compute>(op);
+    // Checked before resizing outC; initializeResources would report it too
+    if (!session->pipeline(kernel)) {
+        std::cerr << kernelName << " is not available on this backend." << std::endl;
+        return false;
+    }
+
+    Timer gpuTimer;
+    gpuTimer.setName("GPU Timer (" + kernelName + ")");
+
+    outC.resize(inA.size());
+    if (inA.empty()) {
+        return true;
+    }
+
+    lengthVector = static_cast<long long>(inA.size());
+    if (!initializeResources(kernel, 0, sizeof(Storage))) {
+        return false;
+    }
+
+    gpuTimer.start();
+    processChunks(inA.data(), inB.data(), inA.size(), [&outC](compute::ChunkPipeline::Slot& done, size_t start, size_t currentChunkSize) {
+        memcpy(outC.data() + start, done.buffer(2)->contents(), currentChunkSize * sizeof(Storage));
+    });
+    chunkPipelineAsync->drain();
+    gpuTimer.stop();
+    gpuTimer.print();
+
+    releaseResources();
+    session->recordCall("addArraysTypedGpuChunked/" + kernelName, std::chrono::steady_clock::now() - callStart);
+    return true;
+}
+
+#define ARRAY_ADDER_TYPED(Storage, Compute) \
+    template bool ArrayAdder::addArraysTypedCPU<Storage, Compute>(const std::vector<Storage>&, const std::vector<Storage>&, \
+                                                                  std::vector<Storage>&, bool, ThreadPool&); \
+    template bool ArrayAdder::addArraysTypedGpuChunked<Storage, Compute>(const std::vector<Storage>&, const std::vector<Storage>&, \
+                                                                         std::vector<Storage>&, bool);
+
+ARRAY_ADDER_TYPED(float, float)
+ARRAY_ADDER_TYPED(float, double)
+ARRAY_ADDER_TYPED(double, double)
+ARRAY_ADDER_TYPED(int32_t, int64_t)
+ARRAY_ADDER_TYPED(uint8_t, int32_t)
+ARRAY_ADDER_TYPED(Half, float)
+ARRAY_ADDER_TYPED(Half, Half)
+ARRAY_ADDER_TYPED(BFloat16, float)
+
+#undef ARRAY_ADDER_TYPED
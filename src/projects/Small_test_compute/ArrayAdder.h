@@ -5,98 +5,281 @@
 #ifndef HELLO_METAL_ARRAYADDER_H
 #define HELLO_METAL_ARRAYADDER_H
 
-#include <Metal/Metal.hpp>
+#include "async/AsyncQueue.h"
+#include "async/ComputeFuture.h"
+#include "async/Task.h"
+#include "async/TaskScheduler.h"
+#include "batch/VectorBatch.h"
+#include "cpu/PageAlignedAllocator.h"
+#include "cpu/SimdKernels.h"
+#include "cpu/ThreadPool.h"
+#include "device/ChunkPipeline.h"
+#include "device/ComputeDevice.h"
+#include "device/ComputeSession.h"
+#include "device/KernelRegistry.h"
+#include "device/Semaphore.h"
+#include "io/MappedFile.h"
+#include "metrics/PipelineMetrics.h"
+#include "random/Philox.h"
+#include "reduce/Reduction.h"
+#include "scan/Scan.h"
+#include "sched/HeterogeneousScheduler.h"
+#include "trace/Timer.h"
+#include "trace/Trace.h"
+#include "tuning/TuningProfile.h"
+#include "types/ElementTypes.h"
+#include "types/ElementwiseOp.h"
+#include "verify/ResultVerifier.h"
+
 #include <algorithm>
+#include <atomic>
+#include <memory>
 #include <chrono>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
 #include <vector>
 
+// Settings for ArrayAdder::addArraysStreaming. Zero chunkSize/inFlight take the values from the tuning profile.
+struct StreamingOptions {
+    size_t chunkSize = 0;
+    size_t inFlight = 0;
+    size_t readAheadChunks = 2; // Chunks prefetched ahead of the one being staged
+    // When set, each output chunk is checked as it completes against the CPU kernels run on the same staged inputs,
+    // and added to the verifier. Costs a CPU pass over each chunk on the completion thread.
+    ResultVerifier* verifier = nullptr;
+};
+
+// The "GPU" paths run on compute::createDefaultDevice(): Metal on macOS, the multithreaded CPU backend elsewhere (or
+// when HELLO_METAL_COMPUTE_BACKEND=cpu), so the chunking and pipelining logic can be exercised on any machine.
+// Device, queue, library, pipelines and staging buffers come from a compute::ComputeSession that outlives the calls;
+// the overloads without a session use ComputeSession::shared().
+//
+// Chunk size, in-flight depth and threadgroup size come from TuningProfile::active() (written by Autotuner) for the
+// session's machine, kernel and vector size; the defaults below are only used for combinations that were never tuned.
+//
+// The synchronous chunked methods (addArraysGpuChunkingDynamicBufferAsync, the reduce, scan, filter, batched, random
+// and typed device paths) run their stages on TaskScheduler::shared() and block until they finish, so they must not be
+// called from one of its workers, which includes ComputeFuture::then continuations of addArraysAsync. They throw
+// std::logic_error there instead of risking a deadlock; use addArraysAsync and co_await it.
 class ArrayAdder {
 public:
+    explicit ArrayAdder(compute::ComputeSession& session = compute::ComputeSession::shared()) : session(&session) {}
+
     // Adds elements of two input arrays using GPU and stores the result in the output array.
     // Parameters inA and inB are the input arrays, and outC is the output array where the result is stored.
     static void addArraysGPU(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC, bool complexAddition);
+    static void addArraysGPU(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC, bool complexAddition,
+                             compute::ComputeSession& session);
+    // CPU versions run the SIMD kernels picked at runtime by SimdKernels (see SimdKernels::forceIsa). elementwiseCPU is
+    // instantiated for every ElementwiseOp; the other two are shorthand for it.
+    template<ElementwiseOp Op>
+    static void elementwiseCPU(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC);
+
     static void addArraysCPU(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC);
 
     static void addArraysComplexCPU(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC);
 
+    // Multithreaded CPU versions of add_arrays / complex_operation. The range is split across a persistent pool, so
+    // no threads are spawned per call. The first overload uses ThreadPool::shared(), sized by setCpuThreadCount.
+    static void addArraysCPUParallel(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC,
+                                     bool complexAddition,
+                                     ThreadPool::Partitioning partitioning = ThreadPool::Partitioning::Static);
+    static void addArraysCPUParallel(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC,
+                                     bool complexAddition, ThreadPool& pool,
+                                     ThreadPool::Partitioning partitioning = ThreadPool::Partitioning::Static);
+    // Zero uses every hardware thread.
+    static void setCpuThreadCount(size_t numThreads);
+
     static void addArraysGpuWithChunking( const std::vector<float>& inA, const std::vector<float>& inB,
                                           std::vector<float>& outC, bool complexAddition, bool onlyOutputToCpu);
+    static void addArraysGpuWithChunking( const std::vector<float>& inA, const std::vector<float>& inB,
+                                          std::vector<float>& outC, bool complexAddition, bool onlyOutputToCpu,
+                                          compute::ComputeSession& session);
+    // Zero-copy path: the vectors' own pages are wrapped as device buffers, so nothing is staged in or copied out.
+    // Vectors longer than the device's maxBufferLength are processed in page-aligned pieces. Returns false, with the
+    // reason on std::cerr, when the lengths differ or the device cannot wrap the memory; nothing is submitted then.
+    static bool addArraysZeroCopy(const PageAlignedVector<float>& inA, const PageAlignedVector<float>& inB,
+                                  PageAlignedVector<float>& outC, bool complexAddition,
+                                  compute::ComputeSession& session = compute::ComputeSession::shared());
+
+    // Out-of-core path for vectors that do not fit in memory. Inputs and output are memory-mapped float files streamed
+    // through the device chunk by chunk: upcoming input chunks are prefetched, consumed inputs and completed outputs
+    // are evicted, so resident memory stays around (readAheadChunks + 4 * inFlight) chunks whatever the file sizes.
+    static bool addArraysStreaming(MappedFile& inA, MappedFile& inB, MappedFile& outC, bool complexAddition,
+                                   const StreamingOptions& options, compute::ComputeSession& session = compute::ComputeSession::shared());
+    // outPath is created (or truncated) to the inputs' length.
+    static bool addArraysStreaming(const std::string& pathA, const std::string& pathB, const std::string& outPath, bool complexAddition,
+                                   const StreamingOptions& options = StreamingOptions(),
+                                   compute::ComputeSession& session = compute::ComputeSession::shared());
+
+    // Splits one operation between the host CPU and the given devices, with chunks claimed according to each side's
+    // measured throughput (see HeterogeneousScheduler). outC is filled in place; a per-executor split is printed.
+    static std::vector<HeterogeneousScheduler::ExecutorReport> addArraysHeterogeneous(
+            const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC, bool complexAddition,
+            const std::vector<compute::ComputeSession*>& devices, bool useHostCpu = true);
+
+    // Overlaps staging with the device internally, but only returns once every chunk has completed. See addArraysAsync
+    // for a version that returns straight away.
     void addArraysGpuChunkingDynamicBufferAsync(const std::vector<float>& inA, const std::vector<float>& inB,
                                                         std::vector<float>& outC, bool complexAddition, bool onlyOutputToCpu);
 
-    int lengthVector = -1;
+    // Non-blocking add_arrays / complex_operation on the session's device. The operation owns its inputs (moved in, or
+    // shared), its output and its own staging ring, so the caller may drop everything and carry on with other work;
+    // the future holds outC once the last chunk is back. The chunks are streamed by the same coroutine stages as
+    // processChunks, spawned on TaskScheduler::shared(), so no thread waits on the device. Operations are independent
+    // of each other and of this ArrayAdder's own calls; the session must outlive them. Pipeline and buffer setup also
+    // runs on the scheduler: inputs of different lengths (std::invalid_argument) and setup failures
+    // (std::runtime_error) come back as exceptions from the future rather than ending the process.
+    ComputeFuture<std::vector<float>> addArraysAsync(std::vector<float> inA, std::vector<float> inB, bool complexAddition);
+    ComputeFuture<std::vector<float>> addArraysAsync(std::shared_ptr<const std::vector<float>> inA,
+                                                     std::shared_ptr<const std::vector<float>> inB, bool complexAddition);
+
+    // Chunks the async path keeps on the device at once (each with its own inA/inB/outC staging set). Zero, the
+    // default, takes the depth from the tuning profile.
+    void setMaxChunksInFlight(size_t depth) { maxChunksInFlight = depth; }
+    size_t getMaxChunksInFlight() const { return maxChunksInFlight; }
+
+    // Prints the chunked paths' launch configuration (threadgroup size, chunk size and count, in-flight depth, device
+    // memory) on every call. Off by default; setting HELLO_METAL_VERBOSE turns it on for new ArrayAdders.
+    void setVerbose(bool enabled) { verbose = enabled; }
+    bool isVerbose() const { return verbose; }
+
+    // Sum, min, max, dot or norm of the data on the device. Chunks go through processChunks like the async map above,
+    // so only the chunks in flight are ever staged; each chunk returns one partial per threadgroup, folded here in
+    // double. inB is only read for ReductionOp::Dot. See Reduction for the CPU versions.
+    // In the deterministic modes chunks are whole leaves and each leaf value is stored at its global index, then folded
+    // by Reduction::pairwiseSum, so the result does not depend on the chunk size or in-flight depth. Throws
+    // std::runtime_error when the kernel or its staging buffers cannot be set up.
+    double reduceArraysGpuChunked(ReductionOp op, const std::vector<float>& inA, const std::vector<float>& inB = {},
+                                  ReductionMode mode = ReductionMode::Fast);
+
+    // Prefix sums and compaction on the device (see Scan for the CPU versions). Each chunk is scanned or compacted
+    // per threadgroup (of the pipeline's largest threadgroup, up to 1024, unless the profile says otherwise); the
+    // completion handlers, which run in commit order, add the running carry while copying each chunk out, so sums and
+    // output positions carry across chunk boundaries. The carry grows by each group's device total.
+    // filterArraysGpuChunked resizes out to the number of elements kept and returns it. Both throw std::runtime_error
+    // when the kernel or its staging buffers cannot be set up.
+    void scanArraysGpuChunked(ScanKind kind, const std::vector<float>& in, std::vector<float>& out);
+    size_t filterArraysGpuChunked(const std::vector<float>& in, std::vector<float>& out, const FilterPredicate& predicate);
+
+    // add_arrays / complex_operation over many independent vectors at once. The batch's vectors are packed end to end
+    // (see VectorBatch), so the CPU version is one parallelFor and the device version one dispatch per chunk of packed
+    // elements rather than one per vector: each chunk is gathered from the vectors it overlaps into a staging slot and
+    // scattered back through the offsets table when it completes. Meant for thousands of short vectors, where the
+    // per-call cost of the other paths dominates the arithmetic. The device version returns false, with the reason on
+    // std::cerr, when the kernel or its staging buffers cannot be set up.
+    static void addArraysBatchedCPU(const VectorBatch& batch, bool complexAddition, ThreadPool& pool = ThreadPool::shared());
+    bool addArraysBatchedGpu(const VectorBatch& batch, bool complexAddition);
+
+    // add_arrays / complex_operation over inputs that never exist in host memory: element i of inA and inB is element
+    // i of randomA's and randomB's uniform [0, 1) sequences (see Philox), generated straight into each chunk's staging
+    // buffers by processChunks. The inputs are the same as filling two vectors with fillUniform, whatever the chunk
+    // size. onOutput gets each chunk of outC in order, from the staging buffer, before the slot is reused. Returns false,
+    // with the reason on std::cerr, when the kernel or its staging buffers cannot be set up.
+    using ChunkOutput = std::function<void(size_t start, const float* outC, size_t chunkSize)>;
+    bool addRandomArraysGpuChunked(size_t vectorSize, const Philox& randomA, const Philox& randomB, bool complexAddition,
+                                   const ChunkOutput& onOutput);
+
+    // add_arrays / complex_operation for any element type in types/ElementTypes.h. Storage is the type of the vectors,
+    // Compute the type the arithmetic runs in, so <Half, float> keeps half the memory traffic of float at float
+    // accuracy. Instantiated (in ArrayAdder.cpp) for <float, float>, <float, double>, <double, double>,
+    // <int32_t, int64_t>, <uint8_t, int32_t>, <Half, float>, <Half, Half> and <BFloat16, float>. complexAddition needs a
+    // floating-point Compute; the device version also needs the typed kernel on the session's backend (Metal has no
+    // double). Both return false, with a message on std::cerr, when the combination cannot run.
+    template<typename Storage, typename Compute = ComputeTypeOf<Storage>>
+    static bool addArraysTypedCPU(const std::vector<Storage>& inA, const std::vector<Storage>& inB, std::vector<Storage>& outC,
+                                  bool complexAddition, ThreadPool& pool = ThreadPool::shared());
+    template<typename Storage, typename Compute = ComputeTypeOf<Storage>>
+    bool addArraysTypedGpuChunked(const std::vector<Storage>& inA, const std::vector<Storage>& inB, std::vector<Storage>& outC,
+                                  bool complexAddition);
+
+    long long lengthVector = -1;
+
+    // Used when the tuning profile has no entry for this machine and kernel.
+    static constexpr size_t defaultChunkSize = 10000000; // Chunk size below 1E8 required for GPU to beat CPU
+    static constexpr size_t defaultInFlight = 3;
+
+    // Fills parameters from the tuning profile, clamped to the device and pipeline limits. Returns false, with the
+    // defaults above and the pipeline's threadExecutionWidth filled in, when nothing was tuned for this kernel.
+    static bool tuningFor(compute::ComputeSession& session, const std::string& kernelName, size_t vectorSize,
+                          const compute::ComputePipelineState& pipelineState, TuningParameters& parameters);
 
 private:
-    dispatch_semaphore_t semaphoreAsync;
-    MTL::Device* deviceAsync;
-    MTL::CommandQueue* commandQueueAsync;
-    MTL::ComputePipelineState* computePipelineStateAsync;
-    std::vector<MTL::Buffer*> bufferPoolAsync;
-    size_t maxChunkSizeAsync; // Adjustable based on GPU vs CPU performance testing.
-    size_t bufferIndexAsync = 0; // Current index for buffer swapping.
-
-    void initializeResources(const std::string& kernelFunctionName);
+    compute::ComputeSession* session;
+    compute::Device* deviceAsync = nullptr;
+    compute::CommandQueue* commandQueueAsync = nullptr;
+    compute::ComputePipelineState* computePipelineStateAsync = nullptr;
+    std::unique_ptr<compute::ChunkPipeline> chunkPipelineAsync; // Ring of staging sets, one per chunk in flight
+    size_t maxChunkSizeAsync; // From the tuning profile, else derived from the pipeline limits
+    size_t inFlightAsync = defaultInFlight; // Chunks allowed on the device at once
+    size_t threadgroupSizeAsync = 0;
+    bool tunedAsync = false; // The chunk and threadgroup sizes came from the tuning profile
+    size_t chunkAlignmentAsync = 1; // Staged chunks are zero-padded to a multiple of this many elements
+    size_t elementsPerThreadAsync = 1; // Dispatch one thread per this many (padded) elements
+    size_t elementSizeAsync = sizeof(float); // Bytes per element staged by processChunks
+    size_t maxChunksInFlight = 0; // User override of inFlightAsync
+    bool verbose = std::getenv("HELLO_METAL_VERBOSE") != nullptr;
+
+    // untunedChunkSize replaces the chunk size derived from the pipeline limits when the profile has no entry.
+    // elementSize sizes the staging buffers for kernels that do not take floats. Returns false, with the reason on
+    // std::cerr and nothing left allocated, when the pipeline or staging buffers cannot be set up; the synchronous
+    // float paths then exit as they always have.
+    bool initializeResources(compute::KernelId kernel, size_t untunedChunkSize = 0, size_t elementSize = sizeof(float));
     void releaseResources();
-    void processChunks(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC, bool complexAddition, bool onlyOutputToCpu);
-    MTL::Buffer* getNextBuffer();
-    NS::Error* errorAsync = nullptr;
+    // The kernel (add or complex) is the one initializeResources loaded.
+    void processChunks(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC, bool onlyOutputToCpu);
 
-    const int numSemaphores = 9;
+    // Streams [0, vectorSize) elements of elementSizeAsync bytes through the chunk ring: each chunk of inA (and inB,
+    // unless null) is staged into buffers 0 and 1 of a slot (zero-padded up to chunkAlignmentAsync) and dispatched over
+    // one thread per elementsPerThreadAsync elements with buffer 2 as output; onChunkCompleted then reads the chunk
+    // back, on a TaskScheduler thread and in chunk order, before the slot is reused. Returns once every chunk has been
+    // read back. constants, when given, are bound with setBytes at index 3 of every dispatch.
+    using ChunkCompletion = std::function<void(compute::ChunkPipeline::Slot& slot, size_t start, size_t chunkSize)>;
+    void processChunks(const void* inA, const void* inB, size_t vectorSize, const ChunkCompletion& onChunkCompleted,
+                       const void* constants = nullptr, size_t constantsLength = 0);
+    // Same, but stageChunk fills buffers 0 and 1 of the slot for [start, start + chunkSize) instead of a memcpy from
+    // contiguous inputs; the padding is still added afterwards.
+    using ChunkStaging = std::function<void(compute::ChunkPipeline::Slot& slot, size_t start, size_t chunkSize)>;
+    void processChunks(size_t vectorSize, const ChunkStaging& stageChunk, const ChunkCompletion& onChunkCompleted,
+                       const void* constants = nullptr, size_t constantsLength = 0);
 
-private:
-    struct Timer {
-        std::string timerName;
-        std::chrono::time_point<std::chrono::high_resolution_clock> startSolver;
-        std::chrono::time_point<std::chrono::high_resolution_clock> endSolver;
-        long long solverElapsedTime = 0;
-        bool useMilliseconds = false;
-
-        void start(bool useMs = false) {
-            if (useMs)
-                useMilliseconds = true;
-            startSolver = std::chrono::high_resolution_clock::now();
-        }
-
-        void stop() {
-            endSolver = std::chrono::high_resolution_clock::now();
-            if (useMilliseconds)
-                solverElapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endSolver - startSolver).count();
-            else
-                solverElapsedTime = std::chrono::duration_cast<std::chrono::seconds>(endSolver - startSolver).count();
-        }
-
-        void setName( const std::string &name ) {
-            timerName = name;
-        }
-
-        void cleanUp() {
-            // Clear the timerName and reset the start and end times to ensure it's fully reset.
-            timerName.clear();
-            startSolver = std::chrono::time_point<std::chrono::high_resolution_clock>();
-            endSolver = std::chrono::time_point<std::chrono::high_resolution_clock>();
-            solverElapsedTime = 0;
-            useMilliseconds = false;
-        }
-
-        void print() {
-            std::cout << "----------------------------------------------------------------\n";
-            if (!timerName.empty())
-                std::cout << "Timing Information - " << timerName << "\n";
-            else
-                std::cout << "\nTiming Information. \n";
-
-            // Directly printing the elapsed time as high_resolution_clock does not directly support conversion to a time_t value.
-            if (useMilliseconds)
-                std::cout << "\tElapsed: " << solverElapsedTime << " [milliseconds]\n";
-            else
-                std::cout << "\tElapsed: " << solverElapsedTime << " [seconds]\n";
-
-            std::cout << "----------------------------------------------------------------\n";
-
-            cleanUp();
-        }
+    // The pipeline behind processChunks, as two coroutine stages on scheduler: stageChunks waits for a free slot,
+    // stages and commits each chunk; streamChunks itself waits for the chunks to complete and reads them back. Both
+    // only suspend, so the stages overlap each other and the device up to the ring's depth. While tracing is on (see
+    // Trace), every chunk is an async span from waiting for its slot to readback, with the staging, encode, commit,
+    // device and readback stages nested inside it. Each chunk is also counted in the session's PipelineMetrics; bytes
+    // out are the chunk's output region, which the reductions only read part of.
+    //
+    // If stageChunk, encoding or onChunkCompleted throws, no further chunks are staged or read back: every chunk
+    // already committed is still waited for and its slot released, and only then does streamChunks rethrow the first
+    // exception, so the ring is left drained and neither stage outlives the call.
+    struct CompletedChunk {
+        compute::ChunkPipeline::Slot* slot; // Null for the marker stageChunks pushes when it stops
+        size_t start;
+        size_t size;
+        uint64_t traceId;   // Zero when not traced
+        uint64_t startedAt; // Trace::now() before waiting for the slot
     };
+    // Shared by the two stages of one run; lives in streamChunks' frame.
+    struct StageProgress {
+        std::atomic<bool> cancelled{false}; // A readback failed; stageChunks stops at its next slot
+        size_t committed = 0;               // Chunks committed; read by streamChunks once it has the end marker
+    };
+    Task<> streamChunks(size_t vectorSize, ChunkStaging stageChunk, ChunkCompletion onChunkCompleted,
+                        const void* constants, size_t constantsLength, TaskScheduler& scheduler);
+    Task<> stageChunks(size_t vectorSize, ChunkStaging stageChunk, AsyncQueue<CompletedChunk>* completed, StageProgress* progress,
+                       const void* constants, size_t constantsLength, TaskScheduler& scheduler);
+    // Pads a staged slot and encodes its dispatch into a new command buffer, left for the caller to commit.
+    std::shared_ptr<compute::CommandBuffer> encodeChunk(compute::ChunkPipeline::Slot& slot, size_t currentChunkSize,
+                                                        const void* constants = nullptr, size_t constantsLength = 0);
+
+    // Sets up adder's resources and streams the chunks; a setup failure throws into the future.
+    static Task<std::vector<float>> addArraysTask(std::shared_ptr<ArrayAdder> adder, std::shared_ptr<const std::vector<float>> inA,
+                                                  std::shared_ptr<const std::vector<float>> inB, bool complexAddition,
+                                                  std::chrono::steady_clock::time_point callStart);
+
+    static constexpr size_t buffersPerChunk = 3; // inA, inB and outC staging
 };
 
 #endif //HELLO_METAL_ARRAYADDER_H
@@ -2,19 +2,12 @@
 // Created by Cameron Aidan McEleney on 15/03/2024.
 //
 
-#include <metal_stdlib>
-using namespace metal;
+#include "elementwise.h"
 
-kernel void add_arrays(const device float* inA [[ buffer(0) ]],
-                       const device float* inB [[ buffer(1) ]],
-                       device float* outC [[ buffer(2) ]],
-                       uint id [[ thread_position_in_grid ]]) {
-    outC[id] = inA[id] + inB[id];
+// add_arrays, complex_operation, ...: one kernel, specialised for the operation by the elementwise_op function constant.
+kernel void elementwise(const device float* inA [[ buffer(0) ]],
+                        const device float* inB [[ buffer(1) ]],
+                        device float* outC [[ buffer(2) ]],
+                        uint id [[ thread_position_in_grid ]]) {
+    outC[id] = elementwise_apply<float>(inA[id], inB[id]);
 }
-
-kernel void complex_operation(const device float* inA [[ buffer(0) ]],
-                              const device float* inB [[ buffer(1) ]],
-                              device float* outC [[ buffer(2) ]],
-                              uint id [[ thread_position_in_grid ]]) {
-    outC[id] = sin(inA[id] * inB[id]) + inA[id];
-}
\ No newline at end of file
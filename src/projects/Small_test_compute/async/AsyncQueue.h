@@ -0,0 +1,72 @@
+//
+// AsyncQueue.h
+//
+
+#ifndef HELLO_METAL_ASYNCQUEUE_H
+#define HELLO_METAL_ASYNCQUEUE_H
+
+#include "TaskScheduler.h"
+
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// Unbounded FIFO between pipeline stages. push() may be called from any thread (e.g. a device completion handler);
+// a single consumer coroutine takes values in push order with co_await queue.pop(), suspending while the queue is empty
+// and resuming on the scheduler.
+template<typename T>
+class AsyncQueue {
+public:
+    explicit AsyncQueue(TaskScheduler& scheduler) : scheduler(scheduler) {}
+
+    AsyncQueue(const AsyncQueue&) = delete;
+    AsyncQueue& operator=(const AsyncQueue&) = delete;
+
+    void push(T value) {
+        TaskScheduler* target = &scheduler;
+        std::coroutine_handle<> resume;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!consumer) {
+                items.push_back(std::move(value));
+                return;
+            }
+            consumer->value.emplace(std::move(value));
+            resume = consumer->handle;
+            consumer = nullptr;
+        }
+        // The consumer may destroy the queue as soon as it runs, so nothing here touches members any more
+        target->post(resume);
+    }
+
+    struct PopAwaiter {
+        AsyncQueue* queue;
+        std::optional<T> value{};
+        std::coroutine_handle<> handle{};
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> awaiting) {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            if (!queue->items.empty()) {
+                value.emplace(std::move(queue->items.front()));
+                queue->items.pop_front();
+                return false;
+            }
+            handle = awaiting;
+            queue->consumer = this;
+            return true;
+        }
+        T await_resume() { return std::move(*value); }
+    };
+
+    PopAwaiter pop() { return PopAwaiter{this}; }
+
+private:
+    TaskScheduler& scheduler;
+    std::mutex mutex;
+    std::deque<T> items;
+    PopAwaiter* consumer = nullptr; // Suspended in pop()
+};
+
+#endif //HELLO_METAL_ASYNCQUEUE_H
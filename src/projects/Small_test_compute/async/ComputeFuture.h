@@ -0,0 +1,231 @@
+//
+// ComputeFuture.h
+//
+
+#ifndef HELLO_METAL_COMPUTEFUTURE_H
+#define HELLO_METAL_COMPUTEFUTURE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template<typename T>
+class ComputeFuture;
+
+namespace ComputeFutureDetail {
+    struct Empty {};
+
+    template<typename T>
+    using Stored = std::conditional_t<std::is_void_v<T>, Empty, T>;
+
+    // Type of continuation(result), or of continuation() for a void future.
+    template<typename Continuation, typename T>
+    struct ThenResult { using type = std::invoke_result_t<Continuation, T>; };
+    template<typename Continuation>
+    struct ThenResult<Continuation, void> { using type = std::invoke_result_t<Continuation>; };
+
+    // Shared between a ComputePromise and its ComputeFuture. Continuations run exactly once, on the thread that
+    // completes the state, or inline when they are added to a state that is already complete.
+    template<typename T>
+    class State {
+    public:
+        bool ready() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return done;
+        }
+
+        void wait() const {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return done; });
+        }
+
+        template<typename Rep, typename Period>
+        bool waitFor(const std::chrono::duration<Rep, Period>& timeout) const {
+            std::unique_lock<std::mutex> lock(mutex);
+            return condition.wait_for(lock, timeout, [this] { return done; });
+        }
+
+        void setValue(Stored<T> result) {
+            complete([&] { value.emplace(std::move(result)); });
+        }
+
+        void setException(std::exception_ptr error) {
+            complete([&] { exception = std::move(error); });
+        }
+
+        // Runs continuation now if the state is complete; otherwise queues it and returns false.
+        bool addContinuation(std::function<void()> continuation, bool runIfReady = true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!done) {
+                    continuations.push_back(std::move(continuation));
+                    return false;
+                }
+            }
+            if (runIfReady)
+                continuation();
+            return true;
+        }
+
+        // Moves the result out; rethrows a stored exception. Only valid once the state is complete.
+        Stored<T> take() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (exception)
+                std::rethrow_exception(exception);
+            if (!value)
+                throw std::logic_error("ComputeFuture: result already taken");
+            Stored<T> result = std::move(*value);
+            value.reset();
+            return result;
+        }
+
+    private:
+        template<typename Publish>
+        void complete(Publish publish) {
+            std::vector<std::function<void()>> pending;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (done)
+                    throw std::logic_error("ComputeFuture: result already set");
+                publish();
+                done = true;
+                pending.swap(continuations);
+            }
+            condition.notify_all();
+            for (auto& continuation : pending)
+                continuation();
+        }
+
+        mutable std::mutex mutex;
+        mutable std::condition_variable condition;
+        bool done = false;
+        std::optional<Stored<T>> value;
+        std::exception_ptr exception;
+        std::vector<std::function<void()>> continuations;
+    };
+}
+
+// Producer side of a ComputeFuture. Set the value (or an exception) exactly once, from any thread.
+template<typename T>
+class ComputePromise {
+public:
+    ComputePromise() : state(std::make_shared<ComputeFutureDetail::State<T>>()) {}
+
+    ComputeFuture<T> future() const { return ComputeFuture<T>(state); }
+
+    template<typename U = T, typename = std::enable_if_t<!std::is_void_v<U>>>
+    void setValue(U result) { state->setValue(std::move(result)); }
+    template<typename U = T, typename = std::enable_if_t<std::is_void_v<U>>>
+    void setValue() { state->setValue({}); }
+    void setException(std::exception_ptr error) { state->setException(std::move(error)); }
+
+private:
+    std::shared_ptr<ComputeFutureDetail::State<T>> state;
+};
+
+// Result of an asynchronous compute operation. It can be polled (ready), waited on (wait, waitFor, get), chained (then)
+// or awaited from a C++20 coroutine (co_await future). Copies share one result, which get() or co_await moves out once.
+//
+// Continuations and resumed coroutines run on the thread that completes the operation, usually the backend's
+// completion thread, so keep them short or hand the work on; further device work is fine to submit from there.
+template<typename T>
+class ComputeFuture {
+public:
+    ComputeFuture() = default;
+
+    bool valid() const { return state != nullptr; }
+    bool ready() const { return state->ready(); }
+    void wait() const { state->wait(); }
+    template<typename Rep, typename Period>
+    bool waitFor(const std::chrono::duration<Rep, Period>& timeout) const { return state->waitFor(timeout); }
+
+    // Blocks until the result is available, then moves it out (or rethrows the operation's exception).
+    T get() {
+        state->wait();
+        if constexpr (std::is_void_v<T>)
+            state->take();
+        else
+            return state->take();
+    }
+
+    // Future of continuation(result). An exception from the operation or from continuation ends up in the returned
+    // future instead.
+    template<typename Continuation>
+    auto then(Continuation continuation) -> ComputeFuture<typename ComputeFutureDetail::ThenResult<Continuation, T>::type> {
+        using Result = typename ComputeFutureDetail::ThenResult<Continuation, T>::type;
+        ComputePromise<Result> next;
+        auto source = state;
+        state->addContinuation([source, next, continuation = std::move(continuation)]() mutable {
+            try {
+                auto invoke = [&]() -> Result {
+                    if constexpr (std::is_void_v<T>) {
+                        source->take();
+                        return continuation();
+                    } else {
+                        return continuation(source->take());
+                    }
+                };
+                if constexpr (std::is_void_v<Result>) {
+                    invoke();
+                    next.setValue();
+                } else {
+                    next.setValue(invoke());
+                }
+            } catch (...) {
+                next.setException(std::current_exception());
+            }
+        });
+        return next.future();
+    }
+
+    struct Awaiter {
+        std::shared_ptr<ComputeFutureDetail::State<T>> state;
+
+        bool await_ready() const { return state->ready(); }
+        // Suspends unless the result arrived in the meantime; the completing thread resumes the coroutine.
+        bool await_suspend(std::coroutine_handle<> handle) {
+            return !state->addContinuation([handle] { handle.resume(); }, false);
+        }
+        T await_resume() {
+            if constexpr (std::is_void_v<T>)
+                state->take();
+            else
+                return state->take();
+        }
+    };
+
+    Awaiter operator co_await() const { return Awaiter{state}; }
+
+private:
+    friend class ComputePromise<T>;
+    explicit ComputeFuture(std::shared_ptr<ComputeFutureDetail::State<T>> state) : state(std::move(state)) {}
+
+    std::shared_ptr<ComputeFutureDetail::State<T>> state;
+};
+
+// Future that is already complete, e.g. for an empty input.
+template<typename T>
+ComputeFuture<T> makeReadyFuture(T value) {
+    ComputePromise<T> promise;
+    promise.setValue(std::move(value));
+    return promise.future();
+}
+
+// Future that already holds error, e.g. for invalid arguments.
+template<typename T>
+ComputeFuture<T> makeExceptionalFuture(std::exception_ptr error) {
+    ComputePromise<T> promise;
+    promise.setException(std::move(error));
+    return promise.future();
+}
+
+#endif //HELLO_METAL_COMPUTEFUTURE_H
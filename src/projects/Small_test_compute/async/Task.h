@@ -0,0 +1,120 @@
+//
+// Task.h
+//
+
+#ifndef HELLO_METAL_TASK_H
+#define HELLO_METAL_TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+template<typename T>
+class Task;
+
+namespace TaskDetail {
+    template<typename T>
+    struct PromiseBase {
+        std::coroutine_handle<> continuation; // Whoever co_awaits the task, resumed when it finishes
+        std::exception_ptr exception;
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        // Hands the thread straight to the awaiting coroutine instead of returning to whoever resumed this one.
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                auto continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    template<typename T>
+    struct Promise : PromiseBase<T> {
+        std::optional<T> value;
+
+        Task<T> get_return_object();
+        void return_value(T result) { value.emplace(std::move(result)); }
+        T result() {
+            if (this->exception)
+                std::rethrow_exception(this->exception);
+            return std::move(*value);
+        }
+    };
+
+    template<>
+    struct Promise<void> : PromiseBase<void> {
+        Task<void> get_return_object();
+        void return_void() {}
+        void result() {
+            if (exception)
+                std::rethrow_exception(exception);
+        }
+    };
+}
+
+// A lazily started C++20 coroutine. Nothing runs until the task is co_awaited, which runs it on the awaiting thread
+// and resumes the awaiter when it finishes, or handed to TaskScheduler::spawn. Stages that have to wait for a device or
+// a buffer suspend on the awaitables in TaskScheduler.h and AsyncQueue.h, which resume them on the scheduler's threads.
+//
+// A coroutine's reference parameters are not copied into its frame, so pass anything the task outlives by value.
+template<typename T = void>
+class Task {
+public:
+    using promise_type = TaskDetail::Promise<T>;
+
+    Task() = default;
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (handle)
+            handle.destroy();
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    struct Awaiter {
+        std::coroutine_handle<promise_type> handle;
+
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+        T await_resume() { return handle.promise().result(); }
+    };
+
+    Awaiter operator co_await() const noexcept { return Awaiter{handle}; }
+
+private:
+    friend struct TaskDetail::Promise<T>;
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+template<typename T>
+Task<T> TaskDetail::Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskDetail::Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+#endif //HELLO_METAL_TASK_H
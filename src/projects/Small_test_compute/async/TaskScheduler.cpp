@@ -0,0 +1,69 @@
+//
+// TaskScheduler.cpp
+//
+
+#include "TaskScheduler.h"
+#include "../trace/Trace.h"
+
+#include <algorithm>
+
+namespace {
+    thread_local const TaskScheduler* currentScheduler = nullptr;
+    thread_local size_t currentIndex = TaskScheduler::npos;
+}
+
+TaskScheduler::TaskScheduler(size_t numThreads) {
+    const size_t totalThreads = numThreads > 0 ? numThreads : std::max<size_t>(2, std::thread::hardware_concurrency());
+    workers.reserve(totalThreads);
+    for (size_t i = 0; i < totalThreads; ++i)
+        workers.emplace_back(&TaskScheduler::workerLoop, this, i);
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+bool TaskScheduler::isWorkerThread() const {
+    return currentScheduler == this;
+}
+
+size_t TaskScheduler::currentWorkerIndex() {
+    return currentIndex;
+}
+
+TaskScheduler& TaskScheduler::shared() {
+    static TaskScheduler scheduler;
+    return scheduler;
+}
+
+void TaskScheduler::post(std::coroutine_handle<> handle) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.push_back(handle);
+    }
+    condition.notify_one();
+}
+
+void TaskScheduler::workerLoop(size_t workerIndex) {
+    Trace::setThreadName("TaskScheduler worker");
+    currentScheduler = this;
+    currentIndex = workerIndex;
+    while (true) {
+        std::coroutine_handle<> next;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return stopping || !ready.empty(); });
+            if (ready.empty())
+                return;
+            next = ready.front();
+            ready.pop_front();
+        }
+        next.resume();
+    }
+}
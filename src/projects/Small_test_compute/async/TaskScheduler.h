@@ -0,0 +1,151 @@
+//
+// TaskScheduler.h
+//
+
+#ifndef HELLO_METAL_TASKSCHEDULER_H
+#define HELLO_METAL_TASKSCHEDULER_H
+
+#include "ComputeFuture.h"
+#include "Task.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Runs coroutines (Task) on a small set of worker threads. A coroutine never blocks a worker: it suspends on an
+// awaitable and is posted back to the queue by whatever completes the wait (a device completion handler, a freed
+// staging slot, a value pushed into an AsyncQueue). Each stage of a pipeline can therefore be written as a straight
+// loop, and the stages overlap with each other and with the device.
+//
+// ThreadPool stays the fork-join pool for data-parallel loops; this one is for the stages that wait in between. Code
+// running on the scheduler must not block on another task (ComputeFuture::get/wait); co_await it instead.
+class TaskScheduler {
+public:
+    // Zero uses every hardware thread, with at least two so two stages can always make progress side by side.
+    explicit TaskScheduler(size_t numThreads = 0);
+    // Runs what is still queued, then joins the workers.
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    size_t threadCount() const { return workers.size(); }
+
+    // True on this scheduler's own worker threads, where blocking on a task could starve the pool.
+    bool isWorkerThread() const;
+    // Index (from zero) of the calling thread among its scheduler's workers, or npos on any other thread.
+    static constexpr size_t npos = static_cast<size_t>(-1);
+    static size_t currentWorkerIndex();
+
+    // Process-wide scheduler used by ArrayAdder's chunked paths.
+    static TaskScheduler& shared();
+
+    // Queues a suspended coroutine to be resumed on a worker. Callable from any thread.
+    void post(std::coroutine_handle<> handle);
+
+    // co_await scheduler.schedule() continues the calling coroutine on a worker.
+    struct ScheduleAwaiter {
+        TaskScheduler* scheduler;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) const { scheduler->post(handle); }
+        void await_resume() const noexcept {}
+    };
+    ScheduleAwaiter schedule() { return ScheduleAwaiter{this}; }
+
+    // Starts task on a worker; the future completes with its result (or exception).
+    template<typename T>
+    ComputeFuture<T> spawn(Task<T> task) {
+        ComputePromise<T> promise;
+        auto future = promise.future();
+        run(*this, std::move(task), std::move(promise));
+        return future;
+    }
+
+private:
+    // Eagerly started, self-destroying coroutine that owns a spawned task until it finishes.
+    struct Detached {
+        struct promise_type {
+            Detached get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+
+    template<typename T>
+    static Detached run(TaskScheduler& scheduler, Task<T> task, ComputePromise<T> promise) {
+        co_await scheduler.schedule();
+        std::exception_ptr error;
+        if constexpr (std::is_void_v<T>) {
+            try {
+                co_await task;
+            } catch (...) {
+                error = std::current_exception();
+            }
+            if (!error)
+                promise.setValue();
+        } else {
+            std::optional<T> result;
+            try {
+                result.emplace(co_await task);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            if (!error)
+                promise.setValue(std::move(*result));
+        }
+        if (error)
+            promise.setException(error);
+    }
+
+    void workerLoop(size_t workerIndex);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::coroutine_handle<>> ready;
+    bool stopping = false;
+};
+
+// Turns a callback-style API into an awaitable that resumes on scheduler: start(done) must arrange for done(value) to
+// be called exactly once, from any thread, possibly before start returns (then the coroutine just carries on).
+// For example, waiting for a free staging slot:
+//     auto* slot = co_await awaitCallback<compute::ChunkPipeline::Slot*>(scheduler, [&](auto done) {
+//         ring.acquireAsync([done](compute::ChunkPipeline::Slot& free) { done(&free); });
+//     });
+template<typename T, typename Start>
+auto awaitCallback(TaskScheduler& scheduler, Start start) {
+    struct Awaiter {
+        TaskScheduler* scheduler;
+        Start start;
+        std::optional<T> value{};
+        std::coroutine_handle<> handle{};
+        std::atomic<int> state{0}; // 0 waiting, 1 suspended, 2 value delivered
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> awaiting) {
+            handle = awaiting;
+            start([this](T result) {
+                // Copy out what is needed first: once state reads 2 the coroutine may resume and destroy this awaiter
+                TaskScheduler* target = scheduler;
+                std::coroutine_handle<> resume = handle;
+                value.emplace(std::move(result));
+                if (state.exchange(2, std::memory_order_acq_rel) == 1)
+                    target->post(resume);
+            });
+            // Already delivered: do not suspend at all
+            return state.exchange(1, std::memory_order_acq_rel) != 2;
+        }
+        T await_resume() { return std::move(*value); }
+    };
+    return Awaiter{&scheduler, std::move(start)};
+}
+
+#endif //HELLO_METAL_TASKSCHEDULER_H
@@ -0,0 +1,36 @@
+//
+// VectorBatch.cpp
+//
+
+#include "VectorBatch.h"
+
+#include <cstring>
+
+void VectorBatch::add(const BatchItem& item) {
+    batchItems.push_back(item);
+    itemOffsets.push_back(itemOffsets.back() + item.length);
+}
+
+void VectorBatch::add(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC) {
+    const size_t length = std::min(inA.size(), inB.size());
+    outC.resize(length);
+    add(inA.data(), inB.data(), outC.data(), length);
+}
+
+void VectorBatch::clear() {
+    batchItems.clear();
+    itemOffsets.assign(1, 0);
+}
+
+void VectorBatch::gather(size_t packedStart, size_t count, float* packedA, float* packedB) const {
+    forEachPiece(packedStart, count, [=](const BatchItem& item, size_t itemOffset, size_t packedOffset, size_t pieceSize) {
+        memcpy(packedA + (packedOffset - packedStart), item.inA + itemOffset, pieceSize * sizeof(float));
+        memcpy(packedB + (packedOffset - packedStart), item.inB + itemOffset, pieceSize * sizeof(float));
+    });
+}
+
+void VectorBatch::scatter(size_t packedStart, size_t count, const float* packedC) const {
+    forEachPiece(packedStart, count, [=](const BatchItem& item, size_t itemOffset, size_t packedOffset, size_t pieceSize) {
+        memcpy(item.outC + itemOffset, packedC + (packedOffset - packedStart), pieceSize * sizeof(float));
+    });
+}
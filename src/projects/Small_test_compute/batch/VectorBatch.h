@@ -0,0 +1,67 @@
+//
+// VectorBatch.h
+//
+
+#ifndef HELLO_METAL_VECTORBATCH_H
+#define HELLO_METAL_VECTORBATCH_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// One vector of a batch: outC[i] = op(inA[i], inB[i]) for i < length. The batch only refers to the memory, which must
+// stay valid (and outC unshared) until the batched call returns.
+struct BatchItem {
+    const float* inA = nullptr;
+    const float* inB = nullptr;
+    float* outC = nullptr;
+    size_t length = 0;
+};
+
+// Many independent vectors laid end to end in one packed index space, so a single launch (or parallelFor) covers all of
+// them. offsets() is the table mapping item i to packed positions [offsets()[i], offsets()[i + 1]); a range of packed
+// positions is gathered from, or scattered back to, the items it overlaps with forEachPiece.
+class VectorBatch {
+public:
+    VectorBatch() : itemOffsets(1, 0) {}
+
+    void add(const BatchItem& item);
+    void add(const float* inA, const float* inB, float* outC, size_t length) { add(BatchItem{inA, inB, outC, length}); }
+    // outC is resized to the inputs' length before its address is taken.
+    void add(const std::vector<float>& inA, const std::vector<float>& inB, std::vector<float>& outC);
+    void clear();
+
+    size_t size() const { return batchItems.size(); }
+    bool empty() const { return batchItems.empty(); }
+    size_t totalElements() const { return itemOffsets.back(); }
+    const std::vector<BatchItem>& items() const { return batchItems; }
+    const std::vector<size_t>& offsets() const { return itemOffsets; }
+
+    // Calls piece(item, itemOffset, packedOffset, count) for each run of [packedStart, packedStart + count) that lies
+    // in one item, in packed order. Empty items are skipped.
+    template<typename Piece>
+    void forEachPiece(size_t packedStart, size_t count, Piece piece) const {
+        const size_t end = std::min(packedStart + count, totalElements());
+        // Last item starting at or before packedStart; with empty items sharing that offset this is the non-empty one
+        size_t index = static_cast<size_t>(std::upper_bound(itemOffsets.begin(), itemOffsets.end(), packedStart)
+                                           - itemOffsets.begin()) - 1;
+        for (size_t position = packedStart; position < end; ++index) {
+            const size_t itemEnd = std::min(itemOffsets[index + 1], end);
+            if (itemEnd > position) {
+                piece(batchItems[index], position - itemOffsets[index], position, itemEnd - position);
+                position = itemEnd;
+            }
+        }
+    }
+
+    // Copies packed positions [packedStart, packedStart + count) of the inputs into packedA and packedB.
+    void gather(size_t packedStart, size_t count, float* packedA, float* packedB) const;
+    // Copies packedC, holding packed positions [packedStart, packedStart + count), to the items' outputs.
+    void scatter(size_t packedStart, size_t count, const float* packedC) const;
+
+private:
+    std::vector<BatchItem> batchItems;
+    std::vector<size_t> itemOffsets; // size() + 1 entries, prefix sums of the lengths
+};
+
+#endif //HELLO_METAL_VECTORBATCH_H
@@ -0,0 +1,721 @@
+//
+// Benchmark.cpp
+//
+
+#include "Benchmark.h"
+#include "../ArrayAdder.h"
+#include "../cpu/SimdKernels.h"
+#include "../io/MappedFile.h"
+#include "../random/Philox.h"
+#include "../types/ElementTypes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace {
+    // Swallows what the ArrayAdder paths print (their Timer output) while they are being timed.
+    class NullBuffer : public std::streambuf {
+    protected:
+        int overflow(int character) override { return character; }
+        std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+    };
+
+    class QuietStdout {
+    public:
+        QuietStdout() : previous(std::cout.rdbuf(&discard)) {}
+        ~QuietStdout() { std::cout.rdbuf(previous); }
+
+    private:
+        NullBuffer discard;
+        std::streambuf* previous;
+    };
+
+    size_t physicalMemoryBytes() {
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+        const long pages = sysconf(_SC_PHYS_PAGES);
+        const long pageSize = sysconf(_SC_PAGESIZE);
+        if (pages > 0 && pageSize > 0)
+            return static_cast<size_t>(pages) * static_cast<size_t>(pageSize);
+#endif
+        return size_t(16) << 30;
+    }
+
+    std::string mebibytes(size_t bytes) {
+        return std::to_string((bytes + (size_t(1) << 20) - 1) >> 20) + " MiB";
+    }
+
+    // Typed inputs from the float ones. Integers are scaled so sums do not wrap.
+    template<typename Storage>
+    Storage fromUnit(float value) {
+        if constexpr (std::is_same<Storage, int32_t>::value)
+            return static_cast<int32_t>(value * 1000000.0f);
+        else if constexpr (std::is_same<Storage, uint8_t>::value)
+            return static_cast<uint8_t>(value * 100.0f);
+        else
+            return static_cast<Storage>(value);
+    }
+
+    template<typename T>
+    double asDouble(T value) {
+        if constexpr (std::is_arithmetic<T>::value)
+            return static_cast<double>(value);
+        else
+            return static_cast<double>(static_cast<float>(value));
+    }
+
+    // Relative error allowed against the host formula. Devices may use a fast-math sin, and the 16-bit types round every
+    // intermediate.
+    template<typename Storage>
+    double tolerance() {
+        if constexpr (std::is_same<Storage, double>::value)
+            return 1e-9;
+        else if constexpr (std::is_same<Storage, float>::value)
+            return 1e-4;
+        else if constexpr (std::is_same<Storage, Half>::value)
+            return 1e-2;
+        else if constexpr (std::is_same<Storage, BFloat16>::value)
+            return 3e-2;
+        else
+            return 0.0;
+    }
+
+    constexpr size_t validationSamples = 64;
+
+    // Compares validationSamples evenly spaced elements, and the last one, with ElementwiseTraits. outputAt(i) reads
+    // element i of the output.
+    template<typename Storage, typename Compute, typename Output>
+    bool checkSamples(const Storage* inA, const Storage* inB, const Output& outputAt, size_t n, ElementwiseOp op, std::string& note) {
+        return visitElementwiseOp(op, [&](auto constant) {
+            constexpr ElementwiseOp Op = decltype(constant)::value;
+            for (size_t sample = 0; sample <= validationSamples && n > 0; ++sample) {
+                const size_t i = sample == validationSamples ? n - 1 : sample * n / validationSamples;
+                const double expected = asDouble(ElementwiseTraits<Op>::template apply<Compute>(static_cast<Compute>(inA[i]),
+                                                                                                static_cast<Compute>(inB[i])));
+                const double actual = asDouble(outputAt(i));
+                if (!(std::abs(actual - expected) <= tolerance<Storage>() * std::max(1.0, std::abs(expected)))) {
+                    note = "element " + std::to_string(i) + " is " + std::to_string(actual) + ", expected " + std::to_string(expected);
+                    return false;
+                }
+            }
+            return true;
+        });
+    }
+
+    struct Inputs {
+        compute::ComputeSession& session;
+        const Benchmark::Options& options;
+        std::vector<float>& inA;
+        std::vector<float>& inB;
+        std::vector<float>& outC;
+    };
+
+    // A variant set up for one size: call runs the path once (false if it could not), check validates the output of
+    // the last call. skip is set instead when the variant cannot run at this size.
+    struct Prepared {
+        std::function<bool(bool complexAddition)> call;
+        std::function<bool(ElementwiseOp op, std::string& note)> check;
+        std::string skip;
+    };
+
+    struct Variant {
+        std::string name;
+        std::string elementType;
+        size_t elementSize = sizeof(float);
+        size_t extraBytesPerElement = 0; // Host memory needed on top of the shared float vectors
+        bool floatingPoint = true;
+        bool runByDefault = true;
+        std::function<Prepared(Inputs& inputs)> prepare;
+    };
+
+    std::function<bool(ElementwiseOp, std::string&)> checkFloat(const std::vector<float>& inA, const std::vector<float>& inB,
+                                                                const float* outC) {
+        const float* a = inA.data();
+        const float* b = inB.data();
+        const size_t n = inA.size();
+        return [a, b, outC, n](ElementwiseOp op, std::string& note) {
+            return checkSamples<float, float>(a, b, [outC](size_t i) { return outC[i]; }, n, op, note);
+        };
+    }
+
+    // A float variant whose call only needs the shared vectors.
+    Variant floatVariant(const std::string& name, std::function<void(Inputs& inputs, bool complexAddition)> body,
+                         size_t extraBytesPerElement = 0) {
+        Variant variant;
+        variant.name = name;
+        variant.elementType = ElementTraits<float>::suffix;
+        variant.extraBytesPerElement = extraBytesPerElement;
+        variant.prepare = [body](Inputs& inputs) {
+            Prepared prepared;
+            Inputs* in = &inputs;
+            prepared.call = [body, in](bool complexAddition) {
+                body(*in, complexAddition);
+                return true;
+            };
+            prepared.check = checkFloat(inputs.inA, inputs.inB, inputs.outC.data());
+            return prepared;
+        };
+        return variant;
+    }
+
+    template<typename Storage>
+    struct TypedVectors {
+        std::vector<Storage> inA;
+        std::vector<Storage> inB;
+        std::vector<Storage> outC;
+
+        TypedVectors(const std::vector<float>& floatA, const std::vector<float>& floatB, ThreadPool& pool)
+                : inA(floatA.size()), inB(floatB.size()), outC(floatA.size()) {
+            pool.parallelFor(floatA.size(), [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    inA[i] = fromUnit<Storage>(floatA[i]);
+                    inB[i] = fromUnit<Storage>(floatB[i]);
+                }
+            });
+        }
+    };
+
+    // addArraysTypedCPU / addArraysTypedGpuChunked on vectors of Storage.
+    template<typename Storage>
+    Variant typedVariant(bool device) {
+        Variant variant;
+        variant.name = std::string(device ? "typed_gpu_" : "typed_cpu_") + ElementTraits<Storage>::suffix;
+        variant.elementType = ElementTraits<Storage>::suffix;
+        variant.elementSize = sizeof(Storage);
+        variant.extraBytesPerElement = 3 * sizeof(Storage);
+        variant.floatingPoint = ElementTraits<ComputeTypeOf<Storage>>::isFloatingPoint;
+        variant.prepare = [device](Inputs& inputs) {
+            auto vectors = std::make_shared<TypedVectors<Storage>>(inputs.inA, inputs.inB, ThreadPool::shared());
+            auto adder = std::make_shared<ArrayAdder>(inputs.session);
+            Prepared prepared;
+            prepared.call = [vectors, adder, device](bool complexAddition) {
+                if (device)
+                    return adder->addArraysTypedGpuChunked<Storage>(vectors->inA, vectors->inB, vectors->outC, complexAddition);
+                return ArrayAdder::addArraysTypedCPU<Storage>(vectors->inA, vectors->inB, vectors->outC, complexAddition);
+            };
+            prepared.check = [vectors](ElementwiseOp op, std::string& note) {
+                const Storage* outC = vectors->outC.data();
+                return checkSamples<Storage, ComputeTypeOf<Storage>>(vectors->inA.data(), vectors->inB.data(),
+                                                                     [outC](size_t i) { return outC[i]; },
+                                                                     vectors->inA.size(), op, note);
+            };
+            return prepared;
+        };
+        return variant;
+    }
+
+    // Removes its directory (and the files in it) when the last reference goes.
+    struct ScratchDirectory {
+        std::filesystem::path path;
+
+        ~ScratchDirectory() {
+            std::error_code error;
+            std::filesystem::remove_all(path, error);
+        }
+    };
+
+    bool writeFloats(const std::filesystem::path& path, const std::vector<float>& values) {
+        std::unique_ptr<MappedFile> file = MappedFile::create(path.string(), values.size() * sizeof(float));
+        if (!file)
+            return false;
+        std::memcpy(file->data(), values.data(), values.size() * sizeof(float));
+        return true;
+    }
+
+    Prepared prepareStreaming(Inputs& inputs) {
+        Prepared prepared;
+        const size_t bytes = 3 * inputs.inA.size() * sizeof(float);
+        std::error_code error;
+        const std::filesystem::path temporary = std::filesystem::temp_directory_path(error);
+        if (error) {
+            prepared.skip = "no temporary directory: " + error.message();
+            return prepared;
+        }
+        const std::filesystem::space_info space = std::filesystem::space(temporary, error);
+        if (error || static_cast<double>(bytes) > inputs.options.memoryFraction * static_cast<double>(space.available)) {
+            prepared.skip = "needs " + mebibytes(bytes) + " of free space in " + temporary.string();
+            return prepared;
+        }
+
+        auto directory = std::make_shared<ScratchDirectory>();
+#if defined(__unix__) || defined(__APPLE__)
+        directory->path = temporary / ("hello_metal_benchmark_" + std::to_string(getpid()));
+#else
+        directory->path = temporary / "hello_metal_benchmark";
+#endif
+        std::filesystem::create_directories(directory->path, error);
+        const std::string pathA = (directory->path / "inA.f32").string();
+        const std::string pathB = (directory->path / "inB.f32").string();
+        const std::string outPath = (directory->path / "outC.f32").string();
+        if (error || !writeFloats(pathA, inputs.inA) || !writeFloats(pathB, inputs.inB)) {
+            prepared.skip = "could not write the input files in " + directory->path.string();
+            return prepared;
+        }
+
+        compute::ComputeSession* session = &inputs.session;
+        prepared.call = [directory, pathA, pathB, outPath, session](bool complexAddition) {
+            return ArrayAdder::addArraysStreaming(pathA, pathB, outPath, complexAddition, StreamingOptions(), *session);
+        };
+        const float* inA = inputs.inA.data();
+        const float* inB = inputs.inB.data();
+        const size_t n = inputs.inA.size();
+        prepared.check = [directory, outPath, inA, inB, n](ElementwiseOp op, std::string& note) {
+            std::unique_ptr<MappedFile> output = MappedFile::open(outPath);
+            if (!output || output->size() < n * sizeof(float)) {
+                note = "could not read " + outPath;
+                return false;
+            }
+            const float* outC = static_cast<const float*>(output->data());
+            return checkSamples<float, float>(inA, inB, [outC](size_t i) { return outC[i]; }, n, op, note);
+        };
+        return prepared;
+    }
+
+    const std::vector<Variant>& allVariants() {
+        static const std::vector<Variant> variants = [] {
+            std::vector<Variant> created;
+            created.push_back(floatVariant("cpu", [](Inputs& in, bool complexAddition) {
+                if (complexAddition)
+                    ArrayAdder::addArraysComplexCPU(in.inA, in.inB, in.outC);
+                else
+                    ArrayAdder::addArraysCPU(in.inA, in.inB, in.outC);
+            }));
+            created.push_back(floatVariant("cpu_parallel", [](Inputs& in, bool complexAddition) {
+                ArrayAdder::addArraysCPUParallel(in.inA, in.inB, in.outC, complexAddition);
+            }));
+
+            Variant gpu = floatVariant("gpu", [](Inputs& in, bool complexAddition) {
+                ArrayAdder::addArraysGPU(in.inA, in.inB, in.outC, complexAddition, in.session);
+            });
+            auto wholeVector = gpu.prepare;
+            gpu.prepare = [wholeVector](Inputs& in) {
+                if (in.inA.size() * sizeof(float) > in.session.device().maxBufferLength()) {
+                    Prepared prepared;
+                    prepared.skip = "vectors are larger than the device's maxBufferLength";
+                    return prepared;
+                }
+                return wholeVector(in);
+            };
+            created.push_back(gpu);
+
+            created.push_back(floatVariant("gpu_chunked", [](Inputs& in, bool complexAddition) {
+                ArrayAdder::addArraysGpuWithChunking(in.inA, in.inB, in.outC, complexAddition, true, in.session);
+            }));
+
+            Variant chunkedAsync;
+            chunkedAsync.name = "gpu_chunked_async";
+            chunkedAsync.elementType = ElementTraits<float>::suffix;
+            chunkedAsync.prepare = [](Inputs& in) {
+                auto adder = std::make_shared<ArrayAdder>(in.session);
+                adder->lengthVector = static_cast<long long>(in.inA.size());
+                Prepared prepared;
+                Inputs* inputs = &in;
+                prepared.call = [adder, inputs](bool complexAddition) {
+                    adder->addArraysGpuChunkingDynamicBufferAsync(inputs->inA, inputs->inB, inputs->outC, complexAddition, true);
+                    return true;
+                };
+                prepared.check = checkFloat(in.inA, in.inB, in.outC.data());
+                return prepared;
+            };
+            created.push_back(chunkedAsync);
+
+            // The future's vector is the output, so there is one extra float vector alive while outC is replaced
+            Variant async;
+            async.name = "async";
+            async.elementType = ElementTraits<float>::suffix;
+            async.extraBytesPerElement = sizeof(float);
+            async.prepare = [](Inputs& in) {
+                auto adder = std::make_shared<ArrayAdder>(in.session);
+                // Shared without copying; the vectors outlive every call
+                std::shared_ptr<const std::vector<float>> inA(&in.inA, [](const std::vector<float>*) {});
+                std::shared_ptr<const std::vector<float>> inB(&in.inB, [](const std::vector<float>*) {});
+                auto outC = std::make_shared<std::vector<float>>();
+                Prepared prepared;
+                prepared.call = [adder, inA, inB, outC](bool complexAddition) {
+                    *outC = adder->addArraysAsync(inA, inB, complexAddition).get();
+                    return outC->size() == inA->size();
+                };
+                const std::vector<float>* floatA = &in.inA;
+                const std::vector<float>* floatB = &in.inB;
+                prepared.check = [floatA, floatB, outC](ElementwiseOp op, std::string& note) {
+                    return checkFloat(*floatA, *floatB, outC->data())(op, note);
+                };
+                return prepared;
+            };
+            created.push_back(async);
+
+            Variant zeroCopy;
+            zeroCopy.name = "zero_copy";
+            zeroCopy.elementType = ElementTraits<float>::suffix;
+            zeroCopy.extraBytesPerElement = 3 * sizeof(float);
+            zeroCopy.prepare = [](Inputs& in) {
+                struct Vectors {
+                    PageAlignedVector<float> inA, inB, outC;
+                };
+                auto vectors = std::make_shared<Vectors>();
+                vectors->inA.assign(in.inA.begin(), in.inA.end());
+                vectors->inB.assign(in.inB.begin(), in.inB.end());
+                vectors->outC.resize(in.inA.size());
+                compute::ComputeSession* session = &in.session;
+                Prepared prepared;
+                prepared.call = [vectors, session](bool complexAddition) {
+                    return ArrayAdder::addArraysZeroCopy(vectors->inA, vectors->inB, vectors->outC, complexAddition, *session);
+                };
+                prepared.check = [vectors](ElementwiseOp op, std::string& note) {
+                    const float* outC = vectors->outC.data();
+                    return checkSamples<float, float>(vectors->inA.data(), vectors->inB.data(),
+                                                      [outC](size_t i) { return outC[i]; }, vectors->inA.size(), op, note);
+                };
+                return prepared;
+            };
+            created.push_back(zeroCopy);
+
+            created.push_back(floatVariant("heterogeneous", [](Inputs& in, bool complexAddition) {
+                ArrayAdder::addArraysHeterogeneous(in.inA, in.inB, in.outC, complexAddition, {&in.session});
+            }));
+
+            // The vectors cut into batchVectorLength pieces, each a separate item of the batch
+            for (const bool device : {false, true}) {
+                Variant batched;
+                batched.name = device ? "batched_gpu" : "batched_cpu";
+                batched.elementType = ElementTraits<float>::suffix;
+                batched.prepare = [device](Inputs& in) {
+                    auto batch = std::make_shared<VectorBatch>();
+                    const size_t length = std::max<size_t>(1, in.options.batchVectorLength);
+                    for (size_t start = 0; start < in.inA.size(); start += length) {
+                        batch->add(in.inA.data() + start, in.inB.data() + start, in.outC.data() + start,
+                                   std::min(length, in.inA.size() - start));
+                    }
+                    auto adder = std::make_shared<ArrayAdder>(in.session);
+                    Prepared prepared;
+                    prepared.call = [batch, adder, device](bool complexAddition) {
+                        if (device)
+                            return adder->addArraysBatchedGpu(*batch, complexAddition);
+                        ArrayAdder::addArraysBatchedCPU(*batch, complexAddition);
+                        return true;
+                    };
+                    prepared.check = checkFloat(in.inA, in.inB, in.outC.data());
+                    return prepared;
+                };
+                created.push_back(batched);
+            }
+
+            Variant streaming;
+            streaming.name = "streaming";
+            streaming.elementType = ElementTraits<float>::suffix;
+            streaming.runByDefault = false;
+            streaming.prepare = prepareStreaming;
+            created.push_back(streaming);
+
+            for (const bool device : {false, true}) {
+                created.push_back(typedVariant<double>(device));
+                created.push_back(typedVariant<int32_t>(device));
+                created.push_back(typedVariant<uint8_t>(device));
+                created.push_back(typedVariant<Half>(device));
+                created.push_back(typedVariant<BFloat16>(device));
+            }
+            return created;
+        }();
+        return variants;
+    }
+
+    void summarise(const std::vector<double>& seconds, Benchmark::Result& result) {
+        std::vector<double> sorted(seconds);
+        std::sort(sorted.begin(), sorted.end());
+        const size_t count = sorted.size();
+        result.repetitions = count;
+        result.medianSeconds = count % 2 ? sorted[count / 2] : 0.5 * (sorted[count / 2 - 1] + sorted[count / 2]);
+        // Nearest rank
+        const size_t rank = static_cast<size_t>(std::ceil(0.95 * static_cast<double>(count)));
+        result.p95Seconds = sorted[std::max<size_t>(rank, 1) - 1];
+        result.minSeconds = sorted.front();
+        double total = 0.0;
+        for (double value : sorted)
+            total += value;
+        result.meanSeconds = total / static_cast<double>(count);
+    }
+
+    // Quotes a CSV field if it needs it.
+    std::string csvField(const std::string& field) {
+        if (field.find_first_of(",\"\n") == std::string::npos)
+            return field;
+        std::string quoted = "\"";
+        for (char character : field) {
+            if (character == '"')
+                quoted += '"';
+            quoted += character;
+        }
+        return quoted + "\"";
+    }
+
+    std::string jsonString(const std::string& text) {
+        std::string escaped = "\"";
+        for (char character : text) {
+            switch (character) {
+                case '"': escaped += "\\\""; break;
+                case '\\': escaped += "\\\\"; break;
+                case '\n': escaped += "\\n"; break;
+                case '\t': escaped += "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(character) < 0x20) {
+                        char code[8];
+                        std::snprintf(code, sizeof(code), "\\u%04x", character);
+                        escaped += code;
+                    } else {
+                        escaped += character;
+                    }
+            }
+        }
+        return escaped + "\"";
+    }
+}
+
+std::vector<std::string> Benchmark::variantNames() {
+    std::vector<std::string> names;
+    for (const Variant& variant : allVariants())
+        names.push_back(variant.name);
+    return names;
+}
+
+std::vector<std::string> Benchmark::defaultVariants() {
+    std::vector<std::string> names;
+    for (const Variant& variant : allVariants()) {
+        if (variant.runByDefault)
+            names.push_back(variant.name);
+    }
+    return names;
+}
+
+double Benchmark::measurePeakBandwidth(ThreadPool& pool, size_t bytesPerArray, size_t repetitions) {
+    const size_t n = std::max<size_t>(bytesPerArray / sizeof(float), 1);
+    // Not value-initialised, so the pages are first touched by the threads that later stream them
+    std::unique_ptr<float[]> inA(new float[n]);
+    std::unique_ptr<float[]> inB(new float[n]);
+    std::unique_ptr<float[]> outC(new float[n]);
+    float* a = inA.get();
+    float* b = inB.get();
+    float* c = outC.get();
+    pool.parallelFor(n, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            a[i] = 1.0f;
+            b[i] = 2.0f;
+            c[i] = 0.0f;
+        }
+    });
+
+    double best = 0.0;
+    for (size_t repetition = 0; repetition < std::max<size_t>(repetitions, 1); ++repetition) {
+        const auto start = std::chrono::steady_clock::now();
+        pool.parallelFor(n, [=](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                c[i] = a[i] + b[i];
+        });
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() > 0.0 && (best == 0.0 || elapsed.count() < best))
+            best = elapsed.count();
+    }
+    return best > 0.0 ? 3.0 * static_cast<double>(n * sizeof(float)) / best / 1e9 : 0.0;
+}
+
+Benchmark::Report Benchmark::run(const Options& options) {
+    Report report;
+    report.backend = compute::backendName(session.device().backend());
+    report.device = session.device().name();
+    report.isa = SimdKernels::isaName(SimdKernels::active().isa);
+    report.hostThreads = ThreadPool::shared().threadCount();
+    report.warmup = options.warmup;
+
+    const size_t memoryBudget = static_cast<size_t>(options.memoryFraction * static_cast<double>(physicalMemoryBytes()));
+    report.peakGigabytesPerSecond = measurePeakBandwidth(ThreadPool::shared(), std::min(options.peakBytesPerArray, memoryBudget / 3));
+    if (options.verbose)
+        std::cerr << "Benchmark: " << report.backend << " (" << report.device << "), " << report.hostThreads << " host threads, "
+                  << report.isa << ", peak " << report.peakGigabytesPerSecond << " GB/s" << std::endl;
+
+    std::vector<const Variant*> selected;
+    for (const std::string& name : options.variants.empty() ? defaultVariants() : options.variants) {
+        auto found = std::find_if(allVariants().begin(), allVariants().end(), [&name](const Variant& variant) { return variant.name == name; });
+        if (found == allVariants().end())
+            std::cerr << "Benchmark: no variant called " << name << std::endl;
+        else
+            selected.push_back(&*found);
+    }
+
+    for (size_t size : options.sizes) {
+        const size_t sharedBytes = 3 * size * sizeof(float);
+        std::vector<float> inA, inB, outC;
+        if (sharedBytes <= memoryBudget) {
+            inA.resize(size);
+            inB.resize(size);
+            outC.resize(size);
+            // Fixed seed so every run and thread count benchmarks the same inputs
+            Philox(1, 0).fillUniform(inA.data(), inA.size());
+            Philox(1, 1).fillUniform(inB.data(), inB.size());
+        }
+        Inputs inputs{session, options, inA, inB, outC};
+
+        for (const Variant* variant : selected) {
+            std::vector<Result> results;
+            for (ElementwiseOp op : options.ops) {
+                Result result;
+                result.variant = variant->name;
+                result.kernel = elementwiseOpName(op);
+                result.elementType = variant->elementType;
+                result.size = size;
+                result.bytesPerElement = 3 * variant->elementSize;
+                results.push_back(result);
+            }
+
+            auto skipAll = [&results](const std::string& note) {
+                for (Result& result : results)
+                    result.note = note;
+            };
+            const size_t neededBytes = sharedBytes + size * variant->extraBytesPerElement;
+            Prepared prepared;
+            if (neededBytes > memoryBudget) {
+                skipAll("needs " + mebibytes(neededBytes) + ", more than the " + mebibytes(memoryBudget) +
+                        " allowed by memoryFraction");
+            } else {
+                try {
+                    prepared = variant->prepare(inputs);
+                    if (!prepared.skip.empty())
+                        skipAll(prepared.skip);
+                } catch (const std::exception& exception) {
+                    skipAll(std::string("setup failed: ") + exception.what());
+                    prepared.skip = "failed";
+                }
+            }
+
+            for (size_t i = 0; i < results.size(); ++i) {
+                Result& result = results[i];
+                const ElementwiseOp op = options.ops[i];
+                const bool complexAddition = op == ElementwiseOp::Complex;
+                const bool needsFloatingPoint = visitElementwiseOp(op, [](auto constant) {
+                    return ElementwiseTraits<decltype(constant)::value>::needsFloatingPoint;
+                });
+                if (neededBytes <= memoryBudget && prepared.skip.empty() && needsFloatingPoint && !variant->floatingPoint)
+                    result.note = result.kernel + " needs a floating-point compute type";
+
+                if (result.note.empty()) {
+                    std::vector<double> seconds;
+                    try {
+                        QuietStdout quiet;
+                        bool ran = true;
+                        for (size_t call = 0; call < options.warmup && ran; ++call)
+                            ran = prepared.call(complexAddition);
+
+                        double total = 0.0;
+                        while (ran && (seconds.size() < std::max<size_t>(options.repetitions, 1) ||
+                                       (total < options.minSeconds && seconds.size() < options.maxRepetitions))) {
+                            const auto start = std::chrono::steady_clock::now();
+                            ran = prepared.call(complexAddition);
+                            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                            seconds.push_back(elapsed.count());
+                            total += elapsed.count();
+                        }
+                        if (!ran)
+                            result.note = "the path reported an error (see std::cerr)";
+                    } catch (const std::exception& exception) {
+                        result.note = std::string("failed: ") + exception.what();
+                    }
+
+                    if (result.note.empty()) {
+                        summarise(seconds, result);
+                        if (result.medianSeconds > 0.0) {
+                            result.elementsPerSecond = static_cast<double>(size) / result.medianSeconds;
+                            result.gigabytesPerSecond = result.elementsPerSecond * static_cast<double>(result.bytesPerElement) / 1e9;
+                        }
+                        if (report.peakGigabytesPerSecond > 0.0)
+                            result.fractionOfPeak = result.gigabytesPerSecond / report.peakGigabytesPerSecond;
+                        result.status = prepared.check(op, result.note) ? Status::Ok : Status::Invalid;
+                    }
+                }
+
+                if (options.verbose) {
+                    std::cerr << "\t" << result.variant << " " << result.kernel << " n=" << size << ": ";
+                    if (result.status == Status::Skipped)
+                        std::cerr << "skipped (" << result.note << ")";
+                    else
+                        std::cerr << "median " << result.medianSeconds * 1e3 << " [ms], p95 " << result.p95Seconds * 1e3 << " [ms], "
+                                  << result.gigabytesPerSecond << " GB/s (" << 100.0 * result.fractionOfPeak << "% of peak)"
+                                  << (result.status == Status::Invalid ? ", INVALID: " + result.note : "");
+                    std::cerr << std::endl;
+                }
+                report.results.push_back(result);
+            }
+        }
+    }
+    return report;
+}
+
+const char* Benchmark::statusName(Status status) {
+    switch (status) {
+        case Status::Ok: return "ok";
+        case Status::Invalid: return "invalid";
+        case Status::Skipped: return "skipped";
+    }
+    return "unknown";
+}
+
+void Benchmark::writeJson(const Report& report, std::ostream& out) {
+    const std::streamsize precision = out.precision(9);
+    out << "{\n"
+        << "  \"backend\": " << jsonString(report.backend) << ",\n"
+        << "  \"device\": " << jsonString(report.device) << ",\n"
+        << "  \"isa\": " << jsonString(report.isa) << ",\n"
+        << "  \"hostThreads\": " << report.hostThreads << ",\n"
+        << "  \"warmup\": " << report.warmup << ",\n"
+        << "  \"peakGBps\": " << report.peakGigabytesPerSecond << ",\n"
+        << "  \"results\": [";
+    for (size_t i = 0; i < report.results.size(); ++i) {
+        const Result& result = report.results[i];
+        out << (i ? ",\n" : "\n")
+            << "    {\"variant\": " << jsonString(result.variant)
+            << ", \"kernel\": " << jsonString(result.kernel)
+            << ", \"elementType\": " << jsonString(result.elementType)
+            << ", \"size\": " << result.size
+            << ", \"bytesPerElement\": " << result.bytesPerElement
+            << ", \"status\": " << jsonString(statusName(result.status))
+            << ", \"repetitions\": " << result.repetitions
+            << ", \"medianSeconds\": " << result.medianSeconds
+            << ", \"p95Seconds\": " << result.p95Seconds
+            << ", \"minSeconds\": " << result.minSeconds
+            << ", \"meanSeconds\": " << result.meanSeconds
+            << ", \"elementsPerSecond\": " << result.elementsPerSecond
+            << ", \"GBps\": " << result.gigabytesPerSecond
+            << ", \"fractionOfPeak\": " << result.fractionOfPeak
+            << ", \"note\": " << jsonString(result.note) << "}";
+    }
+    out << (report.results.empty() ? "]\n" : "\n  ]\n") << "}\n";
+    out.precision(precision);
+}
+
+void Benchmark::writeCsv(const Report& report, std::ostream& out) {
+    const std::streamsize precision = out.precision(9);
+    out << "backend,device,isa,host_threads,peak_gbps,variant,kernel,element_type,size,bytes_per_element,status,repetitions,"
+           "median_s,p95_s,min_s,mean_s,elements_per_s,gbps,fraction_of_peak,note\n";
+    for (const Result& result : report.results) {
+        out << csvField(report.backend) << ',' << csvField(report.device) << ',' << csvField(report.isa) << ','
+            << report.hostThreads << ',' << report.peakGigabytesPerSecond << ','
+            << csvField(result.variant) << ',' << csvField(result.kernel) << ',' << csvField(result.elementType) << ','
+            << result.size << ',' << result.bytesPerElement << ',' << statusName(result.status) << ',' << result.repetitions << ','
+            << result.medianSeconds << ',' << result.p95Seconds << ',' << result.minSeconds << ',' << result.meanSeconds << ','
+            << result.elementsPerSecond << ',' << result.gigabytesPerSecond << ',' << result.fractionOfPeak << ','
+            << csvField(result.note) << '\n';
+    }
+    out.precision(precision);
+}
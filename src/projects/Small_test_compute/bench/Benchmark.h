@@ -0,0 +1,99 @@
+//
+// Benchmark.h
+//
+
+#ifndef HELLO_METAL_BENCHMARK_H
+#define HELLO_METAL_BENCHMARK_H
+
+#include "../cpu/ThreadPool.h"
+#include "../device/ComputeSession.h"
+#include "../types/ElementwiseOp.h"
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Throughput of the ArrayAdder paths. For each vector size, element-wise operation and variant (one per ArrayAdder
+// entry point, plus the typed ones per element type), there are warm-up calls and then at least `repetitions` timed
+// calls, repeated until minSeconds have passed. The median and p95 are reported as elements/s and GB/s, and GB/s is
+// also given as a fraction of the host's measured peak memory bandwidth.
+//
+// Bytes are counted STREAM-style: the two inputs are read and the output is written, so 3 * sizeof(element) per
+// element. The peak is the best STREAM "add" (c = a + b over the shared ThreadPool) on arrays well outside the caches,
+// so it uses the same convention; vectors that fit in cache can come out above 1.
+// The "GPU" variants run on the session's device. On a machine without Metal that is the CPU backend, so the suite
+// also runs on Linux.
+//
+// Every timed call goes through the public ArrayAdder API, including the timers it prints (which are swallowed). A
+// sample of each output is checked against ElementwiseTraits afterwards, so a fast but wrong path shows up as
+// "invalid" rather than as a result.
+class Benchmark {
+public:
+    struct Options {
+        std::vector<size_t> sizes = {1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+        std::vector<std::string> variants; // Empty runs defaultVariants()
+        std::vector<ElementwiseOp> ops = {ElementwiseOp::Add, ElementwiseOp::Complex};
+        size_t warmup = 1;
+        size_t repetitions = 5;          // Minimum number of timed calls
+        size_t maxRepetitions = 1000;
+        double minSeconds = 0.1;         // Keep timing until this much time has passed (or maxRepetitions)
+        size_t batchVectorLength = 4096; // Vector length used by the batched variants
+        size_t peakBytesPerArray = size_t(256) << 20;
+        // Vectors that would need more than this fraction of physical memory (or free disk space, for streaming) are
+        // skipped rather than swapped.
+        double memoryFraction = 0.5;
+        bool verbose = true; // Progress on std::cerr
+    };
+
+    enum class Status { Ok, Invalid, Skipped };
+
+    struct Result {
+        std::string variant;
+        std::string kernel;      // add_arrays, complex_operation
+        std::string elementType; // Suffix from ElementTraits (f32, f16, ...)
+        size_t size = 0;
+        size_t bytesPerElement = 0; // Counted per element: two reads and a write
+        Status status = Status::Skipped;
+        std::string note;           // Why a result was skipped or invalid
+        size_t repetitions = 0;
+        double medianSeconds = 0.0;
+        double p95Seconds = 0.0;
+        double minSeconds = 0.0;
+        double meanSeconds = 0.0;
+        double elementsPerSecond = 0.0; // At the median
+        double gigabytesPerSecond = 0.0;
+        double fractionOfPeak = 0.0;
+    };
+
+    struct Report {
+        std::string backend;
+        std::string device;
+        std::string isa;
+        size_t hostThreads = 0;
+        size_t warmup = 0;
+        double peakGigabytesPerSecond = 0.0;
+        std::vector<Result> results;
+    };
+
+    explicit Benchmark(compute::ComputeSession& session = compute::ComputeSession::shared()) : session(session) {}
+
+    Report run(const Options& options);
+
+    // Every variant, and the ones run when Options::variants is empty. streaming is the only variant left out of the
+    // defaults, because it writes three files as large as the vectors to the temporary directory.
+    static std::vector<std::string> variantNames();
+    static std::vector<std::string> defaultVariants();
+
+    // Best STREAM "add" bandwidth in GB/s over three arrays of bytesPerArray, run on pool.
+    static double measurePeakBandwidth(ThreadPool& pool, size_t bytesPerArray, size_t repetitions = 5);
+
+    static const char* statusName(Status status);
+    static void writeJson(const Report& report, std::ostream& out);
+    static void writeCsv(const Report& report, std::ostream& out);
+
+private:
+    compute::ComputeSession& session;
+};
+
+#endif //HELLO_METAL_BENCHMARK_H
@@ -0,0 +1,171 @@
+//
+// BenchmarkMain.cpp
+//
+// small_test_compute_benchmark: runs Benchmark and writes the report as JSON or CSV. Progress goes to std::cerr, so
+// stdout only holds the report. The device is picked as everywhere else (HELLO_METAL_COMPUTE_BACKEND=cpu forces the
+// CPU backend).
+//
+
+#include "Benchmark.h"
+#include "../ArrayAdder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+    void printUsage(const char* program) {
+        std::cerr << "Usage: " << program << " [options]\n"
+                  << "\t--sizes N,N,...       vector sizes (1e3 style accepted); default 1e3,1e4,...,1e9\n"
+                  << "\t--max-size N          drop sizes above N\n"
+                  << "\t--variants a,b,...    variants to run (see --list); default all but streaming\n"
+                  << "\t--ops a,b             add_arrays, complex_operation; default both\n"
+                  << "\t--warmup N            untimed calls before timing; default 1\n"
+                  << "\t--repetitions N       minimum timed calls; default 5\n"
+                  << "\t--min-time S          keep timing until S seconds have passed; default 0.1\n"
+                  << "\t--threads N           host threads (0 = all); default all\n"
+                  << "\t--batch-length N      vector length for the batched variants; default 4096\n"
+                  << "\t--memory-fraction F   skip sizes needing more than F of physical memory; default 0.5\n"
+                  << "\t--format json|csv     report format; default json\n"
+                  << "\t--output PATH         write the report to PATH instead of stdout\n"
+                  << "\t--quiet               no progress on stderr\n"
+                  << "\t--list                print the variants and exit\n";
+    }
+
+    std::vector<std::string> splitList(const std::string& list) {
+        std::vector<std::string> items;
+        std::istringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            if (!item.empty())
+                items.push_back(item);
+        }
+        return items;
+    }
+
+    // Accepts 1000 as well as 1e3.
+    bool parseSize(const std::string& text, size_t& value) {
+        char* end = nullptr;
+        const double parsed = std::strtod(text.c_str(), &end);
+        if (end == text.c_str() || *end != '\0' || !(parsed >= 0.0))
+            return false;
+        value = static_cast<size_t>(parsed + 0.5);
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    Benchmark::Options options;
+    size_t maxSize = 0;
+    std::string format = "json";
+    std::string outputPath;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << argument << " needs a value" << std::endl;
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        auto sizeValue = [&]() -> size_t {
+            const std::string text = value();
+            size_t parsed = 0;
+            if (!parseSize(text, parsed)) {
+                std::cerr << argument << ": not a number: " << text << std::endl;
+                std::exit(2);
+            }
+            return parsed;
+        };
+
+        if (argument == "--sizes") {
+            options.sizes.clear();
+            for (const std::string& item : splitList(value())) {
+                size_t size = 0;
+                if (!parseSize(item, size) || size == 0) {
+                    std::cerr << "--sizes: not a size: " << item << std::endl;
+                    return 2;
+                }
+                options.sizes.push_back(size);
+            }
+        } else if (argument == "--max-size") {
+            maxSize = sizeValue();
+        } else if (argument == "--variants") {
+            options.variants = splitList(value());
+        } else if (argument == "--ops") {
+            options.ops.clear();
+            for (const std::string& item : splitList(value())) {
+                ElementwiseOp op;
+                if (!parseElementwiseOp(item, op)) {
+                    std::cerr << "--ops: unknown operation " << item << std::endl;
+                    return 2;
+                }
+                options.ops.push_back(op);
+            }
+        } else if (argument == "--warmup") {
+            options.warmup = sizeValue();
+        } else if (argument == "--repetitions") {
+            options.repetitions = sizeValue();
+        } else if (argument == "--min-time") {
+            options.minSeconds = std::atof(value().c_str());
+        } else if (argument == "--threads") {
+            ArrayAdder::setCpuThreadCount(sizeValue());
+        } else if (argument == "--batch-length") {
+            options.batchVectorLength = sizeValue();
+        } else if (argument == "--memory-fraction") {
+            options.memoryFraction = std::atof(value().c_str());
+        } else if (argument == "--format") {
+            format = value();
+            if (format != "json" && format != "csv") {
+                std::cerr << "--format must be json or csv" << std::endl;
+                return 2;
+            }
+        } else if (argument == "--output") {
+            outputPath = value();
+        } else if (argument == "--quiet") {
+            options.verbose = false;
+        } else if (argument == "--list") {
+            const std::vector<std::string> defaults = Benchmark::defaultVariants();
+            for (const std::string& name : Benchmark::variantNames()) {
+                const bool byDefault = std::find(defaults.begin(), defaults.end(), name) != defaults.end();
+                std::cout << name << (byDefault ? "" : " (not run by default)") << "\n";
+            }
+            return 0;
+        } else if (argument == "--help" || argument == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else {
+            std::cerr << "Unknown option " << argument << std::endl;
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (maxSize > 0) {
+        options.sizes.erase(std::remove_if(options.sizes.begin(), options.sizes.end(), [maxSize](size_t size) { return size > maxSize; }),
+                            options.sizes.end());
+    }
+
+    Benchmark benchmark;
+    const Benchmark::Report report = benchmark.run(options);
+
+    std::ofstream file;
+    if (!outputPath.empty()) {
+        file.open(outputPath, std::ios::trunc);
+        if (!file) {
+            std::cerr << "Cannot write " << outputPath << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = outputPath.empty() ? std::cout : file;
+    if (format == "csv")
+        Benchmark::writeCsv(report, out);
+    else
+        Benchmark::writeJson(report, out);
+    return out ? 0 : 1;
+}
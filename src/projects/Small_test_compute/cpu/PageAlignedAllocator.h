@@ -0,0 +1,61 @@
+//
+// PageAlignedAllocator.h
+//
+
+#ifndef HELLO_METAL_PAGEALIGNEDALLOCATOR_H
+#define HELLO_METAL_PAGEALIGNEDALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+// Virtual-memory page size (16 KiB on Apple silicon, usually 4 KiB on x86 Linux).
+inline size_t pageSize() {
+#if defined(_SC_PAGESIZE)
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+#else
+    return 4096;
+#endif
+}
+
+inline size_t roundUpToPageSize(size_t bytes) {
+    const size_t page = pageSize();
+    return (bytes + page - 1) / page * page;
+}
+
+// Allocates whole pages starting on a page boundary. That is what newBufferWithBytesNoCopy needs, so memory from this
+// allocator can be handed to the device directly instead of being staged through a copy.
+template<typename T>
+class PageAlignedAllocator {
+public:
+    using value_type = T;
+
+    PageAlignedAllocator() noexcept = default;
+    template<typename U>
+    PageAlignedAllocator(const PageAlignedAllocator<U>&) noexcept {}
+
+    T* allocate(size_t count) {
+        const size_t bytes = roundUpToPageSize(count * sizeof(T));
+        return static_cast<T*>(::operator new(bytes, std::align_val_t(pageSize())));
+    }
+
+    void deallocate(T* pointer, size_t) noexcept {
+        ::operator delete(pointer, std::align_val_t(pageSize()));
+    }
+
+    template<typename U>
+    bool operator==(const PageAlignedAllocator<U>&) const noexcept { return true; }
+    template<typename U>
+    bool operator!=(const PageAlignedAllocator<U>&) const noexcept { return false; }
+};
+
+// Drop-in replacement for std::vector whose storage can be wrapped as a device buffer without copying.
+template<typename T>
+using PageAlignedVector = std::vector<T, PageAlignedAllocator<T>>;
+
+#endif //HELLO_METAL_PAGEALIGNEDALLOCATOR_H
@@ -0,0 +1,266 @@
+//
+// SimdKernels.cpp
+//
+
+#include "SimdKernelsInternal.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+using namespace SimdKernelsDetail;
+
+namespace {
+    void scalarAddArrays(const float* inA, const float* inB, float* outC, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            outC[i] = inA[i] + inB[i];
+    }
+
+    void scalarComplexOperation(const float* inA, const float* inB, float* outC, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            outC[i] = std::sin(inA[i] * inB[i]) + inA[i];
+    }
+
+    void scalarSubtract(const float* inA, const float* inB, float* outC, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            outC[i] = inA[i] - inB[i];
+    }
+
+    void scalarMultiply(const float* inA, const float* inB, float* outC, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            outC[i] = inA[i] * inB[i];
+    }
+
+    void scalarDivide(const float* inA, const float* inB, float* outC, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            outC[i] = inA[i] / inB[i];
+    }
+
+    void scalarSin(const float* in, float* out, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            out[i] = std::sin(in[i]);
+    }
+
+    void scalarFill(float value, float* out, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            out[i] = value;
+    }
+
+    float scalarSum(const float* in, size_t n) {
+        float total = 0.0f;
+        for (size_t i = 0; i < n; i++)
+            total += in[i];
+        return total;
+    }
+
+    float scalarMinimum(const float* in, size_t n) {
+        float result = INFINITY;
+        for (size_t i = 0; i < n; i++)
+            result = in[i] < result ? in[i] : result;
+        return result;
+    }
+
+    float scalarMaximum(const float* in, size_t n) {
+        float result = -INFINITY;
+        for (size_t i = 0; i < n; i++)
+            result = in[i] > result ? in[i] : result;
+        return result;
+    }
+
+    float scalarDot(const float* inA, const float* inB, size_t n) {
+        float total = 0.0f;
+        for (size_t i = 0; i < n; i++)
+            total += inA[i] * inB[i];
+        return total;
+    }
+
+    float scalarSumOfSquares(const float* in, size_t n) {
+        float total = 0.0f;
+        for (size_t i = 0; i < n; i++)
+            total += in[i] * in[i];
+        return total;
+    }
+
+    void scalarSumFixed(const float* inA, const float* inB, size_t n, float* sum, float* compensation) {
+        float lanes[fixedLanes] = {};
+        float corrections[fixedLanes] = {};
+        finishFixedSum(inA, inB, 0, n, lanes, corrections, sum, compensation);
+    }
+
+    void scalarCompareUlp(const float* expected, const float* actual, size_t n, uint32_t tolerance, UlpComparison* result) {
+        *result = UlpComparison();
+        finishCompareUlp(expected, actual, 0, n, tolerance, result);
+    }
+
+    const SimdKernelTable scalarKernels = {
+            SimdIsa::Scalar,
+            scalarAddArrays,
+            scalarComplexOperation,
+            scalarSubtract,
+            scalarMultiply,
+            scalarDivide,
+            scalarSin,
+            scalarFill,
+            scalarSum,
+            scalarMinimum,
+            scalarMaximum,
+            scalarDot,
+            scalarSumOfSquares,
+            scalarSumFixed,
+            scalarHalfToFloat,
+            scalarFloatToHalf,
+            scalarBfloat16ToFloat,
+            scalarFloatToBfloat16,
+            scalarCompareUlp,
+            scalarPhilox,
+    };
+
+#if defined(__x86_64__) || defined(__i386__)
+    // Reads XCR0 so we only pick AVX kernels when the OS saves the wider registers on context switches.
+    uint64_t readXcr0() {
+        uint32_t eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return (static_cast<uint64_t>(edx) << 32) | eax;
+    }
+
+    struct X86Features {
+        bool sse42 = false;
+        bool avx2 = false;
+        bool avx512 = false;
+    };
+
+    X86Features queryX86Features() {
+        X86Features features;
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return features;
+
+        features.sse42 = (ecx & bit_SSE4_2) != 0;
+        const bool osxsave = (ecx & bit_OSXSAVE) != 0;
+        const bool fma = (ecx & bit_FMA) != 0;
+        const bool f16c = (ecx & bit_F16C) != 0;
+        if (!osxsave)
+            return features;
+
+        const uint64_t xcr0 = readXcr0();
+        const bool osSavesYmm = (xcr0 & 0x6) == 0x6;
+        const bool osSavesZmm = (xcr0 & 0xe6) == 0xe6;
+
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            return features;
+
+        features.avx2 = osSavesYmm && fma && f16c && (ebx & bit_AVX2) != 0;
+        features.avx512 = osSavesZmm && features.avx2 && (ebx & bit_AVX512F) != 0;
+        return features;
+    }
+#endif
+
+    const SimdKernelTable* tableFor(SimdIsa isa) {
+        switch (isa) {
+            case SimdIsa::Scalar: return SimdKernelsDetail::scalarTable();
+            case SimdIsa::Sse42: return SimdKernelsDetail::sse42Table();
+            case SimdIsa::Avx2: return SimdKernelsDetail::avx2Table();
+            case SimdIsa::Avx512: return SimdKernelsDetail::avx512Table();
+            case SimdIsa::Neon: return SimdKernelsDetail::neonTable();
+        }
+        return nullptr;
+    }
+
+    const SimdKernelTable* initialTable() {
+        if (const char* requested = std::getenv("HELLO_METAL_SIMD_ISA")) {
+            SimdIsa isa;
+            if (SimdKernels::parseIsa(requested, isa) && SimdKernels::isSupported(isa))
+                return tableFor(isa);
+        }
+        return tableFor(SimdKernels::detect());
+    }
+
+    std::atomic<const SimdKernelTable*> activeTable{nullptr};
+}
+
+const SimdKernelTable* SimdKernelsDetail::scalarTable() {
+    return &scalarKernels;
+}
+
+const SimdKernelTable& SimdKernels::active() {
+    const SimdKernelTable* current = activeTable.load(std::memory_order_acquire);
+    if (!current) {
+        const SimdKernelTable* chosen = initialTable();
+        // Another thread may have raced us here or called forceIsa; keep whichever got in first.
+        if (!activeTable.compare_exchange_strong(current, chosen, std::memory_order_acq_rel))
+            return *current;
+        current = chosen;
+    }
+    return *current;
+}
+
+SimdIsa SimdKernels::detect() {
+    for (SimdIsa isa : {SimdIsa::Avx512, SimdIsa::Avx2, SimdIsa::Neon, SimdIsa::Sse42}) {
+        if (isSupported(isa))
+            return isa;
+    }
+    return SimdIsa::Scalar;
+}
+
+bool SimdKernels::isSupported(SimdIsa isa) {
+    if (!tableFor(isa))
+        return false;
+
+#if defined(__x86_64__) || defined(__i386__)
+    static const X86Features features = queryX86Features();
+    switch (isa) {
+        case SimdIsa::Sse42: return features.sse42;
+        case SimdIsa::Avx2: return features.avx2;
+        case SimdIsa::Avx512: return features.avx512;
+        default: break;
+    }
+#endif
+    // Scalar always works; NEON is part of the AArch64 baseline, so having its table compiled in is enough.
+    return true;
+}
+
+void SimdKernels::forceIsa(SimdIsa isa) {
+    if (!isSupported(isa))
+        throw std::invalid_argument(std::string("SIMD instruction set not supported on this CPU: ") + isaName(isa));
+    activeTable.store(tableFor(isa), std::memory_order_release);
+}
+
+void SimdKernels::resetIsa() {
+    activeTable.store(tableFor(detect()), std::memory_order_release);
+}
+
+const SimdKernelTable& SimdKernels::table(SimdIsa isa) {
+    const SimdKernelTable* kernels = tableFor(isa);
+    if (!kernels)
+        throw std::invalid_argument(std::string("SIMD instruction set not compiled into this binary: ") + isaName(isa));
+    return *kernels;
+}
+
+uint32_t SimdKernels::ulpDistance(float a, float b) {
+    return SimdKernelsDetail::ulpDistance(a, b);
+}
+
+const char* SimdKernels::isaName(SimdIsa isa) {
+    switch (isa) {
+        case SimdIsa::Scalar: return "scalar";
+        case SimdIsa::Sse42: return "sse4.2";
+        case SimdIsa::Avx2: return "avx2";
+        case SimdIsa::Avx512: return "avx512";
+        case SimdIsa::Neon: return "neon";
+    }
+    return "unknown";
+}
+
+bool SimdKernels::parseIsa(const std::string& name, SimdIsa& isa) {
+    for (SimdIsa candidate : {SimdIsa::Scalar, SimdIsa::Sse42, SimdIsa::Avx2, SimdIsa::Avx512, SimdIsa::Neon}) {
+        if (name == isaName(candidate)) {
+            isa = candidate;
+            return true;
+        }
+    }
+    return false;
+}
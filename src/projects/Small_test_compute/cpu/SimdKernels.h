@@ -0,0 +1,91 @@
+//
+// SimdKernels.h
+//
+
+#ifndef HELLO_METAL_SIMDKERNELS_H
+#define HELLO_METAL_SIMDKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Instruction sets the CPU kernels are written for. Order matters: later entries are preferred when supported.
+enum class SimdIsa { Scalar, Sse42, Neon, Avx2, Avx512 };
+
+// Summary of comparing two float arrays in units in the last place (see SimdKernelTable::compareUlp).
+struct UlpComparison {
+    uint64_t sumUlps = 0;
+    uint32_t maxUlps = 0;
+    uint64_t outside = 0; // Elements further apart than the tolerance
+};
+
+// One set of element-wise kernels, all compiled for the same instruction set. Every function processes n elements;
+// pointers need no particular alignment and outputs may alias inputs.
+struct SimdKernelTable {
+    SimdIsa isa;
+
+    // Mirrors of the kernels in addition.metal
+    void (*addArrays)(const float* inA, const float* inB, float* outC, size_t n);
+    void (*complexOperation)(const float* inA, const float* inB, float* outC, size_t n);
+
+    // Building blocks for composed expressions
+    void (*subtract)(const float* inA, const float* inB, float* outC, size_t n);
+    void (*multiply)(const float* inA, const float* inB, float* outC, size_t n);
+    void (*divide)(const float* inA, const float* inB, float* outC, size_t n);
+    void (*sin)(const float* in, float* out, size_t n);
+    void (*fill)(float value, float* out, size_t n);
+
+    // Reductions. Several vector accumulators are used, so additions happen in a different order than a sequential
+    // loop; keep n moderate (Reduction.h folds blocks of these results in double). An empty range gives the identity
+    // (0, +inf or -inf). Results for inputs containing NaN are unspecified.
+    float (*sum)(const float* in, size_t n);
+    float (*minimum)(const float* in, size_t n);
+    float (*maximum)(const float* in, size_t n);
+    float (*dot)(const float* inA, const float* inB, size_t n);
+    float (*sumOfSquares)(const float* in, size_t n);
+
+    // Fixed-shape sum for the deterministic reductions: element i goes into lane i % 32 in index order, then the 32
+    // lanes are folded pairwise (lane l takes lane l + 16, then l + 8, ...). Products are not fused, so every ISA
+    // returns the same bits. Sums inA[i] * inB[i] when inB is not null. When compensation is not null each lane also
+    // keeps a Neumaier correction term, folded the same way, and the correction is returned there.
+    void (*sumFixed)(const float* inA, const float* inB, size_t n, float* sum, float* compensation);
+
+    // Conversions for 16-bit float storage (Half and BFloat16 in ElementTypes.h), rounding to nearest even. Used by
+    // the typed kernels to widen blocks of 16-bit data to float and back.
+    void (*halfToFloat)(const uint16_t* in, float* out, size_t n);
+    void (*floatToHalf)(const float* in, uint16_t* out, size_t n);
+    void (*bfloat16ToFloat)(const uint16_t* in, float* out, size_t n);
+    void (*floatToBfloat16)(const float* in, uint16_t* out, size_t n);
+
+    // Distance between expected[i] and actual[i] in ULPs (SimdKernelsDetail::ulpDistance), summed, maxed and counted
+    // against tolerance over n elements. Used by ResultVerifier.
+    void (*compareUlp)(const float* expected, const float* actual, size_t n, uint32_t tolerance, UlpComparison* result);
+
+    // Philox4x32-10 blocks firstBlock to firstBlock + blocks - 1 for (key, stream), four words each, written in block
+    // order. Every ISA gives the same words (SimdKernelsDetail::philoxBlock). Used by Philox.
+    void (*philox)(uint64_t key, uint64_t stream, uint64_t firstBlock, uint32_t* out, size_t blocks);
+};
+
+class SimdKernels {
+public:
+    // Kernels for the active instruction set. Chosen from CPUID on first use unless forced.
+    static const SimdKernelTable& active();
+
+    // Best instruction set this CPU (and OS) can run.
+    static SimdIsa detect();
+    static bool isSupported(SimdIsa isa);
+
+    // Pins the kernels to one instruction set, e.g. to compare results between ISAs. Throws std::invalid_argument if
+    // the CPU cannot run it. The HELLO_METAL_SIMD_ISA environment variable ("scalar", "sse4.2", "avx2", "avx512",
+    // "neon") does the same at start-up.
+    static void forceIsa(SimdIsa isa);
+    static void resetIsa();
+
+    static const SimdKernelTable& table(SimdIsa isa);
+    // The per-element rule SimdKernelTable::compareUlp follows.
+    static uint32_t ulpDistance(float a, float b);
+    static const char* isaName(SimdIsa isa);
+    static bool parseIsa(const std::string& name, SimdIsa& isa);
+};
+
+#endif //HELLO_METAL_SIMDKERNELS_H
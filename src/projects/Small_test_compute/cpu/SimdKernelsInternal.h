@@ -0,0 +1,208 @@
+//
+// SimdKernelsInternal.h
+//
+// Shared between the per-ISA kernel translation units. Not part of the public interface.
+//
+
+#ifndef HELLO_METAL_SIMDKERNELSINTERNAL_H
+#define HELLO_METAL_SIMDKERNELSINTERNAL_H
+
+#include "SimdKernels.h"
+#include "../types/ElementTypes.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace SimdKernelsDetail {
+    // sin(x) is computed as (-1)^q * P(r) with q = rint(x / pi) and r = x - q * pi. pi is split into four parts so the
+    // reduction stays exact for |x| < sinReductionLimit; larger lanes are handed back to std::sin. The polynomial is a
+    // minimax fit on [-pi/2, pi/2] and is accurate to about 3.5 ULP.
+    constexpr float sinReductionLimit = 39000.0f;
+    constexpr float invPi = 0.318309886183790671538f;
+    constexpr float piA = 3.140625f;
+    constexpr float piB = 0.0009670257568359375f;
+    constexpr float piC = 6.2771141529083251953e-07f;
+    constexpr float piD = 1.2154201256553420762e-10f;
+    constexpr float sinC9 = 2.6083159809786593541503e-06f;
+    constexpr float sinC7 = -0.0001981069071916863322258f;
+    constexpr float sinC5 = 0.00833307858556509017944336f;
+    constexpr float sinC3 = -0.166666597127914428710938f;
+
+    // Scalar form of the vector algorithm without fused multiply-adds, used for the SSE loop tails so every element of
+    // a call sees the same maths. The FMA kernels (AVX2, AVX-512, NEON) would round differently through it, so they
+    // run their tails through the vector code instead (masked or zero-padded) and only call std::sin for lanes outside
+    // the reduction range.
+    inline float polynomialSin(float x) {
+        if (!(std::fabs(x) < sinReductionLimit))
+            return std::sin(x);
+        // The reduction computes -0 - (-0 * pi) = +0; sin(-0) is -0, as std::sin gives
+        if (x == 0.0f)
+            return x;
+
+        const float q = std::nearbyint(x * invPi);
+        float r = x - q * piA;
+        r = r - q * piB;
+        r = r - q * piC;
+        r = r - q * piD;
+
+        const float s = r * r;
+        if (static_cast<int32_t>(q) & 1)
+            r = -r;
+
+        float u = sinC9;
+        u = u * s + sinC7;
+        u = u * s + sinC5;
+        u = u * s + sinC3;
+        return s * (u * r) + r;
+    }
+
+    // Scalar combines used for reduction tails and horizontal folds. Same selection rule as the vector min/max.
+    inline float reduceAdd(float a, float b) { return a + b; }
+    inline float reduceMin(float a, float b) { return b < a ? b : a; }
+    inline float reduceMax(float a, float b) { return b > a ? b : a; }
+
+    // Fixed-shape reduction (SimdKernelTable::sumFixed). Each ISA accumulates whole groups of fixedLanes elements into
+    // its registers; these helpers hold the scalar rules that the vector code must match bit for bit.
+    constexpr size_t fixedLanes = 32;
+
+    // Neumaier step: the correction picks up the low bits lost when adding x to s.
+    inline void neumaierAdd(float& s, float& c, float x) {
+        const float t = s + x;
+        if (std::fabs(s) >= std::fabs(x))
+            c += (s - t) + x;
+        else
+            c += (x - t) + s;
+        s = t;
+    }
+
+    // Adds elements [begin, n) into their lanes, then folds the lanes pairwise into *sum (and *compensation).
+    inline void finishFixedSum(const float* inA, const float* inB, size_t begin, size_t n,
+                               float* lanes, float* corrections, float* sum, float* compensation) {
+        for (size_t i = begin; i < n; i++) {
+            const float x = inB ? inA[i] * inB[i] : inA[i];
+            if (compensation)
+                neumaierAdd(lanes[i % fixedLanes], corrections[i % fixedLanes], x);
+            else
+                lanes[i % fixedLanes] += x;
+        }
+
+        for (size_t width = fixedLanes / 2; width > 0; width /= 2) {
+            for (size_t l = 0; l < width; l++) {
+                if (compensation) {
+                    neumaierAdd(lanes[l], corrections[l], lanes[l + width]);
+                    corrections[l] += corrections[l + width];
+                } else {
+                    lanes[l] += lanes[l + width];
+                }
+            }
+        }
+
+        *sum = lanes[0];
+        if (compensation)
+            *compensation = corrections[0];
+    }
+
+    // Scalar 16-bit float conversions, for ISAs without a vector form and for loop tails.
+    inline void scalarHalfToFloat(const uint16_t* in, float* out, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            out[i] = halfBitsToFloat(in[i]);
+    }
+
+    inline void scalarFloatToHalf(const float* in, uint16_t* out, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            out[i] = floatToHalfBits(in[i]);
+    }
+
+    inline void scalarBfloat16ToFloat(const uint16_t* in, float* out, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            out[i] = bfloat16BitsToFloat(in[i]);
+    }
+
+    inline void scalarFloatToBfloat16(const float* in, uint16_t* out, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            out[i] = floatToBfloat16Bits(in[i]);
+    }
+
+    // ULP distance: how many floats lie between a and b, counting +0 and -0 as one value. The vector kernels map the
+    // bits to orderedFloatBits, which is monotonic in the float's value, and take the difference. Two NaNs are equal;
+    // a NaN against a number is as far apart as it gets.
+    inline int32_t orderedFloatBits(float x) {
+        uint32_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        const int32_t magnitude = static_cast<int32_t>(bits & 0x7FFFFFFFu);
+        return (bits >> 31) ? -magnitude : magnitude;
+    }
+
+    inline uint32_t ulpDistance(float a, float b) {
+        const bool nanA = a != a;
+        const bool nanB = b != b;
+        if (nanA || nanB)
+            return nanA && nanB ? 0 : UINT32_MAX;
+        const int32_t orderedA = orderedFloatBits(a);
+        const int32_t orderedB = orderedFloatBits(b);
+        return orderedA > orderedB ? static_cast<uint32_t>(orderedA) - static_cast<uint32_t>(orderedB)
+                                   : static_cast<uint32_t>(orderedB) - static_cast<uint32_t>(orderedA);
+    }
+
+    // Adds elements [begin, n) to result, for loop tails and the scalar table.
+    inline void finishCompareUlp(const float* expected, const float* actual, size_t begin, size_t n, uint32_t tolerance,
+                                 UlpComparison* result) {
+        for (size_t i = begin; i < n; i++) {
+            const uint32_t distance = ulpDistance(expected[i], actual[i]);
+            result->sumUlps += distance;
+            result->maxUlps = distance > result->maxUlps ? distance : result->maxUlps;
+            result->outside += distance > tolerance;
+        }
+    }
+
+    // Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC11). The 128-bit counter is the
+    // block index in words 0-1 and the stream in words 2-3; the seed is the 64-bit key. Each round multiplies words 0
+    // and 2 into 64-bit products and mixes their halves with words 1 and 3 and the key, which is bumped by the Weyl
+    // constants between rounds. The vector kernels run the same rounds with one block per lane.
+    constexpr uint32_t philoxM0 = 0xD2511F53;
+    constexpr uint32_t philoxM1 = 0xCD9E8D57;
+    constexpr uint32_t philoxW0 = 0x9E3779B9;
+    constexpr uint32_t philoxW1 = 0xBB67AE85;
+    constexpr int philoxRounds = 10;
+
+    inline void philoxBlock(uint64_t key, uint64_t stream, uint64_t counter, uint32_t* out) {
+        uint32_t c0 = static_cast<uint32_t>(counter);
+        uint32_t c1 = static_cast<uint32_t>(counter >> 32);
+        uint32_t c2 = static_cast<uint32_t>(stream);
+        uint32_t c3 = static_cast<uint32_t>(stream >> 32);
+        uint32_t k0 = static_cast<uint32_t>(key);
+        uint32_t k1 = static_cast<uint32_t>(key >> 32);
+        for (int round = 0; round < philoxRounds; round++) {
+            if (round > 0) {
+                k0 += philoxW0;
+                k1 += philoxW1;
+            }
+            const uint64_t product0 = static_cast<uint64_t>(philoxM0) * c0;
+            const uint64_t product1 = static_cast<uint64_t>(philoxM1) * c2;
+            c0 = static_cast<uint32_t>(product1 >> 32) ^ c1 ^ k0;
+            c2 = static_cast<uint32_t>(product0 >> 32) ^ c3 ^ k1;
+            c1 = static_cast<uint32_t>(product1);
+            c3 = static_cast<uint32_t>(product0);
+        }
+        out[0] = c0;
+        out[1] = c1;
+        out[2] = c2;
+        out[3] = c3;
+    }
+
+    // For ISAs without a vector form and for loop tails.
+    inline void scalarPhilox(uint64_t key, uint64_t stream, uint64_t firstBlock, uint32_t* out, size_t blocks) {
+        for (size_t b = 0; b < blocks; b++)
+            philoxBlock(key, stream, firstBlock + b, out + 4 * b);
+    }
+
+    // Per-ISA tables. Each returns nullptr when that ISA was not compiled into this binary.
+    const SimdKernelTable* scalarTable();
+    const SimdKernelTable* sse42Table();
+    const SimdKernelTable* avx2Table();
+    const SimdKernelTable* avx512Table();
+    const SimdKernelTable* neonTable();
+}
+
+#endif //HELLO_METAL_SIMDKERNELSINTERNAL_H
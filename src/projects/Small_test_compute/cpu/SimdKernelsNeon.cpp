@@ -0,0 +1,346 @@
+//
+// SimdKernelsNeon.cpp
+//
+// NEON kernels. Advanced SIMD is part of the AArch64 baseline, so no target attributes or runtime checks are needed.
+//
+
+#include "SimdKernelsInternal.h"
+
+#if defined(__aarch64__)
+
+#include <algorithm>
+#include <arm_neon.h>
+
+using namespace SimdKernelsDetail;
+
+namespace {
+    inline float32x4_t sinNeon(float32x4_t x) {
+        const float32x4_t q = vrndnq_f32(vmulq_n_f32(x, invPi));
+        float32x4_t r = vfmsq_n_f32(x, q, piA);
+        r = vfmsq_n_f32(r, q, piB);
+        r = vfmsq_n_f32(r, q, piC);
+        r = vfmsq_n_f32(r, q, piD);
+
+        const float32x4_t s = vmulq_f32(r, r);
+        const uint32x4_t oddSign = vshlq_n_u32(vreinterpretq_u32_s32(vcvtq_s32_f32(q)), 31);
+        r = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(r), oddSign));
+
+        float32x4_t u = vdupq_n_f32(sinC9);
+        u = vfmaq_f32(vdupq_n_f32(sinC7), u, s);
+        u = vfmaq_f32(vdupq_n_f32(sinC5), u, s);
+        u = vfmaq_f32(vdupq_n_f32(sinC3), u, s);
+        const float32x4_t result = vfmaq_f32(r, s, vmulq_f32(u, r));
+        // The reduction turns -0 into +0; keep zero inputs (and their sign) as they are, like std::sin
+        return vbslq_f32(vceqzq_f32(x), x, result);
+    }
+
+    inline float32x4_t safeSinNeon(float32x4_t x) {
+        // vcltq is false for NaN, so NaN lanes also take the scalar route.
+        const uint32x4_t inRange = vcltq_f32(vabsq_f32(x), vdupq_n_f32(sinReductionLimit));
+        const float32x4_t result = sinNeon(x);
+        if (vminvq_u32(inRange) != 0)
+            return result;
+        // Only the out-of-range lanes take std::sin; the rest keep the fused vector result
+        float inputs[4];
+        float lanes[4];
+        vst1q_f32(inputs, x);
+        vst1q_f32(lanes, result);
+        for (int lane = 0; lane < 4; lane++) {
+            if (!(std::fabs(inputs[lane]) < sinReductionLimit))
+                lanes[lane] = std::sin(inputs[lane]);
+        }
+        return vld1q_f32(lanes);
+    }
+
+    // The last n % 4 elements, zero-padded to one vector. polynomialSin is not fused, so a scalar tail would round
+    // differently from the vector body.
+    inline float32x4_t loadTailNeon(const float* in, size_t remaining) {
+        float lanes[4] = {};
+        std::copy(in, in + remaining, lanes);
+        return vld1q_f32(lanes);
+    }
+
+    inline void storeTailNeon(float* out, float32x4_t value, size_t remaining) {
+        float lanes[4];
+        vst1q_f32(lanes, value);
+        std::copy(lanes, lanes + remaining, out);
+    }
+
+#define NEON_BINARY_KERNEL(name, intrinsic, op)                                                     \
+    void name(const float* inA, const float* inB, float* outC, size_t n) {                          \
+        size_t i = 0;                                                                               \
+        for (; i + 8 <= n; i += 8) {                                                                \
+            vst1q_f32(outC + i, intrinsic(vld1q_f32(inA + i), vld1q_f32(inB + i)));                 \
+            vst1q_f32(outC + i + 4, intrinsic(vld1q_f32(inA + i + 4), vld1q_f32(inB + i + 4)));     \
+        }                                                                                           \
+        for (; i < n; i++)                                                                          \
+            outC[i] = inA[i] op inB[i];                                                             \
+    }
+
+    NEON_BINARY_KERNEL(neonAddArrays, vaddq_f32, +)
+    NEON_BINARY_KERNEL(neonSubtract, vsubq_f32, -)
+    NEON_BINARY_KERNEL(neonMultiply, vmulq_f32, *)
+    NEON_BINARY_KERNEL(neonDivide, vdivq_f32, /)
+
+    void neonComplexOperation(const float* inA, const float* inB, float* outC, size_t n) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const float32x4_t a = vld1q_f32(inA + i);
+            const float32x4_t product = vmulq_f32(a, vld1q_f32(inB + i));
+            vst1q_f32(outC + i, vaddq_f32(safeSinNeon(product), a));
+        }
+        if (i < n) {
+            const float32x4_t a = loadTailNeon(inA + i, n - i);
+            const float32x4_t product = vmulq_f32(a, loadTailNeon(inB + i, n - i));
+            storeTailNeon(outC + i, vaddq_f32(safeSinNeon(product), a), n - i);
+        }
+    }
+
+    void neonSin(const float* in, float* out, size_t n) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            vst1q_f32(out + i, safeSinNeon(vld1q_f32(in + i)));
+        if (i < n)
+            storeTailNeon(out + i, safeSinNeon(loadTailNeon(in + i, n - i)), n - i);
+    }
+
+    void neonFill(float value, float* out, size_t n) {
+        const float32x4_t v = vdupq_n_f32(value);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            vst1q_f32(out + i, v);
+        for (; i < n; i++)
+            out[i] = value;
+    }
+
+#define NEON_REDUCE_KERNEL(name, identity, intrinsic, horizontal, combine)                         \
+    float name(const float* in, size_t n) {                                                         \
+        float32x4_t acc0 = vdupq_n_f32(identity);                                                   \
+        float32x4_t acc1 = acc0;                                                                    \
+        size_t i = 0;                                                                               \
+        for (; i + 8 <= n; i += 8) {                                                                \
+            acc0 = intrinsic(acc0, vld1q_f32(in + i));                                              \
+            acc1 = intrinsic(acc1, vld1q_f32(in + i + 4));                                          \
+        }                                                                                           \
+        for (; i + 4 <= n; i += 4)                                                                  \
+            acc0 = intrinsic(acc0, vld1q_f32(in + i));                                              \
+        float result = horizontal(intrinsic(acc0, acc1));                                           \
+        for (; i < n; i++)                                                                          \
+            result = combine(result, in[i]);                                                        \
+        return result;                                                                              \
+    }
+
+    NEON_REDUCE_KERNEL(neonSum, 0.0f, vaddq_f32, vaddvq_f32, reduceAdd)
+    NEON_REDUCE_KERNEL(neonMinimum, INFINITY, vminq_f32, vminvq_f32, reduceMin)
+    NEON_REDUCE_KERNEL(neonMaximum, -INFINITY, vmaxq_f32, vmaxvq_f32, reduceMax)
+
+    float neonDot(const float* inA, const float* inB, size_t n) {
+        float32x4_t acc0 = vdupq_n_f32(0.0f);
+        float32x4_t acc1 = acc0;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            acc0 = vfmaq_f32(acc0, vld1q_f32(inA + i), vld1q_f32(inB + i));
+            acc1 = vfmaq_f32(acc1, vld1q_f32(inA + i + 4), vld1q_f32(inB + i + 4));
+        }
+        for (; i + 4 <= n; i += 4)
+            acc0 = vfmaq_f32(acc0, vld1q_f32(inA + i), vld1q_f32(inB + i));
+        float result = vaddvq_f32(vaddq_f32(acc0, acc1));
+        for (; i < n; i++)
+            result += inA[i] * inB[i];
+        return result;
+    }
+
+    float neonSumOfSquares(const float* in, size_t n) {
+        return neonDot(in, in, n);
+    }
+
+    // s[r] holds lanes 4r to 4r + 3 of the fixed-shape sum. vmulq + vaddq rather than vfmaq, to match the other ISAs.
+    template <bool Product, bool Compensated>
+    void neonFixedGroups(const float* inA, const float* inB, size_t groups, float* lanes, float* corrections) {
+        float32x4_t s[8], c[8];
+        for (int r = 0; r < 8; r++)
+            s[r] = c[r] = vdupq_n_f32(0.0f);
+
+        for (size_t g = 0; g < groups; g++) {
+            for (int r = 0; r < 8; r++) {
+                const size_t i = g * fixedLanes + r * 4;
+                float32x4_t x = vld1q_f32(inA + i);
+                if (Product)
+                    x = vmulq_f32(x, vld1q_f32(inB + i));
+                if (Compensated) {
+                    const float32x4_t t = vaddq_f32(s[r], x);
+                    const uint32x4_t sLarger = vcgeq_f32(vabsq_f32(s[r]), vabsq_f32(x));
+                    const float32x4_t fromS = vaddq_f32(vsubq_f32(s[r], t), x);
+                    const float32x4_t fromX = vaddq_f32(vsubq_f32(x, t), s[r]);
+                    c[r] = vaddq_f32(c[r], vbslq_f32(sLarger, fromS, fromX));
+                    s[r] = t;
+                } else {
+                    s[r] = vaddq_f32(s[r], x);
+                }
+            }
+        }
+
+        for (int r = 0; r < 8; r++) {
+            vst1q_f32(lanes + r * 4, s[r]);
+            vst1q_f32(corrections + r * 4, c[r]);
+        }
+    }
+
+    void neonHalfToFloat(const uint16_t* in, float* out, size_t n) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            vst1q_f32(out + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(in + i))));
+        scalarHalfToFloat(in + i, out + i, n - i);
+    }
+
+    void neonFloatToHalf(const float* in, uint16_t* out, size_t n) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            vst1_u16(out + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(in + i))));
+        scalarFloatToHalf(in + i, out + i, n - i);
+    }
+
+    void neonBfloat16ToFloat(const uint16_t* in, float* out, size_t n) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            vst1q_f32(out + i, vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(in + i), 16)));
+        scalarBfloat16ToFloat(in + i, out + i, n - i);
+    }
+
+    // Same rounding as floatToBfloat16Bits: add 0x7FFF plus the lowest kept bit, keep the top half; NaNs get the
+    // quiet bit instead.
+    void neonFloatToBfloat16(const float* in, uint16_t* out, size_t n) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const uint32x4_t bits = vreinterpretq_u32_f32(vld1q_f32(in + i));
+            const uint32x4_t isNan = vcgtq_u32(vandq_u32(bits, vdupq_n_u32(0x7FFFFFFF)), vdupq_n_u32(0x7F800000));
+            const uint32x4_t lowestKept = vandq_u32(vshrq_n_u32(bits, 16), vdupq_n_u32(1));
+            const uint32x4_t rounded = vaddq_u32(bits, vaddq_u32(vdupq_n_u32(0x7FFF), lowestKept));
+            const uint32x4_t quieted = vorrq_u32(bits, vdupq_n_u32(0x400000));
+            vst1_u16(out + i, vshrn_n_u32(vbslq_u32(isNan, quieted, rounded), 16));
+        }
+        scalarFloatToBfloat16(in + i, out + i, n - i);
+    }
+
+    void neonSumFixed(const float* inA, const float* inB, size_t n, float* sum, float* compensation) {
+        float lanes[fixedLanes];
+        float corrections[fixedLanes];
+        const size_t groups = n / fixedLanes;
+        if (inB)
+            compensation ? neonFixedGroups<true, true>(inA, inB, groups, lanes, corrections)
+                         : neonFixedGroups<true, false>(inA, inB, groups, lanes, corrections);
+        else
+            compensation ? neonFixedGroups<false, true>(inA, inB, groups, lanes, corrections)
+                         : neonFixedGroups<false, false>(inA, inB, groups, lanes, corrections);
+        finishFixedSum(inA, inB, groups * fixedLanes, n, lanes, corrections, sum, compensation);
+    }
+
+    // orderedFloatBits of each lane; the distance is then max - min, which fits in 32 unsigned bits. NaN lanes are
+    // patched afterwards, the same way as ulpDistance.
+    void neonCompareUlp(const float* expected, const float* actual, size_t n, uint32_t tolerance, UlpComparison* result) {
+        const int32x4_t magnitudeMask = vdupq_n_s32(0x7FFFFFFF);
+        const int32x4_t infinity = vdupq_n_s32(0x7F800000);
+        const uint32x4_t limit = vdupq_n_u32(tolerance);
+        uint64x2_t sums = vdupq_n_u64(0);
+        uint64x2_t outside = vdupq_n_u64(0);
+        uint32x4_t maximum = vdupq_n_u32(0);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const int32x4_t a = vreinterpretq_s32_f32(vld1q_f32(expected + i));
+            const int32x4_t b = vreinterpretq_s32_f32(vld1q_f32(actual + i));
+            const int32x4_t magnitudeA = vandq_s32(a, magnitudeMask);
+            const int32x4_t magnitudeB = vandq_s32(b, magnitudeMask);
+            const int32x4_t signA = vshrq_n_s32(a, 31);
+            const int32x4_t signB = vshrq_n_s32(b, 31);
+            const int32x4_t orderedA = vsubq_s32(veorq_s32(magnitudeA, signA), signA);
+            const int32x4_t orderedB = vsubq_s32(veorq_s32(magnitudeB, signB), signB);
+            uint32x4_t distance = vreinterpretq_u32_s32(vsubq_s32(vmaxq_s32(orderedA, orderedB), vminq_s32(orderedA, orderedB)));
+
+            const uint32x4_t nanA = vcgtq_s32(magnitudeA, infinity);
+            const uint32x4_t nanB = vcgtq_s32(magnitudeB, infinity);
+            distance = vbicq_u32(vorrq_u32(distance, vorrq_u32(nanA, nanB)), vandq_u32(nanA, nanB));
+
+            sums = vpadalq_u32(sums, distance);
+            maximum = vmaxq_u32(maximum, distance);
+            outside = vpadalq_u32(outside, vshrq_n_u32(vcgtq_u32(distance, limit), 31));
+        }
+
+        result->sumUlps = vaddvq_u64(sums);
+        result->maxUlps = vmaxvq_u32(maximum);
+        result->outside = vaddvq_u64(outside);
+        finishCompareUlp(expected, actual, i, n, tolerance, result);
+    }
+
+    // 32 x 32 -> 64-bit products of every lane with multiplier, split into high and low words.
+    inline void mulHiLoNeon(uint32x4_t a, uint32_t multiplier, uint32x4_t& high, uint32x4_t& low) {
+        const uint32x4_t first = vreinterpretq_u32_u64(vmull_u32(vget_low_u32(a), vdup_n_u32(multiplier)));
+        const uint32x4_t second = vreinterpretq_u32_u64(vmull_high_u32(a, vdupq_n_u32(multiplier)));
+        low = vuzp1q_u32(first, second);
+        high = vuzp2q_u32(first, second);
+    }
+
+    // Four blocks at a time, one per lane; vst4q interleaves the lanes so each block's words are contiguous.
+    void neonPhilox(uint64_t key, uint64_t stream, uint64_t firstBlock, uint32_t* out, size_t blocks) {
+        const uint32_t laneValues[4] = {0, 1, 2, 3};
+        const uint32x4_t laneIndex = vld1q_u32(laneValues);
+        size_t b = 0;
+        for (; b + 4 <= blocks; b += 4) {
+            const uint64_t counter = firstBlock + b;
+            const uint32x4_t base = vdupq_n_u32(static_cast<uint32_t>(counter));
+            uint32x4x4_t c;
+            c.val[0] = vaddq_u32(base, laneIndex);
+            // Lanes whose low word wrapped carry into the high word
+            c.val[1] = vsubq_u32(vdupq_n_u32(static_cast<uint32_t>(counter >> 32)), vcltq_u32(c.val[0], base));
+            c.val[2] = vdupq_n_u32(static_cast<uint32_t>(stream));
+            c.val[3] = vdupq_n_u32(static_cast<uint32_t>(stream >> 32));
+            uint32_t k0 = static_cast<uint32_t>(key);
+            uint32_t k1 = static_cast<uint32_t>(key >> 32);
+            for (int round = 0; round < philoxRounds; round++) {
+                if (round > 0) {
+                    k0 += philoxW0;
+                    k1 += philoxW1;
+                }
+                uint32x4_t high0, low0, high1, low1;
+                mulHiLoNeon(c.val[0], philoxM0, high0, low0);
+                mulHiLoNeon(c.val[2], philoxM1, high1, low1);
+                c.val[0] = veorq_u32(veorq_u32(high1, c.val[1]), vdupq_n_u32(k0));
+                c.val[2] = veorq_u32(veorq_u32(high0, c.val[3]), vdupq_n_u32(k1));
+                c.val[1] = low1;
+                c.val[3] = low0;
+            }
+            vst4q_u32(out + 4 * b, c);
+        }
+        scalarPhilox(key, stream, firstBlock + b, out + 4 * b, blocks - b);
+    }
+
+    const SimdKernelTable neonKernels = {
+            SimdIsa::Neon,
+            neonAddArrays,
+            neonComplexOperation,
+            neonSubtract,
+            neonMultiply,
+            neonDivide,
+            neonSin,
+            neonFill,
+            neonSum,
+            neonMinimum,
+            neonMaximum,
+            neonDot,
+            neonSumOfSquares,
+            neonSumFixed,
+            neonHalfToFloat,
+            neonFloatToHalf,
+            neonBfloat16ToFloat,
+            neonFloatToBfloat16,
+            neonCompareUlp,
+            neonPhilox,
+    };
+}
+
+const SimdKernelTable* SimdKernelsDetail::neonTable() { return &neonKernels; }
+
+#else
+
+const SimdKernelTable* SimdKernelsDetail::neonTable() { return nullptr; }
+
+#endif
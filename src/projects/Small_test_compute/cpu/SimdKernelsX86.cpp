@@ -0,0 +1,992 @@
+//
+// SimdKernelsX86.cpp
+//
+// SSE4.2, AVX2 and AVX-512 kernels. Each function carries its own target attribute instead of this file being built
+// with -mavx2 etc., so the rest of the binary stays runnable on the baseline ISA and nothing AVX-encoded can leak
+// into shared inline code. SimdKernels only hands these out after CPUID says they are safe.
+//
+
+#include "SimdKernelsInternal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <algorithm>
+#include <immintrin.h>
+
+using namespace SimdKernelsDetail;
+
+namespace {
+
+    // ------------------------------------------------------------------------------------------------------------
+    // SSE4.2: 4 lanes
+
+#define SSE_TARGET __attribute__((target("sse4.2")))
+
+    SSE_TARGET inline __m128 sinSse(__m128 x) {
+        const __m128 q = _mm_round_ps(_mm_mul_ps(x, _mm_set1_ps(invPi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m128 r = _mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(piA)));
+        r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(piB)));
+        r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(piC)));
+        r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(piD)));
+
+        const __m128 s = _mm_mul_ps(r, r);
+        const __m128i oddSign = _mm_slli_epi32(_mm_cvtps_epi32(q), 31);
+        r = _mm_xor_ps(r, _mm_castsi128_ps(oddSign));
+
+        __m128 u = _mm_set1_ps(sinC9);
+        u = _mm_add_ps(_mm_mul_ps(u, s), _mm_set1_ps(sinC7));
+        u = _mm_add_ps(_mm_mul_ps(u, s), _mm_set1_ps(sinC5));
+        u = _mm_add_ps(_mm_mul_ps(u, s), _mm_set1_ps(sinC3));
+        const __m128 result = _mm_add_ps(_mm_mul_ps(s, _mm_mul_ps(u, r)), r);
+        // The reduction turns -0 into +0; keep zero inputs (and their sign) as they are, like std::sin
+        return _mm_blendv_ps(result, x, _mm_cmpeq_ps(x, _mm_setzero_ps()));
+    }
+
+    // True when a lane is outside the exact reduction range (or NaN) and has to go through std::sin.
+    SSE_TARGET inline bool needsScalarSinSse(__m128 x) {
+        const __m128 magnitude = _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+        return _mm_movemask_ps(_mm_cmpnlt_ps(magnitude, _mm_set1_ps(sinReductionLimit))) != 0;
+    }
+
+    SSE_TARGET inline __m128 safeSinSse(__m128 x) {
+        if (!needsScalarSinSse(x))
+            return sinSse(x);
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, x);
+        for (float& lane : lanes)
+            lane = polynomialSin(lane);
+        return _mm_load_ps(lanes);
+    }
+
+#define SSE_BINARY_KERNEL(name, intrinsic, op)                                                      \
+    SSE_TARGET void name(const float* inA, const float* inB, float* outC, size_t n) {               \
+        size_t i = 0;                                                                               \
+        for (; i + 4 <= n; i += 4)                                                                  \
+            _mm_storeu_ps(outC + i, intrinsic(_mm_loadu_ps(inA + i), _mm_loadu_ps(inB + i)));       \
+        for (; i < n; i++)                                                                          \
+            outC[i] = inA[i] op inB[i];                                                             \
+    }
+
+    SSE_BINARY_KERNEL(sseAddArrays, _mm_add_ps, +)
+    SSE_BINARY_KERNEL(sseSubtract, _mm_sub_ps, -)
+    SSE_BINARY_KERNEL(sseMultiply, _mm_mul_ps, *)
+    SSE_BINARY_KERNEL(sseDivide, _mm_div_ps, /)
+
+    SSE_TARGET void sseComplexOperation(const float* inA, const float* inB, float* outC, size_t n) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m128 a = _mm_loadu_ps(inA + i);
+            const __m128 product = _mm_mul_ps(a, _mm_loadu_ps(inB + i));
+            _mm_storeu_ps(outC + i, _mm_add_ps(safeSinSse(product), a));
+        }
+        for (; i < n; i++)
+            outC[i] = polynomialSin(inA[i] * inB[i]) + inA[i];
+    }
+
+    SSE_TARGET void sseSin(const float* in, float* out, size_t n) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm_storeu_ps(out + i, safeSinSse(_mm_loadu_ps(in + i)));
+        for (; i < n; i++)
+            out[i] = polynomialSin(in[i]);
+    }
+
+    SSE_TARGET void sseFill(float value, float* out, size_t n) {
+        const __m128 v = _mm_set1_ps(value);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm_storeu_ps(out + i, v);
+        for (; i < n; i++)
+            out[i] = value;
+    }
+
+    // Reductions keep two accumulators so consecutive adds do not wait on each other
+#define SSE_REDUCE_KERNEL(name, identity, intrinsic, combine)                                       \
+    SSE_TARGET float name(const float* in, size_t n) {                                              \
+        __m128 acc0 = _mm_set1_ps(identity);                                                        \
+        __m128 acc1 = acc0;                                                                         \
+        size_t i = 0;                                                                               \
+        for (; i + 8 <= n; i += 8) {                                                                \
+            acc0 = intrinsic(acc0, _mm_loadu_ps(in + i));                                           \
+            acc1 = intrinsic(acc1, _mm_loadu_ps(in + i + 4));                                       \
+        }                                                                                           \
+        for (; i + 4 <= n; i += 4)                                                                  \
+            acc0 = intrinsic(acc0, _mm_loadu_ps(in + i));                                           \
+        alignas(16) float lanes[4];                                                                 \
+        _mm_store_ps(lanes, intrinsic(acc0, acc1));                                                 \
+        float result = combine(combine(lanes[0], lanes[1]), combine(lanes[2], lanes[3]));           \
+        for (; i < n; i++)                                                                          \
+            result = combine(result, in[i]);                                                        \
+        return result;                                                                              \
+    }
+
+    SSE_REDUCE_KERNEL(sseSum, 0.0f, _mm_add_ps, reduceAdd)
+    SSE_REDUCE_KERNEL(sseMinimum, INFINITY, _mm_min_ps, reduceMin)
+    SSE_REDUCE_KERNEL(sseMaximum, -INFINITY, _mm_max_ps, reduceMax)
+
+    SSE_TARGET float sseDot(const float* inA, const float* inB, size_t n) {
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(inA + i), _mm_loadu_ps(inB + i)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(inA + i + 4), _mm_loadu_ps(inB + i + 4)));
+        }
+        for (; i + 4 <= n; i += 4)
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(inA + i), _mm_loadu_ps(inB + i)));
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, _mm_add_ps(acc0, acc1));
+        float result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        for (; i < n; i++)
+            result += inA[i] * inB[i];
+        return result;
+    }
+
+    SSE_TARGET float sseSumOfSquares(const float* in, size_t n) {
+        return sseDot(in, in, n);
+    }
+
+    // s[r] holds lanes 4r to 4r + 3 of the fixed-shape sum.
+    template <bool Product, bool Compensated>
+    SSE_TARGET void sseFixedGroups(const float* inA, const float* inB, size_t groups, float* lanes, float* corrections) {
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        __m128 s[8], c[8];
+        for (int r = 0; r < 8; r++)
+            s[r] = c[r] = _mm_setzero_ps();
+
+        for (size_t g = 0; g < groups; g++) {
+            for (int r = 0; r < 8; r++) {
+                const size_t i = g * fixedLanes + r * 4;
+                __m128 x = _mm_loadu_ps(inA + i);
+                if (Product)
+                    x = _mm_mul_ps(x, _mm_loadu_ps(inB + i));
+                if (Compensated) {
+                    const __m128 t = _mm_add_ps(s[r], x);
+                    const __m128 sLarger = _mm_cmpge_ps(_mm_andnot_ps(signMask, s[r]), _mm_andnot_ps(signMask, x));
+                    const __m128 fromS = _mm_add_ps(_mm_sub_ps(s[r], t), x);
+                    const __m128 fromX = _mm_add_ps(_mm_sub_ps(x, t), s[r]);
+                    c[r] = _mm_add_ps(c[r], _mm_blendv_ps(fromX, fromS, sLarger));
+                    s[r] = t;
+                } else {
+                    s[r] = _mm_add_ps(s[r], x);
+                }
+            }
+        }
+
+        for (int r = 0; r < 8; r++) {
+            _mm_storeu_ps(lanes + r * 4, s[r]);
+            _mm_storeu_ps(corrections + r * 4, c[r]);
+        }
+    }
+
+    SSE_TARGET void sseSumFixed(const float* inA, const float* inB, size_t n, float* sum, float* compensation) {
+        float lanes[fixedLanes];
+        float corrections[fixedLanes];
+        const size_t groups = n / fixedLanes;
+        if (inB)
+            compensation ? sseFixedGroups<true, true>(inA, inB, groups, lanes, corrections)
+                         : sseFixedGroups<true, false>(inA, inB, groups, lanes, corrections);
+        else
+            compensation ? sseFixedGroups<false, true>(inA, inB, groups, lanes, corrections)
+                         : sseFixedGroups<false, false>(inA, inB, groups, lanes, corrections);
+        finishFixedSum(inA, inB, groups * fixedLanes, n, lanes, corrections, sum, compensation);
+    }
+
+    // orderedFloatBits of each lane; the distance is then max - min, which fits in 32 unsigned bits. NaN lanes are
+    // patched afterwards, the same way as ulpDistance.
+    SSE_TARGET void sseCompareUlp(const float* expected, const float* actual, size_t n, uint32_t tolerance, UlpComparison* result) {
+        const __m128i magnitudeMask = _mm_set1_epi32(0x7FFFFFFF);
+        const __m128i infinity = _mm_set1_epi32(0x7F800000);
+        const __m128i limit = _mm_set1_epi32(static_cast<int32_t>(tolerance));
+        __m128i sumLow = _mm_setzero_si128();
+        __m128i sumHigh = _mm_setzero_si128();
+        __m128i maximum = _mm_setzero_si128();
+        uint64_t outside = 0;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(expected + i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(actual + i));
+            const __m128i magnitudeA = _mm_and_si128(a, magnitudeMask);
+            const __m128i magnitudeB = _mm_and_si128(b, magnitudeMask);
+            const __m128i signA = _mm_srai_epi32(a, 31);
+            const __m128i signB = _mm_srai_epi32(b, 31);
+            const __m128i orderedA = _mm_sub_epi32(_mm_xor_si128(magnitudeA, signA), signA);
+            const __m128i orderedB = _mm_sub_epi32(_mm_xor_si128(magnitudeB, signB), signB);
+            __m128i distance = _mm_sub_epi32(_mm_max_epi32(orderedA, orderedB), _mm_min_epi32(orderedA, orderedB));
+
+            const __m128i nanA = _mm_cmpgt_epi32(magnitudeA, infinity);
+            const __m128i nanB = _mm_cmpgt_epi32(magnitudeB, infinity);
+            distance = _mm_andnot_si128(_mm_and_si128(nanA, nanB), _mm_or_si128(distance, _mm_or_si128(nanA, nanB)));
+
+            sumLow = _mm_add_epi64(sumLow, _mm_cvtepu32_epi64(distance));
+            sumHigh = _mm_add_epi64(sumHigh, _mm_cvtepu32_epi64(_mm_srli_si128(distance, 8)));
+            maximum = _mm_max_epu32(maximum, distance);
+            const __m128i within = _mm_cmpeq_epi32(_mm_min_epu32(distance, limit), distance);
+            outside += 4 - __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(within)));
+        }
+
+        alignas(16) uint64_t sums[2];
+        alignas(16) uint32_t maxima[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(sums), _mm_add_epi64(sumLow, sumHigh));
+        _mm_store_si128(reinterpret_cast<__m128i*>(maxima), maximum);
+        result->sumUlps = sums[0] + sums[1];
+        result->maxUlps = std::max(std::max(maxima[0], maxima[1]), std::max(maxima[2], maxima[3]));
+        result->outside = outside;
+        finishCompareUlp(expected, actual, i, n, tolerance, result);
+    }
+
+    const SimdKernelTable sse42Kernels = {
+            SimdIsa::Sse42,
+            sseAddArrays,
+            sseComplexOperation,
+            sseSubtract,
+            sseMultiply,
+            sseDivide,
+            sseSin,
+            sseFill,
+            sseSum,
+            sseMinimum,
+            sseMaximum,
+            sseDot,
+            sseSumOfSquares,
+            sseSumFixed,
+            scalarHalfToFloat,
+            scalarFloatToHalf,
+            scalarBfloat16ToFloat,
+            scalarFloatToBfloat16,
+            sseCompareUlp,
+            scalarPhilox,
+    };
+
+    // ------------------------------------------------------------------------------------------------------------
+    // AVX2 + FMA (+ F16C for the half conversions): 8 lanes
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+    AVX2_TARGET inline __m256 sinAvx2(__m256 x) {
+        const __m256 q = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(invPi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256 r = _mm256_fnmadd_ps(q, _mm256_set1_ps(piA), x);
+        r = _mm256_fnmadd_ps(q, _mm256_set1_ps(piB), r);
+        r = _mm256_fnmadd_ps(q, _mm256_set1_ps(piC), r);
+        r = _mm256_fnmadd_ps(q, _mm256_set1_ps(piD), r);
+
+        const __m256 s = _mm256_mul_ps(r, r);
+        const __m256i oddSign = _mm256_slli_epi32(_mm256_cvtps_epi32(q), 31);
+        r = _mm256_xor_ps(r, _mm256_castsi256_ps(oddSign));
+
+        __m256 u = _mm256_set1_ps(sinC9);
+        u = _mm256_fmadd_ps(u, s, _mm256_set1_ps(sinC7));
+        u = _mm256_fmadd_ps(u, s, _mm256_set1_ps(sinC5));
+        u = _mm256_fmadd_ps(u, s, _mm256_set1_ps(sinC3));
+        const __m256 result = _mm256_fmadd_ps(s, _mm256_mul_ps(u, r), r);
+        // See sinSse: zero inputs keep their sign
+        return _mm256_blendv_ps(result, x, _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_EQ_OQ));
+    }
+
+    AVX2_TARGET inline bool needsScalarSinAvx2(__m256 x) {
+        const __m256 magnitude = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+        return _mm256_movemask_ps(_mm256_cmp_ps(magnitude, _mm256_set1_ps(sinReductionLimit), _CMP_NLT_UQ)) != 0;
+    }
+
+    // Only the lanes outside the reduction range go through std::sin; the rest keep the fused vector result, so an
+    // element's value does not depend on its neighbours.
+    AVX2_TARGET inline __m256 safeSinAvx2(__m256 x) {
+        const __m256 result = sinAvx2(x);
+        if (!needsScalarSinAvx2(x))
+            return result;
+        alignas(32) float inputs[8];
+        alignas(32) float lanes[8];
+        _mm256_store_ps(inputs, x);
+        _mm256_store_ps(lanes, result);
+        for (int lane = 0; lane < 8; lane++) {
+            if (!(std::fabs(inputs[lane]) < sinReductionLimit))
+                lanes[lane] = std::sin(inputs[lane]);
+        }
+        return _mm256_load_ps(lanes);
+    }
+
+    // Lanes [0, remaining) set, for maskload/maskstore tails. The sin kernels finish with a masked vector step rather
+    // than a scalar loop: polynomialSin is not fused, so it would round differently from the vector body.
+    AVX2_TARGET inline __m256i tailMaskAvx2(size_t remaining) {
+        return _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int32_t>(remaining)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    }
+
+#define AVX2_BINARY_KERNEL(name, intrinsic, op)                                                             \
+    AVX2_TARGET void name(const float* inA, const float* inB, float* outC, size_t n) {                      \
+        size_t i = 0;                                                                                       \
+        for (; i + 16 <= n; i += 16) {                                                                      \
+            _mm256_storeu_ps(outC + i, intrinsic(_mm256_loadu_ps(inA + i), _mm256_loadu_ps(inB + i)));      \
+            _mm256_storeu_ps(outC + i + 8, intrinsic(_mm256_loadu_ps(inA + i + 8), _mm256_loadu_ps(inB + i + 8))); \
+        }                                                                                                   \
+        for (; i + 8 <= n; i += 8)                                                                          \
+            _mm256_storeu_ps(outC + i, intrinsic(_mm256_loadu_ps(inA + i), _mm256_loadu_ps(inB + i)));      \
+        for (; i < n; i++)                                                                                  \
+            outC[i] = inA[i] op inB[i];                                                                     \
+    }
+
+    AVX2_BINARY_KERNEL(avx2AddArrays, _mm256_add_ps, +)
+    AVX2_BINARY_KERNEL(avx2Subtract, _mm256_sub_ps, -)
+    AVX2_BINARY_KERNEL(avx2Multiply, _mm256_mul_ps, *)
+    AVX2_BINARY_KERNEL(avx2Divide, _mm256_div_ps, /)
+
+    AVX2_TARGET void avx2ComplexOperation(const float* inA, const float* inB, float* outC, size_t n) {
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m256 a = _mm256_loadu_ps(inA + i);
+            const __m256 product = _mm256_mul_ps(a, _mm256_loadu_ps(inB + i));
+            _mm256_storeu_ps(outC + i, _mm256_add_ps(safeSinAvx2(product), a));
+        }
+        if (i < n) {
+            const __m256i mask = tailMaskAvx2(n - i);
+            const __m256 a = _mm256_maskload_ps(inA + i, mask);
+            const __m256 product = _mm256_mul_ps(a, _mm256_maskload_ps(inB + i, mask));
+            _mm256_maskstore_ps(outC + i, mask, _mm256_add_ps(safeSinAvx2(product), a));
+        }
+    }
+
+    AVX2_TARGET void avx2Sin(const float* in, float* out, size_t n) {
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(out + i, safeSinAvx2(_mm256_loadu_ps(in + i)));
+        if (i < n) {
+            const __m256i mask = tailMaskAvx2(n - i);
+            _mm256_maskstore_ps(out + i, mask, safeSinAvx2(_mm256_maskload_ps(in + i, mask)));
+        }
+    }
+
+    AVX2_TARGET void avx2Fill(float value, float* out, size_t n) {
+        const __m256 v = _mm256_set1_ps(value);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(out + i, v);
+        for (; i < n; i++)
+            out[i] = value;
+    }
+
+#define AVX2_REDUCE_KERNEL(name, identity, intrinsic, combine)                                      \
+    AVX2_TARGET float name(const float* in, size_t n) {                                             \
+        __m256 acc0 = _mm256_set1_ps(identity);                                                     \
+        __m256 acc1 = acc0;                                                                         \
+        size_t i = 0;                                                                               \
+        for (; i + 16 <= n; i += 16) {                                                              \
+            acc0 = intrinsic(acc0, _mm256_loadu_ps(in + i));                                        \
+            acc1 = intrinsic(acc1, _mm256_loadu_ps(in + i + 8));                                    \
+        }                                                                                           \
+        for (; i + 8 <= n; i += 8)                                                                  \
+            acc0 = intrinsic(acc0, _mm256_loadu_ps(in + i));                                        \
+        alignas(32) float lanes[8];                                                                 \
+        _mm256_store_ps(lanes, intrinsic(acc0, acc1));                                              \
+        float result = identity;                                                                    \
+        for (float lane : lanes)                                                                    \
+            result = combine(result, lane);                                                         \
+        for (; i < n; i++)                                                                          \
+            result = combine(result, in[i]);                                                        \
+        return result;                                                                              \
+    }
+
+    AVX2_REDUCE_KERNEL(avx2Sum, 0.0f, _mm256_add_ps, reduceAdd)
+    AVX2_REDUCE_KERNEL(avx2Minimum, INFINITY, _mm256_min_ps, reduceMin)
+    AVX2_REDUCE_KERNEL(avx2Maximum, -INFINITY, _mm256_max_ps, reduceMax)
+
+    AVX2_TARGET float avx2Dot(const float* inA, const float* inB, size_t n) {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(inA + i), _mm256_loadu_ps(inB + i), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(inA + i + 8), _mm256_loadu_ps(inB + i + 8), acc1);
+        }
+        for (; i + 8 <= n; i += 8)
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(inA + i), _mm256_loadu_ps(inB + i), acc0);
+        alignas(32) float lanes[8];
+        _mm256_store_ps(lanes, _mm256_add_ps(acc0, acc1));
+        float result = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+        for (; i < n; i++)
+            result += inA[i] * inB[i];
+        return result;
+    }
+
+    AVX2_TARGET float avx2SumOfSquares(const float* in, size_t n) {
+        return avx2Dot(in, in, n);
+    }
+
+    // s[r] holds lanes 8r to 8r + 7 of the fixed-shape sum. The multiply and add stay separate instructions because
+    // the library is built with -ffp-contract=off.
+    template <bool Product, bool Compensated>
+    AVX2_TARGET void avx2FixedGroups(const float* inA, const float* inB, size_t groups, float* lanes, float* corrections) {
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+        __m256 s[4], c[4];
+        for (int r = 0; r < 4; r++)
+            s[r] = c[r] = _mm256_setzero_ps();
+
+        for (size_t g = 0; g < groups; g++) {
+            for (int r = 0; r < 4; r++) {
+                const size_t i = g * fixedLanes + r * 8;
+                __m256 x = _mm256_loadu_ps(inA + i);
+                if (Product)
+                    x = _mm256_mul_ps(x, _mm256_loadu_ps(inB + i));
+                if (Compensated) {
+                    const __m256 t = _mm256_add_ps(s[r], x);
+                    const __m256 sLarger = _mm256_cmp_ps(_mm256_andnot_ps(signMask, s[r]), _mm256_andnot_ps(signMask, x), _CMP_GE_OS);
+                    const __m256 fromS = _mm256_add_ps(_mm256_sub_ps(s[r], t), x);
+                    const __m256 fromX = _mm256_add_ps(_mm256_sub_ps(x, t), s[r]);
+                    c[r] = _mm256_add_ps(c[r], _mm256_blendv_ps(fromX, fromS, sLarger));
+                    s[r] = t;
+                } else {
+                    s[r] = _mm256_add_ps(s[r], x);
+                }
+            }
+        }
+
+        for (int r = 0; r < 4; r++) {
+            _mm256_storeu_ps(lanes + r * 8, s[r]);
+            _mm256_storeu_ps(corrections + r * 8, c[r]);
+        }
+    }
+
+    // F16C is a separate CPUID bit; detect() only reports AVX2 when it is present too.
+#define AVX2_F16C_TARGET __attribute__((target("avx2,fma,f16c")))
+
+    AVX2_F16C_TARGET void avx2HalfToFloat(const uint16_t* in, float* out, size_t n) {
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))));
+        scalarHalfToFloat(in + i, out + i, n - i);
+    }
+
+    AVX2_F16C_TARGET void avx2FloatToHalf(const float* in, uint16_t* out, size_t n) {
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+        scalarFloatToHalf(in + i, out + i, n - i);
+    }
+
+    AVX2_TARGET void avx2Bfloat16ToFloat(const uint16_t* in, float* out, size_t n) {
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m256i widened = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_slli_epi32(widened, 16));
+        }
+        scalarBfloat16ToFloat(in + i, out + i, n - i);
+    }
+
+    // Same rounding as floatToBfloat16Bits: add 0x7FFF plus the lowest kept bit, keep the top half; NaNs get the
+    // quiet bit instead.
+    AVX2_TARGET void avx2FloatToBfloat16(const float* in, uint16_t* out, size_t n) {
+        const __m256i magnitudeMask = _mm256_set1_epi32(0x7FFFFFFF);
+        const __m256i infinity = _mm256_set1_epi32(0x7F800000);
+        const __m256i roundingBias = _mm256_set1_epi32(0x7FFF);
+        const __m256i one = _mm256_set1_epi32(1);
+        const __m256i quietBit = _mm256_set1_epi32(0x40);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m256i bits = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+            const __m256i isNan = _mm256_cmpgt_epi32(_mm256_and_si256(bits, magnitudeMask), infinity);
+            const __m256i lowestKept = _mm256_and_si256(_mm256_srli_epi32(bits, 16), one);
+            const __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(roundingBias, lowestKept)), 16);
+            const __m256i quieted = _mm256_or_si256(_mm256_srli_epi32(bits, 16), quietBit);
+            const __m256i narrowed = _mm256_blendv_epi8(rounded, quieted, isNan);
+            // packus works within 128-bit lanes; the permute puts the two halves back in order
+            const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(narrowed, narrowed), 0xD8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_castsi256_si128(packed));
+        }
+        scalarFloatToBfloat16(in + i, out + i, n - i);
+    }
+
+    AVX2_TARGET void avx2SumFixed(const float* inA, const float* inB, size_t n, float* sum, float* compensation) {
+        float lanes[fixedLanes];
+        float corrections[fixedLanes];
+        const size_t groups = n / fixedLanes;
+        if (inB)
+            compensation ? avx2FixedGroups<true, true>(inA, inB, groups, lanes, corrections)
+                         : avx2FixedGroups<true, false>(inA, inB, groups, lanes, corrections);
+        else
+            compensation ? avx2FixedGroups<false, true>(inA, inB, groups, lanes, corrections)
+                         : avx2FixedGroups<false, false>(inA, inB, groups, lanes, corrections);
+        finishFixedSum(inA, inB, groups * fixedLanes, n, lanes, corrections, sum, compensation);
+    }
+
+    AVX2_TARGET void avx2CompareUlp(const float* expected, const float* actual, size_t n, uint32_t tolerance, UlpComparison* result) {
+        const __m256i magnitudeMask = _mm256_set1_epi32(0x7FFFFFFF);
+        const __m256i infinity = _mm256_set1_epi32(0x7F800000);
+        const __m256i limit = _mm256_set1_epi32(static_cast<int32_t>(tolerance));
+        __m256i sumLow = _mm256_setzero_si256();
+        __m256i sumHigh = _mm256_setzero_si256();
+        __m256i maximum = _mm256_setzero_si256();
+        uint64_t outside = 0;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(expected + i));
+            const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(actual + i));
+            const __m256i magnitudeA = _mm256_and_si256(a, magnitudeMask);
+            const __m256i magnitudeB = _mm256_and_si256(b, magnitudeMask);
+            const __m256i signA = _mm256_srai_epi32(a, 31);
+            const __m256i signB = _mm256_srai_epi32(b, 31);
+            const __m256i orderedA = _mm256_sub_epi32(_mm256_xor_si256(magnitudeA, signA), signA);
+            const __m256i orderedB = _mm256_sub_epi32(_mm256_xor_si256(magnitudeB, signB), signB);
+            __m256i distance = _mm256_sub_epi32(_mm256_max_epi32(orderedA, orderedB), _mm256_min_epi32(orderedA, orderedB));
+
+            const __m256i nanA = _mm256_cmpgt_epi32(magnitudeA, infinity);
+            const __m256i nanB = _mm256_cmpgt_epi32(magnitudeB, infinity);
+            distance = _mm256_andnot_si256(_mm256_and_si256(nanA, nanB), _mm256_or_si256(distance, _mm256_or_si256(nanA, nanB)));
+
+            sumLow = _mm256_add_epi64(sumLow, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(distance)));
+            sumHigh = _mm256_add_epi64(sumHigh, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(distance, 1)));
+            maximum = _mm256_max_epu32(maximum, distance);
+            const __m256i within = _mm256_cmpeq_epi32(_mm256_min_epu32(distance, limit), distance);
+            outside += 8 - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(within)));
+        }
+
+        alignas(32) uint64_t sums[4];
+        alignas(32) uint32_t maxima[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(sums), _mm256_add_epi64(sumLow, sumHigh));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(maxima), maximum);
+        result->sumUlps = sums[0] + sums[1] + sums[2] + sums[3];
+        result->maxUlps = *std::max_element(maxima, maxima + 8);
+        result->outside = outside;
+        finishCompareUlp(expected, actual, i, n, tolerance, result);
+    }
+
+    // 32 x 32 -> 64-bit products of every lane with multiplier, split into high and low words. mul_epu32 only
+    // multiplies the even lanes, so the odd ones are shifted down for a second multiply.
+    AVX2_TARGET inline void mulHiLoAvx2(__m256i a, __m256i multiplier, __m256i& high, __m256i& low) {
+        const __m256i even = _mm256_mul_epu32(a, multiplier);
+        const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), multiplier);
+        high = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+        low = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+    }
+
+    // Eight blocks at a time, one per lane, transposed on the way out so each block's four words are contiguous.
+    AVX2_TARGET void avx2Philox(uint64_t key, uint64_t stream, uint64_t firstBlock, uint32_t* out, size_t blocks) {
+        const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m256i signBit = _mm256_set1_epi32(INT32_MIN);
+        const __m256i m0 = _mm256_set1_epi32(static_cast<int32_t>(philoxM0));
+        const __m256i m1 = _mm256_set1_epi32(static_cast<int32_t>(philoxM1));
+        size_t b = 0;
+        for (; b + 8 <= blocks; b += 8) {
+            const uint64_t counter = firstBlock + b;
+            const __m256i base = _mm256_set1_epi32(static_cast<int32_t>(counter));
+            __m256i c0 = _mm256_add_epi32(base, laneIndex);
+            // Lanes whose low word wrapped carry into the high word (unsigned compare via the flipped sign bit)
+            const __m256i carry = _mm256_cmpgt_epi32(_mm256_xor_si256(base, signBit), _mm256_xor_si256(c0, signBit));
+            __m256i c1 = _mm256_sub_epi32(_mm256_set1_epi32(static_cast<int32_t>(counter >> 32)), carry);
+            __m256i c2 = _mm256_set1_epi32(static_cast<int32_t>(stream));
+            __m256i c3 = _mm256_set1_epi32(static_cast<int32_t>(stream >> 32));
+            uint32_t k0 = static_cast<uint32_t>(key);
+            uint32_t k1 = static_cast<uint32_t>(key >> 32);
+            for (int round = 0; round < philoxRounds; round++) {
+                if (round > 0) {
+                    k0 += philoxW0;
+                    k1 += philoxW1;
+                }
+                __m256i high0, low0, high1, low1;
+                mulHiLoAvx2(c0, m0, high0, low0);
+                mulHiLoAvx2(c2, m1, high1, low1);
+                c0 = _mm256_xor_si256(_mm256_xor_si256(high1, c1), _mm256_set1_epi32(static_cast<int32_t>(k0)));
+                c2 = _mm256_xor_si256(_mm256_xor_si256(high0, c3), _mm256_set1_epi32(static_cast<int32_t>(k1)));
+                c1 = low1;
+                c3 = low0;
+            }
+
+            // unpack works within 128-bit halves: u0 holds blocks 0 | 4, u1 1 | 5, u2 2 | 6, u3 3 | 7
+            const __m256i t0 = _mm256_unpacklo_epi32(c0, c1);
+            const __m256i t1 = _mm256_unpackhi_epi32(c0, c1);
+            const __m256i t2 = _mm256_unpacklo_epi32(c2, c3);
+            const __m256i t3 = _mm256_unpackhi_epi32(c2, c3);
+            const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+            const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+            const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+            const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+            auto* destination = reinterpret_cast<__m256i*>(out + 4 * b);
+            _mm256_storeu_si256(destination, _mm256_permute2x128_si256(u0, u1, 0x20));
+            _mm256_storeu_si256(destination + 1, _mm256_permute2x128_si256(u2, u3, 0x20));
+            _mm256_storeu_si256(destination + 2, _mm256_permute2x128_si256(u0, u1, 0x31));
+            _mm256_storeu_si256(destination + 3, _mm256_permute2x128_si256(u2, u3, 0x31));
+        }
+        scalarPhilox(key, stream, firstBlock + b, out + 4 * b, blocks - b);
+    }
+
+    const SimdKernelTable avx2Kernels = {
+            SimdIsa::Avx2,
+            avx2AddArrays,
+            avx2ComplexOperation,
+            avx2Subtract,
+            avx2Multiply,
+            avx2Divide,
+            avx2Sin,
+            avx2Fill,
+            avx2Sum,
+            avx2Minimum,
+            avx2Maximum,
+            avx2Dot,
+            avx2SumOfSquares,
+            avx2SumFixed,
+            avx2HalfToFloat,
+            avx2FloatToHalf,
+            avx2Bfloat16ToFloat,
+            avx2FloatToBfloat16,
+            avx2CompareUlp,
+            avx2Philox,
+    };
+
+    // ------------------------------------------------------------------------------------------------------------
+    // AVX-512F: 16 lanes. Tails use masked loads/stores instead of a scalar loop.
+
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+    AVX512_TARGET inline __m512 sinAvx512(__m512 x) {
+        const __m512 q = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(invPi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m512 r = _mm512_fnmadd_ps(q, _mm512_set1_ps(piA), x);
+        r = _mm512_fnmadd_ps(q, _mm512_set1_ps(piB), r);
+        r = _mm512_fnmadd_ps(q, _mm512_set1_ps(piC), r);
+        r = _mm512_fnmadd_ps(q, _mm512_set1_ps(piD), r);
+
+        const __m512 s = _mm512_mul_ps(r, r);
+        const __m512i oddSign = _mm512_slli_epi32(_mm512_cvtps_epi32(q), 31);
+        r = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(r), oddSign));
+
+        __m512 u = _mm512_set1_ps(sinC9);
+        u = _mm512_fmadd_ps(u, s, _mm512_set1_ps(sinC7));
+        u = _mm512_fmadd_ps(u, s, _mm512_set1_ps(sinC5));
+        u = _mm512_fmadd_ps(u, s, _mm512_set1_ps(sinC3));
+        const __m512 result = _mm512_fmadd_ps(s, _mm512_mul_ps(u, r), r);
+        // See sinSse: zero inputs keep their sign
+        return _mm512_mask_mov_ps(result, _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_EQ_OQ), x);
+    }
+
+    AVX512_TARGET inline __m512 safeSinAvx512(__m512 x) {
+        const __m512 magnitude = _mm512_abs_ps(x);
+        const __mmask16 large = _mm512_cmp_ps_mask(magnitude, _mm512_set1_ps(sinReductionLimit), _CMP_NLT_UQ);
+        const __m512 result = sinAvx512(x);
+        if (large == 0)
+            return result;
+        // As for AVX2, only the out-of-range lanes are replaced
+        alignas(64) float inputs[16];
+        alignas(64) float lanes[16];
+        _mm512_store_ps(inputs, x);
+        _mm512_store_ps(lanes, result);
+        for (int lane = 0; lane < 16; lane++) {
+            if (large & (1u << lane))
+                lanes[lane] = std::sin(inputs[lane]);
+        }
+        return _mm512_load_ps(lanes);
+    }
+
+    AVX512_TARGET inline __mmask16 tailMask(size_t remaining) {
+        return static_cast<__mmask16>((1u << remaining) - 1u);
+    }
+
+#define AVX512_BINARY_KERNEL(name, intrinsic)                                                               \
+    AVX512_TARGET void name(const float* inA, const float* inB, float* outC, size_t n) {                    \
+        size_t i = 0;                                                                                       \
+        for (; i + 16 <= n; i += 16)                                                                        \
+            _mm512_storeu_ps(outC + i, intrinsic(_mm512_loadu_ps(inA + i), _mm512_loadu_ps(inB + i)));      \
+        if (i < n) {                                                                                        \
+            const __mmask16 mask = tailMask(n - i);                                                         \
+            const __m512 a = _mm512_maskz_loadu_ps(mask, inA + i);                                          \
+            const __m512 b = _mm512_mask_loadu_ps(_mm512_set1_ps(1.0f), mask, inB + i);                     \
+            _mm512_mask_storeu_ps(outC + i, mask, intrinsic(a, b));                                         \
+        }                                                                                                   \
+    }
+
+    AVX512_BINARY_KERNEL(avx512AddArrays, _mm512_add_ps)
+    AVX512_BINARY_KERNEL(avx512Subtract, _mm512_sub_ps)
+    AVX512_BINARY_KERNEL(avx512Multiply, _mm512_mul_ps)
+    AVX512_BINARY_KERNEL(avx512Divide, _mm512_div_ps)
+
+    AVX512_TARGET void avx512ComplexOperation(const float* inA, const float* inB, float* outC, size_t n) {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            const __m512 a = _mm512_loadu_ps(inA + i);
+            const __m512 product = _mm512_mul_ps(a, _mm512_loadu_ps(inB + i));
+            _mm512_storeu_ps(outC + i, _mm512_add_ps(safeSinAvx512(product), a));
+        }
+        if (i < n) {
+            const __mmask16 mask = tailMask(n - i);
+            const __m512 a = _mm512_maskz_loadu_ps(mask, inA + i);
+            const __m512 product = _mm512_mul_ps(a, _mm512_maskz_loadu_ps(mask, inB + i));
+            _mm512_mask_storeu_ps(outC + i, mask, _mm512_add_ps(safeSinAvx512(product), a));
+        }
+    }
+
+    AVX512_TARGET void avx512Sin(const float* in, float* out, size_t n) {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+            _mm512_storeu_ps(out + i, safeSinAvx512(_mm512_loadu_ps(in + i)));
+        if (i < n) {
+            const __mmask16 mask = tailMask(n - i);
+            _mm512_mask_storeu_ps(out + i, mask, safeSinAvx512(_mm512_maskz_loadu_ps(mask, in + i)));
+        }
+    }
+
+    AVX512_TARGET void avx512Fill(float value, float* out, size_t n) {
+        const __m512 v = _mm512_set1_ps(value);
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+            _mm512_storeu_ps(out + i, v);
+        if (i < n)
+            _mm512_mask_storeu_ps(out + i, tailMask(n - i), v);
+    }
+
+#define AVX512_REDUCE_KERNEL(name, identity, intrinsic, horizontal)                                \
+    AVX512_TARGET float name(const float* in, size_t n) {                                           \
+        const __m512 fill = _mm512_set1_ps(identity);                                               \
+        __m512 acc0 = fill;                                                                         \
+        __m512 acc1 = fill;                                                                         \
+        size_t i = 0;                                                                               \
+        for (; i + 32 <= n; i += 32) {                                                              \
+            acc0 = intrinsic(acc0, _mm512_loadu_ps(in + i));                                        \
+            acc1 = intrinsic(acc1, _mm512_loadu_ps(in + i + 16));                                   \
+        }                                                                                           \
+        for (; i + 16 <= n; i += 16)                                                                \
+            acc0 = intrinsic(acc0, _mm512_loadu_ps(in + i));                                        \
+        if (i < n)                                                                                  \
+            acc1 = intrinsic(acc1, _mm512_mask_loadu_ps(fill, tailMask(n - i), in + i));            \
+        return horizontal(intrinsic(acc0, acc1));                                                   \
+    }
+
+    AVX512_REDUCE_KERNEL(avx512Sum, 0.0f, _mm512_add_ps, _mm512_reduce_add_ps)
+    AVX512_REDUCE_KERNEL(avx512Minimum, INFINITY, _mm512_min_ps, _mm512_reduce_min_ps)
+    AVX512_REDUCE_KERNEL(avx512Maximum, -INFINITY, _mm512_max_ps, _mm512_reduce_max_ps)
+
+    AVX512_TARGET float avx512Dot(const float* inA, const float* inB, size_t n) {
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(inA + i), _mm512_loadu_ps(inB + i), acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(inA + i + 16), _mm512_loadu_ps(inB + i + 16), acc1);
+        }
+        for (; i + 16 <= n; i += 16)
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(inA + i), _mm512_loadu_ps(inB + i), acc0);
+        if (i < n) {
+            const __mmask16 mask = tailMask(n - i);
+            acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, inA + i), _mm512_maskz_loadu_ps(mask, inB + i), acc1);
+        }
+        return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    }
+
+    AVX512_TARGET float avx512SumOfSquares(const float* in, size_t n) {
+        return avx512Dot(in, in, n);
+    }
+
+    // s[r] holds lanes 16r to 16r + 15 of the fixed-shape sum.
+    template <bool Product, bool Compensated>
+    AVX512_TARGET void avx512FixedGroups(const float* inA, const float* inB, size_t groups, float* lanes, float* corrections) {
+        __m512 s[2], c[2];
+        for (int r = 0; r < 2; r++)
+            s[r] = c[r] = _mm512_setzero_ps();
+
+        for (size_t g = 0; g < groups; g++) {
+            for (int r = 0; r < 2; r++) {
+                const size_t i = g * fixedLanes + r * 16;
+                __m512 x = _mm512_loadu_ps(inA + i);
+                if (Product)
+                    x = _mm512_mul_ps(x, _mm512_loadu_ps(inB + i));
+                if (Compensated) {
+                    const __m512 t = _mm512_add_ps(s[r], x);
+                    const __mmask16 sLarger = _mm512_cmp_ps_mask(_mm512_abs_ps(s[r]), _mm512_abs_ps(x), _CMP_GE_OS);
+                    const __m512 fromS = _mm512_add_ps(_mm512_sub_ps(s[r], t), x);
+                    const __m512 fromX = _mm512_add_ps(_mm512_sub_ps(x, t), s[r]);
+                    c[r] = _mm512_add_ps(c[r], _mm512_mask_blend_ps(sLarger, fromX, fromS));
+                    s[r] = t;
+                } else {
+                    s[r] = _mm512_add_ps(s[r], x);
+                }
+            }
+        }
+
+        for (int r = 0; r < 2; r++) {
+            _mm512_storeu_ps(lanes + r * 16, s[r]);
+            _mm512_storeu_ps(corrections + r * 16, c[r]);
+        }
+    }
+
+    AVX512_TARGET void avx512HalfToFloat(const uint16_t* in, float* out, size_t n) {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+            _mm512_storeu_ps(out + i, _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i))));
+        scalarHalfToFloat(in + i, out + i, n - i);
+    }
+
+    AVX512_TARGET void avx512FloatToHalf(const float* in, uint16_t* out, size_t n) {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                                _mm512_cvtps_ph(_mm512_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+        scalarFloatToHalf(in + i, out + i, n - i);
+    }
+
+    AVX512_TARGET void avx512Bfloat16ToFloat(const uint16_t* in, float* out, size_t n) {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            const __m512i widened = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)));
+            _mm512_storeu_si512(out + i, _mm512_slli_epi32(widened, 16));
+        }
+        scalarBfloat16ToFloat(in + i, out + i, n - i);
+    }
+
+    AVX512_TARGET void avx512FloatToBfloat16(const float* in, uint16_t* out, size_t n) {
+        const __m512i magnitudeMask = _mm512_set1_epi32(0x7FFFFFFF);
+        const __m512i infinity = _mm512_set1_epi32(0x7F800000);
+        const __m512i roundingBias = _mm512_set1_epi32(0x7FFF);
+        const __m512i one = _mm512_set1_epi32(1);
+        const __m512i quietBit = _mm512_set1_epi32(0x40);
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            const __m512i bits = _mm512_loadu_si512(in + i);
+            const __mmask16 isNan = _mm512_cmpgt_epi32_mask(_mm512_and_si512(bits, magnitudeMask), infinity);
+            const __m512i lowestKept = _mm512_and_si512(_mm512_srli_epi32(bits, 16), one);
+            const __m512i rounded = _mm512_srli_epi32(_mm512_add_epi32(bits, _mm512_add_epi32(roundingBias, lowestKept)), 16);
+            const __m512i quieted = _mm512_or_si512(_mm512_srli_epi32(bits, 16), quietBit);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm512_cvtepi32_epi16(_mm512_mask_blend_epi32(isNan, rounded, quieted)));
+        }
+        scalarFloatToBfloat16(in + i, out + i, n - i);
+    }
+
+    AVX512_TARGET void avx512SumFixed(const float* inA, const float* inB, size_t n, float* sum, float* compensation) {
+        float lanes[fixedLanes];
+        float corrections[fixedLanes];
+        const size_t groups = n / fixedLanes;
+        if (inB)
+            compensation ? avx512FixedGroups<true, true>(inA, inB, groups, lanes, corrections)
+                         : avx512FixedGroups<true, false>(inA, inB, groups, lanes, corrections);
+        else
+            compensation ? avx512FixedGroups<false, true>(inA, inB, groups, lanes, corrections)
+                         : avx512FixedGroups<false, false>(inA, inB, groups, lanes, corrections);
+        finishFixedSum(inA, inB, groups * fixedLanes, n, lanes, corrections, sum, compensation);
+    }
+
+    AVX512_TARGET void avx512CompareUlp(const float* expected, const float* actual, size_t n, uint32_t tolerance, UlpComparison* result) {
+        const __m512i magnitudeMask = _mm512_set1_epi32(0x7FFFFFFF);
+        const __m512i infinity = _mm512_set1_epi32(0x7F800000);
+        const __m512i limit = _mm512_set1_epi32(static_cast<int32_t>(tolerance));
+        const __m512i allOnes = _mm512_set1_epi32(-1);
+        __m512i sumLow = _mm512_setzero_si512();
+        __m512i sumHigh = _mm512_setzero_si512();
+        __m512i maximum = _mm512_setzero_si512();
+        uint64_t outside = 0;
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            const __m512i a = _mm512_loadu_si512(expected + i);
+            const __m512i b = _mm512_loadu_si512(actual + i);
+            const __m512i magnitudeA = _mm512_and_si512(a, magnitudeMask);
+            const __m512i magnitudeB = _mm512_and_si512(b, magnitudeMask);
+            const __m512i signA = _mm512_srai_epi32(a, 31);
+            const __m512i signB = _mm512_srai_epi32(b, 31);
+            const __m512i orderedA = _mm512_sub_epi32(_mm512_xor_si512(magnitudeA, signA), signA);
+            const __m512i orderedB = _mm512_sub_epi32(_mm512_xor_si512(magnitudeB, signB), signB);
+            __m512i distance = _mm512_sub_epi32(_mm512_max_epi32(orderedA, orderedB), _mm512_min_epi32(orderedA, orderedB));
+
+            const __mmask16 nanA = _mm512_cmpgt_epi32_mask(magnitudeA, infinity);
+            const __mmask16 nanB = _mm512_cmpgt_epi32_mask(magnitudeB, infinity);
+            distance = _mm512_mask_mov_epi32(distance, static_cast<__mmask16>(nanA | nanB), allOnes);
+            distance = _mm512_maskz_mov_epi32(static_cast<__mmask16>(~(nanA & nanB)), distance);
+
+            sumLow = _mm512_add_epi64(sumLow, _mm512_cvtepu32_epi64(_mm512_castsi512_si256(distance)));
+            sumHigh = _mm512_add_epi64(sumHigh, _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(distance, 1)));
+            maximum = _mm512_max_epu32(maximum, distance);
+            outside += __builtin_popcount(_mm512_cmpgt_epu32_mask(distance, limit));
+        }
+
+        result->sumUlps = static_cast<uint64_t>(_mm512_reduce_add_epi64(_mm512_add_epi64(sumLow, sumHigh)));
+        result->maxUlps = _mm512_reduce_max_epu32(maximum);
+        result->outside = outside;
+        finishCompareUlp(expected, actual, i, n, tolerance, result);
+    }
+
+    AVX512_TARGET inline void mulHiLoAvx512(__m512i a, __m512i multiplier, __m512i& high, __m512i& low) {
+        const __m512i even = _mm512_mul_epu32(a, multiplier);
+        const __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), multiplier);
+        high = _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(even, 32), odd);
+        low = _mm512_mask_blend_epi32(0xAAAA, even, _mm512_slli_epi64(odd, 32));
+    }
+
+    AVX512_TARGET void avx512Philox(uint64_t key, uint64_t stream, uint64_t firstBlock, uint32_t* out, size_t blocks) {
+        const __m512i laneIndex = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        const __m512i m0 = _mm512_set1_epi32(static_cast<int32_t>(philoxM0));
+        const __m512i m1 = _mm512_set1_epi32(static_cast<int32_t>(philoxM1));
+        size_t b = 0;
+        for (; b + 16 <= blocks; b += 16) {
+            const uint64_t counter = firstBlock + b;
+            const __m512i base = _mm512_set1_epi32(static_cast<int32_t>(counter));
+            __m512i c0 = _mm512_add_epi32(base, laneIndex);
+            const __mmask16 carry = _mm512_cmplt_epu32_mask(c0, base);
+            const __m512i highBase = _mm512_set1_epi32(static_cast<int32_t>(counter >> 32));
+            __m512i c1 = _mm512_mask_add_epi32(highBase, carry, highBase, _mm512_set1_epi32(1));
+            __m512i c2 = _mm512_set1_epi32(static_cast<int32_t>(stream));
+            __m512i c3 = _mm512_set1_epi32(static_cast<int32_t>(stream >> 32));
+            uint32_t k0 = static_cast<uint32_t>(key);
+            uint32_t k1 = static_cast<uint32_t>(key >> 32);
+            for (int round = 0; round < philoxRounds; round++) {
+                if (round > 0) {
+                    k0 += philoxW0;
+                    k1 += philoxW1;
+                }
+                __m512i high0, low0, high1, low1;
+                mulHiLoAvx512(c0, m0, high0, low0);
+                mulHiLoAvx512(c2, m1, high1, low1);
+                c0 = _mm512_xor_si512(_mm512_xor_si512(high1, c1), _mm512_set1_epi32(static_cast<int32_t>(k0)));
+                c2 = _mm512_xor_si512(_mm512_xor_si512(high0, c3), _mm512_set1_epi32(static_cast<int32_t>(k1)));
+                c1 = low1;
+                c3 = low0;
+            }
+
+            // As for AVX2, u0..u3 hold blocks 4q + 0..3 of 128-bit lane q; two rounds of shuffles gather each run of
+            // four blocks into one register
+            const __m512i t0 = _mm512_unpacklo_epi32(c0, c1);
+            const __m512i t1 = _mm512_unpackhi_epi32(c0, c1);
+            const __m512i t2 = _mm512_unpacklo_epi32(c2, c3);
+            const __m512i t3 = _mm512_unpackhi_epi32(c2, c3);
+            const __m512i u0 = _mm512_unpacklo_epi64(t0, t2);
+            const __m512i u1 = _mm512_unpackhi_epi64(t0, t2);
+            const __m512i u2 = _mm512_unpacklo_epi64(t1, t3);
+            const __m512i u3 = _mm512_unpackhi_epi64(t1, t3);
+            const __m512i v0 = _mm512_shuffle_i32x4(u0, u1, _MM_SHUFFLE(2, 0, 2, 0)); // 0 8 1 9
+            const __m512i v1 = _mm512_shuffle_i32x4(u2, u3, _MM_SHUFFLE(2, 0, 2, 0)); // 2 10 3 11
+            const __m512i v2 = _mm512_shuffle_i32x4(u0, u1, _MM_SHUFFLE(3, 1, 3, 1)); // 4 12 5 13
+            const __m512i v3 = _mm512_shuffle_i32x4(u2, u3, _MM_SHUFFLE(3, 1, 3, 1)); // 6 14 7 15
+            uint32_t* destination = out + 4 * b;
+            _mm512_storeu_si512(destination, _mm512_shuffle_i32x4(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm512_storeu_si512(destination + 16, _mm512_shuffle_i32x4(v2, v3, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm512_storeu_si512(destination + 32, _mm512_shuffle_i32x4(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+            _mm512_storeu_si512(destination + 48, _mm512_shuffle_i32x4(v2, v3, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+        scalarPhilox(key, stream, firstBlock + b, out + 4 * b, blocks - b);
+    }
+
+    const SimdKernelTable avx512Kernels = {
+            SimdIsa::Avx512,
+            avx512AddArrays,
+            avx512ComplexOperation,
+            avx512Subtract,
+            avx512Multiply,
+            avx512Divide,
+            avx512Sin,
+            avx512Fill,
+            avx512Sum,
+            avx512Minimum,
+            avx512Maximum,
+            avx512Dot,
+            avx512SumOfSquares,
+            avx512SumFixed,
+            avx512HalfToFloat,
+            avx512FloatToHalf,
+            avx512Bfloat16ToFloat,
+            avx512FloatToBfloat16,
+            avx512CompareUlp,
+            avx512Philox,
+    };
+}
+
+const SimdKernelTable* SimdKernelsDetail::sse42Table() { return &sse42Kernels; }
+const SimdKernelTable* SimdKernelsDetail::avx2Table() { return &avx2Kernels; }
+const SimdKernelTable* SimdKernelsDetail::avx512Table() { return &avx512Kernels; }
+
+#else
+
+const SimdKernelTable* SimdKernelsDetail::sse42Table() { return nullptr; }
+const SimdKernelTable* SimdKernelsDetail::avx2Table() { return nullptr; }
+const SimdKernelTable* SimdKernelsDetail::avx512Table() { return nullptr; }
+
+#endif
@@ -0,0 +1,158 @@
+//
+// ThreadPool.cpp
+//
+
+#include "ThreadPool.h"
+#include "../trace/Trace.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+namespace {
+    // Set while a thread is executing a parallelFor body, so nested calls do not deadlock on the pool.
+    thread_local bool insideParallelRegion = false;
+
+    std::mutex sharedPoolMutex;
+    std::unique_ptr<ThreadPool> sharedPool;
+
+    size_t resolveThreadCount(size_t requested) {
+        if (requested > 0)
+            return requested;
+        return std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+}
+
+ThreadPool::ThreadPool(size_t numThreads) {
+    const size_t totalThreads = resolveThreadCount(numThreads);
+    workers.reserve(totalThreads - 1);
+    for (size_t i = 1; i < totalThreads; ++i)
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+    std::lock_guard<std::mutex> lock(sharedPoolMutex);
+    if (!sharedPool)
+        sharedPool = std::make_unique<ThreadPool>();
+    return *sharedPool;
+}
+
+void ThreadPool::resizeShared(size_t numThreads) {
+    std::lock_guard<std::mutex> lock(sharedPoolMutex);
+    if (sharedPool && sharedPool->threadCount() == resolveThreadCount(numThreads))
+        return;
+    sharedPool.reset();
+    sharedPool = std::make_unique<ThreadPool>(numThreads);
+}
+
+void ThreadPool::parallelFor(size_t count, const RangeFunction& body, Partitioning partitioning,
+                             size_t grainSize, size_t alignment) {
+    if (count == 0)
+        return;
+
+    // Nothing to share, or already on a pool thread: run inline.
+    if (workers.empty() || insideParallelRegion) {
+        body(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> submitLock(submitMutex);
+
+    const size_t participants = threadCount();
+    if (grainSize == 0)
+        grainSize = std::max<size_t>(1024, count / (participants * 8));
+
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        jobBody = &body;
+        jobCount = count;
+        jobGrain = grainSize;
+        jobAlignment = std::max<size_t>(1, alignment);
+        jobPartitioning = partitioning;
+        jobError = nullptr;
+        nextIndex.store(0, std::memory_order_relaxed);
+        pendingWorkers.store(workers.size(), std::memory_order_relaxed);
+        ++generation;
+    }
+    wakeCondition.notify_all();
+
+    runParticipant(0);
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        doneCondition.wait(lock, [this] { return pendingWorkers.load(std::memory_order_acquire) == 0; });
+        error = jobError;
+        jobBody = nullptr;
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void ThreadPool::workerLoop(size_t participantIndex) {
+    Trace::setThreadName("ThreadPool worker " + std::to_string(participantIndex));
+    uint64_t seenGeneration = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            wakeCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping)
+                return;
+            seenGeneration = generation;
+        }
+
+        runParticipant(participantIndex);
+
+        if (pendingWorkers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // Take the lock so the notify cannot slip between the caller's predicate check and its wait.
+            std::lock_guard<std::mutex> lock(stateMutex);
+            doneCondition.notify_one();
+        }
+    }
+}
+
+void ThreadPool::runParticipant(size_t participantIndex) {
+    insideParallelRegion = true;
+
+    try {
+        if (jobPartitioning == Partitioning::Static) {
+            const size_t participants = threadCount();
+            auto boundary = [&](size_t index) {
+                if (index >= participants)
+                    return jobCount;
+                const size_t raw = jobCount / participants * index + (jobCount % participants) * index / participants;
+                return std::min(jobCount, raw - raw % jobAlignment);
+            };
+
+            const size_t begin = boundary(participantIndex);
+            const size_t end = boundary(participantIndex + 1);
+            if (begin < end)
+                (*jobBody)(begin, end);
+        } else {
+            while (true) {
+                const size_t begin = nextIndex.fetch_add(jobGrain, std::memory_order_relaxed);
+                if (begin >= jobCount)
+                    break;
+                (*jobBody)(begin, std::min(jobCount, begin + jobGrain));
+            }
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!jobError)
+            jobError = std::current_exception();
+    }
+
+    insideParallelRegion = false;
+}
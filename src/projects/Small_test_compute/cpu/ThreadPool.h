@@ -0,0 +1,73 @@
+//
+// ThreadPool.h
+//
+
+#ifndef HELLO_METAL_THREADPOOL_H
+#define HELLO_METAL_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // How a parallelFor range is divided between the participating threads.
+    //      Static:  one contiguous slice per thread. Lowest overhead; best for uniform, bandwidth-bound work.
+    //      Dynamic: threads repeatedly claim grain-sized pieces from a shared counter. Balances uneven work.
+    enum class Partitioning { Static, Dynamic };
+
+    // Body of a parallelFor; called with a half-open range [begin, end).
+    using RangeFunction = std::function<void(size_t begin, size_t end)>;
+
+    // numThreads includes the calling thread, so a pool of N spawns N-1 workers. Zero selects hardware_concurrency.
+    explicit ThreadPool(size_t numThreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t threadCount() const { return workers.size() + 1; }
+
+    // Splits [0, count) across the pool and blocks until every piece has run. The calling thread takes part.
+    // Static boundaries are rounded to multiples of alignment (in elements) so SIMD loops and cache lines are not
+    // split between threads; grainSize is the piece size for Dynamic (zero picks one from the range and pool size).
+    // Calls made from inside a running body execute serially on the calling thread.
+    void parallelFor(size_t count, const RangeFunction& body, Partitioning partitioning = Partitioning::Static,
+                     size_t grainSize = 0, size_t alignment = 16);
+
+    // Process-wide pool used by the ArrayAdder CPU paths. resizeShared must not race with work on the shared pool.
+    static ThreadPool& shared();
+    static void resizeShared(size_t numThreads);
+
+private:
+    void workerLoop(size_t participantIndex);
+    void runParticipant(size_t participantIndex);
+
+    std::vector<std::thread> workers;
+
+    std::mutex submitMutex; // Serialises callers; one job is in flight at a time.
+    std::mutex stateMutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    // Current job. Written under stateMutex before generation is bumped.
+    const RangeFunction* jobBody = nullptr;
+    size_t jobCount = 0;
+    size_t jobGrain = 0;
+    size_t jobAlignment = 1;
+    Partitioning jobPartitioning = Partitioning::Static;
+    std::exception_ptr jobError;
+
+    alignas(64) std::atomic<size_t> nextIndex{0};
+    alignas(64) std::atomic<size_t> pendingWorkers{0};
+};
+
+#endif //HELLO_METAL_THREADPOOL_H
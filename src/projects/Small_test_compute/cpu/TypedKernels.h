@@ -0,0 +1,119 @@
+//
+// TypedKernels.h
+//
+// The element-wise operations (types/ElementwiseOp.h) for every element type in ElementTypes.h. Storage is the type in
+// memory, Compute the type the arithmetic runs in (ComputeTypeOf<Storage> unless a mixed-precision pair is asked for).
+// Each operation and pair is its own instantiation, so the widening, arithmetic and narrowing are resolved at compile
+// time.
+//
+
+#ifndef HELLO_METAL_TYPEDKERNELS_H
+#define HELLO_METAL_TYPEDKERNELS_H
+
+#include "SimdKernels.h"
+#include "../device/KernelRegistry.h"
+#include "../types/ElementTypes.h"
+#include "../types/ElementwiseOp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <type_traits>
+
+// Converting copy from From to To. Half and BFloat16 to and from float go through the SIMD converters; everything
+// else is a static_cast per element (integers narrow by wrapping).
+template<typename From, typename To>
+void convertElements(const From* in, To* out, size_t n) {
+    if constexpr (std::is_same<From, To>::value) {
+        std::copy(in, in + n, out);
+    } else if constexpr (std::is_same<From, Half>::value && std::is_same<To, float>::value) {
+        SimdKernels::active().halfToFloat(reinterpret_cast<const uint16_t*>(in), out, n);
+    } else if constexpr (std::is_same<From, float>::value && std::is_same<To, Half>::value) {
+        SimdKernels::active().floatToHalf(in, reinterpret_cast<uint16_t*>(out), n);
+    } else if constexpr (std::is_same<From, BFloat16>::value && std::is_same<To, float>::value) {
+        SimdKernels::active().bfloat16ToFloat(reinterpret_cast<const uint16_t*>(in), out, n);
+    } else if constexpr (std::is_same<From, float>::value && std::is_same<To, BFloat16>::value) {
+        SimdKernels::active().floatToBfloat16(in, reinterpret_cast<uint16_t*>(out), n);
+    } else {
+        for (size_t i = 0; i < n; i++)
+            out[i] = static_cast<To>(in[i]);
+    }
+}
+
+// Name of the typed device kernel (typed.metal) and its CPU twin: base_<storage>, plus _<compute> for a non-default
+// compute type. float with float compute is the original kernel, so it keeps the plain name.
+template<typename Storage, typename Compute = ComputeTypeOf<Storage>>
+std::string typedKernelName(const std::string& base) {
+    if (std::is_same<Storage, float>::value && std::is_same<Compute, float>::value)
+        return base;
+    std::string name = base + "_" + ElementTraits<Storage>::suffix;
+    if (!std::is_same<Compute, ComputeTypeOf<Storage>>::value)
+        name += std::string("_") + ElementTraits<Compute>::suffix;
+    return name;
+}
+
+// Registry id of op's kernel for this storage/compute pair, for looking up its pipeline. Asking for a pair without a
+// kernel throws std::invalid_argument (complex_operation only exists for floating-point compute types).
+template<typename Storage, typename Compute = ComputeTypeOf<Storage>>
+constexpr compute::KernelId elementwiseKernelId(ElementwiseOp op) {
+    const char* base = elementwiseOpName(op);
+    if constexpr (std::is_same<Storage, float>::value && std::is_same<Compute, float>::value)
+        return compute::kernelId({base});
+    else if constexpr (std::is_same<Compute, ComputeTypeOf<Storage>>::value)
+        return compute::kernelId({base, ElementTraits<Storage>::suffix});
+    else
+        return compute::kernelId({base, ElementTraits<Storage>::suffix, ElementTraits<Compute>::suffix});
+}
+
+// Whether op can run with Compute arithmetic.
+template<typename Compute>
+constexpr bool supportsElementwise(ElementwiseOp op) {
+    return visitElementwiseOp(op, [](auto constant) {
+        return !ElementwiseTraits<decltype(constant)::value>::needsFloatingPoint || ElementTraits<Compute>::isFloatingPoint;
+    });
+}
+
+// The float kernel in SimdKernelTable that implements Op.
+template<ElementwiseOp Op>
+constexpr auto simdElementwise = nullptr;
+template<>
+constexpr auto simdElementwise<ElementwiseOp::Add> = &SimdKernelTable::addArrays;
+template<>
+constexpr auto simdElementwise<ElementwiseOp::Complex> = &SimdKernelTable::complexOperation;
+
+// Operands are widened a block at a time into stack buffers, so the float cases reuse the SIMD arithmetic kernels
+// and 16-bit data only costs a conversion per element on top.
+template<typename Storage, typename Compute = ComputeTypeOf<Storage>>
+struct TypedKernels {
+    static constexpr size_t blockSize = 1024;
+
+    // outC = Op(inA, inB), element by element.
+    template<ElementwiseOp Op>
+    static void apply(const Storage* inA, const Storage* inB, Storage* outC, size_t n) {
+        static_assert(!ElementwiseTraits<Op>::needsFloatingPoint || ElementTraits<Compute>::isFloatingPoint,
+                      "this operation needs a floating-point compute type");
+        if constexpr (std::is_same<Storage, float>::value && std::is_same<Compute, float>::value) {
+            (SimdKernels::active().*simdElementwise<Op>)(inA, inB, outC, n);
+        } else {
+            Compute a[blockSize];
+            Compute b[blockSize];
+            for (size_t first = 0; first < n; first += blockSize) {
+                const size_t count = std::min(blockSize, n - first);
+                convertElements(inA + first, a, count);
+                convertElements(inB + first, b, count);
+                if constexpr (std::is_same<Compute, float>::value) {
+                    (SimdKernels::active().*simdElementwise<Op>)(a, b, a, count);
+                } else {
+                    for (size_t i = 0; i < count; i++)
+                        a[i] = ElementwiseTraits<Op>::apply(a[i], b[i]);
+                }
+                convertElements(a, outC + first, count);
+            }
+        }
+    }
+
+    template<ElementwiseOp Op>
+    static constexpr bool supports = !ElementwiseTraits<Op>::needsFloatingPoint || ElementTraits<Compute>::isFloatingPoint;
+};
+
+#endif //HELLO_METAL_TYPEDKERNELS_H
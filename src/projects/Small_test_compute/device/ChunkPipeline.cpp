@@ -0,0 +1,111 @@
+//
+// ChunkPipeline.cpp
+//
+
+#include "ChunkPipeline.h"
+
+#include <algorithm>
+
+namespace compute {
+
+    ChunkPipeline::ChunkPipeline(ComputeSession& session, size_t depth, size_t buffersPerSlot, size_t bytesPerBuffer)
+            : session(session) {
+        slots.reserve(std::max<size_t>(1, depth));
+        for (size_t i = 0; i < std::max<size_t>(1, depth); ++i) {
+            auto slot = std::make_unique<Slot>();
+            slot->slotIndex = i;
+            slot->available = std::make_unique<Semaphore>(1);
+            for (size_t j = 0; j < buffersPerSlot; ++j) {
+                auto buffer = session.acquireBuffer(bytesPerBuffer);
+                if (!buffer)
+                    allocated = false;
+                slot->buffers.push_back(std::move(buffer));
+            }
+            slots.push_back(std::move(slot));
+        }
+    }
+
+    ChunkPipeline::~ChunkPipeline() {
+        drain();
+        // The last handler signals its slot while holding waiterMutex; wait for it to let go
+        std::lock_guard<std::mutex> lock(waiterMutex);
+        for (auto& slot : slots) {
+            for (auto& buffer : slot->buffers)
+                session.recycleBuffer(std::move(buffer));
+        }
+    }
+
+    ChunkPipeline::Slot& ChunkPipeline::acquire() {
+        Slot& slot = *slots[nextSlot];
+        nextSlot = (nextSlot + 1) % slots.size();
+
+        const auto waitStart = std::chrono::steady_clock::now();
+        if (!slot.available->tryWait())
+            slot.available->wait();
+        chunksInFlight.fetch_add(1, std::memory_order_relaxed);
+        acquired(slot, waitStart);
+        return slot;
+    }
+
+    void ChunkPipeline::acquireAsync(std::function<void(Slot&)> onAvailable) {
+        Slot& slot = *slots[nextSlot];
+        nextSlot = (nextSlot + 1) % slots.size();
+        const auto waitStart = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(waiterMutex);
+            if (!slot.available->tryWait()) {
+                slot.waiter = std::move(onAvailable);
+                slot.waitStart = waitStart;
+                return;
+            }
+        }
+        chunksInFlight.fetch_add(1, std::memory_order_relaxed);
+        acquired(slot, waitStart);
+        onAvailable(slot);
+    }
+
+    void ChunkPipeline::releaseOnCompletion(CommandBuffer& commandBuffer, Slot& slot, std::function<void(Slot&)> onCompleted) {
+        Slot* owner = &slot;
+        commandBuffer.addCompletedHandler([this, owner, onCompleted = std::move(onCompleted)](CommandBuffer*) {
+            if (onCompleted)
+                onCompleted(*owner);
+            release(*owner);
+        });
+    }
+
+    void ChunkPipeline::release(Slot& slot) {
+        session.pipelineMetrics().slotReleased(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - slot.acquiredAt).count()));
+
+        std::function<void(Slot&)> waiter;
+        {
+            std::lock_guard<std::mutex> lock(waiterMutex);
+            waiter = std::move(slot.waiter);
+            slot.waiter = nullptr;
+            if (!waiter) {
+                chunksInFlight.fetch_sub(1, std::memory_order_relaxed);
+                // Last thing this touches: after this the slot may be refilled (or the pipeline destroyed, which first
+                // takes waiterMutex)
+                slot.available->signal();
+                return;
+            }
+        }
+        // Handed over while still taken, so it counts as in flight throughout
+        acquired(slot, slot.waitStart);
+        waiter(slot);
+    }
+
+    void ChunkPipeline::acquired(Slot& slot, std::chrono::steady_clock::time_point waitStart) {
+        slot.acquiredAt = std::chrono::steady_clock::now();
+        const auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(slot.acquiredAt - waitStart).count();
+        waitNanoseconds.fetch_add(waited, std::memory_order_relaxed);
+        session.pipelineMetrics().slotAcquired(static_cast<uint64_t>(waited));
+    }
+
+    void ChunkPipeline::drain() {
+        for (auto& slot : slots) {
+            slot->available->wait();
+            slot->available->signal();
+        }
+    }
+}
@@ -0,0 +1,92 @@
+//
+// ChunkPipeline.h
+//
+
+#ifndef HELLO_METAL_CHUNKPIPELINE_H
+#define HELLO_METAL_CHUNKPIPELINE_H
+
+#include "ComputeDevice.h"
+#include "ComputeSession.h"
+#include "Semaphore.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace compute {
+
+    // Ring of staging buffer sets for streaming a long vector through the device one chunk at a time. Each slot holds
+    // the buffers one chunk needs (e.g. inA, inB, outC). A slot is handed out again only after the completion handler
+    // of the command buffer that last used it has run, so the host can never overwrite a buffer the device is still
+    // reading. acquire() blocks while every slot is in flight, which is the pipeline's backpressure. Waits and slot
+    // holding times are also recorded in the session's PipelineMetrics.
+    class ChunkPipeline {
+    public:
+        class Slot {
+        public:
+            Buffer* buffer(size_t index) { return buffers[index].get(); }
+            size_t index() const { return slotIndex; }
+
+        private:
+            friend class ChunkPipeline;
+            std::vector<std::unique_ptr<Buffer>> buffers;
+            std::unique_ptr<Semaphore> available; // Count 1 while the slot is free
+            std::function<void(Slot&)> waiter; // Set by acquireAsync while the slot is in flight
+            std::chrono::steady_clock::time_point waitStart; // When waiter was set
+            std::chrono::steady_clock::time_point acquiredAt; // When the chunk holding it was handed the slot
+            size_t slotIndex = 0;
+        };
+
+        // depth is the number of chunks allowed in flight; each slot gets buffersPerSlot buffers of bytesPerBuffer.
+        ChunkPipeline(ComputeSession& session, size_t depth, size_t buffersPerSlot, size_t bytesPerBuffer);
+        // Waits for outstanding chunks, then hands the buffers back to the session.
+        ~ChunkPipeline();
+
+        ChunkPipeline(const ChunkPipeline&) = delete;
+        ChunkPipeline& operator=(const ChunkPipeline&) = delete;
+
+        // False if the session could not allocate every staging buffer.
+        bool valid() const { return allocated; }
+
+        // Next slot in the ring, blocking until its previous chunk has completed.
+        Slot& acquire();
+        // Non-blocking acquire: onAvailable gets the next slot, either right away on this thread when it is free, or
+        // from the completion handler that frees it (the slot then passes straight to onAvailable without becoming
+        // free in between). Like acquire(), one producer calls it once per chunk, and not again until onAvailable has
+        // been called for the previous request.
+        void acquireAsync(std::function<void(Slot&)> onAvailable);
+
+        // Adds a completion handler to commandBuffer that runs onCompleted (e.g. copying the result out of the slot)
+        // and then returns the slot to the ring. Call once per acquire(), before committing.
+        void releaseOnCompletion(CommandBuffer& commandBuffer, Slot& slot, std::function<void(Slot&)> onCompleted = {});
+        // Returns a slot to the ring directly, for callers that read it back after the device is done themselves.
+        // Use instead of releaseOnCompletion, once per acquire().
+        void release(Slot& slot);
+
+        // Blocks until every chunk handed out so far has completed.
+        void drain();
+
+        size_t depth() const { return slots.size(); }
+        size_t inFlight() const { return chunksInFlight.load(std::memory_order_relaxed); }
+        // Total time acquire() spent blocked, or acquireAsync requests waited, on the device.
+        std::chrono::nanoseconds backpressureWait() const { return std::chrono::nanoseconds(waitNanoseconds.load(std::memory_order_relaxed)); }
+
+    private:
+        // Bookkeeping for a slot just handed to a chunk, after waiting since waitStart.
+        void acquired(Slot& slot, std::chrono::steady_clock::time_point waitStart);
+
+        ComputeSession& session;
+        std::vector<std::unique_ptr<Slot>> slots;
+        size_t nextSlot = 0;
+        std::mutex waiterMutex; // Orders acquireAsync against the handlers that free slots
+        bool allocated = true;
+        std::atomic<size_t> chunksInFlight{0};
+        std::atomic<long long> waitNanoseconds{0};
+    };
+}
+
+#endif //HELLO_METAL_CHUNKPIPELINE_H
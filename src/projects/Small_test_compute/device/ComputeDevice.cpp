@@ -0,0 +1,111 @@
+//
+// ComputeDevice.cpp
+//
+
+#include "ComputeDevice.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace compute {
+
+#if !defined(HELLO_METAL_HAS_METAL)
+    // MetalDevice.mm provides the real one on Apple platforms.
+    std::unique_ptr<Device> createMetalDevice() {
+        return nullptr;
+    }
+#endif
+
+    FunctionConstants::FunctionConstants(std::initializer_list<std::pair<uint32_t, uint32_t>> values) {
+        for (const auto& [index, value] : values)
+            set(index, value);
+    }
+
+    FunctionConstants& FunctionConstants::set(uint32_t index, uint32_t value) {
+        auto position = std::lower_bound(entries.begin(), entries.end(), index,
+                                         [](const std::pair<uint32_t, uint32_t>& entry, uint32_t key) { return entry.first < key; });
+        if (position != entries.end() && position->first == index)
+            position->second = value;
+        else
+            entries.insert(position, {index, value});
+        return *this;
+    }
+
+    bool FunctionConstants::get(uint32_t index, uint32_t& value) const {
+        for (const auto& entry : entries) {
+            if (entry.first == index) {
+                value = entry.second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string specialisedName(const std::string& functionName, const FunctionConstants& constants) {
+        if (constants.empty())
+            return functionName;
+        std::string name = functionName + "[";
+        for (size_t i = 0; i < constants.values().size(); ++i) {
+            if (i > 0)
+                name += ",";
+            name += std::to_string(constants.values()[i].first) + "=" + std::to_string(constants.values()[i].second);
+        }
+        return name + "]";
+    }
+
+    bool parseSpecialisedName(const std::string& name, std::string& functionName, FunctionConstants& constants) {
+        constants = FunctionConstants();
+        const size_t open = name.find('[');
+        if (open == std::string::npos) {
+            functionName = name;
+            return !name.empty();
+        }
+        if (open == 0 || name.back() != ']')
+            return false;
+        functionName = name.substr(0, open);
+
+        std::istringstream list(name.substr(open + 1, name.size() - open - 2));
+        std::string entry;
+        while (std::getline(list, entry, ',')) {
+            const size_t equals = entry.find('=');
+            if (equals == std::string::npos)
+                return false;
+            try {
+                constants.set(static_cast<uint32_t>(std::stoul(entry.substr(0, equals))),
+                              static_cast<uint32_t>(std::stoul(entry.substr(equals + 1))));
+            } catch (const std::exception&) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::unique_ptr<Device> createDefaultDevice() {
+        const char* requestedValue = std::getenv("HELLO_METAL_COMPUTE_BACKEND");
+        const std::string requested = requestedValue ? requestedValue : "";
+        if (requested == "cpu")
+            return createCpuDevice();
+        if (!requested.empty() && requested != "metal") {
+            std::cerr << "HELLO_METAL_COMPUTE_BACKEND: unknown backend \"" << requested
+                      << "\" (expected \"cpu\" or \"metal\"); choosing automatically." << std::endl;
+        }
+
+        if (auto device = createMetalDevice())
+            return device;
+        if (requested == "metal")
+            std::cerr << "HELLO_METAL_COMPUTE_BACKEND=metal, but no Metal device is available; using the CPU backend." << std::endl;
+        return createCpuDevice();
+    }
+
+    const char* backendName(Backend backend) {
+        switch (backend) {
+            case Backend::Metal: return "metal";
+            case Backend::Cpu: return "cpu";
+        }
+        return "unknown";
+    }
+}
@@ -0,0 +1,187 @@
+//
+// ComputeDevice.h
+//
+// Backend-neutral version of the slice of the Metal object model that ArrayAdder uses: device, command queue,
+// shared-storage buffers, library, pipeline state, command buffer and compute encoder. Two backends implement it:
+//      Metal (MetalDevice.mm, macOS only) forwards to metal-cpp.
+//      CPU   (CpuDevice.cpp) runs kernels on a ThreadPool with the same asynchronous semantics, so scheduling code
+//            written against this layer can be run and profiled anywhere.
+//
+// Naming follows metal-cpp so code reads the same as before, but ownership is C++: objects returned by new*() are
+// unique_ptrs, and command buffers are shared_ptrs because the queue keeps them alive until they complete.
+//
+
+#ifndef HELLO_METAL_COMPUTEDEVICE_H
+#define HELLO_METAL_COMPUTEDEVICE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace compute {
+
+    enum class Backend { Metal, Cpu };
+
+    struct Size {
+        size_t width = 1;
+        size_t height = 1;
+        size_t depth = 1;
+    };
+
+    // Contents are visible to both the host and the device (MTL::ResourceStorageModeShared).
+    class Buffer {
+    public:
+        virtual ~Buffer() = default;
+        virtual void* contents() = 0;
+        virtual size_t length() const = 0;
+    };
+
+    class ComputePipelineState {
+    public:
+        virtual ~ComputePipelineState() = default;
+        virtual const std::string& functionName() const = 0;
+        virtual size_t threadExecutionWidth() const = 0;
+        virtual size_t maxTotalThreadsPerThreadgroup() const = 0;
+        virtual size_t staticThreadgroupMemoryLength() const = 0;
+    };
+
+    // Values for a kernel's function constants: [[ function_constant(index) ]] in Metal, a template argument of the CPU
+    // twin. A pipeline is compiled for one set of values, so the kernel has no branch on them. The project's kernels
+    // only take uint constants.
+    class FunctionConstants {
+    public:
+        FunctionConstants() = default;
+        FunctionConstants(std::initializer_list<std::pair<uint32_t, uint32_t>> values);
+
+        FunctionConstants& set(uint32_t index, uint32_t value);
+        bool get(uint32_t index, uint32_t& value) const;
+        bool empty() const { return entries.empty(); }
+        // Sorted by index
+        const std::vector<std::pair<uint32_t, uint32_t>>& values() const { return entries; }
+
+    private:
+        std::vector<std::pair<uint32_t, uint32_t>> entries;
+    };
+
+    // What a specialised pipeline is cached and archived under: functionName, or functionName[index=value,...].
+    std::string specialisedName(const std::string& functionName, const FunctionConstants& constants);
+    // Inverse of specialisedName. false if name is not of that form.
+    bool parseSpecialisedName(const std::string& name, std::string& functionName, FunctionConstants& constants);
+
+    // A collection of kernels that pipelines are created from. On Metal this is a loaded .metallib; on the CPU it is
+    // the set of built-in kernels (add_arrays, complex_operation, ...).
+    class Library {
+    public:
+        virtual ~Library() = default;
+        virtual bool hasFunction(const std::string& functionName) const = 0;
+    };
+
+    // Compiled pipelines kept on disk between runs, so that a warm start does not compile its kernels again. On Metal
+    // this is an MTL::BinaryArchive. The CPU kernels are compiled into the binary, so the CPU archive records which
+    // kernels were built and the SIMD variant they were specialised for, and is discarded when the CPU would now pick a
+    // different one.
+    class PipelineArchive {
+    public:
+        virtual ~PipelineArchive() = default;
+        virtual const std::string& path() const = 0;
+        // Functions the archive holds a compiled pipeline for, whether loaded from disk or added since.
+        virtual std::vector<std::string> functionNames() const = 0;
+        virtual bool contains(const std::string& functionName) const = 0;
+        // Writes the archive to path(), replacing what was there. false (with errorMessage set, if given) on failure.
+        virtual bool serialize(std::string* errorMessage = nullptr) = 0;
+    };
+
+    class ComputeCommandEncoder {
+    public:
+        virtual ~ComputeCommandEncoder() = default;
+        virtual void setComputePipelineState(ComputePipelineState* pipelineState) = 0;
+        virtual void setBuffer(Buffer* buffer, size_t offset, size_t index) = 0;
+        // Copies length bytes (a few kB at most) into the argument table at index, like Metal's setBytes.
+        virtual void setBytes(const void* bytes, size_t length, size_t index) = 0;
+        // Non-uniform dispatch: exactly gridSize threads run, in groups of threadgroupSize.
+        virtual void dispatchThreads(Size gridSize, Size threadgroupSize) = 0;
+        virtual void endEncoding() = 0;
+    };
+
+    class CommandBuffer {
+    public:
+        enum class Status { NotEnqueued, Committed, Completed, Error };
+        using Handler = std::function<void(CommandBuffer*)>;
+
+        virtual ~CommandBuffer() = default;
+
+        // The encoder is owned by the command buffer. Call endEncoding() before committing.
+        virtual ComputeCommandEncoder* computeCommandEncoder() = 0;
+
+        // Handlers run once the work has finished, on a thread owned by the backend. Add them before commit().
+        virtual void addCompletedHandler(const Handler& handler) = 0;
+
+        // Queues the work and returns immediately.
+        virtual void commit() = 0;
+        virtual void waitUntilCompleted() = 0;
+        virtual Status status() const = 0;
+    };
+
+    class CommandQueue {
+    public:
+        virtual ~CommandQueue() = default;
+        // Command buffers from one queue execute, and run their completed handlers, in the order they are committed.
+        virtual std::shared_ptr<CommandBuffer> commandBuffer() = 0;
+    };
+
+    class Device {
+    public:
+        virtual ~Device() = default;
+
+        virtual Backend backend() const = 0;
+        virtual std::string name() const = 0;
+        virtual bool hasUnifiedMemory() const = 0;
+        virtual size_t maxBufferLength() const = 0;
+        virtual size_t maxThreadgroupMemoryLength() const = 0;
+        virtual size_t maxArgumentBufferSamplerCount() const = 0;
+        virtual size_t recommendedMaxWorkingSetSize() const = 0;
+        virtual size_t currentAllocatedSize() const = 0;
+
+        virtual std::unique_ptr<CommandQueue> newCommandQueue() = 0;
+        virtual std::unique_ptr<Buffer> newBuffer(size_t length) = 0;
+        // Copies length bytes from pointer into a new buffer.
+        virtual std::unique_ptr<Buffer> newBuffer(const void* pointer, size_t length) = 0;
+        // Wraps existing host memory without copying (newBufferWithBytesNoCopy). pointer and length must both be
+        // multiples of the page size (see PageAlignedAllocator.h), otherwise nullptr is returned. The memory must
+        // outlive the buffer and every command buffer using it.
+        virtual std::unique_ptr<Buffer> newBufferNoCopy(void* pointer, size_t length) = 0;
+
+        // The library built alongside the project (addition.metallib on Metal). nullptr if it cannot be loaded.
+        virtual std::unique_ptr<Library> newDefaultLibrary() = 0;
+        // nullptr (with errorMessage set, if given) when the library has no such function, or no variant for constants.
+        // With an archive, a pipeline it already holds is loaded from it instead of compiled, and a newly compiled one
+        // is added to it (under specialisedName).
+        virtual std::unique_ptr<ComputePipelineState> newComputePipelineState(Library& library, const std::string& functionName,
+                                                                              const FunctionConstants& constants,
+                                                                              std::string* errorMessage = nullptr,
+                                                                              PipelineArchive* archive = nullptr) = 0;
+        // Opens the archive at path, or starts an empty one when there is none or it cannot be used on this device
+        // (which is not an error). nullptr only if the backend cannot create archives at all.
+        virtual std::unique_ptr<PipelineArchive> newPipelineArchive(const std::string& path, std::string* errorMessage = nullptr) = 0;
+    };
+
+    // Metal when it is compiled in and a GPU is present, otherwise the CPU backend. Setting the environment variable
+    // HELLO_METAL_COMPUTE_BACKEND to "cpu" forces the CPU backend; "metal" asks for Metal and warns on std::cerr when
+    // it has to fall back to the CPU. Any other value is reported and ignored.
+    std::unique_ptr<Device> createDefaultDevice();
+
+    // numThreads includes the queue thread that drives each dispatch; zero uses every hardware thread.
+    std::unique_ptr<Device> createCpuDevice(size_t numThreads = 0);
+
+    // nullptr when Metal is not compiled in or no GPU is available.
+    std::unique_ptr<Device> createMetalDevice();
+
+    const char* backendName(Backend backend);
+}
+
+#endif //HELLO_METAL_COMPUTEDEVICE_H
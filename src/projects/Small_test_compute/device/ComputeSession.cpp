@@ -0,0 +1,297 @@
+//
+// ComputeSession.cpp
+//
+
+#include "ComputeSession.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+
+namespace compute {
+
+    ComputeSession::ComputeSession(std::unique_ptr<Device> device)
+            : createdAt(std::chrono::steady_clock::now()), sessionDevice(std::move(device)) {
+        commandQueue = sessionDevice->newCommandQueue();
+        maxBufferBytes = sessionDevice->maxBufferLength();
+        defaultLibrary = sessionDevice->newDefaultLibrary();
+        if (!defaultLibrary)
+            std::cerr << "ComputeSession: no default library for device " << sessionDevice->name() << std::endl;
+        if (const char* directory = std::getenv("HELLO_METAL_PIPELINE_CACHE"))
+            openPipelineArchive(directory);
+        if (const char* interval = std::getenv("HELLO_METAL_METRICS_INTERVAL")) {
+            const long milliseconds = std::strtol(interval, nullptr, 10);
+            if (milliseconds > 0)
+                metrics.startPeriodicDump(std::chrono::milliseconds(milliseconds));
+        }
+    }
+
+    ComputeSession::~ComputeSession() {
+        savePipelineArchive();
+    }
+
+    ComputeSession& ComputeSession::shared() {
+        static ComputeSession session;
+        return session;
+    }
+
+    ComputePipelineState* ComputeSession::pipeline(KernelId kernel) {
+        auto& slot = kernelPipelines[static_cast<size_t>(kernel)];
+        if (ComputePipelineState* cached = slot.load(std::memory_order_acquire))
+            return cached;
+
+        const KernelInfo& info = kernelInfo(kernel);
+        FunctionConstants constants;
+        if (info.specialised)
+            constants.set(info.constantIndex, info.constantValue);
+
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        ComputePipelineState* created = createPipeline(std::string(info.function), constants);
+        if (created)
+            slot.store(created, std::memory_order_release);
+        return created;
+    }
+
+    ComputePipelineState* ComputeSession::pipeline(const std::string& functionName) {
+        KernelId kernel;
+        if (findKernel({functionName}, kernel))
+            return pipeline(kernel);
+
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        return createPipeline(functionName, FunctionConstants());
+    }
+
+    ComputePipelineState* ComputeSession::pipeline(const std::string& functionName, const FunctionConstants& constants) {
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        return createPipeline(functionName, constants);
+    }
+
+    ComputePipelineState* ComputeSession::createPipeline(const std::string& functionName, const FunctionConstants& constants) {
+        const std::string key = specialisedName(functionName, constants);
+        auto cached = pipelines.find(key);
+        if (cached != pipelines.end())
+            return cached->second.get();
+
+        if (!defaultLibrary)
+            return nullptr;
+
+        const auto start = std::chrono::steady_clock::now();
+        const bool archived = archive && archive->contains(key);
+        std::string error;
+        auto created = sessionDevice->newComputePipelineState(*defaultLibrary, functionName, constants, &error, archive.get());
+        if (!created) {
+            std::cerr << "Failed to create the compute pipeline for " << key << ": " << error << std::endl;
+            return nullptr;
+        }
+
+        startupReport.pipelinesBuilt++;
+        startupReport.pipelineMicroseconds += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        if (archived)
+            startupReport.pipelinesFromArchive++;
+        else if (archive)
+            archiveChanged = true;
+        return pipelines.emplace(key, std::move(created)).first->second.get();
+    }
+
+    bool ComputeSession::openPipelineArchive(const std::string& directory) {
+        std::error_code failure;
+        std::filesystem::create_directories(directory, failure);
+        if (failure) {
+            std::cerr << "ComputeSession: cannot create the pipeline cache directory " << directory << ": "
+                      << failure.message() << std::endl;
+            return false;
+        }
+
+        // One archive per backend and device, so a shared directory never mixes code for different targets
+        std::string fileName = std::string(backendName(sessionDevice->backend())) + "-" + sessionDevice->name();
+        for (char& c : fileName)
+            if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '.')
+                c = '_';
+        const std::string path = (std::filesystem::path(directory) / (fileName + ".pipelines")).string();
+
+        std::string error;
+        auto opened = sessionDevice->newPipelineArchive(path, &error);
+        if (!opened) {
+            std::cerr << "ComputeSession: cannot open the pipeline archive " << path << ": " << error << std::endl;
+            return false;
+        }
+
+        savePipelineArchive();
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        archive = std::move(opened);
+        archiveChanged = false;
+        startupReport.warmStart = !archive->functionNames().empty();
+        return true;
+    }
+
+    size_t ComputeSession::prewarmPipelines() {
+        if (!archive)
+            return 0;
+        size_t built = 0;
+        for (const auto& name : archive->functionNames()) {
+            std::string functionName;
+            FunctionConstants constants;
+            if (parseSpecialisedName(name, functionName, constants) && pipeline(functionName, constants))
+                built++;
+        }
+        return built;
+    }
+
+    bool ComputeSession::savePipelineArchive() {
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        if (!archive || !archiveChanged)
+            return true;
+
+        std::string error;
+        if (!archive->serialize(&error)) {
+            std::cerr << "ComputeSession: cannot save the pipeline archive: " << error << std::endl;
+            return false;
+        }
+        archiveChanged = false;
+        return true;
+    }
+
+    ComputeSession::StartupReport ComputeSession::startup() const {
+        StartupReport report;
+        {
+            std::lock_guard<std::mutex> lock(pipelineMutex);
+            report = startupReport;
+        }
+        std::lock_guard<std::mutex> lock(latencyMutex);
+        report.firstResultMicroseconds = firstResultMicroseconds;
+        return report;
+    }
+
+    size_t ComputeSession::sizeClass(size_t length) const {
+        // Whole pages in quarter steps between powers of two (... 16, 20, 24, 28, 32, 40, 48 ... KiB): a slightly longer
+        // request can still reuse a pooled buffer, and rounding wastes at most a quarter of it (a 40 MB chunk gets
+        // 40 MiB, not 64). Never more than the device allows in one buffer, so lengths that passed the
+        // maxBufferLength checks still allocate.
+        if (length <= 4096)
+            return 4096;
+        size_t power = 4096;
+        while (power * 2 <= length)
+            power <<= 1;
+        const size_t step = std::max<size_t>(4096, power / 4);
+        const size_t rounded = (length + step - 1) / step * step;
+        return std::min(rounded, std::max(length, maxBufferBytes));
+    }
+
+    std::unique_ptr<Buffer> ComputeSession::acquireBuffer(size_t length) {
+        const size_t rounded = sizeClass(length);
+        {
+            std::lock_guard<std::mutex> lock(bufferMutex);
+            auto bucket = freeBuffers.find(rounded);
+            if (bucket != freeBuffers.end() && !bucket->second.empty()) {
+                auto buffer = std::move(bucket->second.back());
+                bucket->second.pop_back();
+                pooledBytes -= rounded;
+                return buffer;
+            }
+        }
+        return sessionDevice->newBuffer(rounded);
+    }
+
+    void ComputeSession::recycleBuffer(std::unique_ptr<Buffer> buffer) {
+        if (!buffer)
+            return;
+        const size_t rounded = sizeClass(buffer->length());
+        if (rounded != buffer->length())
+            return; // Not one of ours; let it go
+
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        auto& bucket = freeBuffers[rounded];
+        if (bucket.size() < maxPooledPerClass && pooledBytes + rounded <= bufferPoolLimit) {
+            bucket.push_back(std::move(buffer));
+            pooledBytes += rounded;
+        }
+    }
+
+    void ComputeSession::trimBufferPool() {
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        freeBuffers.clear();
+        pooledBytes = 0;
+    }
+
+    void ComputeSession::setBufferPoolLimit(size_t bytes) {
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        bufferPoolLimit = bytes;
+        // Largest classes go first: they free the most memory for the fewest future allocations
+        for (auto bucket = freeBuffers.rbegin(); bucket != freeBuffers.rend() && pooledBytes > bufferPoolLimit; ++bucket) {
+            while (!bucket->second.empty() && pooledBytes > bufferPoolLimit) {
+                bucket->second.pop_back();
+                pooledBytes -= bucket->first;
+            }
+        }
+    }
+
+    void ComputeSession::recordCall(const std::string& label, std::chrono::nanoseconds elapsed) {
+        const double microseconds = static_cast<double>(elapsed.count()) / 1e3;
+
+        std::lock_guard<std::mutex> lock(latencyMutex);
+        if (firstResultMicroseconds == 0.0)
+            firstResultMicroseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - createdAt).count();
+        LatencyRecord& record = latencies[label];
+        if (record.calls == 0) {
+            record.coldMicroseconds = microseconds;
+        } else if (record.calls == 1) {
+            record.warmTotalMicroseconds = microseconds;
+            record.warmMinMicroseconds = microseconds;
+            record.warmMaxMicroseconds = microseconds;
+        } else {
+            record.warmTotalMicroseconds += microseconds;
+            record.warmMinMicroseconds = std::min(record.warmMinMicroseconds, microseconds);
+            record.warmMaxMicroseconds = std::max(record.warmMaxMicroseconds, microseconds);
+        }
+        record.calls++;
+    }
+
+    ComputeSession::CallLatency ComputeSession::latency(const std::string& label) const {
+        std::lock_guard<std::mutex> lock(latencyMutex);
+        CallLatency result;
+        auto found = latencies.find(label);
+        if (found == latencies.end())
+            return result;
+
+        const LatencyRecord& record = found->second;
+        result.calls = record.calls;
+        result.coldMicroseconds = record.coldMicroseconds;
+        if (record.calls > 1) {
+            result.warmMeanMicroseconds = record.warmTotalMicroseconds / static_cast<double>(record.calls - 1);
+            result.warmMinMicroseconds = record.warmMinMicroseconds;
+            result.warmMaxMicroseconds = record.warmMaxMicroseconds;
+        }
+        return result;
+    }
+
+    void ComputeSession::printLatencyReport() const {
+        std::vector<std::string> labels;
+        {
+            std::lock_guard<std::mutex> lock(latencyMutex);
+            for (const auto& entry : latencies)
+                labels.push_back(entry.first);
+        }
+
+        std::cout << "----------------------------------------------------------------\n";
+        std::cout << "Compute session latency - " << sessionDevice->name() << "\n";
+        const StartupReport start = startup();
+        std::cout << "\t" << (start.warmStart ? "warm" : "cold") << " start: first result after " << start.firstResultMicroseconds
+                  << " [us] | " << start.pipelinesBuilt << " pipelines (" << start.pipelinesFromArchive << " from the archive) in "
+                  << start.pipelineMicroseconds << " [us]\n";
+        for (const auto& label : labels) {
+            const CallLatency stats = latency(label);
+            std::cout << "\t" << label << ": " << stats.calls << " calls | cold " << stats.coldMicroseconds << " [us]";
+            if (stats.calls > 1)
+                std::cout << " | warm mean " << stats.warmMeanMicroseconds << " min " << stats.warmMinMicroseconds
+                          << " max " << stats.warmMaxMicroseconds << " [us]";
+            std::cout << "\n";
+        }
+        std::cout << "----------------------------------------------------------------\n";
+
+        const PipelineMetrics::Snapshot pipeline = metrics.snapshot();
+        if (pipeline.chunksAcquired > 0)
+            PipelineMetrics::print(pipeline);
+    }
+}
@@ -0,0 +1,137 @@
+//
+// ComputeSession.h
+//
+
+#ifndef HELLO_METAL_COMPUTESESSION_H
+#define HELLO_METAL_COMPUTESESSION_H
+
+#include "ComputeDevice.h"
+#include "KernelRegistry.h"
+#include "../metrics/PipelineMetrics.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace compute {
+
+    // Long-lived owner of the expensive objects: device, command queue, library, one pipeline per kernel and a pool
+    // of recycled buffers. Created once, it turns a repeated ArrayAdder call into encode + execute only. Thread-safe.
+    class ComputeSession {
+    public:
+        explicit ComputeSession(std::unique_ptr<Device> device = createDefaultDevice());
+        // Saves pipelines built since the pipeline archive was opened.
+        ~ComputeSession();
+
+        // Process-wide session on the default device, created on first use.
+        static ComputeSession& shared();
+
+        Device& device() { return *sessionDevice; }
+        CommandQueue& queue() { return *commandQueue; }
+        Library* library() { return defaultLibrary.get(); }
+
+        // Built on first request and cached. nullptr (after printing why) if it cannot be created. Once a registered
+        // kernel's pipeline exists, looking it up by id is a single atomic load; by name it also costs a registry scan,
+        // and names that are not in KernelRegistry.h go through a map under a lock.
+        ComputePipelineState* pipeline(KernelId kernel);
+        ComputePipelineState* pipeline(const std::string& functionName);
+        // The library function specialised for constants, one pipeline per distinct set of values.
+        ComputePipelineState* pipeline(const std::string& functionName, const FunctionConstants& constants);
+
+        // On-disk pipeline archive (see PipelineArchive), one file per backend and device in directory. The constructor
+        // opens one in the directory named by the HELLO_METAL_PIPELINE_CACHE environment variable, when it is set.
+        bool openPipelineArchive(const std::string& directory);
+        PipelineArchive* pipelineArchive() { return archive.get(); }
+        // Builds every pipeline the archive holds, so the first call of each kernel does not pay for it. Returns how
+        // many were built.
+        size_t prewarmPipelines();
+        // Writes the archive back if pipelines were added to it since it was opened or last saved.
+        bool savePipelineArchive();
+
+        // Time from constructing the session to the end of the first recorded call. A warm start had an archive with
+        // pipelines to load; a cold one compiled every pipeline it used.
+        struct StartupReport {
+            bool warmStart = false;
+            size_t pipelinesBuilt = 0;
+            size_t pipelinesFromArchive = 0;
+            double pipelineMicroseconds = 0.0; // Spent building pipelines, in total
+            double firstResultMicroseconds = 0.0; // Zero until a call has been recorded
+        };
+        StartupReport startup() const;
+
+        // A buffer of at least length bytes, reused from earlier calls when possible, or nullptr if the device cannot
+        // allocate one. Hand it back with recycleBuffer.
+        std::unique_ptr<Buffer> acquireBuffer(size_t length);
+        void recycleBuffer(std::unique_ptr<Buffer> buffer);
+        void trimBufferPool();
+        // Most bytes the pool keeps for reuse (256 MiB by default); buffers recycled beyond it are freed. Lowering it
+        // frees pooled buffers straight away.
+        void setBufferPoolLimit(size_t bytes);
+
+        // Wall-clock latency per labelled call. The first call of a label is reported as cold (it pays for pipeline
+        // creation and first-touch allocation); the rest are warm.
+        struct CallLatency {
+            size_t calls = 0;
+            double coldMicroseconds = 0.0;
+            double warmMeanMicroseconds = 0.0;
+            double warmMinMicroseconds = 0.0;
+            double warmMaxMicroseconds = 0.0;
+        };
+        void recordCall(const std::string& label, std::chrono::nanoseconds elapsed);
+        CallLatency latency(const std::string& label) const;
+        // Also prints the pipeline metrics, when any chunk has gone through a pipeline.
+        void printLatencyReport() const;
+
+        // Counters shared by every ChunkPipeline on this session (see PipelineMetrics).
+        PipelineMetrics& pipelineMetrics() { return metrics; }
+        const PipelineMetrics& pipelineMetrics() const { return metrics; }
+
+    private:
+        struct LatencyRecord {
+            size_t calls = 0;
+            double coldMicroseconds = 0.0;
+            double warmTotalMicroseconds = 0.0;
+            double warmMinMicroseconds = 0.0;
+            double warmMaxMicroseconds = 0.0;
+        };
+
+        size_t sizeClass(size_t length) const;
+
+        // Builds (or returns the cached) pipeline for functionName and constants. pipelineMutex must be held.
+        ComputePipelineState* createPipeline(const std::string& functionName, const FunctionConstants& constants);
+
+        std::chrono::steady_clock::time_point createdAt;
+
+        std::unique_ptr<Device> sessionDevice;
+        std::unique_ptr<CommandQueue> commandQueue;
+        std::unique_ptr<Library> defaultLibrary;
+
+        mutable std::mutex pipelineMutex;
+        std::unordered_map<std::string, std::unique_ptr<ComputePipelineState>> pipelines; // By specialisedName
+        std::array<std::atomic<ComputePipelineState*>, kernelCount> kernelPipelines{};    // Registered ones, by id
+        std::unique_ptr<PipelineArchive> archive;
+        bool archiveChanged = false;
+        StartupReport startupReport;
+
+        std::mutex bufferMutex;
+        std::map<size_t, std::vector<std::unique_ptr<Buffer>>> freeBuffers; // Keyed by size class
+        static constexpr size_t maxPooledPerClass = 8;
+        size_t bufferPoolLimit = size_t(256) << 20;
+        size_t pooledBytes = 0;
+        size_t maxBufferBytes = 0; // The device's maxBufferLength
+
+        mutable std::mutex latencyMutex;
+        std::map<std::string, LatencyRecord> latencies;
+        double firstResultMicroseconds = 0.0;
+
+        PipelineMetrics metrics;
+    };
+}
+
+#endif //HELLO_METAL_COMPUTESESSION_H
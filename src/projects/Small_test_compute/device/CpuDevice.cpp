@@ -0,0 +1,652 @@
+//
+// CpuDevice.cpp
+//
+
+#include "CpuDevice.h"
+#include "../cpu/PageAlignedAllocator.h"
+#include "../cpu/SimdKernels.h"
+#include "../cpu/ThreadPool.h"
+#include "../cpu/TypedKernels.h"
+#include "../reduce/Reduction.h"
+#include "../scan/Scan.h"
+#include "../types/ElementwiseOp.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace compute {
+
+    namespace {
+        // ------------------------------------------------------------------------------------------------------------
+        // Kernels
+
+        // Twins of reduction.metal: one partial per threadgroup, written to buffer 2. The values inside a threadgroup
+        // are folded by the SIMD reduction kernels rather than a tree, so the partials can differ in the last bits.
+        template<typename Reduce>
+        void reduceThreadgroups(const CpuKernelArguments& arguments, size_t begin, size_t end, Reduce reduce) {
+            const size_t groupWidth = std::max<size_t>(1, arguments.threadgroupWidth());
+            float* partials = arguments.buffer<float>(2);
+            for (size_t first = begin; first < end; first += groupWidth)
+                partials[first / groupWidth] = reduce(first, std::min(groupWidth, end - first));
+        }
+
+        void reduceSumKernel(const CpuKernelArguments& arguments, size_t begin, size_t end) {
+            const float* inA = arguments.buffer<const float>(0);
+            reduceThreadgroups(arguments, begin, end, [&](size_t first, size_t n) { return SimdKernels::active().sum(inA + first, n); });
+        }
+
+        void reduceMinKernel(const CpuKernelArguments& arguments, size_t begin, size_t end) {
+            const float* inA = arguments.buffer<const float>(0);
+            reduceThreadgroups(arguments, begin, end, [&](size_t first, size_t n) { return SimdKernels::active().minimum(inA + first, n); });
+        }
+
+        void reduceMaxKernel(const CpuKernelArguments& arguments, size_t begin, size_t end) {
+            const float* inA = arguments.buffer<const float>(0);
+            reduceThreadgroups(arguments, begin, end, [&](size_t first, size_t n) { return SimdKernels::active().maximum(inA + first, n); });
+        }
+
+        void reduceDotKernel(const CpuKernelArguments& arguments, size_t begin, size_t end) {
+            const float* inA = arguments.buffer<const float>(0);
+            const float* inB = arguments.buffer<const float>(1);
+            reduceThreadgroups(arguments, begin, end, [&](size_t first, size_t n) { return SimdKernels::active().dot(inA + first, inB + first, n); });
+        }
+
+        void reduceSumSquaresKernel(const CpuKernelArguments& arguments, size_t begin, size_t end) {
+            const float* inA = arguments.buffer<const float>(0);
+            reduceThreadgroups(arguments, begin, end, [&](size_t first, size_t n) { return SimdKernels::active().sumOfSquares(inA + first, n); });
+        }
+
+        // Twins of the elementwise kernels in addition.metal and typed.metal: one instantiation per operation and
+        // storage/compute pair (see typedKernelName), picked by the operation's function constant.
+        template<ElementwiseOp Op, typename Storage, typename Compute>
+        void elementwiseKernel(const CpuKernelArguments& arguments, size_t begin, size_t end) {
+            TypedKernels<Storage, Compute>::template apply<Op>(arguments.buffer<const Storage>(0) + begin,
+                                                               arguments.buffer<const Storage>(1) + begin,
+                                                               arguments.buffer<Storage>(2) + begin, end - begin);
+        }
+
+        template<typename Storage, typename Compute = ComputeTypeOf<Storage>>
+        CpuKernelFunction specialiseElementwise(const FunctionConstants& constants, std::string* errorMessage) {
+            uint32_t value = 0;
+            if (!constants.get(elementwiseOpConstant, value) || value >= elementwiseOpCount) {
+                if (errorMessage)
+                    *errorMessage = "elementwise kernels need a valid operation in function constant " + std::to_string(elementwiseOpConstant);
+                return {};
+            }
+            return visitElementwiseOp(static_cast<ElementwiseOp>(value), [&](auto op) -> CpuKernelFunction {
+                constexpr ElementwiseOp Op = decltype(op)::value;
+                if constexpr (TypedKernels<Storage, Compute>::template supports<Op>) {
+                    return elementwiseKernel<Op, Storage, Compute>;
+                } else {
+                    if (errorMessage)
+                        *errorMessage = std::string(ElementwiseTraits<Op>::name) + " needs a floating-point compute type";
+                    return {};
+                }
+            });
+        }
+
+        // Twins of the reduce_*_leaves kernels: Reduction::leafLanes threads per leaf of Reduction::leafSize elements.
+        // SimdKernelTable::sumFixed has the same shape as the Metal leaf. Threadgroups are whole leaves, so the ranges
+        // handed out by parallelFor never split one.
+        enum class LeafInput { Sum, Dot, SumSquares };
+
+        void reduceLeaves(const CpuKernelArguments& arguments, size_t begin, size_t end, LeafInput input, bool compensated) {
+            const float* inA = arguments.buffer<const float>(0);
+            const float* inB = input == LeafInput::Dot ? arguments.buffer<const float>(1)
+                             : input == LeafInput::SumSquares ? inA : nullptr;
+            float* partials = arguments.buffer<float>(2);
+            for (size_t leaf = begin / Reduction::leafLanes; leaf * Reduction::leafLanes < end; ++leaf) {
+                const size_t first = leaf * Reduction::leafSize;
+                if (compensated)
+                    SimdKernels::active().sumFixed(inA + first, inB ? inB + first : nullptr, Reduction::leafSize,
+                                                   &partials[2 * leaf], &partials[2 * leaf + 1]);
+                else
+                    SimdKernels::active().sumFixed(inA + first, inB ? inB + first : nullptr, Reduction::leafSize,
+                                                   &partials[leaf], nullptr);
+            }
+        }
+
+        template<LeafInput Input, bool Compensated>
+        void reduceLeavesKernel(const CpuKernelArguments& arguments, size_t begin, size_t end) {
+            reduceLeaves(arguments, begin, end, Input, Compensated);
+        }
+
+        // Twins of scan.metal. Threadgroups are scanned serially in float, so partial sums can differ from the
+        // device's tree in the last bits.
+        void scanThreadgroupsKernel(const CpuKernelArguments& arguments, size_t begin, size_t end) {
+            const size_t groupWidth = std::max<size_t>(1, arguments.threadgroupWidth());
+            const float* inA = arguments.buffer<const float>(0);
+            float* outC = arguments.buffer<float>(2);
+            for (size_t first = begin; first < end; first += groupWidth) {
+                const size_t last = std::min(first + groupWidth, end);
+                float running = 0.0f;
+                for (size_t i = first; i < last; ++i) {
+                    running += inA[i];
+                    outC[i] = running;
+                }
+            }
+        }
+
+        void filterThreadgroupsKernel(const CpuKernelArguments& arguments, size_t begin, size_t end) {
+            const size_t groupWidth = std::max<size_t>(1, arguments.threadgroupWidth());
+            const float* inA = arguments.buffer<const float>(0);
+            auto* counts = arguments.buffer<uint32_t>(1);
+            float* outC = arguments.buffer<float>(2);
+            const FilterPredicate& predicate = *arguments.buffer<const FilterPredicate>(3);
+            for (size_t first = begin; first < end; first += groupWidth) {
+                const size_t last = std::min(first + groupWidth, end);
+                float* next = outC + first;
+                for (size_t i = first; i < last; ++i) {
+                    if (predicate(inA[i]))
+                        *next++ = inA[i];
+                }
+                counts[first / groupWidth] = static_cast<uint32_t>(next - (outC + first));
+            }
+        }
+
+        struct KernelTable {
+            std::mutex mutex;
+            std::unordered_map<std::string, CpuKernelFunction> functions;
+            std::unordered_map<std::string, CpuKernelSpecialiser> specialisers;
+
+            template<typename Storage, typename Compute = ComputeTypeOf<Storage>>
+            void addElementwise() {
+                specialisers.emplace(typedKernelName<Storage, Compute>("elementwise"), specialiseElementwise<Storage, Compute>);
+            }
+        };
+
+        KernelTable& kernelTable() {
+            static KernelTable* table = [] {
+                auto* created = new KernelTable();
+                created->addElementwise<float>();
+                created->functions.emplace("reduce_sum", reduceSumKernel);
+                created->functions.emplace("reduce_min", reduceMinKernel);
+                created->functions.emplace("reduce_max", reduceMaxKernel);
+                created->functions.emplace("reduce_dot", reduceDotKernel);
+                created->functions.emplace("reduce_sum_squares", reduceSumSquaresKernel);
+                created->functions.emplace("scan_threadgroups", scanThreadgroupsKernel);
+                created->functions.emplace("filter_threadgroups", filterThreadgroupsKernel);
+                created->functions.emplace("reduce_sum_leaves", reduceLeavesKernel<LeafInput::Sum, false>);
+                created->functions.emplace("reduce_dot_leaves", reduceLeavesKernel<LeafInput::Dot, false>);
+                created->functions.emplace("reduce_sum_squares_leaves", reduceLeavesKernel<LeafInput::SumSquares, false>);
+                created->functions.emplace("reduce_sum_leaves_compensated", reduceLeavesKernel<LeafInput::Sum, true>);
+                created->functions.emplace("reduce_dot_leaves_compensated", reduceLeavesKernel<LeafInput::Dot, true>);
+                created->functions.emplace("reduce_sum_squares_leaves_compensated", reduceLeavesKernel<LeafInput::SumSquares, true>);
+                created->addElementwise<float, double>();
+                created->addElementwise<double>();
+                created->addElementwise<int32_t>();
+                created->addElementwise<uint8_t>();
+                created->addElementwise<Half>();
+                created->addElementwise<Half, Half>();
+                created->addElementwise<BFloat16>();
+                return created;
+            }();
+            return *table;
+        }
+
+        size_t physicalMemoryBytes() {
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+            const long pages = sysconf(_SC_PHYS_PAGES);
+            const long pageSize = sysconf(_SC_PAGESIZE);
+            if (pages > 0 && pageSize > 0)
+                return static_cast<size_t>(pages) * static_cast<size_t>(pageSize);
+#endif
+            return size_t(16) << 30;
+        }
+
+        size_t simdLanes() {
+            switch (SimdKernels::active().isa) {
+                case SimdIsa::Avx512: return 16;
+                case SimdIsa::Avx2: return 8;
+                case SimdIsa::Sse42:
+                case SimdIsa::Neon: return 4;
+                case SimdIsa::Scalar: return 1;
+            }
+            return 1;
+        }
+
+        // ------------------------------------------------------------------------------------------------------------
+        // Objects
+
+        constexpr size_t bufferAlignment = 64;
+
+        class CpuBuffer final : public Buffer {
+        public:
+            CpuBuffer(size_t length, std::shared_ptr<std::atomic<size_t>> allocated)
+                    : size(length), allocatedBytes(std::move(allocated)) {
+                data = ::operator new(std::max<size_t>(length, 1), std::align_val_t(bufferAlignment));
+                allocatedBytes->fetch_add(size, std::memory_order_relaxed);
+            }
+
+            ~CpuBuffer() override {
+                ::operator delete(data, std::align_val_t(bufferAlignment));
+                allocatedBytes->fetch_sub(size, std::memory_order_relaxed);
+            }
+
+            void* contents() override { return data; }
+            size_t length() const override { return size; }
+
+        private:
+            void* data;
+            size_t size;
+            std::shared_ptr<std::atomic<size_t>> allocatedBytes;
+        };
+
+        // Host memory owned by the caller (newBufferNoCopy).
+        class CpuBorrowedBuffer final : public Buffer {
+        public:
+            CpuBorrowedBuffer(void* pointer, size_t length) : data(pointer), size(length) {}
+
+            void* contents() override { return data; }
+            size_t length() const override { return size; }
+
+        private:
+            void* data;
+            size_t size;
+        };
+
+        class CpuLibrary final : public Library {
+        public:
+            bool hasFunction(const std::string& functionName) const override {
+                return CpuKernelRegistry::contains(functionName);
+            }
+        };
+
+        class CpuPipelineState final : public ComputePipelineState {
+        public:
+            CpuPipelineState(std::string name, CpuKernelFunction function)
+                    : name(std::move(name)), function(std::move(function)) {}
+
+            const std::string& functionName() const override { return name; }
+            size_t threadExecutionWidth() const override { return simdLanes(); }
+            size_t maxTotalThreadsPerThreadgroup() const override { return 1024; }
+            size_t staticThreadgroupMemoryLength() const override { return 0; }
+
+            const CpuKernelFunction& kernel() const { return function; }
+
+        private:
+            std::string name;
+            CpuKernelFunction function;
+        };
+
+        // Text file: a header line, the ISA the pipelines were specialised for, then one function name per line.
+        class CpuPipelineArchive final : public PipelineArchive {
+        public:
+            static constexpr const char* header = "hello_metal_cpu_pipeline_archive 1";
+
+            explicit CpuPipelineArchive(std::string path) : archivePath(std::move(path)), isa(SimdKernels::active().isa) {
+                std::ifstream file(archivePath);
+                std::string line;
+                if (!file || !std::getline(file, line) || line != header)
+                    return;
+                SimdIsa archivedIsa;
+                if (!std::getline(file, line) || !SimdKernels::parseIsa(line, archivedIsa) || archivedIsa != isa)
+                    return; // Built for another instruction set: start over rather than report stale pipelines
+                while (std::getline(file, line))
+                    if (!line.empty())
+                        names.insert(line);
+            }
+
+            const std::string& path() const override { return archivePath; }
+
+            std::vector<std::string> functionNames() const override {
+                std::lock_guard<std::mutex> lock(mutex);
+                return {names.begin(), names.end()};
+            }
+
+            bool contains(const std::string& functionName) const override {
+                std::lock_guard<std::mutex> lock(mutex);
+                return names.count(functionName) != 0;
+            }
+
+            bool serialize(std::string* errorMessage) override {
+                std::ostringstream contents;
+                contents << header << "\n" << SimdKernels::isaName(isa) << "\n";
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    for (const auto& name : names)
+                        contents << name << "\n";
+                }
+
+                // Written next to the archive and renamed over it, so a concurrent reader never sees half a file
+                const std::string temporary = archivePath + ".tmp";
+                {
+                    std::ofstream file(temporary, std::ios::trunc);
+                    file << contents.str();
+                    if (!file) {
+                        if (errorMessage)
+                            *errorMessage = "Cannot write " + temporary;
+                        return false;
+                    }
+                }
+                if (std::rename(temporary.c_str(), archivePath.c_str()) != 0) {
+                    std::remove(temporary.c_str());
+                    if (errorMessage)
+                        *errorMessage = "Cannot replace " + archivePath;
+                    return false;
+                }
+                return true;
+            }
+
+            void add(const std::string& functionName) {
+                std::lock_guard<std::mutex> lock(mutex);
+                names.insert(functionName);
+            }
+
+        private:
+            std::string archivePath;
+            SimdIsa isa;
+            mutable std::mutex mutex;
+            std::set<std::string> names;
+        };
+
+        struct Dispatch {
+            const CpuPipelineState* pipelineState;
+            CpuKernelArguments arguments;
+        };
+
+        class CpuEncoder final : public ComputeCommandEncoder {
+        public:
+            void setComputePipelineState(ComputePipelineState* pipelineState) override {
+                current = static_cast<CpuPipelineState*>(pipelineState);
+            }
+
+            void setBuffer(Buffer* buffer, size_t offset, size_t index) override {
+                if (index >= CpuKernelArguments::maxBuffers)
+                    throw std::out_of_range("CpuEncoder::setBuffer: buffer index out of range");
+                bound.buffers[index] = buffer ? static_cast<char*>(buffer->contents()) + offset : nullptr;
+            }
+
+            void setBytes(const void* bytes, size_t length, size_t index) override {
+                if (index >= CpuKernelArguments::maxBuffers)
+                    throw std::out_of_range("CpuEncoder::setBytes: buffer index out of range");
+                // The copy lives as long as the encoder, i.e. until the command buffer is destroyed
+                const auto* first = static_cast<const char*>(bytes);
+                constants.emplace_back(first, first + length);
+                bound.buffers[index] = constants.back().data();
+            }
+
+            void dispatchThreads(Size gridSize, Size threadgroupSize) override {
+                if (!current)
+                    throw std::logic_error("CpuEncoder::dispatchThreads: no pipeline state set");
+                CpuKernelArguments arguments = bound;
+                arguments.gridSize = gridSize;
+                arguments.threadgroupSize = threadgroupSize;
+                dispatches.push_back({current, arguments});
+            }
+
+            void endEncoding() override { ended = true; }
+
+            std::vector<Dispatch> dispatches;
+            bool ended = false;
+
+        private:
+            const CpuPipelineState* current = nullptr;
+            CpuKernelArguments bound;
+            std::vector<std::vector<char>> constants; // Backing for setBytes; the inner buffers never move
+        };
+
+        class CpuCommandBuffer;
+
+        // Shared between a queue and the command buffers it hands out, so a committed buffer never outlives it.
+        struct QueueState {
+            std::shared_ptr<ThreadPool> pool;
+            std::mutex mutex;
+            std::condition_variable condition;
+            std::deque<std::shared_ptr<CpuCommandBuffer>> pending;
+            bool stopping = false;
+        };
+
+        class CpuCommandBuffer final : public CommandBuffer, public std::enable_shared_from_this<CpuCommandBuffer> {
+        public:
+            explicit CpuCommandBuffer(std::shared_ptr<QueueState> queue) : queue(std::move(queue)) {}
+
+            ComputeCommandEncoder* computeCommandEncoder() override {
+                encoders.push_back(std::make_unique<CpuEncoder>());
+                return encoders.back().get();
+            }
+
+            void addCompletedHandler(const Handler& handler) override {
+                handlers.push_back(handler);
+            }
+
+            void commit() override {
+                {
+                    std::lock_guard<std::mutex> lock(stateMutex);
+                    if (currentStatus != Status::NotEnqueued)
+                        throw std::logic_error("CpuCommandBuffer::commit: command buffer already committed");
+                    currentStatus = Status::Committed;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(queue->mutex);
+                    queue->pending.push_back(shared_from_this());
+                }
+                queue->condition.notify_one();
+            }
+
+            void waitUntilCompleted() override {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                completedCondition.wait(lock, [this] {
+                    return currentStatus == Status::Completed || currentStatus == Status::Error;
+                });
+            }
+
+            Status status() const override {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                return currentStatus;
+            }
+
+            // Called on the queue thread.
+            void execute(ThreadPool& pool) {
+                Status finalStatus = Status::Completed;
+                try {
+                    for (const auto& encoder : encoders) {
+                        for (const Dispatch& dispatch : encoder->dispatches) {
+                            const CpuKernelArguments& arguments = dispatch.arguments;
+                            const size_t threads = arguments.gridSize.width * arguments.gridSize.height * arguments.gridSize.depth;
+                            const CpuKernelFunction& kernel = dispatch.pipelineState->kernel();
+                            pool.parallelFor(threads, [&](size_t begin, size_t end) {
+                                kernel(arguments, begin, end);
+                            }, ThreadPool::Partitioning::Static, 0, std::max<size_t>(1, arguments.threadgroupWidth()));
+                        }
+                    }
+                } catch (...) {
+                    finalStatus = Status::Error;
+                }
+
+                // Handlers run before waitUntilCompleted returns, so anything they publish is visible to the waiter.
+                for (const auto& handler : handlers)
+                    handler(this);
+
+                {
+                    std::lock_guard<std::mutex> lock(stateMutex);
+                    currentStatus = finalStatus;
+                }
+                completedCondition.notify_all();
+            }
+
+        private:
+            std::shared_ptr<QueueState> queue;
+            std::vector<std::unique_ptr<CpuEncoder>> encoders;
+            std::vector<Handler> handlers;
+
+            mutable std::mutex stateMutex;
+            std::condition_variable completedCondition;
+            Status currentStatus = Status::NotEnqueued;
+        };
+
+        class CpuCommandQueue final : public CommandQueue {
+        public:
+            explicit CpuCommandQueue(std::shared_ptr<ThreadPool> pool) : state(std::make_shared<QueueState>()) {
+                state->pool = std::move(pool);
+                worker = std::thread(&CpuCommandQueue::run, state);
+            }
+
+            ~CpuCommandQueue() override {
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->stopping = true;
+                }
+                state->condition.notify_one();
+                worker.join();
+            }
+
+            std::shared_ptr<CommandBuffer> commandBuffer() override {
+                return std::make_shared<CpuCommandBuffer>(state);
+            }
+
+        private:
+            // Executes committed command buffers in order. Drains the queue before stopping.
+            static void run(std::shared_ptr<QueueState> state) {
+                while (true) {
+                    std::shared_ptr<CpuCommandBuffer> next;
+                    {
+                        std::unique_lock<std::mutex> lock(state->mutex);
+                        state->condition.wait(lock, [&] { return state->stopping || !state->pending.empty(); });
+                        if (state->pending.empty())
+                            return;
+                        next = std::move(state->pending.front());
+                        state->pending.pop_front();
+                    }
+                    next->execute(*state->pool);
+                }
+            }
+
+            std::shared_ptr<QueueState> state;
+            std::thread worker;
+        };
+
+        class CpuDevice final : public Device {
+        public:
+            explicit CpuDevice(size_t numThreads)
+                    : pool(std::make_shared<ThreadPool>(numThreads)),
+                      allocatedBytes(std::make_shared<std::atomic<size_t>>(0)),
+                      physicalMemory(physicalMemoryBytes()) {}
+
+            Backend backend() const override { return Backend::Cpu; }
+            std::string name() const override {
+                return "CPU (" + std::to_string(pool->threadCount()) + " threads, " + SimdKernels::isaName(SimdKernels::active().isa) + ")";
+            }
+            bool hasUnifiedMemory() const override { return true; }
+            size_t maxBufferLength() const override { return physicalMemory / 2; }
+            size_t maxThreadgroupMemoryLength() const override { return 32768; }
+            size_t maxArgumentBufferSamplerCount() const override { return 1024; }
+            size_t recommendedMaxWorkingSetSize() const override { return physicalMemory / 4 * 3; }
+            size_t currentAllocatedSize() const override { return allocatedBytes->load(std::memory_order_relaxed); }
+
+            std::unique_ptr<CommandQueue> newCommandQueue() override {
+                return std::make_unique<CpuCommandQueue>(pool);
+            }
+
+            std::unique_ptr<Buffer> newBuffer(size_t length) override {
+                return std::make_unique<CpuBuffer>(length, allocatedBytes);
+            }
+
+            std::unique_ptr<Buffer> newBuffer(const void* pointer, size_t length) override {
+                auto buffer = std::make_unique<CpuBuffer>(length, allocatedBytes);
+                std::memcpy(buffer->contents(), pointer, length);
+                return buffer;
+            }
+
+            std::unique_ptr<Buffer> newBufferNoCopy(void* pointer, size_t length) override {
+                // Same contract as Metal, so code that works here also works on the GPU
+                const size_t page = pageSize();
+                if (!pointer || length == 0 || reinterpret_cast<uintptr_t>(pointer) % page != 0 || length % page != 0)
+                    return nullptr;
+                return std::make_unique<CpuBorrowedBuffer>(pointer, length);
+            }
+
+            std::unique_ptr<Library> newDefaultLibrary() override {
+                return std::make_unique<CpuLibrary>();
+            }
+
+            std::unique_ptr<ComputePipelineState> newComputePipelineState(Library&, const std::string& functionName,
+                                                                          const FunctionConstants& constants,
+                                                                          std::string* errorMessage,
+                                                                          PipelineArchive* archive) override {
+                CpuKernelFunction function = CpuKernelRegistry::specialise(functionName, constants, errorMessage);
+                if (!function)
+                    return nullptr;
+                if (archive)
+                    static_cast<CpuPipelineArchive*>(archive)->add(specialisedName(functionName, constants));
+                return std::make_unique<CpuPipelineState>(functionName, std::move(function));
+            }
+
+            std::unique_ptr<PipelineArchive> newPipelineArchive(const std::string& path, std::string*) override {
+                return std::make_unique<CpuPipelineArchive>(path);
+            }
+
+        private:
+            std::shared_ptr<ThreadPool> pool;
+            std::shared_ptr<std::atomic<size_t>> allocatedBytes;
+            size_t physicalMemory;
+        };
+    }
+
+    void CpuKernelRegistry::add(const std::string& functionName, CpuKernelFunction function) {
+        KernelTable& table = kernelTable();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        table.functions[functionName] = std::move(function);
+    }
+
+    const CpuKernelFunction* CpuKernelRegistry::find(const std::string& functionName) {
+        KernelTable& table = kernelTable();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        auto it = table.functions.find(functionName);
+        return it == table.functions.end() ? nullptr : &it->second;
+    }
+
+    void CpuKernelRegistry::addSpecialised(const std::string& functionName, CpuKernelSpecialiser specialiser) {
+        KernelTable& table = kernelTable();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        table.specialisers[functionName] = std::move(specialiser);
+    }
+
+    CpuKernelFunction CpuKernelRegistry::specialise(const std::string& functionName, const FunctionConstants& constants,
+                                                    std::string* errorMessage) {
+        CpuKernelSpecialiser specialiser;
+        {
+            KernelTable& table = kernelTable();
+            std::lock_guard<std::mutex> lock(table.mutex);
+            auto plain = table.functions.find(functionName);
+            if (plain != table.functions.end())
+                return plain->second;
+            auto found = table.specialisers.find(functionName);
+            if (found == table.specialisers.end()) {
+                if (errorMessage)
+                    *errorMessage = "No CPU kernel named " + functionName;
+                return {};
+            }
+            specialiser = found->second;
+        }
+        return specialiser(constants, errorMessage);
+    }
+
+    bool CpuKernelRegistry::contains(const std::string& functionName) {
+        KernelTable& table = kernelTable();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        return table.functions.count(functionName) != 0 || table.specialisers.count(functionName) != 0;
+    }
+
+    std::unique_ptr<Device> createCpuDevice(size_t numThreads) {
+        return std::make_unique<CpuDevice>(numThreads);
+    }
+}
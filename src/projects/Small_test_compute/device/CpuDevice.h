@@ -0,0 +1,57 @@
+//
+// CpuDevice.h
+//
+// CPU implementation of the compute device layer. Kernels are plain functions registered by name; a dispatch splits
+// the grid across the device's ThreadPool on whole-threadgroup boundaries, so a kernel invocation always sees
+// complete threadgroups (which is what threadgroup-cooperative kernels such as reductions rely on).
+//
+
+#ifndef HELLO_METAL_CPUDEVICE_H
+#define HELLO_METAL_CPUDEVICE_H
+
+#include "ComputeDevice.h"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace compute {
+
+    struct CpuKernelArguments {
+        // Same size as Metal's buffer argument table
+        static constexpr size_t maxBuffers = 31;
+
+        void* buffers[maxBuffers] = {};
+        Size gridSize;
+        Size threadgroupSize;
+
+        template<typename T>
+        T* buffer(size_t index) const { return static_cast<T*>(buffers[index]); }
+
+        size_t threadgroupWidth() const { return threadgroupSize.width * threadgroupSize.height * threadgroupSize.depth; }
+    };
+
+    // Runs the threads with linear ids [begin, end) of one dispatch. begin is a multiple of the threadgroup size.
+    using CpuKernelFunction = std::function<void(const CpuKernelArguments& arguments, size_t begin, size_t end)>;
+
+    // Twin of a kernel with function constants: returns the variant for one set of values, normally a template
+    // instantiation picked by them, so the variant has no branch on the constants. An empty function (with
+    // errorMessage set, if given) when there is no variant for those values.
+    using CpuKernelSpecialiser = std::function<CpuKernelFunction(const FunctionConstants& constants, std::string* errorMessage)>;
+
+    // Every CPU library resolves function names against this table. The project's kernels (the CPU twins of the
+    // .metal files) are registered on first use by CpuDevice.cpp; add() and addSpecialised() make further kernels
+    // available.
+    class CpuKernelRegistry {
+    public:
+        static void add(const std::string& functionName, CpuKernelFunction function);
+        static void addSpecialised(const std::string& functionName, CpuKernelSpecialiser specialiser);
+        static const CpuKernelFunction* find(const std::string& functionName);
+        // The variant of a function registered with addSpecialised; plain functions ignore constants, like Metal does.
+        static CpuKernelFunction specialise(const std::string& functionName, const FunctionConstants& constants,
+                                            std::string* errorMessage = nullptr);
+        static bool contains(const std::string& functionName);
+    };
+}
+
+#endif //HELLO_METAL_CPUDEVICE_H
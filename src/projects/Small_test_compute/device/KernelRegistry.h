@@ -0,0 +1,160 @@
+//
+// KernelRegistry.h
+//
+// Every kernel the project ships (the .metal files and their CPU twins), with an id fixed at compile time. A session
+// keeps one pipeline slot per id, so once a pipeline exists, looking it up is an array index rather than hashing the
+// function name under a lock. Names remain what callers, tuning profiles and call labels use. A kernel is either a
+// library function of the same name or a specialisation of one: add_arrays is the elementwise function with its
+// operation constant set to ElementwiseOp::Add.
+//
+
+#ifndef HELLO_METAL_KERNELREGISTRY_H
+#define HELLO_METAL_KERNELREGISTRY_H
+
+#include "../types/ElementwiseOp.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <string_view>
+
+namespace compute {
+
+    enum class KernelId : uint16_t {
+        // addition.metal (specialisations of elementwise)
+        AddArrays,
+        ComplexOperation,
+        // reduction.metal
+        ReduceSum,
+        ReduceMin,
+        ReduceMax,
+        ReduceDot,
+        ReduceSumSquares,
+        ReduceSumLeaves,
+        ReduceDotLeaves,
+        ReduceSumSquaresLeaves,
+        ReduceSumLeavesCompensated,
+        ReduceDotLeavesCompensated,
+        ReduceSumSquaresLeavesCompensated,
+        // scan.metal
+        ScanThreadgroups,
+        FilterThreadgroups,
+        // typed.metal (specialisations of elementwise_<type>; the f64 ones are CPU only)
+        AddArraysF32F64,
+        AddArraysF64,
+        AddArraysI32,
+        AddArraysU8,
+        AddArraysF16,
+        AddArraysF16F16,
+        AddArraysBf16,
+        ComplexOperationF32F64,
+        ComplexOperationF64,
+        ComplexOperationF16,
+        ComplexOperationF16F16,
+        ComplexOperationBf16,
+
+        Count
+    };
+
+    constexpr size_t kernelCount = static_cast<size_t>(KernelId::Count);
+
+    struct KernelInfo {
+        std::string_view name;
+        std::string_view function; // In the library
+        bool specialised = false; // If so, function constant constantIndex is set to constantValue
+        uint32_t constantIndex = 0;
+        uint32_t constantValue = 0;
+    };
+
+    namespace KernelRegistryDetail {
+        constexpr KernelInfo plain(std::string_view name) {
+            return {name, name};
+        }
+
+        constexpr KernelInfo elementwise(std::string_view name, std::string_view function, ElementwiseOp op) {
+            return {name, function, true, elementwiseOpConstant, static_cast<uint32_t>(op)};
+        }
+
+        // In KernelId order
+        constexpr KernelInfo kernels[] = {
+                elementwise("add_arrays", "elementwise", ElementwiseOp::Add),
+                elementwise("complex_operation", "elementwise", ElementwiseOp::Complex),
+                plain("reduce_sum"),
+                plain("reduce_min"),
+                plain("reduce_max"),
+                plain("reduce_dot"),
+                plain("reduce_sum_squares"),
+                plain("reduce_sum_leaves"),
+                plain("reduce_dot_leaves"),
+                plain("reduce_sum_squares_leaves"),
+                plain("reduce_sum_leaves_compensated"),
+                plain("reduce_dot_leaves_compensated"),
+                plain("reduce_sum_squares_leaves_compensated"),
+                plain("scan_threadgroups"),
+                plain("filter_threadgroups"),
+                elementwise("add_arrays_f32_f64", "elementwise_f32_f64", ElementwiseOp::Add),
+                elementwise("add_arrays_f64", "elementwise_f64", ElementwiseOp::Add),
+                elementwise("add_arrays_i32", "elementwise_i32", ElementwiseOp::Add),
+                elementwise("add_arrays_u8", "elementwise_u8", ElementwiseOp::Add),
+                elementwise("add_arrays_f16", "elementwise_f16", ElementwiseOp::Add),
+                elementwise("add_arrays_f16_f16", "elementwise_f16_f16", ElementwiseOp::Add),
+                elementwise("add_arrays_bf16", "elementwise_bf16", ElementwiseOp::Add),
+                elementwise("complex_operation_f32_f64", "elementwise_f32_f64", ElementwiseOp::Complex),
+                elementwise("complex_operation_f64", "elementwise_f64", ElementwiseOp::Complex),
+                elementwise("complex_operation_f16", "elementwise_f16", ElementwiseOp::Complex),
+                elementwise("complex_operation_f16_f16", "elementwise_f16_f16", ElementwiseOp::Complex),
+                elementwise("complex_operation_bf16", "elementwise_bf16", ElementwiseOp::Complex),
+        };
+        static_assert(sizeof(kernels) / sizeof(kernels[0]) == kernelCount, "every KernelId needs an entry");
+
+        // Whether name is parts joined with '_'
+        constexpr bool joinedEquals(std::string_view name, std::initializer_list<std::string_view> parts) {
+            size_t position = 0;
+            bool first = true;
+            for (std::string_view part : parts) {
+                if (!first) {
+                    if (position >= name.size() || name[position] != '_')
+                        return false;
+                    ++position;
+                }
+                if (name.substr(position, part.size()) != part)
+                    return false;
+                position += part.size();
+                first = false;
+            }
+            return position == name.size();
+        }
+    }
+
+    constexpr const KernelInfo& kernelInfo(KernelId kernel) {
+        return KernelRegistryDetail::kernels[static_cast<size_t>(kernel)];
+    }
+
+    constexpr std::string_view kernelName(KernelId kernel) {
+        return kernelInfo(kernel).name;
+    }
+
+    // Looks up the kernel called parts joined with '_', e.g. {"add_arrays", "f16"}. false for names not registered here
+    // (CpuKernelRegistry::add can still make those available by name).
+    constexpr bool findKernel(std::initializer_list<std::string_view> parts, KernelId& kernel) {
+        for (size_t i = 0; i < kernelCount; ++i) {
+            if (KernelRegistryDetail::joinedEquals(KernelRegistryDetail::kernels[i].name, parts)) {
+                kernel = static_cast<KernelId>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Same, but an unknown name throws std::invalid_argument, which makes it a compile error in a constant expression:
+    //     constexpr KernelId scan = kernelId({"scan_threadgroups"});
+    constexpr KernelId kernelId(std::initializer_list<std::string_view> parts) {
+        KernelId kernel{};
+        if (!findKernel(parts, kernel))
+            throw std::invalid_argument("kernelId: no kernel with that name is registered");
+        return kernel;
+    }
+}
+
+#endif //HELLO_METAL_KERNELREGISTRY_H
@@ -0,0 +1,17 @@
+//
+// MetalCppImpl.cpp
+//
+// The one translation unit that instantiates metal-cpp's selector and class symbols. It lives in the library so every
+// executable linking small_test_compute (hello_metal, the benchmark) gets them; nothing else may define the
+// *_PRIVATE_IMPLEMENTATION macros. AppKit's symbols are keyed to NS_PRIVATE_IMPLEMENTATION too, so they are
+// instantiated here as well; MetalKit's stay with the only target that uses it (main.cpp).
+//
+
+#define NS_PRIVATE_IMPLEMENTATION
+#define CA_PRIVATE_IMPLEMENTATION
+#define MTL_PRIVATE_IMPLEMENTATION
+
+#include <AppKit/AppKit.hpp>
+#include <Foundation/Foundation.hpp>
+#include <Metal/Metal.hpp>
+#include <QuartzCore/QuartzCore.hpp>
@@ -0,0 +1,348 @@
+//
+// MetalDevice.mm
+//
+// Metal backend of the compute device layer: thin owners around the metal-cpp objects ArrayAdder used to hold.
+//
+
+#include "ComputeDevice.h"
+
+#include <Metal/Metal.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace compute {
+
+    namespace {
+        std::string describe(NS::Error* error) {
+            if (error && error->localizedDescription())
+                return error->localizedDescription()->utf8String();
+            return "unknown error";
+        }
+
+        class MetalBuffer final : public Buffer {
+        public:
+            explicit MetalBuffer(MTL::Buffer* buffer) : buffer(buffer) {}
+            ~MetalBuffer() override { buffer->release(); }
+
+            void* contents() override { return buffer->contents(); }
+            size_t length() const override { return buffer->length(); }
+
+            MTL::Buffer* buffer;
+        };
+
+        class MetalLibrary final : public Library {
+        public:
+            explicit MetalLibrary(MTL::Library* library) : library(library) {}
+            ~MetalLibrary() override { library->release(); }
+
+            bool hasFunction(const std::string& functionName) const override {
+                MTL::Function* function = library->newFunction(NS::String::string(functionName.c_str(), NS::UTF8StringEncoding));
+                if (!function)
+                    return false;
+                function->release();
+                return true;
+            }
+
+            MTL::Library* library;
+        };
+
+        class MetalPipelineState final : public ComputePipelineState {
+        public:
+            MetalPipelineState(std::string name, MTL::ComputePipelineState* pipelineState)
+                    : name(std::move(name)), pipelineState(pipelineState) {}
+            ~MetalPipelineState() override { pipelineState->release(); }
+
+            const std::string& functionName() const override { return name; }
+            size_t threadExecutionWidth() const override { return pipelineState->threadExecutionWidth(); }
+            size_t maxTotalThreadsPerThreadgroup() const override { return pipelineState->maxTotalThreadsPerThreadgroup(); }
+            size_t staticThreadgroupMemoryLength() const override { return pipelineState->staticThreadgroupMemoryLength(); }
+
+            std::string name;
+            MTL::ComputePipelineState* pipelineState;
+        };
+
+        // An MTL::BinaryArchive at path, plus path + ".functions" listing what it holds (Metal cannot be asked).
+        class MetalPipelineArchive final : public PipelineArchive {
+        public:
+            MetalPipelineArchive(std::string path, MTL::BinaryArchive* archive, std::set<std::string> names)
+                    : archive(archive), archivePath(std::move(path)), names(std::move(names)) {}
+            ~MetalPipelineArchive() override { archive->release(); }
+
+            const std::string& path() const override { return archivePath; }
+
+            std::vector<std::string> functionNames() const override {
+                std::lock_guard<std::mutex> lock(mutex);
+                return {names.begin(), names.end()};
+            }
+
+            bool contains(const std::string& functionName) const override {
+                std::lock_guard<std::mutex> lock(mutex);
+                return names.count(functionName) != 0;
+            }
+
+            bool serialize(std::string* errorMessage) override {
+                std::lock_guard<std::mutex> lock(mutex);
+                // Serialised next to the archive and renamed over it, so a concurrent reader never sees half a file
+                const std::string temporary = archivePath + ".tmp";
+                NS::Error* error = nullptr;
+                auto url = NS::URL::fileURLWithPath(NS::String::string(temporary.c_str(), NS::UTF8StringEncoding));
+                if (!archive->serializeToURL(url, &error) || std::rename(temporary.c_str(), archivePath.c_str()) != 0) {
+                    std::remove(temporary.c_str());
+                    if (errorMessage)
+                        *errorMessage = "Cannot write " + archivePath + " (" + describe(error) + ")";
+                    return false;
+                }
+
+                std::ofstream list(archivePath + ".functions", std::ios::trunc);
+                for (const auto& name : names)
+                    list << name << "\n";
+                return true;
+            }
+
+            // Compiles descriptor's function into the archive unless it is already there.
+            void add(const std::string& functionName, MTL::ComputePipelineDescriptor* descriptor) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (names.count(functionName))
+                    return;
+                NS::Error* error = nullptr;
+                if (archive->addComputePipelineFunctions(descriptor, &error))
+                    names.insert(functionName);
+                else
+                    std::cerr << "Cannot add " << functionName << " to the pipeline archive: " << describe(error) << std::endl;
+            }
+
+            MTL::BinaryArchive* archive;
+
+        private:
+            std::string archivePath;
+            mutable std::mutex mutex;
+            std::set<std::string> names;
+        };
+
+        class MetalEncoder final : public ComputeCommandEncoder {
+        public:
+            explicit MetalEncoder(MTL::ComputeCommandEncoder* encoder) : encoder(encoder->retain()) {}
+            ~MetalEncoder() override { encoder->release(); }
+
+            void setComputePipelineState(ComputePipelineState* pipelineState) override {
+                encoder->setComputePipelineState(static_cast<MetalPipelineState*>(pipelineState)->pipelineState);
+            }
+
+            void setBuffer(Buffer* buffer, size_t offset, size_t index) override {
+                encoder->setBuffer(buffer ? static_cast<MetalBuffer*>(buffer)->buffer : nullptr, offset, index);
+            }
+
+            void setBytes(const void* bytes, size_t length, size_t index) override {
+                encoder->setBytes(bytes, length, index);
+            }
+
+            void dispatchThreads(Size gridSize, Size threadgroupSize) override {
+                encoder->dispatchThreads(MTL::Size(gridSize.width, gridSize.height, gridSize.depth),
+                                         MTL::Size(threadgroupSize.width, threadgroupSize.height, threadgroupSize.depth));
+            }
+
+            void endEncoding() override { encoder->endEncoding(); }
+
+        private:
+            MTL::ComputeCommandEncoder* encoder;
+        };
+
+        class MetalCommandBuffer final : public CommandBuffer, public std::enable_shared_from_this<MetalCommandBuffer> {
+        public:
+            explicit MetalCommandBuffer(MTL::CommandBuffer* commandBuffer) : commandBuffer(commandBuffer->retain()) {}
+            ~MetalCommandBuffer() override { commandBuffer->release(); }
+
+            ComputeCommandEncoder* computeCommandEncoder() override {
+                encoders.push_back(std::make_unique<MetalEncoder>(commandBuffer->computeCommandEncoder()));
+                return encoders.back().get();
+            }
+
+            void addCompletedHandler(const Handler& handler) override {
+                handlers.push_back(handler);
+            }
+
+            void commit() override {
+                // The block keeps this wrapper alive until Metal has called back, even if the caller drops it.
+                std::shared_ptr<MetalCommandBuffer> self = shared_from_this();
+                commandBuffer->addCompletedHandler([self](MTL::CommandBuffer*) {
+                    for (const auto& handler : self->handlers)
+                        handler(self.get());
+                });
+                commandBuffer->commit();
+            }
+
+            void waitUntilCompleted() override { commandBuffer->waitUntilCompleted(); }
+
+            Status status() const override {
+                switch (commandBuffer->status()) {
+                    case MTL::CommandBufferStatusNotEnqueued: return Status::NotEnqueued;
+                    case MTL::CommandBufferStatusCompleted: return Status::Completed;
+                    case MTL::CommandBufferStatusError: return Status::Error;
+                    default: return Status::Committed;
+                }
+            }
+
+        private:
+            MTL::CommandBuffer* commandBuffer;
+            std::vector<std::unique_ptr<MetalEncoder>> encoders;
+            std::vector<Handler> handlers;
+        };
+
+        class MetalCommandQueue final : public CommandQueue {
+        public:
+            explicit MetalCommandQueue(MTL::CommandQueue* commandQueue) : commandQueue(commandQueue) {}
+            ~MetalCommandQueue() override { commandQueue->release(); }
+
+            std::shared_ptr<CommandBuffer> commandBuffer() override {
+                MTL::CommandBuffer* commandBuffer = commandQueue->commandBuffer();
+                if (!commandBuffer)
+                    return nullptr;
+                return std::make_shared<MetalCommandBuffer>(commandBuffer);
+            }
+
+        private:
+            MTL::CommandQueue* commandQueue;
+        };
+
+        class MetalDevice final : public Device {
+        public:
+            explicit MetalDevice(MTL::Device* device) : device(device) {}
+            ~MetalDevice() override { device->release(); }
+
+            Backend backend() const override { return Backend::Metal; }
+            std::string name() const override { return device->name()->utf8String(); }
+            bool hasUnifiedMemory() const override { return device->hasUnifiedMemory(); }
+            size_t maxBufferLength() const override { return device->maxBufferLength(); }
+            size_t maxThreadgroupMemoryLength() const override { return device->maxThreadgroupMemoryLength(); }
+            size_t maxArgumentBufferSamplerCount() const override { return device->maxArgumentBufferSamplerCount(); }
+            size_t recommendedMaxWorkingSetSize() const override { return device->recommendedMaxWorkingSetSize(); }
+            size_t currentAllocatedSize() const override { return device->currentAllocatedSize(); }
+
+            std::unique_ptr<CommandQueue> newCommandQueue() override {
+                MTL::CommandQueue* commandQueue = device->newCommandQueue();
+                return commandQueue ? std::make_unique<MetalCommandQueue>(commandQueue) : nullptr;
+            }
+
+            std::unique_ptr<Buffer> newBuffer(size_t length) override {
+                MTL::Buffer* buffer = device->newBuffer(length, MTL::ResourceStorageModeShared);
+                return buffer ? std::make_unique<MetalBuffer>(buffer) : nullptr;
+            }
+
+            std::unique_ptr<Buffer> newBuffer(const void* pointer, size_t length) override {
+                MTL::Buffer* buffer = device->newBuffer(pointer, length, MTL::ResourceStorageModeShared);
+                return buffer ? std::make_unique<MetalBuffer>(buffer) : nullptr;
+            }
+
+            std::unique_ptr<Buffer> newBufferNoCopy(void* pointer, size_t length) override {
+                // Metal rejects memory that is not page-aligned; no deallocator because the caller keeps ownership
+                MTL::Buffer* buffer = device->newBuffer(pointer, length, MTL::ResourceStorageModeShared, nullptr);
+                return buffer ? std::make_unique<MetalBuffer>(buffer) : nullptr;
+            }
+
+            std::unique_ptr<Library> newDefaultLibrary() override {
+                NS::Error* error = nullptr;
+                auto libraryPath = NS::String::string(METAL_SHADER_METALLIB_PATH, NS::UTF8StringEncoding);
+                MTL::Library* library = device->newLibrary(libraryPath, &error);
+                if (!library) {
+                    std::cerr << "Failed to load the library from path: " << METAL_SHADER_METALLIB_PATH
+                              << " (" << describe(error) << ")" << std::endl;
+                    return nullptr;
+                }
+                return std::make_unique<MetalLibrary>(library);
+            }
+
+            std::unique_ptr<ComputePipelineState> newComputePipelineState(Library& library, const std::string& functionName,
+                                                                          const FunctionConstants& constants,
+                                                                          std::string* errorMessage,
+                                                                          PipelineArchive* archive) override {
+                auto name = NS::String::string(functionName.c_str(), NS::UTF8StringEncoding);
+                NS::Error* error = nullptr;
+                MTL::Function* function = nullptr;
+                if (constants.empty()) {
+                    function = static_cast<MetalLibrary&>(library).library->newFunction(name);
+                } else {
+                    // Specialised: the compiler folds the constants into the function before the pipeline is built
+                    MTL::FunctionConstantValues* values = MTL::FunctionConstantValues::alloc()->init();
+                    for (const auto& [index, value] : constants.values())
+                        values->setConstantValue(&value, MTL::DataTypeUInt, index);
+                    function = static_cast<MetalLibrary&>(library).library->newFunction(name, values, &error);
+                    values->release();
+                }
+                if (!function) {
+                    if (errorMessage)
+                        *errorMessage = error ? describe(error) : "No Metal function named " + functionName;
+                    return nullptr;
+                }
+
+                MTL::ComputePipelineState* pipelineState = nullptr;
+                if (archive) {
+                    // Metal takes the compiled code from the archive when it has it and compiles as usual otherwise
+                    auto* metalArchive = static_cast<MetalPipelineArchive*>(archive);
+                    MTL::ComputePipelineDescriptor* descriptor = MTL::ComputePipelineDescriptor::alloc()->init();
+                    descriptor->setComputeFunction(function);
+                    descriptor->setBinaryArchives(NS::Array::array(metalArchive->archive));
+                    pipelineState = device->newComputePipelineState(descriptor, MTL::PipelineOptionNone, nullptr, &error);
+                    if (pipelineState)
+                        metalArchive->add(specialisedName(functionName, constants), descriptor);
+                    descriptor->release();
+                } else {
+                    pipelineState = device->newComputePipelineState(function, &error);
+                }
+                function->release();
+                if (!pipelineState) {
+                    if (errorMessage)
+                        *errorMessage = describe(error);
+                    return nullptr;
+                }
+                return std::make_unique<MetalPipelineState>(functionName, pipelineState);
+            }
+
+            std::unique_ptr<PipelineArchive> newPipelineArchive(const std::string& path, std::string* errorMessage) override {
+                std::set<std::string> names;
+                {
+                    std::ifstream list(path + ".functions");
+                    std::string line;
+                    while (std::getline(list, line))
+                        if (!line.empty())
+                            names.insert(line);
+                }
+
+                MTL::BinaryArchiveDescriptor* descriptor = MTL::BinaryArchiveDescriptor::alloc()->init();
+                NS::Error* error = nullptr;
+                MTL::BinaryArchive* archive = nullptr;
+                if (!names.empty()) {
+                    descriptor->setUrl(NS::URL::fileURLWithPath(NS::String::string(path.c_str(), NS::UTF8StringEncoding)));
+                    archive = device->newBinaryArchive(descriptor, &error);
+                }
+                if (!archive) {
+                    // Missing, or written by another OS or GPU: start an empty one
+                    names.clear();
+                    descriptor->setUrl(nullptr);
+                    archive = device->newBinaryArchive(descriptor, &error);
+                }
+                descriptor->release();
+                if (!archive) {
+                    if (errorMessage)
+                        *errorMessage = describe(error);
+                    return nullptr;
+                }
+                return std::make_unique<MetalPipelineArchive>(path, archive, std::move(names));
+            }
+
+        private:
+            MTL::Device* device;
+        };
+    }
+
+    std::unique_ptr<Device> createMetalDevice() {
+        MTL::Device* device = MTL::CreateSystemDefaultDevice();
+        if (!device)
+            return nullptr;
+        return std::make_unique<MetalDevice>(device);
+    }
+}
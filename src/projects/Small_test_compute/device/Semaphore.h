@@ -0,0 +1,48 @@
+//
+// Semaphore.h
+//
+
+#ifndef HELLO_METAL_SEMAPHORE_H
+#define HELLO_METAL_SEMAPHORE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+namespace compute {
+
+    // Counting semaphore with the same role as dispatch_semaphore_t: wait() blocks while the count is zero, signal()
+    // may be called from any thread (typically a completion handler).
+    class Semaphore {
+    public:
+        explicit Semaphore(size_t initialCount = 0) : count(initialCount) {}
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return count > 0; });
+            --count;
+        }
+
+        bool tryWait() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (count == 0)
+                return false;
+            --count;
+            return true;
+        }
+
+        // Notifies under the lock so a waiter that destroys the semaphore as soon as wait() returns cannot race with it.
+        void signal() {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++count;
+            condition.notify_one();
+        }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable condition;
+        size_t count;
+    };
+}
+
+#endif //HELLO_METAL_SEMAPHORE_H
@@ -0,0 +1,36 @@
+//
+// elementwise.h
+//
+// Shared by addition.metal and typed.metal: the operation every elementwise kernel is specialised for. It is a function
+// constant, so each pipeline (MTLFunctionConstantValues at library->newFunction) is compiled for one operation and the
+// switch below folds away. The values match ElementwiseOp in types/ElementwiseOp.h.
+//
+
+#ifndef HELLO_METAL_ELEMENTWISE_H
+#define HELLO_METAL_ELEMENTWISE_H
+
+#include <metal_stdlib>
+using namespace metal;
+
+#define ELEMENTWISE_ADD 0
+#define ELEMENTWISE_COMPLEX 1
+
+constant uint elementwise_op [[ function_constant(0) ]];
+
+template <typename Compute>
+static Compute elementwise_apply(Compute a, Compute b) {
+    switch (elementwise_op) {
+        case ELEMENTWISE_COMPLEX:
+            return sin(a * b) + a;
+        default:
+            return a + b;
+    }
+}
+
+// Integer kernels only do ELEMENTWISE_ADD; the host never specialises them for anything else
+template <>
+int elementwise_apply<int>(int a, int b) {
+    return a + b;
+}
+
+#endif //HELLO_METAL_ELEMENTWISE_H
@@ -0,0 +1,117 @@
+//
+// Expression.h
+//
+// Lazy element-wise expressions over float arrays. Writing
+//
+//      auto a = expr::array(vec1);
+//      auto b = expr::array(vec2);
+//      expr::assign(result, expr::sin(a * b) + a);
+//
+// builds a small tree of value types at compile time; nothing is computed until assign/evaluate, which runs the whole
+// chain in a single pass over memory instead of one pass (and one temporary vector) per operator.
+//
+
+#ifndef HELLO_METAL_EXPRESSION_H
+#define HELLO_METAL_EXPRESSION_H
+
+#include "ExpressionProgram.h"
+
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace expr {
+
+    // CRTP base so the operators below only pick up expression types.
+    template<typename Derived>
+    struct Expression {
+        const Derived& self() const { return static_cast<const Derived&>(*this); }
+
+        Program compile() const {
+            Program program;
+            self().lower(program);
+            return program;
+        }
+    };
+
+    struct ArrayRef : Expression<ArrayRef> {
+        const float* data;
+        size_t size;
+
+        ArrayRef(const float* data, size_t size) : data(data), size(size) {}
+        size_t lower(Program& program) const { return program.addInput(data, size); }
+    };
+
+    struct Constant : Expression<Constant> {
+        float value;
+
+        explicit Constant(float value) : value(value) {}
+        size_t lower(Program& program) const { return program.addConstant(value); }
+    };
+
+    template<Program::OpCode Op, typename Lhs, typename Rhs>
+    struct Binary : Expression<Binary<Op, Lhs, Rhs>> {
+        Lhs lhs;
+        Rhs rhs;
+
+        Binary(const Lhs& lhs, const Rhs& rhs) : lhs(lhs), rhs(rhs) {}
+        size_t lower(Program& program) const {
+            const size_t left = lhs.lower(program);
+            const size_t right = rhs.lower(program);
+            return program.addBinary(Op, left, right);
+        }
+    };
+
+    template<Program::OpCode Op, typename Operand>
+    struct Unary : Expression<Unary<Op, Operand>> {
+        Operand operand;
+
+        explicit Unary(const Operand& operand) : operand(operand) {}
+        size_t lower(Program& program) const { return program.addUnary(Op, operand.lower(program)); }
+    };
+
+    inline ArrayRef array(const std::vector<float>& values) { return {values.data(), values.size()}; }
+    inline ArrayRef array(const float* data, size_t size) { return {data, size}; }
+
+    template<typename Operand>
+    Unary<Program::OpCode::Sin, Operand> sin(const Expression<Operand>& operand) {
+        return Unary<Program::OpCode::Sin, Operand>(operand.self());
+    }
+
+#define HELLO_METAL_EXPR_BINARY_OPERATOR(symbol, opCode)                                                            \
+    template<typename Lhs, typename Rhs>                                                                            \
+    Binary<Program::OpCode::opCode, Lhs, Rhs> operator symbol(const Expression<Lhs>& lhs, const Expression<Rhs>& rhs) { \
+        return Binary<Program::OpCode::opCode, Lhs, Rhs>(lhs.self(), rhs.self());                                   \
+    }                                                                                                               \
+    template<typename Lhs>                                                                                          \
+    Binary<Program::OpCode::opCode, Lhs, Constant> operator symbol(const Expression<Lhs>& lhs, float rhs) {         \
+        return Binary<Program::OpCode::opCode, Lhs, Constant>(lhs.self(), Constant(rhs));                           \
+    }                                                                                                               \
+    template<typename Rhs>                                                                                          \
+    Binary<Program::OpCode::opCode, Constant, Rhs> operator symbol(float lhs, const Expression<Rhs>& rhs) {         \
+        return Binary<Program::OpCode::opCode, Constant, Rhs>(Constant(lhs), rhs.self());                           \
+    }
+
+    HELLO_METAL_EXPR_BINARY_OPERATOR(+, Add)
+    HELLO_METAL_EXPR_BINARY_OPERATOR(-, Subtract)
+    HELLO_METAL_EXPR_BINARY_OPERATOR(*, Multiply)
+    HELLO_METAL_EXPR_BINARY_OPERATOR(/, Divide)
+
+#undef HELLO_METAL_EXPR_BINARY_OPERATOR
+
+    // Evaluates the expression into out, which must already hold as many elements as the input arrays.
+    template<typename E>
+    void assign(std::vector<float>& out, const Expression<E>& expression, ThreadPool& pool = ThreadPool::shared()) {
+        const Program program = expression.compile();
+        if (out.size() != program.length())
+            throw std::invalid_argument("expr: output length does not match the expression");
+        evaluate(program, out.data(), pool);
+    }
+
+    template<typename E>
+    std::string toMetalSource(const Expression<E>& expression, const std::string& kernelName) {
+        return expression.compile().toMetalSource(kernelName);
+    }
+}
+
+#endif //HELLO_METAL_EXPRESSION_H
@@ -0,0 +1,214 @@
+//
+// ExpressionProgram.cpp
+//
+
+#include "ExpressionProgram.h"
+#include "../cpu/SimdKernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace expr {
+
+    size_t Program::push(const Instruction& instruction) {
+        code.push_back(instruction);
+        return code.size() - 1;
+    }
+
+    size_t Program::addInput(const float* data, size_t size) {
+        if (inputData.empty())
+            inputLength = size;
+        else if (size != inputLength)
+            throw std::invalid_argument("expr: all arrays in an expression must have the same length");
+
+        // The same array used twice becomes one input (and one Metal buffer).
+        auto existing = std::find(inputData.begin(), inputData.end(), data);
+        size_t inputIndex = static_cast<size_t>(existing - inputData.begin());
+        if (existing == inputData.end())
+            inputData.push_back(data);
+
+        Instruction instruction{OpCode::Load};
+        instruction.input = inputIndex;
+        return push(instruction);
+    }
+
+    size_t Program::addConstant(float value) {
+        Instruction instruction{OpCode::Constant};
+        instruction.value = value;
+        return push(instruction);
+    }
+
+    size_t Program::addUnary(OpCode op, size_t operand) {
+        Instruction instruction{op};
+        instruction.lhs = operand;
+        return push(instruction);
+    }
+
+    size_t Program::addBinary(OpCode op, size_t lhs, size_t rhs) {
+        Instruction instruction{op};
+        instruction.lhs = lhs;
+        instruction.rhs = rhs;
+        return push(instruction);
+    }
+
+    void Program::evaluateRange(float* out, size_t begin, size_t end) const {
+        if (code.empty() || begin >= end)
+            return;
+
+        const SimdKernelTable& kernels = SimdKernels::active();
+        const size_t resultRegister = code.size() - 1;
+
+        // Loads point straight into the input arrays; everything else gets a tile of scratch. Constants are filled once.
+        std::vector<float> scratch(code.size() * tileSize);
+        std::vector<const float*> registers(code.size(), nullptr);
+        for (size_t reg = 0; reg < code.size(); reg++) {
+            if (code[reg].op == OpCode::Constant)
+                kernels.fill(code[reg].value, scratch.data() + reg * tileSize, tileSize);
+        }
+
+        for (size_t tileBegin = begin; tileBegin < end; tileBegin += tileSize) {
+            const size_t count = std::min(tileSize, end - tileBegin);
+
+            for (size_t reg = 0; reg < code.size(); reg++) {
+                const Instruction& instruction = code[reg];
+                // The last instruction writes directly into the caller's output.
+                float* target = (reg == resultRegister) ? out + tileBegin : scratch.data() + reg * tileSize;
+
+                switch (instruction.op) {
+                    case OpCode::Load:
+                        registers[reg] = inputData[instruction.input] + tileBegin;
+                        if (reg == resultRegister)
+                            std::memcpy(target, registers[reg], count * sizeof(float));
+                        continue;
+                    case OpCode::Constant:
+                        if (reg == resultRegister)
+                            kernels.fill(instruction.value, target, count);
+                        registers[reg] = scratch.data() + reg * tileSize;
+                        continue;
+                    case OpCode::Add:
+                        kernels.addArrays(registers[instruction.lhs], registers[instruction.rhs], target, count);
+                        break;
+                    case OpCode::Subtract:
+                        kernels.subtract(registers[instruction.lhs], registers[instruction.rhs], target, count);
+                        break;
+                    case OpCode::Multiply:
+                        kernels.multiply(registers[instruction.lhs], registers[instruction.rhs], target, count);
+                        break;
+                    case OpCode::Divide:
+                        kernels.divide(registers[instruction.lhs], registers[instruction.rhs], target, count);
+                        break;
+                    case OpCode::Sin:
+                        kernels.sin(registers[instruction.lhs], target, count);
+                        break;
+                }
+                registers[reg] = target;
+            }
+        }
+    }
+
+    void evaluate(const Program& program, float* out, ThreadPool& pool) {
+        pool.parallelFor(program.length(), [&](size_t begin, size_t end) {
+            program.evaluateRange(out, begin, end);
+        }, ThreadPool::Partitioning::Static, 0, Program::tileSize);
+    }
+
+    namespace {
+        int precedence(Program::OpCode op) {
+            switch (op) {
+                case Program::OpCode::Add:
+                case Program::OpCode::Subtract:
+                    return 1;
+                case Program::OpCode::Multiply:
+                case Program::OpCode::Divide:
+                    return 2;
+                default:
+                    return 3;
+            }
+        }
+
+        const char* symbol(Program::OpCode op) {
+            switch (op) {
+                case Program::OpCode::Add: return " + ";
+                case Program::OpCode::Subtract: return " - ";
+                case Program::OpCode::Multiply: return " * ";
+                case Program::OpCode::Divide: return " / ";
+                default: return "";
+            }
+        }
+
+        std::string bufferName(size_t index) {
+            return std::string("in") + static_cast<char>('A' + index % 26) + (index >= 26 ? std::to_string(index / 26) : "");
+        }
+    }
+
+    std::string Program::metalExpression(size_t reg, int parentPrecedence, bool rightOperand) const {
+        const Instruction& instruction = code[reg];
+        std::ostringstream source;
+
+        switch (instruction.op) {
+            case OpCode::Load:
+                source << bufferName(instruction.input) << "[id]";
+                break;
+            case OpCode::Constant: {
+                // Infinities and NaN have no literal form; metal_stdlib defines the macros
+                if (std::isnan(instruction.value)) {
+                    source << "NAN";
+                    break;
+                }
+                if (std::isinf(instruction.value)) {
+                    source << (instruction.value < 0 ? "-INFINITY" : "INFINITY");
+                    break;
+                }
+                // Nine significant digits round-trip a float; Metal needs a decimal point for a float literal.
+                std::ostringstream literal;
+                literal.precision(9);
+                literal << instruction.value;
+                std::string text = literal.str();
+                if (text.find_first_of(".eE") == std::string::npos)
+                    text += ".0";
+                source << text << "f";
+                break;
+            }
+            case OpCode::Sin:
+                source << "sin(" << metalExpression(instruction.lhs, 0, false) << ")";
+                break;
+            default: {
+                const int own = precedence(instruction.op);
+                // Every right operand of equal precedence keeps its brackets, a + (b + c) included: float addition and
+                // multiplication are not associative, and the kernel must round exactly as Program::evaluate does.
+                const bool bracket = own < parentPrecedence || (rightOperand && own == parentPrecedence);
+                if (bracket)
+                    source << "(";
+                source << metalExpression(instruction.lhs, own, false) << symbol(instruction.op)
+                       << metalExpression(instruction.rhs, own, true);
+                if (bracket)
+                    source << ")";
+                break;
+            }
+        }
+        return source.str();
+    }
+
+    std::string Program::toMetalSource(const std::string& kernelName) const {
+        if (code.empty())
+            throw std::logic_error("expr: cannot generate a kernel for an empty program");
+
+        std::ostringstream source;
+        source << "#include <metal_stdlib>\n"
+               << "using namespace metal;\n\n";
+
+        const std::string prefix = "kernel void " + kernelName + "(";
+        const std::string indent(prefix.size(), ' ');
+        source << prefix;
+        for (size_t i = 0; i < inputData.size(); i++)
+            source << (i == 0 ? "" : indent) << "const device float* " << bufferName(i) << " [[ buffer(" << i << ") ]],\n";
+        source << (inputData.empty() ? "" : indent) << "device float* outC [[ buffer(" << inputData.size() << ") ]],\n"
+               << indent << "uint id [[ thread_position_in_grid ]]) {\n"
+               << "    outC[id] = " << metalExpression(code.size() - 1, 0, false) << ";\n"
+               << "}\n";
+        return source.str();
+    }
+}
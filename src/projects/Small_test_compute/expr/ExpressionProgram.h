@@ -0,0 +1,65 @@
+//
+// ExpressionProgram.h
+//
+
+#ifndef HELLO_METAL_EXPRESSIONPROGRAM_H
+#define HELLO_METAL_EXPRESSIONPROGRAM_H
+
+#include "../cpu/ThreadPool.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace expr {
+
+    // Flattened form of an expression tree. Instruction i writes register i, so operands always refer to earlier
+    // instructions. Built by Expression::lower(); executed by evaluate() or turned into a Metal kernel.
+    class Program {
+    public:
+        enum class OpCode { Load, Constant, Add, Subtract, Multiply, Divide, Sin };
+
+        struct Instruction {
+            OpCode op;
+            size_t lhs = 0;     // Operand registers (binary ops use both, Sin uses lhs)
+            size_t rhs = 0;
+            size_t input = 0;   // Load: index into inputs()
+            float value = 0.0f; // Constant
+        };
+
+        size_t addInput(const float* data, size_t size);
+        size_t addConstant(float value);
+        size_t addUnary(OpCode op, size_t operand);
+        size_t addBinary(OpCode op, size_t lhs, size_t rhs);
+
+        const std::vector<Instruction>& instructions() const { return code; }
+        const std::vector<const float*>& inputs() const { return inputData; }
+
+        // Length shared by every input array; zero if the expression only has constants.
+        size_t length() const { return inputLength; }
+
+        // Elements processed per register per step. Every register fits in L1 together, so intermediate values never
+        // travel through DRAM.
+        static constexpr size_t tileSize = 512;
+
+        // Evaluates elements [begin, end) into out (which is indexed from begin as well). Single-threaded.
+        void evaluateRange(float* out, size_t begin, size_t end) const;
+
+        // Metal kernel equivalent to the program: inputs become buffers inA, inB, ... in order of first use and the
+        // output is the buffer after them. For sin(a * b) + a this reproduces complex_operation in addition.metal.
+        std::string toMetalSource(const std::string& kernelName) const;
+
+    private:
+        size_t push(const Instruction& instruction);
+        std::string metalExpression(size_t reg, int parentPrecedence, bool rightOperand) const;
+
+        std::vector<Instruction> code;
+        std::vector<const float*> inputData;
+        size_t inputLength = 0;
+    };
+
+    // Runs the program over its whole length as one fused pass, split across the pool.
+    void evaluate(const Program& program, float* out, ThreadPool& pool = ThreadPool::shared());
+}
+
+#endif //HELLO_METAL_EXPRESSIONPROGRAM_H
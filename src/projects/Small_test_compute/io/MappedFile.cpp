@@ -0,0 +1,135 @@
+//
+// MappedFile.cpp
+//
+
+#include "MappedFile.h"
+#include "../cpu/PageAlignedAllocator.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::unique_ptr<MappedFile> MappedFile::open(const std::string& path, Access access) {
+    const int fd = ::open(path.c_str(), access == Access::ReadWrite ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "MappedFile: cannot open " << path << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    struct stat info {};
+    if (fstat(fd, &info) != 0) {
+        std::cerr << "MappedFile: cannot stat " << path << ": " << std::strerror(errno) << std::endl;
+        ::close(fd);
+        return nullptr;
+    }
+    return map(fd, access, static_cast<size_t>(info.st_size), path);
+}
+
+std::unique_ptr<MappedFile> MappedFile::create(const std::string& path, size_t length) {
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "MappedFile: cannot create " << path << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    // Sparse: no disk blocks are written until the pages are
+    if (ftruncate(fd, static_cast<off_t>(length)) != 0) {
+        std::cerr << "MappedFile: cannot resize " << path << ": " << std::strerror(errno) << std::endl;
+        ::close(fd);
+        return nullptr;
+    }
+    return map(fd, Access::ReadWrite, length, path);
+}
+
+std::unique_ptr<MappedFile> MappedFile::fromDescriptor(int fd, Access access, size_t length) {
+    const int owned = ::dup(fd);
+    if (owned < 0) {
+        std::cerr << "MappedFile: cannot duplicate descriptor " << fd << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    struct stat info {};
+    if (fstat(owned, &info) != 0) {
+        std::cerr << "MappedFile: cannot stat descriptor " << fd << ": " << std::strerror(errno) << std::endl;
+        ::close(owned);
+        return nullptr;
+    }
+
+    const auto fileSize = static_cast<size_t>(info.st_size);
+    if (length == 0) {
+        length = fileSize;
+    } else if (length > fileSize) {
+        if (access != Access::ReadWrite || ftruncate(owned, static_cast<off_t>(length)) != 0) {
+            std::cerr << "MappedFile: descriptor " << fd << " is shorter than the " << length << " bytes requested" << std::endl;
+            ::close(owned);
+            return nullptr;
+        }
+    }
+    return map(owned, access, length, "descriptor " + std::to_string(fd));
+}
+
+std::unique_ptr<MappedFile> MappedFile::map(int fd, Access access, size_t length, const std::string& description) {
+    if (length == 0) {
+        // mmap rejects empty mappings; an empty file is still a valid (empty) input
+        return std::unique_ptr<MappedFile>(new MappedFile(fd, nullptr, 0, access));
+    }
+
+    const int protection = access == Access::ReadWrite ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void* mapping = mmap(nullptr, length, protection, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "MappedFile: cannot map " << description << ": " << std::strerror(errno) << std::endl;
+        ::close(fd);
+        return nullptr;
+    }
+    return std::unique_ptr<MappedFile>(new MappedFile(fd, mapping, length, access));
+}
+
+MappedFile::~MappedFile() {
+    if (mapping)
+        munmap(mapping, length);
+    if (fd >= 0)
+        ::close(fd);
+}
+
+bool MappedFile::pageRange(size_t offset, size_t bytes, char*& begin, size_t& rangeBytes) const {
+    if (!mapping || offset >= length || bytes == 0)
+        return false;
+
+    const size_t end = std::min(length, offset + bytes);
+    const size_t alignedBegin = offset / pageSize() * pageSize();
+    begin = static_cast<char*>(mapping) + alignedBegin;
+    rangeBytes = end - alignedBegin;
+    return true;
+}
+
+void MappedFile::adviseSequential() {
+    if (mapping)
+        madvise(mapping, length, MADV_SEQUENTIAL);
+}
+
+void MappedFile::willNeed(size_t offset, size_t bytes) {
+    char* begin;
+    size_t rangeBytes;
+    if (pageRange(offset, bytes, begin, rangeBytes))
+        madvise(begin, rangeBytes, MADV_WILLNEED);
+}
+
+void MappedFile::evict(size_t offset, size_t bytes) {
+    char* begin;
+    size_t rangeBytes;
+    if (!pageRange(offset, bytes, begin, rangeBytes))
+        return;
+
+    if (writable())
+        msync(begin, rangeBytes, MS_SYNC); // Write dirty pages back so dropping them loses nothing
+    madvise(begin, rangeBytes, MADV_DONTNEED);
+#if defined(POSIX_FADV_DONTNEED)
+    // Also release the page cache, so the file system does not hold on to what the process just gave back
+    posix_fadvise(fd, static_cast<off_t>(begin - static_cast<char*>(mapping)), static_cast<off_t>(rangeBytes), POSIX_FADV_DONTNEED);
+#endif
+}
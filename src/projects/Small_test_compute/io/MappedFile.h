@@ -0,0 +1,59 @@
+//
+// MappedFile.h
+//
+
+#ifndef HELLO_METAL_MAPPEDFILE_H
+#define HELLO_METAL_MAPPEDFILE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// A whole file mapped into memory (POSIX mmap, MAP_SHARED), with the paging hints the streaming paths need: read-ahead
+// for chunks that are about to be used and eviction for chunks that are finished. Only the pages between those two
+// points stay resident, so files far larger than physical memory can be processed.
+//
+// Factory functions print the reason and return nullptr on failure.
+class MappedFile {
+public:
+    enum class Access { ReadOnly, ReadWrite };
+
+    static std::unique_ptr<MappedFile> open(const std::string& path, Access access = Access::ReadOnly);
+    // Creates (or truncates) path to exactly length bytes and maps it for writing.
+    static std::unique_ptr<MappedFile> create(const std::string& path, size_t length);
+    // Maps an already-open descriptor. The descriptor is duplicated, so the caller keeps ownership of fd. A length of
+    // zero maps the whole file; a larger length grows a writable file first.
+    static std::unique_ptr<MappedFile> fromDescriptor(int fd, Access access, size_t length = 0);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    void* data() { return mapping; }
+    const void* data() const { return mapping; }
+    size_t size() const { return length; }
+    bool writable() const { return access == Access::ReadWrite; }
+
+    // Pages are accessed front to back (more aggressive read-ahead, earlier reclaim).
+    void adviseSequential();
+    // Starts reading [offset, offset + bytes) in the background.
+    void willNeed(size_t offset, size_t bytes);
+    // Drops [offset, offset + bytes) from this process's resident set. Writable files are flushed to disk first, so
+    // nothing is lost; the range can still be read again later (it is faulted back in from the file).
+    void evict(size_t offset, size_t bytes);
+
+private:
+    MappedFile(int fd, void* mapping, size_t length, Access access) : fd(fd), mapping(mapping), length(length), access(access) {}
+
+    static std::unique_ptr<MappedFile> map(int fd, Access access, size_t length, const std::string& description);
+    // Page-aligned range covering [offset, offset + bytes), clipped to the mapping. False if it is empty.
+    bool pageRange(size_t offset, size_t bytes, char*& begin, size_t& rangeBytes) const;
+
+    int fd = -1;
+    void* mapping = nullptr;
+    size_t length = 0;
+    Access access = Access::ReadOnly;
+};
+
+#endif //HELLO_METAL_MAPPEDFILE_H
@@ -0,0 +1,85 @@
+//
+// LatencyHistogram.cpp
+//
+
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+void LatencyHistogram::reset() {
+    for (auto& count : counts)
+        count.store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    lowest.store(UINT64_MAX, std::memory_order_relaxed);
+    highest.store(0, std::memory_order_relaxed);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot copy;
+    copy.count = total.load(std::memory_order_relaxed);
+    if (copy.count == 0)
+        return copy;
+    copy.sum = sum.load(std::memory_order_relaxed);
+    copy.min = lowest.load(std::memory_order_relaxed);
+    copy.max = highest.load(std::memory_order_relaxed);
+    copy.counts.resize(bucketCount);
+    for (size_t i = 0; i < bucketCount; ++i)
+        copy.counts[i] = counts[i].load(std::memory_order_relaxed);
+    return copy;
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double percent) const {
+    if (count == 0 || counts.empty())
+        return 0;
+    const double clamped = std::clamp(percent, 0.0, 100.0);
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(clamped / 100.0 * static_cast<double>(count))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        seen += counts[i];
+        if (seen >= rank)
+            return std::clamp(bucketHighest(i), min, max);
+    }
+    return max;
+}
+
+void LatencyHistogram::Snapshot::merge(const Snapshot& other) {
+    if (other.count == 0)
+        return;
+    if (count == 0) {
+        *this = other;
+        return;
+    }
+    for (size_t i = 0; i < bucketCount; ++i)
+        counts[i] += other.counts[i];
+    count += other.count;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::Snapshot::since(const Snapshot& previous) const {
+    if (previous.count == 0)
+        return *this;
+    Snapshot interval;
+    if (count <= previous.count)
+        return interval;
+    interval.count = count - previous.count;
+    interval.sum = sum - previous.sum;
+    interval.counts.assign(bucketCount, 0);
+    size_t first = bucketCount;
+    size_t last = 0;
+    for (size_t i = 0; i < bucketCount; ++i) {
+        interval.counts[i] = counts[i] >= previous.counts[i] ? counts[i] - previous.counts[i] : 0;
+        if (interval.counts[i]) {
+            first = std::min(first, i);
+            last = i;
+        }
+    }
+    if (first == bucketCount)
+        return Snapshot();
+    interval.min = std::max(min, bucketLowest(first));
+    interval.max = std::min(max, bucketHighest(last));
+    return interval;
+}
@@ -0,0 +1,87 @@
+//
+// LatencyHistogram.h
+//
+
+#ifndef HELLO_METAL_LATENCYHISTOGRAM_H
+#define HELLO_METAL_LATENCYHISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// HDR-style histogram of non-negative integer values (nanoseconds, for latencies). Buckets are log-linear: every
+// power of two is split into subBuckets equal sub-buckets, so any value is known to within 1/subBuckets (about 3%)
+// of itself, from 1 ns up to the full uint64_t range, in a fixed 15 KiB of counters.
+//
+// record() is a few relaxed atomic adds, so any number of threads can record into one histogram without a lock.
+// snapshot() copies the counters for percentiles; it is not atomic with respect to concurrent record() calls, so a
+// snapshot taken mid-flight may be off by the values recorded while it was copied.
+class LatencyHistogram {
+public:
+    static constexpr unsigned subBucketBits = 5;
+    static constexpr uint64_t subBuckets = uint64_t(1) << subBucketBits;
+    static constexpr size_t bucketCount = (64 - subBucketBits + 1) * subBuckets;
+
+    // Values below 2 * subBuckets get a bucket each; above that a bucket covers 2^shift values.
+    static constexpr size_t bucketIndex(uint64_t value) {
+        if (value < subBuckets)
+            return static_cast<size_t>(value);
+        const unsigned shift = static_cast<unsigned>(std::bit_width(value)) - 1 - subBucketBits;
+        return static_cast<size_t>(shift * subBuckets + (value >> shift));
+    }
+    static constexpr uint64_t bucketLowest(size_t index) {
+        if (index < subBuckets)
+            return index;
+        const unsigned shift = static_cast<unsigned>(index / subBuckets) - 1;
+        return (static_cast<uint64_t>(index) - shift * subBuckets) << shift;
+    }
+    static constexpr uint64_t bucketHighest(size_t index) {
+        if (index < subBuckets)
+            return index;
+        const unsigned shift = static_cast<unsigned>(index / subBuckets) - 1;
+        return bucketLowest(index) + ((uint64_t(1) << shift) - 1);
+    }
+
+    void record(uint64_t value) {
+        counts[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t seen = lowest.load(std::memory_order_relaxed);
+        while (value < seen && !lowest.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+        seen = highest.load(std::memory_order_relaxed);
+        while (value > seen && !highest.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+    }
+
+    // Not safe against concurrent record() calls: those may survive the reset or be half-counted.
+    void reset();
+
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t min = 0;
+        uint64_t max = 0;
+        std::vector<uint64_t> counts; // Per bucket; empty when count is zero
+
+        double mean() const { return count ? static_cast<double>(sum) / static_cast<double>(count) : 0.0; }
+        // Highest value in the bucket holding the nearest-rank percentile (0 to 100), clamped to [min, max].
+        uint64_t percentile(double percent) const;
+        // Adds other's counts, e.g. to combine histograms recorded separately.
+        void merge(const Snapshot& other);
+        // What was recorded between previous (an earlier snapshot of the same histogram) and this one. min and max
+        // cannot be recovered for the interval, so they are narrowed to the buckets that changed.
+        Snapshot since(const Snapshot& previous) const;
+    };
+    Snapshot snapshot() const;
+
+private:
+    std::array<std::atomic<uint64_t>, bucketCount> counts{};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> lowest{UINT64_MAX};
+    std::atomic<uint64_t> highest{0};
+};
+
+#endif //HELLO_METAL_LATENCYHISTOGRAM_H
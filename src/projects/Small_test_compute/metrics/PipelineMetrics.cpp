@@ -0,0 +1,258 @@
+//
+// PipelineMetrics.cpp
+//
+
+#include "PipelineMetrics.h"
+#include "../async/TaskScheduler.h"
+#include "../trace/Trace.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace {
+    // Slots follow the TaskScheduler worker ids, so they stay meaningful however many other threads come and go;
+    // everything else (device completion threads, callers of the synchronous paths) shares slot 0.
+    size_t workerIndex() {
+        const size_t schedulerIndex = TaskScheduler::currentWorkerIndex();
+        return schedulerIndex == TaskScheduler::npos ? 0 : schedulerIndex + 1;
+    }
+
+    std::string duration(double nanoseconds) {
+        std::ostringstream text;
+        text << std::setprecision(3);
+        if (nanoseconds < 1e3)
+            text << nanoseconds << " ns";
+        else if (nanoseconds < 1e6)
+            text << nanoseconds * 1e-3 << " us";
+        else if (nanoseconds < 1e9)
+            text << nanoseconds * 1e-6 << " ms";
+        else
+            text << nanoseconds * 1e-9 << " s";
+        return text.str();
+    }
+
+    double gigabytesPerSecond(uint64_t bytes, double seconds) {
+        return seconds > 0.0 ? static_cast<double>(bytes) / seconds * 1e-9 : 0.0;
+    }
+
+    void printLatency(std::ostream& out, const char* label, const LatencyHistogram::Snapshot& latency) {
+        out << "\t" << label << ": ";
+        if (latency.count == 0) {
+            out << "none\n";
+            return;
+        }
+        out << latency.count << " | mean " << duration(latency.mean()) << " | p50 " << duration(latency.percentile(50))
+            << " p90 " << duration(latency.percentile(90)) << " p99 " << duration(latency.percentile(99))
+            << " | min " << duration(latency.min) << " max " << duration(latency.max) << "\n";
+    }
+}
+
+PipelineMetrics::PipelineMetrics() : startedAt(Trace::now()) {}
+
+PipelineMetrics::~PipelineMetrics() {
+    stopPeriodicDump();
+}
+
+void PipelineMetrics::slotAcquired(uint64_t waitNanoseconds) {
+    chunksAcquired.fetch_add(1, std::memory_order_relaxed);
+    const size_t depth = inFlight.fetch_add(1, std::memory_order_relaxed) + 1;
+    updateMax(maxInFlight, depth);
+    inFlightAtAcquire[std::min(depth, maxTrackedDepth)].fetch_add(1, std::memory_order_relaxed);
+    backpressureNanoseconds.fetch_add(waitNanoseconds, std::memory_order_relaxed);
+    slotWait.record(waitNanoseconds);
+}
+
+void PipelineMetrics::slotReleased(uint64_t heldNanoseconds) {
+    // A reset() while chunks were in flight must not wrap the count
+    size_t current = inFlight.load(std::memory_order_relaxed);
+    while (current > 0 && !inFlight.compare_exchange_weak(current, current - 1, std::memory_order_relaxed)) {}
+    this->heldNanoseconds.fetch_add(heldNanoseconds, std::memory_order_relaxed);
+}
+
+void PipelineMetrics::bytesStaged(uint64_t bytes) {
+    bytesIn.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void PipelineMetrics::chunkStaged(uint64_t nanoseconds) {
+    staging.record(nanoseconds);
+    WorkerCounters& worker = workerCounters();
+    worker.busyNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    worker.chunks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PipelineMetrics::deviceCompleted(uint64_t nanoseconds) {
+    chunksCompleted.fetch_add(1, std::memory_order_relaxed);
+    device.record(nanoseconds);
+}
+
+void PipelineMetrics::chunkReadBack(uint64_t bytes, uint64_t nanoseconds) {
+    bytesOut.fetch_add(bytes, std::memory_order_relaxed);
+    readback.record(nanoseconds);
+    WorkerCounters& worker = workerCounters();
+    worker.busyNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    worker.chunks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PipelineMetrics::chunkFinished(uint64_t nanoseconds) {
+    chunksFinished.fetch_add(1, std::memory_order_relaxed);
+    endToEnd.record(nanoseconds);
+}
+
+PipelineMetrics::Snapshot PipelineMetrics::snapshot() const {
+    Snapshot copy;
+    const uint64_t elapsed = Trace::now() - startedAt.load(std::memory_order_relaxed);
+    copy.seconds = static_cast<double>(elapsed) * 1e-9;
+    copy.bytesIn = bytesIn.load(std::memory_order_relaxed);
+    copy.bytesOut = bytesOut.load(std::memory_order_relaxed);
+    copy.chunksAcquired = chunksAcquired.load(std::memory_order_relaxed);
+    // Completed before finished, so a chunk finishing in between cannot show up as awaiting readback
+    const uint64_t completed = chunksCompleted.load(std::memory_order_relaxed);
+    copy.chunksFinished = chunksFinished.load(std::memory_order_relaxed);
+    copy.inFlight = inFlight.load(std::memory_order_relaxed);
+    copy.maxInFlight = maxInFlight.load(std::memory_order_relaxed);
+    copy.meanInFlight = elapsed ? static_cast<double>(heldNanoseconds.load(std::memory_order_relaxed)) / static_cast<double>(elapsed) : 0.0;
+    copy.awaitingReadback = completed > copy.chunksFinished ? static_cast<size_t>(completed - copy.chunksFinished) : 0;
+    copy.backpressureNanoseconds = backpressureNanoseconds.load(std::memory_order_relaxed);
+
+    copy.inFlightAtAcquire.resize(maxTrackedDepth + 1);
+    for (size_t depth = 0; depth <= maxTrackedDepth; ++depth)
+        copy.inFlightAtAcquire[depth] = inFlightAtAcquire[depth].load(std::memory_order_relaxed);
+    while (!copy.inFlightAtAcquire.empty() && copy.inFlightAtAcquire.back() == 0)
+        copy.inFlightAtAcquire.pop_back();
+
+    copy.slotWait = slotWait.snapshot();
+    copy.staging = staging.snapshot();
+    copy.device = device.snapshot();
+    copy.readback = readback.snapshot();
+    copy.endToEnd = endToEnd.snapshot();
+
+    uint64_t busiest = 0;
+    uint64_t totalBusy = 0;
+    for (size_t i = 0; i < maxWorkers; ++i) {
+        Worker worker;
+        worker.index = i;
+        worker.busyNanoseconds = workers[i].busyNanoseconds.load(std::memory_order_relaxed);
+        worker.chunks = workers[i].chunks.load(std::memory_order_relaxed);
+        if (worker.chunks == 0)
+            continue;
+        worker.utilisation = elapsed ? static_cast<double>(worker.busyNanoseconds) / static_cast<double>(elapsed) : 0.0;
+        busiest = std::max(busiest, worker.busyNanoseconds);
+        totalBusy += worker.busyNanoseconds;
+        copy.workers.push_back(worker);
+    }
+    if (totalBusy > 0)
+        copy.workerSkew = static_cast<double>(busiest) * static_cast<double>(copy.workers.size()) / static_cast<double>(totalBusy);
+    return copy;
+}
+
+void PipelineMetrics::reset() {
+    bytesIn.store(0, std::memory_order_relaxed);
+    bytesOut.store(0, std::memory_order_relaxed);
+    chunksAcquired.store(0, std::memory_order_relaxed);
+    chunksCompleted.store(0, std::memory_order_relaxed);
+    chunksFinished.store(0, std::memory_order_relaxed);
+    inFlight.store(0, std::memory_order_relaxed);
+    maxInFlight.store(0, std::memory_order_relaxed);
+    heldNanoseconds.store(0, std::memory_order_relaxed);
+    backpressureNanoseconds.store(0, std::memory_order_relaxed);
+    for (auto& count : inFlightAtAcquire)
+        count.store(0, std::memory_order_relaxed);
+    slotWait.reset();
+    staging.reset();
+    device.reset();
+    readback.reset();
+    endToEnd.reset();
+    for (auto& worker : workers) {
+        worker.busyNanoseconds.store(0, std::memory_order_relaxed);
+        worker.chunks.store(0, std::memory_order_relaxed);
+    }
+    startedAt.store(Trace::now(), std::memory_order_relaxed);
+}
+
+void PipelineMetrics::print(const Snapshot& snapshot, std::ostream& out) {
+    out << "----------------------------------------------------------------\n";
+    out << "Pipeline metrics - over " << snapshot.seconds << " [s]\n";
+    out << "\tbytes: in " << snapshot.bytesIn << " (" << gigabytesPerSecond(snapshot.bytesIn, snapshot.seconds)
+        << " GB/s) | out " << snapshot.bytesOut << " (" << gigabytesPerSecond(snapshot.bytesOut, snapshot.seconds) << " GB/s)\n";
+    out << "\tchunks: " << snapshot.chunksAcquired << " acquired, " << snapshot.chunksFinished << " finished | in flight "
+        << snapshot.inFlight << " now, " << snapshot.maxInFlight << " max, " << snapshot.meanInFlight << " mean | "
+        << snapshot.awaitingReadback << " awaiting readback\n";
+    out << "\tin flight at acquire:";
+    for (size_t depth = 1; depth < snapshot.inFlightAtAcquire.size(); ++depth)
+        out << " " << depth << (depth == maxTrackedDepth ? "+" : "") << ":" << snapshot.inFlightAtAcquire[depth];
+    out << "\n";
+    out << "\tbackpressure: " << duration(static_cast<double>(snapshot.backpressureNanoseconds)) << " in total\n";
+    printLatency(out, "slot wait", snapshot.slotWait);
+    printLatency(out, "stage", snapshot.staging);
+    printLatency(out, "device", snapshot.device);
+    printLatency(out, "read back", snapshot.readback);
+    printLatency(out, "end to end", snapshot.endToEnd);
+    for (const Worker& worker : snapshot.workers) {
+        out << "\t" << (worker.index == 0 ? std::string("other threads") : "worker " + std::to_string(worker.index - 1))
+            << ": " << worker.chunks << " stages, busy "
+            << duration(static_cast<double>(worker.busyNanoseconds)) << " (" << 100.0 * worker.utilisation << "%)\n";
+    }
+    if (!snapshot.workers.empty())
+        out << "\tworker skew: " << snapshot.workerSkew << " (busiest over mean)\n";
+    out << "----------------------------------------------------------------\n";
+}
+
+void PipelineMetrics::printInterval(const Snapshot& previous, const Snapshot& current, std::ostream& out) {
+    const double seconds = current.seconds - previous.seconds;
+    const LatencyHistogram::Snapshot endToEnd = current.endToEnd.since(previous.endToEnd);
+    std::ostringstream line;
+    line << std::setprecision(3) << "[metrics " << current.seconds << " s] in "
+         << gigabytesPerSecond(current.bytesIn - previous.bytesIn, seconds) << " GB/s, out "
+         << gigabytesPerSecond(current.bytesOut - previous.bytesOut, seconds) << " GB/s | "
+         << current.chunksFinished - previous.chunksFinished << " chunks, " << current.inFlight << " in flight, "
+         << current.awaitingReadback << " awaiting readback | backpressure "
+         << duration(static_cast<double>(current.backpressureNanoseconds - previous.backpressureNanoseconds));
+    if (endToEnd.count)
+        line << " | chunk p50 " << duration(endToEnd.percentile(50)) << " p99 " << duration(endToEnd.percentile(99));
+    if (!current.workers.empty())
+        line << " | skew " << current.workerSkew;
+    line << "\n";
+    out << line.str() << std::flush;
+}
+
+void PipelineMetrics::startPeriodicDump(std::chrono::milliseconds period, std::ostream& out) {
+    stopPeriodicDump();
+    {
+        std::lock_guard<std::mutex> lock(dumpMutex);
+        dumpStopping = false;
+    }
+    dumpThread = std::thread([this, period, &out] {
+        Trace::setThreadName("metrics dump");
+        Snapshot previous = snapshot();
+        std::unique_lock<std::mutex> lock(dumpMutex);
+        while (!dumpWake.wait_for(lock, period, [this] { return dumpStopping; })) {
+            Snapshot current = snapshot();
+            // A reset() since the last line restarts the deltas
+            if (current.seconds < previous.seconds)
+                previous = Snapshot();
+            printInterval(previous, current, out);
+            previous = std::move(current);
+        }
+    });
+}
+
+void PipelineMetrics::stopPeriodicDump() {
+    {
+        std::lock_guard<std::mutex> lock(dumpMutex);
+        dumpStopping = true;
+    }
+    dumpWake.notify_all();
+    if (dumpThread.joinable())
+        dumpThread.join();
+}
+
+PipelineMetrics::WorkerCounters& PipelineMetrics::workerCounters() {
+    return workers[std::min(workerIndex(), maxWorkers - 1)];
+}
+
+void PipelineMetrics::updateMax(std::atomic<size_t>& target, size_t value) {
+    size_t seen = target.load(std::memory_order_relaxed);
+    while (value > seen && !target.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+}
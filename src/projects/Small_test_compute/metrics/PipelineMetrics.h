@@ -0,0 +1,132 @@
+//
+// PipelineMetrics.h
+//
+
+#ifndef HELLO_METAL_PIPELINEMETRICS_H
+#define HELLO_METAL_PIPELINEMETRICS_H
+
+#include "LatencyHistogram.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Live counters for the chunk pipeline (ChunkPipeline and ArrayAdder::processChunks): bytes staged in and read back,
+// chunks in flight and waiting for readback, time blocked on backpressure, HDR latency histograms per stage, and how
+// the staging and readback work spread over the scheduler's worker threads. Where Trace answers "what happened to
+// chunk 7", this answers "how is the pipeline doing", cheaply enough to leave on: every record is a handful of
+// relaxed atomic adds, and nothing takes a lock.
+//
+// The session owns one (ComputeSession::pipelineMetrics()) that every pipeline it creates records into. Query it with
+// snapshot(), print a report with print(), or have a background thread print one line per interval with
+// startPeriodicDump(). Setting HELLO_METAL_METRICS_INTERVAL to a number of milliseconds starts the dump on std::cerr
+// when the session is created.
+class PipelineMetrics {
+public:
+    // Slot 0 counts every thread that is not a TaskScheduler worker; worker i counts in slot i + 1, and workers past
+    // the last slot share it.
+    static constexpr size_t maxWorkers = 64;
+    // Depths past the last are counted in its entry.
+    static constexpr size_t maxTrackedDepth = 64;
+
+    PipelineMetrics();
+    ~PipelineMetrics();
+
+    PipelineMetrics(const PipelineMetrics&) = delete;
+    PipelineMetrics& operator=(const PipelineMetrics&) = delete;
+
+    // ChunkPipeline: a slot was handed out after waiting waitNanoseconds for the device, and later given back after
+    // being held for heldNanoseconds.
+    void slotAcquired(uint64_t waitNanoseconds);
+    void slotReleased(uint64_t heldNanoseconds);
+
+    // processChunks, per chunk. Staging and readback are charged to the calling thread.
+    void bytesStaged(uint64_t bytes);
+    void chunkStaged(uint64_t nanoseconds);
+    void deviceCompleted(uint64_t nanoseconds); // Commit to completion handler
+    void chunkReadBack(uint64_t bytes, uint64_t nanoseconds);
+    void chunkFinished(uint64_t nanoseconds);   // From waiting for a slot to the end of readback
+
+    struct Worker {
+        size_t index = 0;             // Slot: 0 for other threads, else 1 + the TaskScheduler worker index
+        uint64_t busyNanoseconds = 0; // Staging plus readback
+        uint64_t chunks = 0;          // Staged or read back
+        double utilisation = 0.0;     // busyNanoseconds over the snapshot's time span
+    };
+
+    struct Snapshot {
+        double seconds = 0.0; // Since construction or reset()
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+        uint64_t chunksAcquired = 0;
+        uint64_t chunksFinished = 0;
+        size_t inFlight = 0;
+        size_t maxInFlight = 0;
+        double meanInFlight = 0.0; // Time-weighted: total slot holding time over seconds
+        size_t awaitingReadback = 0; // Done on the device, not read back yet
+        uint64_t backpressureNanoseconds = 0;
+        // inFlightAtAcquire[d] counts the slots acquired with d chunks in flight, counting the new one.
+        std::vector<uint64_t> inFlightAtAcquire;
+        LatencyHistogram::Snapshot slotWait;
+        LatencyHistogram::Snapshot staging;
+        LatencyHistogram::Snapshot device;
+        LatencyHistogram::Snapshot readback;
+        LatencyHistogram::Snapshot endToEnd;
+        std::vector<Worker> workers; // Only threads that did any work
+        // Busiest worker over the mean of all of them: 1 is perfectly even, workers.size() is one thread doing it all.
+        double workerSkew = 0.0;
+    };
+    Snapshot snapshot() const;
+    // Clears every counter and restarts the clock. Chunks in flight across a reset can leave the in-flight count off
+    // until the pipeline drains.
+    void reset();
+
+    static void print(const Snapshot& snapshot, std::ostream& out = std::cout);
+    // One line covering what happened between previous and current.
+    static void printInterval(const Snapshot& previous, const Snapshot& current, std::ostream& out);
+
+    // Prints a line to out every period until stopPeriodicDump() (or destruction). Replaces a running dump.
+    void startPeriodicDump(std::chrono::milliseconds period, std::ostream& out = std::cerr);
+    void stopPeriodicDump();
+
+private:
+    struct alignas(64) WorkerCounters {
+        std::atomic<uint64_t> busyNanoseconds{0};
+        std::atomic<uint64_t> chunks{0};
+    };
+
+    WorkerCounters& workerCounters();
+    static void updateMax(std::atomic<size_t>& target, size_t value);
+
+    std::atomic<uint64_t> startedAt;
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+    std::atomic<uint64_t> chunksAcquired{0};
+    std::atomic<uint64_t> chunksCompleted{0};
+    std::atomic<uint64_t> chunksFinished{0};
+    std::atomic<size_t> inFlight{0};
+    std::atomic<size_t> maxInFlight{0};
+    std::atomic<uint64_t> heldNanoseconds{0};
+    std::atomic<uint64_t> backpressureNanoseconds{0};
+    std::array<std::atomic<uint64_t>, maxTrackedDepth + 1> inFlightAtAcquire{};
+    LatencyHistogram slotWait;
+    LatencyHistogram staging;
+    LatencyHistogram device;
+    LatencyHistogram readback;
+    LatencyHistogram endToEnd;
+    std::array<WorkerCounters, maxWorkers> workers;
+
+    std::mutex dumpMutex;
+    std::condition_variable dumpWake;
+    bool dumpStopping = false;
+    std::thread dumpThread;
+};
+
+#endif //HELLO_METAL_PIPELINEMETRICS_H
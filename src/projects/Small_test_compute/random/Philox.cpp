@@ -0,0 +1,77 @@
+//
+// Philox.cpp
+//
+
+#include "Philox.h"
+#include "../cpu/SimdKernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+void Philox::words(uint64_t first, uint32_t* out, size_t n) const {
+    const SimdKernelTable& kernels = SimdKernels::active();
+    uint64_t block = first / 4;
+    size_t done = 0;
+
+    // A range starting part-way into a block takes the rest of that block first
+    const size_t skip = static_cast<size_t>(first % 4);
+    if (skip != 0 && n > 0) {
+        uint32_t partial[4];
+        kernels.philox(key, streamId, block++, partial, 1);
+        done = std::min<size_t>(4 - skip, n);
+        std::copy(partial + skip, partial + skip + done, out);
+    }
+
+    const size_t wholeBlocks = (n - done) / 4;
+    kernels.philox(key, streamId, block, out + done, wholeBlocks);
+    block += wholeBlocks;
+    done += 4 * wholeBlocks;
+
+    if (done < n) {
+        uint32_t partial[4];
+        kernels.philox(key, streamId, block, partial, 1);
+        std::copy(partial, partial + (n - done), out + done);
+    }
+}
+
+void Philox::uniform(uint64_t first, float* out, size_t n, float low, float high) const {
+    constexpr float scale = 1.0f / 16777216.0f; // 2^-24
+    const float range = high - low;
+    // low + range * u rounds up to high for some u < 1 when low != 0; the largest value below high keeps [low, high)
+    const float below = std::nextafter(high, low);
+    uint32_t buffer[batchWords];
+    for (size_t offset = 0; offset < n; offset += batchWords) {
+        const size_t count = std::min(batchWords, n - offset);
+        words(first + offset, buffer, count);
+        for (size_t i = 0; i < count; ++i)
+            out[offset + i] = std::min(low + range * (static_cast<float>(buffer[i] >> 8) * scale), below);
+    }
+}
+
+void Philox::uniform(uint64_t first, double* out, size_t n, double low, double high) const {
+    constexpr double scale = 1.0 / 9007199254740992.0; // 2^-53
+    constexpr size_t batchElements = batchWords / 2;
+    const double range = high - low;
+    const double below = std::nextafter(high, low); // As for float
+    uint32_t buffer[batchWords];
+    for (size_t offset = 0; offset < n; offset += batchElements) {
+        const size_t count = std::min(batchElements, n - offset);
+        words(2 * (first + offset), buffer, 2 * count);
+        for (size_t i = 0; i < count; ++i) {
+            const uint64_t bits = ((static_cast<uint64_t>(buffer[2 * i]) << 32) | buffer[2 * i + 1]) >> 11;
+            out[offset + i] = std::min(low + range * (static_cast<double>(bits) * scale), below);
+        }
+    }
+}
+
+void Philox::fillUniform(float* out, size_t n, float low, float high, ThreadPool& pool) const {
+    pool.parallelFor(n, [this, out, low, high](size_t begin, size_t end) {
+        uniform(begin, out + begin, end - begin, low, high);
+    });
+}
+
+void Philox::fillUniform(double* out, size_t n, double low, double high, ThreadPool& pool) const {
+    pool.parallelFor(n, [this, out, low, high](size_t begin, size_t end) {
+        uniform(begin, out + begin, end - begin, low, high);
+    });
+}
@@ -0,0 +1,49 @@
+//
+// Philox.h
+//
+
+#ifndef HELLO_METAL_PHILOX_H
+#define HELLO_METAL_PHILOX_H
+
+#include "../cpu/ThreadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Counter-based random numbers: Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"). Word i
+// of a sequence is a pure function of (seed, stream, i), so any range of it can be generated on its own, by any thread
+// and in any order, and the values never depend on how the work was split, the thread count or the SIMD ISA. That is
+// what lets fillUniform run across a ThreadPool and ArrayAdder::addRandomArraysGpuChunked generate each chunk straight
+// into its staging buffers, with the same numbers a serial loop would give.
+//
+// Word i is word i % 4 of block i / 4, generated by SimdKernelTable::philox. A float takes the top 24 bits of one word
+// and a double 53 bits of two (words 2i and 2i + 1), so both are multiples of 2^-24 or 2^-53 in [0, 1) before scaling.
+// Streams of one seed are independent sequences: use one per input rather than offsets into one stream.
+class Philox {
+public:
+    explicit Philox(uint64_t seed, uint64_t stream = 0) : key(seed), streamId(stream) {}
+
+    uint64_t seed() const { return key; }
+    uint64_t stream() const { return streamId; }
+
+    // Words [first, first + n) of the sequence.
+    void words(uint64_t first, uint32_t* out, size_t n) const;
+
+    // Elements [first, first + n) of a uniform sequence on [low, high), on the calling thread.
+    void uniform(uint64_t first, float* out, size_t n, float low = 0.0f, float high = 1.0f) const;
+    void uniform(uint64_t first, double* out, size_t n, double low = 0.0, double high = 1.0) const;
+
+    // Elements [0, n), split across pool. The values are those of uniform(0, out, n, low, high).
+    void fillUniform(float* out, size_t n, float low = 0.0f, float high = 1.0f, ThreadPool& pool = ThreadPool::shared()) const;
+    void fillUniform(double* out, size_t n, double low = 0.0, double high = 1.0, ThreadPool& pool = ThreadPool::shared()) const;
+
+private:
+    // Words are generated into a stack buffer of this many and converted from there.
+    static constexpr size_t batchWords = 1024;
+
+    uint64_t key;
+    uint64_t streamId;
+};
+
+#endif //HELLO_METAL_PHILOX_H
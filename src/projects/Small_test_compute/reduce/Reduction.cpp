@@ -0,0 +1,145 @@
+//
+// Reduction.cpp
+//
+
+#include "Reduction.h"
+#include "../cpu/SimdKernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+double Reduction::identity(ReductionOp op) {
+    switch (op) {
+        case ReductionOp::Min: return std::numeric_limits<double>::infinity();
+        case ReductionOp::Max: return -std::numeric_limits<double>::infinity();
+        default: return 0.0;
+    }
+}
+
+double Reduction::combine(ReductionOp op, double accumulated, double value) {
+    switch (op) {
+        case ReductionOp::Min: return std::min(accumulated, value);
+        case ReductionOp::Max: return std::max(accumulated, value);
+        default: return accumulated + value;
+    }
+}
+
+double Reduction::finish(ReductionOp op, double accumulated) {
+    return op == ReductionOp::Norm ? std::sqrt(accumulated) : accumulated;
+}
+
+compute::KernelId Reduction::kernel(ReductionOp op) {
+    switch (op) {
+        case ReductionOp::Sum: return compute::KernelId::ReduceSum;
+        case ReductionOp::Min: return compute::KernelId::ReduceMin;
+        case ReductionOp::Max: return compute::KernelId::ReduceMax;
+        case ReductionOp::Dot: return compute::KernelId::ReduceDot;
+        case ReductionOp::Norm: return compute::KernelId::ReduceSumSquares;
+    }
+    return compute::KernelId::ReduceSum;
+}
+
+const char* Reduction::name(ReductionOp op) {
+    switch (op) {
+        case ReductionOp::Sum: return "sum";
+        case ReductionOp::Min: return "min";
+        case ReductionOp::Max: return "max";
+        case ReductionOp::Dot: return "dot";
+        case ReductionOp::Norm: return "norm";
+    }
+    return "sum";
+}
+
+bool Reduction::usesLeaves(ReductionOp op, ReductionMode mode) {
+    return mode != ReductionMode::Fast && op != ReductionOp::Min && op != ReductionOp::Max;
+}
+
+double Reduction::leaf(ReductionOp op, ReductionMode mode, const float* inA, const float* inB, size_t n) {
+    const float* second = op == ReductionOp::Dot ? inB : op == ReductionOp::Norm ? inA : nullptr;
+    float sum = 0.0f;
+    if (mode == ReductionMode::Compensated) {
+        float compensation = 0.0f;
+        SimdKernels::active().sumFixed(inA, second, n, &sum, &compensation);
+        return static_cast<double>(sum) + static_cast<double>(compensation);
+    }
+    SimdKernels::active().sumFixed(inA, second, n, &sum, nullptr);
+    return sum;
+}
+
+double Reduction::pairwiseSum(std::vector<double>& values) {
+    size_t count = values.size();
+    if (count == 0)
+        return 0.0;
+    while (count > 1) {
+        const size_t half = count / 2;
+        for (size_t i = 0; i < half; ++i)
+            values[i] = values[2 * i] + values[2 * i + 1];
+        if (count % 2 != 0)
+            values[half] = values[count - 1];
+        count = half + count % 2;
+    }
+    return values[0];
+}
+
+compute::KernelId Reduction::leafKernel(ReductionOp op, ReductionMode mode) {
+    const bool compensated = mode == ReductionMode::Compensated;
+    switch (op) {
+        case ReductionOp::Dot:
+            return compensated ? compute::KernelId::ReduceDotLeavesCompensated : compute::KernelId::ReduceDotLeaves;
+        case ReductionOp::Norm:
+            return compensated ? compute::KernelId::ReduceSumSquaresLeavesCompensated : compute::KernelId::ReduceSumSquaresLeaves;
+        default:
+            return compensated ? compute::KernelId::ReduceSumLeavesCompensated : compute::KernelId::ReduceSumLeaves;
+    }
+}
+
+double Reduction::reduce(ReductionOp op, const std::vector<float>& inA, const std::vector<float>& inB,
+                         ReductionMode mode, ThreadPool& pool) {
+    const size_t n = op == ReductionOp::Dot ? std::min(inA.size(), inB.size()) : inA.size();
+    return reduce(op, inA.data(), inB.data(), n, mode, pool);
+}
+
+double Reduction::reduce(ReductionOp op, const float* inA, const float* inB, size_t n, ReductionMode mode, ThreadPool& pool) {
+    if (usesLeaves(op, mode)) {
+        // Every leaf lands in its own slot, so which thread computed it does not matter
+        std::vector<double> leaves((n + leafSize - 1) / leafSize);
+        pool.parallelFor(leaves.size(), [&](size_t firstLeaf, size_t lastLeaf) {
+            for (size_t index = firstLeaf; index < lastLeaf; ++index) {
+                const size_t begin = index * leafSize;
+                leaves[index] = leaf(op, mode, inA + begin, inB ? inB + begin : nullptr, std::min(leafSize, n - begin));
+            }
+        });
+        return finish(op, pairwiseSum(leaves));
+    }
+
+    const SimdKernelTable& kernels = SimdKernels::active();
+    const size_t blocks = (n + blockSize - 1) / blockSize;
+
+    std::mutex resultMutex;
+    double result = identity(op);
+
+    pool.parallelFor(blocks, [&](size_t firstBlock, size_t lastBlock) {
+        double local = identity(op);
+        for (size_t block = firstBlock; block < lastBlock; ++block) {
+            const size_t begin = block * blockSize;
+            const size_t count = std::min(blockSize, n - begin);
+            float value;
+            switch (op) {
+                case ReductionOp::Sum: value = kernels.sum(inA + begin, count); break;
+                case ReductionOp::Min: value = kernels.minimum(inA + begin, count); break;
+                case ReductionOp::Max: value = kernels.maximum(inA + begin, count); break;
+                case ReductionOp::Dot: value = kernels.dot(inA + begin, inB + begin, count); break;
+                case ReductionOp::Norm: value = kernels.sumOfSquares(inA + begin, count); break;
+                default: value = 0.0f; break;
+            }
+            local = combine(op, local, value);
+        }
+
+        std::lock_guard<std::mutex> lock(resultMutex);
+        result = combine(op, result, local);
+    });
+
+    return finish(op, result);
+}
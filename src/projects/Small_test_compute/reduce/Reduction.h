@@ -0,0 +1,67 @@
+//
+// Reduction.h
+//
+
+#ifndef HELLO_METAL_REDUCTION_H
+#define HELLO_METAL_REDUCTION_H
+
+#include "../cpu/ThreadPool.h"
+#include "../device/KernelRegistry.h"
+
+#include <cstddef>
+#include <vector>
+
+// Aggregates over float vectors. Norm is the Euclidean (L2) norm; Dot is the only operation that reads inB.
+enum class ReductionOp { Sum, Min, Max, Dot, Norm };
+
+// Fast folds blocks in whatever order the threads finish them, so the last bits of a sum can change with the thread
+// count, the chunk size or the SIMD ISA. Deterministic gives the same bits for the same input on any of those.
+// Compensated is Deterministic plus a Neumaier correction inside every leaf, for sums with heavy cancellation.
+enum class ReductionMode { Fast, Deterministic, Compensated };
+
+// Reductions on the CPU are hierarchical: SIMD kernels reduce fixed blocks of blockSize elements in float registers,
+// each thread folds its blocks in double, and the per-thread results are folded in double at the end. Float error is
+// therefore limited to what accumulates inside one block. The device versions (threadgroup tree reductions in
+// reduction.metal, with CPU twins registered by CpuDevice) go through ArrayAdder::reduceArraysGpuChunked.
+//
+// In the deterministic modes the shape of the sum depends only on n. The input is cut into leaves of leafSize elements
+// at fixed global offsets; a leaf is summed by SimdKernelTable::sumFixed (32 interleaved lanes folded pairwise, the
+// same on every ISA and in the reduce_*_leaves device kernels), and the leaf values are folded in double by a pairwise
+// tree over the leaf index. Threads and chunks only decide who computes which leaf. Min and max are exact whatever the
+// order, so they ignore the mode.
+class Reduction {
+public:
+    static constexpr size_t blockSize = 16384;
+    static constexpr size_t leafSize = 4096;
+    static constexpr size_t leafLanes = 32; // Threads per leaf in the reduce_*_leaves kernels
+
+    static double reduce(ReductionOp op, const float* inA, const float* inB, size_t n,
+                         ReductionMode mode = ReductionMode::Fast, ThreadPool& pool = ThreadPool::shared());
+    static double reduce(ReductionOp op, const std::vector<float>& inA, const std::vector<float>& inB = {},
+                         ReductionMode mode = ReductionMode::Fast, ThreadPool& pool = ThreadPool::shared());
+
+    static double sum(const std::vector<float>& in) { return reduce(ReductionOp::Sum, in); }
+    static double min(const std::vector<float>& in) { return reduce(ReductionOp::Min, in); }
+    static double max(const std::vector<float>& in) { return reduce(ReductionOp::Max, in); }
+    static double dot(const std::vector<float>& inA, const std::vector<float>& inB) { return reduce(ReductionOp::Dot, inA, inB); }
+    static double norm(const std::vector<float>& in) { return reduce(ReductionOp::Norm, in); }
+
+    // Building blocks shared with the device path. Norm accumulates a sum of squares until finish() takes the root.
+    static double identity(ReductionOp op);
+    static double combine(ReductionOp op, double accumulated, double value);
+    static double finish(ReductionOp op, double accumulated);
+    // Device kernel in reduction.metal (and its CPU twin).
+    static compute::KernelId kernel(ReductionOp op);
+    static const char* name(ReductionOp op);
+
+    // Deterministic building blocks. A leaf is at most leafSize elements starting at a multiple of leafSize; inB is
+    // only read for Dot. pairwiseSum folds ((v0 + v1) + (v2 + v3)) + ..., carrying an odd tail up one level, so its
+    // shape depends only on values.size(); the values are overwritten.
+    static bool usesLeaves(ReductionOp op, ReductionMode mode);
+    static double leaf(ReductionOp op, ReductionMode mode, const float* inA, const float* inB, size_t n);
+    static double pairwiseSum(std::vector<double>& values);
+    // Device kernel writing one value per leaf, or a (sum, correction) pair per leaf for Compensated.
+    static compute::KernelId leafKernel(ReductionOp op, ReductionMode mode);
+};
+
+#endif //HELLO_METAL_REDUCTION_H
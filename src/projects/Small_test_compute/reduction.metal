@@ -0,0 +1,177 @@
+//
+// reduction.metal
+//
+
+#include <metal_stdlib>
+using namespace metal;
+
+// One partial result per threadgroup. Each thread loads one element (dot and sum-of-squares multiply first), the
+// threadgroup folds them with a tree in threadgroup memory, and thread 0 writes partials[threadgroup]. The host
+// combines the partials. Dispatch with dispatchThreads over the element count and a power-of-two threadgroup size of at
+// most 1024; the last threadgroup may be partial.
+
+constant uint maxThreadsPerThreadgroup = 1024;
+
+template <typename Combine>
+static void reduce_threadgroup(float value, threadgroup float* scratch, device float* partials,
+                               uint lid, uint groupSize, uint groupId, Combine combine) {
+    scratch[lid] = value;
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    // groupSize is the size of this threadgroup, which is smaller than the others for the last one
+    for (uint stride = maxThreadsPerThreadgroup / 2; stride > 0; stride >>= 1) {
+        if (lid < stride && lid + stride < groupSize)
+            scratch[lid] = combine(scratch[lid], scratch[lid + stride]);
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+    }
+
+    if (lid == 0)
+        partials[groupId] = scratch[0];
+}
+
+struct SumCombine { float operator()(float a, float b) const { return a + b; } };
+struct MinCombine { float operator()(float a, float b) const { return min(a, b); } };
+struct MaxCombine { float operator()(float a, float b) const { return max(a, b); } };
+
+kernel void reduce_sum(const device float* inA [[ buffer(0) ]],
+                       const device float* inB [[ buffer(1) ]],
+                       device float* partials [[ buffer(2) ]],
+                       uint id [[ thread_position_in_grid ]],
+                       uint lid [[ thread_position_in_threadgroup ]],
+                       uint groupSize [[ threads_per_threadgroup ]],
+                       uint groupId [[ threadgroup_position_in_grid ]]) {
+    threadgroup float scratch[maxThreadsPerThreadgroup];
+    reduce_threadgroup(inA[id], scratch, partials, lid, groupSize, groupId, SumCombine());
+}
+
+kernel void reduce_min(const device float* inA [[ buffer(0) ]],
+                       const device float* inB [[ buffer(1) ]],
+                       device float* partials [[ buffer(2) ]],
+                       uint id [[ thread_position_in_grid ]],
+                       uint lid [[ thread_position_in_threadgroup ]],
+                       uint groupSize [[ threads_per_threadgroup ]],
+                       uint groupId [[ threadgroup_position_in_grid ]]) {
+    threadgroup float scratch[maxThreadsPerThreadgroup];
+    reduce_threadgroup(inA[id], scratch, partials, lid, groupSize, groupId, MinCombine());
+}
+
+kernel void reduce_max(const device float* inA [[ buffer(0) ]],
+                       const device float* inB [[ buffer(1) ]],
+                       device float* partials [[ buffer(2) ]],
+                       uint id [[ thread_position_in_grid ]],
+                       uint lid [[ thread_position_in_threadgroup ]],
+                       uint groupSize [[ threads_per_threadgroup ]],
+                       uint groupId [[ threadgroup_position_in_grid ]]) {
+    threadgroup float scratch[maxThreadsPerThreadgroup];
+    reduce_threadgroup(inA[id], scratch, partials, lid, groupSize, groupId, MaxCombine());
+}
+
+kernel void reduce_dot(const device float* inA [[ buffer(0) ]],
+                       const device float* inB [[ buffer(1) ]],
+                       device float* partials [[ buffer(2) ]],
+                       uint id [[ thread_position_in_grid ]],
+                       uint lid [[ thread_position_in_threadgroup ]],
+                       uint groupSize [[ threads_per_threadgroup ]],
+                       uint groupId [[ threadgroup_position_in_grid ]]) {
+    threadgroup float scratch[maxThreadsPerThreadgroup];
+    reduce_threadgroup(inA[id] * inB[id], scratch, partials, lid, groupSize, groupId, SumCombine());
+}
+
+kernel void reduce_sum_squares(const device float* inA [[ buffer(0) ]],
+                               const device float* inB [[ buffer(1) ]],
+                               device float* partials [[ buffer(2) ]],
+                               uint id [[ thread_position_in_grid ]],
+                               uint lid [[ thread_position_in_threadgroup ]],
+                               uint groupSize [[ threads_per_threadgroup ]],
+                               uint groupId [[ threadgroup_position_in_grid ]]) {
+    threadgroup float scratch[maxThreadsPerThreadgroup];
+    reduce_threadgroup(inA[id] * inA[id], scratch, partials, lid, groupSize, groupId, SumCombine());
+}
+
+// Leaves for the deterministic modes of Reduction (ReductionMode::Deterministic / Compensated). Each leaf is a run of
+// leafSize elements summed by leafLanes consecutive threads: lane l adds elements l, l + 32, l + 64, ... in order, then
+// the lanes are folded pairwise (l takes l + 16, then l + 8, ...), the same shape as SimdKernelTable::sumFixed on the
+// CPU. Plain leaves write partials[leaf]; compensated ones keep a Neumaier correction per lane and write the pair
+// (sum, correction) to partials[2 * leaf]. The host folds leaves by a pairwise tree over the global leaf index, so the
+// result does not depend on the chunking. Dispatch leafLanes threads per leaf over zero-padded chunks; the threadgroup
+// size must be a multiple of leafLanes, at most 1024. This file is compiled with -fno-fast-math so products are not
+// fused into the adds.
+
+constant uint leafSize = 4096;
+constant uint leafLanes = 32;
+
+enum class LeafInput { Sum, Dot, SumSquares };
+
+static inline void neumaier_add(thread float& s, thread float& c, float x) {
+    const float t = s + x;
+    if (fabs(s) >= fabs(x))
+        c += (s - t) + x;
+    else
+        c += (x - t) + s;
+    s = t;
+}
+
+template <LeafInput Input, bool Compensated>
+static void reduce_leaf(const device float* inA, const device float* inB, device float* partials,
+                        threadgroup float* sums, threadgroup float* corrections, uint id, uint lid) {
+    const uint leaf = id / leafLanes;
+    const uint lane = id % leafLanes;
+    const uint first = leaf * leafSize + lane;
+
+    float s = 0.0f;
+    float c = 0.0f;
+    for (uint i = first; i < first + leafSize; i += leafLanes) {
+        const float x = Input == LeafInput::Sum ? inA[i] : Input == LeafInput::Dot ? inA[i] * inB[i] : inA[i] * inA[i];
+        if (Compensated)
+            neumaier_add(s, c, x);
+        else
+            s += x;
+    }
+    sums[lid] = s;
+    corrections[lid] = c;
+
+    // Threads of one leaf are adjacent in the threadgroup, starting at a multiple of leafLanes
+    const uint base = lid - lane;
+    for (uint width = leafLanes / 2; width > 0; width >>= 1) {
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        if (lane < width) {
+            if (Compensated) {
+                float sum = sums[base + lane];
+                float correction = corrections[base + lane];
+                neumaier_add(sum, correction, sums[base + lane + width]);
+                sums[base + lane] = sum;
+                corrections[base + lane] = correction + corrections[base + lane + width];
+            } else {
+                sums[base + lane] += sums[base + lane + width];
+            }
+        }
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    if (lane == 0) {
+        if (Compensated) {
+            partials[2 * leaf] = sums[base];
+            partials[2 * leaf + 1] = corrections[base];
+        } else {
+            partials[leaf] = sums[base];
+        }
+    }
+}
+
+#define REDUCE_LEAF_KERNEL(name, input, compensated)                                                \
+kernel void name(const device float* inA [[ buffer(0) ]],                                           \
+                 const device float* inB [[ buffer(1) ]],                                           \
+                 device float* partials [[ buffer(2) ]],                                            \
+                 uint id [[ thread_position_in_grid ]],                                             \
+                 uint lid [[ thread_position_in_threadgroup ]]) {                                   \
+    threadgroup float sums[maxThreadsPerThreadgroup];                                               \
+    threadgroup float corrections[maxThreadsPerThreadgroup];                                        \
+    reduce_leaf<input, compensated>(inA, inB, partials, sums, corrections, id, lid);                \
+}
+
+REDUCE_LEAF_KERNEL(reduce_sum_leaves, LeafInput::Sum, false)
+REDUCE_LEAF_KERNEL(reduce_dot_leaves, LeafInput::Dot, false)
+REDUCE_LEAF_KERNEL(reduce_sum_squares_leaves, LeafInput::SumSquares, false)
+REDUCE_LEAF_KERNEL(reduce_sum_leaves_compensated, LeafInput::Sum, true)
+REDUCE_LEAF_KERNEL(reduce_dot_leaves_compensated, LeafInput::Dot, true)
+REDUCE_LEAF_KERNEL(reduce_sum_squares_leaves_compensated, LeafInput::SumSquares, true)
@@ -0,0 +1,77 @@
+//
+// scan.metal
+//
+
+#include <metal_stdlib>
+using namespace metal;
+
+// Per-threadgroup building blocks for the chunked scan and filter in ArrayAdder. Each threadgroup works on its own
+// range of the chunk with a Hillis-Steele scan in threadgroup memory; the host stitches the threadgroups (and chunks)
+// together when it copies the results out. Dispatch with dispatchThreads over the element count and at most 1024
+// threads per threadgroup; the last threadgroup may be partial.
+
+constant uint maxScanThreadgroupSize = 1024;
+
+// Same layout as FilterPredicate in Scan.h
+struct FilterPredicate {
+    uint compare; // Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual
+    float value;
+};
+
+static bool keeps(constant FilterPredicate& predicate, float x) {
+    switch (predicate.compare) {
+        case 0: return x < predicate.value;
+        case 1: return x <= predicate.value;
+        case 2: return x > predicate.value;
+        case 3: return x >= predicate.value;
+        case 4: return x == predicate.value;
+        case 5: return x != predicate.value;
+        default: return false;
+    }
+}
+
+template <typename T>
+static T inclusive_scan_threadgroup(T value, threadgroup T* scratch, uint lid, uint groupSize) {
+    scratch[lid] = value;
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    for (uint offset = 1; offset < groupSize; offset <<= 1) {
+        const T addend = lid >= offset ? scratch[lid - offset] : T(0);
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        scratch[lid] += addend;
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+    }
+    return scratch[lid];
+}
+
+// outC gets the inclusive prefix sum of each threadgroup's elements
+kernel void scan_threadgroups(const device float* inA [[ buffer(0) ]],
+                              const device float* inB [[ buffer(1) ]],
+                              device float* outC [[ buffer(2) ]],
+                              uint id [[ thread_position_in_grid ]],
+                              uint lid [[ thread_position_in_threadgroup ]],
+                              uint groupSize [[ threads_per_threadgroup ]]) {
+    threadgroup float scratch[maxScanThreadgroupSize];
+    outC[id] = inclusive_scan_threadgroup(inA[id], scratch, lid, groupSize);
+}
+
+// The kept elements of each threadgroup are written, in order, to the front of its range of outC and their number to
+// counts[threadgroup]
+kernel void filter_threadgroups(const device float* inA [[ buffer(0) ]],
+                                device uint* counts [[ buffer(1) ]],
+                                device float* outC [[ buffer(2) ]],
+                                constant FilterPredicate& predicate [[ buffer(3) ]],
+                                uint id [[ thread_position_in_grid ]],
+                                uint lid [[ thread_position_in_threadgroup ]],
+                                uint groupSize [[ threads_per_threadgroup ]],
+                                uint groupId [[ threadgroup_position_in_grid ]]) {
+    threadgroup uint scratch[maxScanThreadgroupSize];
+    const float value = inA[id];
+    const uint keep = keeps(predicate, value) ? 1 : 0;
+    const uint kept = inclusive_scan_threadgroup(keep, scratch, lid, groupSize);
+
+    if (keep)
+        outC[id - lid + kept - 1] = value;
+    if (lid == groupSize - 1)
+        counts[groupId] = kept;
+}
@@ -0,0 +1,59 @@
+//
+// Scan.cpp
+//
+
+#include "Scan.h"
+
+void Scan::scan(ScanKind kind, const float* in, float* out, size_t n, ThreadPool& pool) {
+    const size_t blocks = (n + blockSize - 1) / blockSize;
+    std::vector<double> offsets(blocks);
+
+    pool.parallelFor(blocks, [&](size_t firstBlock, size_t lastBlock) {
+        for (size_t block = firstBlock; block < lastBlock; ++block) {
+            const size_t end = std::min(n, (block + 1) * blockSize);
+            double total = 0.0;
+            for (size_t i = block * blockSize; i < end; ++i)
+                total += in[i];
+            offsets[block] = total;
+        }
+    }, ThreadPool::Partitioning::Static, 0, 1);
+
+    double running = 0.0;
+    for (double& offset : offsets) {
+        const double total = offset;
+        offset = running;
+        running += total;
+    }
+
+    // Each element is read before its slot is written, so in == out is fine
+    pool.parallelFor(blocks, [&](size_t firstBlock, size_t lastBlock) {
+        for (size_t block = firstBlock; block < lastBlock; ++block) {
+            const size_t end = std::min(n, (block + 1) * blockSize);
+            double sum = offsets[block];
+            if (kind == ScanKind::Inclusive) {
+                for (size_t i = block * blockSize; i < end; ++i) {
+                    sum += in[i];
+                    out[i] = static_cast<float>(sum);
+                }
+            } else {
+                for (size_t i = block * blockSize; i < end; ++i) {
+                    const float value = in[i];
+                    out[i] = static_cast<float>(sum);
+                    sum += value;
+                }
+            }
+        }
+    }, ThreadPool::Partitioning::Static, 0, 1);
+}
+
+std::vector<float> Scan::inclusive(const std::vector<float>& in, ThreadPool& pool) {
+    std::vector<float> out(in.size());
+    scan(ScanKind::Inclusive, in.data(), out.data(), in.size(), pool);
+    return out;
+}
+
+std::vector<float> Scan::exclusive(const std::vector<float>& in, ThreadPool& pool) {
+    std::vector<float> out(in.size());
+    scan(ScanKind::Exclusive, in.data(), out.data(), in.size(), pool);
+    return out;
+}
@@ -0,0 +1,104 @@
+//
+// Scan.h
+//
+
+#ifndef HELLO_METAL_SCAN_H
+#define HELLO_METAL_SCAN_H
+
+#include "../cpu/ThreadPool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Inclusive: out[i] = in[0] + ... + in[i]. Exclusive: out[i] = in[0] + ... + in[i - 1], so out[0] = 0.
+enum class ScanKind { Inclusive, Exclusive };
+
+// A predicate that filter() can also evaluate on a device (filter_threadgroups in scan.metal, which declares the same
+// layout): keeps x when "x compare value" holds.
+struct FilterPredicate {
+    enum class Compare : uint32_t { Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual };
+
+    Compare compare = Compare::Greater;
+    float value = 0.0f;
+
+    bool operator()(float x) const {
+        switch (compare) {
+            case Compare::Less: return x < value;
+            case Compare::LessEqual: return x <= value;
+            case Compare::Greater: return x > value;
+            case Compare::GreaterEqual: return x >= value;
+            case Compare::Equal: return x == value;
+            case Compare::NotEqual: return x != value;
+        }
+        return false;
+    }
+};
+
+// Prefix sums and stream compaction on the CPU, as two passes over fixed blocks of blockSize elements. The first pass
+// totals (or counts) every block in parallel, a serial scan of those few totals gives each block its starting offset,
+// and the second pass scans (or compacts) every block from its offset in parallel. Running sums are kept in double,
+// so only the stored values are rounded to float. The device versions (scan.metal, with CPU twins registered by
+// CpuDevice) go through ArrayAdder::scanArraysGpuChunked and filterArraysGpuChunked.
+class Scan {
+public:
+    static constexpr size_t blockSize = 16384;
+
+    // out may be the same array as in.
+    static void scan(ScanKind kind, const float* in, float* out, size_t n, ThreadPool& pool = ThreadPool::shared());
+    static std::vector<float> inclusive(const std::vector<float>& in, ThreadPool& pool = ThreadPool::shared());
+    static std::vector<float> exclusive(const std::vector<float>& in, ThreadPool& pool = ThreadPool::shared());
+
+    // Writes the elements of in that satisfy predicate to the front of out, in order, and returns how many there are.
+    // out needs room for n elements and must not overlap in. predicate is called twice per element, from any thread.
+    template<typename Predicate>
+    static size_t filter(const float* in, size_t n, float* out, Predicate predicate, ThreadPool& pool = ThreadPool::shared());
+    template<typename Predicate>
+    static std::vector<float> filter(const std::vector<float>& in, Predicate predicate, ThreadPool& pool = ThreadPool::shared());
+};
+
+template<typename Predicate>
+size_t Scan::filter(const float* in, size_t n, float* out, Predicate predicate, ThreadPool& pool) {
+    const size_t blocks = (n + blockSize - 1) / blockSize;
+    std::vector<size_t> offsets(blocks);
+
+    pool.parallelFor(blocks, [&](size_t firstBlock, size_t lastBlock) {
+        for (size_t block = firstBlock; block < lastBlock; ++block) {
+            const size_t end = std::min(n, (block + 1) * blockSize);
+            size_t count = 0;
+            for (size_t i = block * blockSize; i < end; ++i)
+                count += predicate(in[i]) ? 1 : 0;
+            offsets[block] = count;
+        }
+    }, ThreadPool::Partitioning::Static, 0, 1);
+
+    size_t total = 0;
+    for (size_t& offset : offsets) {
+        const size_t count = offset;
+        offset = total;
+        total += count;
+    }
+
+    pool.parallelFor(blocks, [&](size_t firstBlock, size_t lastBlock) {
+        for (size_t block = firstBlock; block < lastBlock; ++block) {
+            const size_t end = std::min(n, (block + 1) * blockSize);
+            float* next = out + offsets[block];
+            for (size_t i = block * blockSize; i < end; ++i) {
+                if (predicate(in[i]))
+                    *next++ = in[i];
+            }
+        }
+    }, ThreadPool::Partitioning::Static, 0, 1);
+
+    return total;
+}
+
+template<typename Predicate>
+std::vector<float> Scan::filter(const std::vector<float>& in, Predicate predicate, ThreadPool& pool) {
+    std::vector<float> out(in.size());
+    out.resize(filter(in.data(), in.size(), out.data(), predicate, pool));
+    return out;
+}
+
+#endif //HELLO_METAL_SCAN_H
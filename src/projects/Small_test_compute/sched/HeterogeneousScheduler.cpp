@@ -0,0 +1,200 @@
+//
+// HeterogeneousScheduler.cpp
+//
+
+#include "HeterogeneousScheduler.h"
+#include "../cpu/SimdKernels.h"
+#include "../cpu/TypedKernels.h"
+#include "../device/ChunkPipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+// Shared position in [0, count). claim() hands out the next range, sized for the claiming executor.
+class HeterogeneousScheduler::Cursor {
+public:
+    Cursor(size_t count, size_t executors, const Options& options) : count(count), executors(std::max<size_t>(1, executors)), options(options) {}
+
+    // False once everything has been claimed.
+    bool claim(double elementsPerSecond, size_t& begin, size_t& end) {
+        size_t current = next.load(std::memory_order_relaxed);
+        for (;;) {
+            if (current >= count)
+                return false;
+
+            const size_t remaining = count - current;
+            size_t size = elementsPerSecond > 0.0
+                          ? static_cast<size_t>(elementsPerSecond * options.targetChunkSeconds)
+                          : options.initialChunkSize;
+            // Guided tail: never take more than half of an even share of what is left
+            size = std::min(size, remaining / (2 * executors));
+            size = std::clamp(size, options.minChunkSize, options.maxChunkSize);
+            size = std::min(size, remaining);
+
+            if (next.compare_exchange_weak(current, current + size, std::memory_order_relaxed)) {
+                begin = current;
+                end = current + size;
+                return true;
+            }
+        }
+    }
+
+private:
+    std::atomic<size_t> next{0};
+    const size_t count;
+    const size_t executors;
+    const Options& options;
+};
+
+namespace {
+    // Exponential moving average, seeded with the first sample.
+    double smoothed(double previous, double sample) {
+        return previous > 0.0 ? 0.7 * previous + 0.3 * sample : sample;
+    }
+}
+
+HeterogeneousScheduler::HeterogeneousScheduler(std::vector<compute::ComputeSession*> devices, const Options& options)
+        : devices(std::move(devices)), options(options) {
+    this->options.minChunkSize = std::max<size_t>(1, this->options.minChunkSize);
+    this->options.maxChunkSize = std::max(this->options.minChunkSize, this->options.maxChunkSize);
+    this->options.deviceInFlight = std::max<size_t>(1, this->options.deviceInFlight);
+}
+
+std::vector<HeterogeneousScheduler::ExecutorReport> HeterogeneousScheduler::run(const std::string& kernelName, const float* inA,
+                                                                                const float* inB, float* outC, size_t count) {
+    const size_t executors = devices.size() + (options.useHost ? 1 : 0);
+    std::vector<ExecutorReport> reports(executors);
+    if (executors == 0 || count == 0)
+        return reports;
+
+    Cursor cursor(count, executors, options);
+
+    // One driver thread per device; the host executor runs on the calling thread
+    std::vector<std::thread> drivers;
+    const size_t firstDevice = options.useHost ? 1 : 0;
+    for (size_t i = 0; i < devices.size(); ++i) {
+        drivers.emplace_back([this, i, firstDevice, &kernelName, inA, inB, outC, &cursor, &reports] {
+            runDevice(*devices[i], kernelName, inA, inB, outC, cursor, reports[firstDevice + i]);
+        });
+    }
+
+    std::exception_ptr hostError;
+    if (options.useHost) {
+        try {
+            runHost(kernelName, inA, inB, outC, cursor, reports[0]);
+        } catch (...) {
+            hostError = std::current_exception();
+        }
+    }
+
+    for (auto& driver : drivers)
+        driver.join();
+    if (hostError)
+        std::rethrow_exception(hostError);
+
+    // A device whose pipeline could not be created leaves its share to the others; if there were no others, say so
+    size_t processed = 0;
+    for (const auto& report : reports)
+        processed += report.elements;
+    if (processed != count)
+        std::cerr << "HeterogeneousScheduler: only " << processed << " of " << count << " elements were processed." << std::endl;
+    return reports;
+}
+
+void HeterogeneousScheduler::runHost(const std::string& kernelName, const float* inA, const float* inB, float* outC,
+                                     Cursor& cursor, ExecutorReport& report) {
+    ThreadPool& pool = options.hostPool ? *options.hostPool : ThreadPool::shared();
+    report.name = "host (" + std::to_string(pool.threadCount()) + " threads, " + SimdKernels::isaName(SimdKernels::active().isa) + ")";
+
+    ElementwiseOp op = ElementwiseOp::Add;
+    parseElementwiseOp(kernelName, op);
+    const SimdKernelTable& kernels = SimdKernels::active();
+    auto kernel = visitElementwiseOp(op, [&](auto constant) { return kernels.*simdElementwise<decltype(constant)::value>; });
+
+    size_t begin, end;
+    while (cursor.claim(report.elementsPerSecond, begin, end)) {
+        const auto chunkStart = std::chrono::steady_clock::now();
+        pool.parallelFor(end - begin, [=](size_t first, size_t last) {
+            kernel(inA + begin + first, inB + begin + first, outC + begin + first, last - first);
+        });
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - chunkStart;
+
+        report.chunks++;
+        report.elements += end - begin;
+        if (elapsed.count() > 0.0)
+            report.elementsPerSecond = smoothed(report.elementsPerSecond, (end - begin) / elapsed.count());
+    }
+}
+
+void HeterogeneousScheduler::runDevice(compute::ComputeSession& session, const std::string& kernelName, const float* inA,
+                                       const float* inB, float* outC, Cursor& cursor, ExecutorReport& report) {
+    report.name = session.device().name();
+
+    auto computePipelineState = session.pipeline(kernelName);
+    if (!computePipelineState)
+        return;
+
+    compute::ChunkPipeline chunkPipeline(session, options.deviceInFlight, 3, options.maxChunkSize * sizeof(float));
+    if (!chunkPipeline.valid()) {
+        std::cerr << "HeterogeneousScheduler: could not allocate staging buffers on " << report.name << std::endl;
+        return;
+    }
+
+    // Completion handlers run on the backend's thread and update the throughput this driver sizes its claims with
+    std::mutex reportMutex;
+    double elementsPerSecond = 0.0;
+    std::chrono::steady_clock::time_point lastCompletion;
+
+    size_t begin, end;
+    for (;;) {
+        double rate;
+        {
+            std::lock_guard<std::mutex> lock(reportMutex);
+            rate = elementsPerSecond;
+        }
+        if (!cursor.claim(rate, begin, end))
+            break;
+
+        auto& slot = chunkPipeline.acquire();
+        const auto chunkStart = std::chrono::steady_clock::now();
+        const size_t chunkSize = end - begin;
+        memcpy(slot.buffer(0)->contents(), inA + begin, chunkSize * sizeof(float));
+        memcpy(slot.buffer(1)->contents(), inB + begin, chunkSize * sizeof(float));
+
+        auto commandBuffer = session.queue().commandBuffer();
+        auto computeCommandEncoder = commandBuffer->computeCommandEncoder();
+        computeCommandEncoder->setComputePipelineState(computePipelineState);
+        computeCommandEncoder->setBuffer(slot.buffer(0), 0, 0);
+        computeCommandEncoder->setBuffer(slot.buffer(1), 0, 1);
+        computeCommandEncoder->setBuffer(slot.buffer(2), 0, 2);
+        computeCommandEncoder->dispatchThreads({chunkSize, 1, 1},
+                                               {std::min(computePipelineState->threadExecutionWidth(), chunkSize), 1, 1});
+        computeCommandEncoder->endEncoding();
+
+        // Throughput covers staging as well as execution, since both limit how fast this executor gets through work.
+        // With several chunks in flight a chunk also queues behind the previous one, so it is only charged for the
+        // time since that one completed.
+        float* destination = outC + begin;
+        chunkPipeline.releaseOnCompletion(*commandBuffer, slot,
+                                          [destination, chunkSize, chunkStart, &reportMutex, &elementsPerSecond, &lastCompletion, &report](compute::ChunkPipeline::Slot& done) {
+            memcpy(destination, done.buffer(2)->contents(), chunkSize * sizeof(float));
+            const auto now = std::chrono::steady_clock::now();
+
+            std::lock_guard<std::mutex> lock(reportMutex);
+            const std::chrono::duration<double> elapsed = now - std::max(chunkStart, lastCompletion);
+            lastCompletion = now;
+            report.chunks++;
+            report.elements += chunkSize;
+            if (elapsed.count() > 0.0)
+                elementsPerSecond = smoothed(elementsPerSecond, chunkSize / elapsed.count());
+        });
+        commandBuffer->commit();
+    }
+    chunkPipeline.drain();
+    report.elementsPerSecond = elementsPerSecond;
+}
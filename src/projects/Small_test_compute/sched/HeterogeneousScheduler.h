@@ -0,0 +1,62 @@
+//
+// HeterogeneousScheduler.h
+//
+
+#ifndef HELLO_METAL_HETEROGENEOUSSCHEDULER_H
+#define HELLO_METAL_HETEROGENEOUSSCHEDULER_H
+
+#include "../cpu/ThreadPool.h"
+#include "../device/ComputeSession.h"
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Runs one element-wise kernel over a vector using several executors at once: the host CPU (SIMD kernels on a
+// ThreadPool) and any number of devices (each through its own ComputeSession). Work is not split up front. Every
+// executor repeatedly claims the next unprocessed range from a shared cursor and writes its result straight into
+// outC, so a faster executor simply comes back for more.
+//
+// Claims are sized from each executor's measured throughput (elements per second, smoothed over its recent chunks)
+// so that a claim takes about targetChunkSeconds: devices with high launch overhead get big chunks, slower executors
+// small ones. Near the end claims are capped at a fraction of what is left, so no executor is stuck with a large tail.
+class HeterogeneousScheduler {
+public:
+    struct Options {
+        bool useHost = true;                 // Include the host CPU as an executor
+        ThreadPool* hostPool = nullptr;      // nullptr uses ThreadPool::shared()
+        size_t initialChunkSize = size_t(1) << 18; // Claim size before an executor has been measured
+        size_t minChunkSize = size_t(1) << 14;
+        size_t maxChunkSize = size_t(1) << 22;     // Also sizes each device's staging buffers
+        size_t deviceInFlight = 2;           // Chunks each device keeps in flight
+        double targetChunkSeconds = 0.002;
+    };
+
+    struct ExecutorReport {
+        std::string name;
+        size_t chunks = 0;
+        size_t elements = 0;
+        double elementsPerSecond = 0.0; // Smoothed throughput at the end of the run
+    };
+
+    explicit HeterogeneousScheduler(std::vector<compute::ComputeSession*> devices) : HeterogeneousScheduler(std::move(devices), Options()) {}
+    HeterogeneousScheduler(std::vector<compute::ComputeSession*> devices, const Options& options);
+
+    // Runs kernelName ("add_arrays" or "complex_operation") over [0, count). Returns one report per executor, the
+    // host first when it takes part. Exceptions from the host kernels are rethrown once every executor has stopped.
+    std::vector<ExecutorReport> run(const std::string& kernelName, const float* inA, const float* inB, float* outC, size_t count);
+
+private:
+    class Cursor;
+
+    void runHost(const std::string& kernelName, const float* inA, const float* inB, float* outC, Cursor& cursor,
+                 ExecutorReport& report);
+    void runDevice(compute::ComputeSession& session, const std::string& kernelName, const float* inA, const float* inB,
+                   float* outC, Cursor& cursor, ExecutorReport& report);
+
+    std::vector<compute::ComputeSession*> devices;
+    Options options;
+};
+
+#endif //HELLO_METAL_HETEROGENEOUSSCHEDULER_H
@@ -0,0 +1,74 @@
+//
+// Timer.h
+//
+
+#ifndef HELLO_METAL_TIMER_H
+#define HELLO_METAL_TIMER_H
+
+#include "Trace.h"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// Stopwatch for one operation, printed in whichever unit suits it (nanoseconds to seconds), so short chunk stages no
+// longer print as 0. Uses the same nanosecond clock as Trace, and while tracing is on each start/stop pair is also
+// recorded as a span named after the timer.
+class Timer {
+public:
+    explicit Timer(const std::string& name = std::string()) : timerName(name) {}
+
+    void setName(const std::string& name) {
+        timerName = name;
+    }
+
+    void start() {
+        startTime = Trace::now();
+        endTime = startTime;
+    }
+
+    void stop() {
+        endTime = Trace::now();
+        if (Trace::enabled())
+            Trace::complete(Trace::intern(timerName.empty() ? std::string("Timer") : timerName), "timer", startTime, endTime);
+    }
+
+    uint64_t elapsedNanoseconds() const { return endTime - startTime; }
+    double elapsedSeconds() const { return static_cast<double>(elapsedNanoseconds()) * 1e-9; }
+
+    // Resets the name and times, ready for the next start().
+    void cleanUp() {
+        timerName.clear();
+        startTime = 0;
+        endTime = 0;
+    }
+
+    void print() {
+        std::cout << "----------------------------------------------------------------\n";
+        if (!timerName.empty())
+            std::cout << "Timing Information - " << timerName << "\n";
+        else
+            std::cout << "\nTiming Information. \n";
+
+        const double elapsed = static_cast<double>(elapsedNanoseconds());
+        if (elapsed < 1e3)
+            std::cout << "\tElapsed: " << elapsed << " [nanoseconds]\n";
+        else if (elapsed < 1e6)
+            std::cout << "\tElapsed: " << elapsed * 1e-3 << " [microseconds]\n";
+        else if (elapsed < 1e9)
+            std::cout << "\tElapsed: " << elapsed * 1e-6 << " [milliseconds]\n";
+        else
+            std::cout << "\tElapsed: " << elapsed * 1e-9 << " [seconds]\n";
+
+        std::cout << "----------------------------------------------------------------\n";
+
+        cleanUp();
+    }
+
+private:
+    std::string timerName;
+    uint64_t startTime = 0;
+    uint64_t endTime = 0;
+};
+
+#endif //HELLO_METAL_TIMER_H
@@ -0,0 +1,296 @@
+//
+// Trace.cpp
+//
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace {
+    struct Event {
+        const char* name;
+        const char* category;
+        char phase; // Chrome trace-event phase: X complete, i instant, b/e async begin/end
+        uint64_t timestamp;
+        uint64_t duration;
+        uint64_t id;
+        Trace::Arg args[2];
+    };
+
+    constexpr size_t eventsPerBlock = 4096;
+
+    struct Block {
+        Event events[eventsPerBlock];
+        std::atomic<size_t> count{0}; // Events published to readers
+    };
+
+    // One per thread. Only the owner appends, and it only takes the mutex to add a block or to drop the blocks of an
+    // earlier recording, so readers (which hold the mutex) see a stable list and read each block up to its count.
+    struct ThreadBuffer {
+        uint32_t threadId = 0;
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Block>> blocks;
+        Block* current = nullptr;
+        uint64_t recording = 0; // Which recording the blocks belong to
+        std::string threadName;
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+        std::atomic<uint64_t> recording{1};
+        std::atomic<uint64_t> origin{0}; // now() at start(); timestamps are exported relative to it
+        std::atomic<uint64_t> nextId{1};
+        uint32_t nextThreadId = 1;
+
+        std::mutex internMutex;
+        std::set<std::string> interned;
+
+        std::string exitPath; // From HELLO_METAL_TRACE
+    };
+
+    // Never destroyed: worker threads may still record while statics are torn down.
+    Registry& registry() {
+        static Registry* instance = new Registry();
+        return *instance;
+    }
+
+    ThreadBuffer& threadBuffer() {
+        // The registry keeps a reference too, so the events outlive the thread.
+        thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+            auto created = std::make_shared<ThreadBuffer>();
+            Registry& shared = registry();
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            created->threadId = shared.nextThreadId++;
+            shared.buffers.push_back(created);
+            return created;
+        }();
+        return *buffer;
+    }
+
+    void append(const Event& event) {
+        ThreadBuffer& buffer = threadBuffer();
+        const uint64_t recording = registry().recording.load(std::memory_order_acquire);
+        if (buffer.recording != recording || !buffer.current || buffer.current->count.load(std::memory_order_relaxed) == eventsPerBlock) {
+            std::lock_guard<std::mutex> lock(buffer.mutex);
+            if (buffer.recording != recording) {
+                buffer.blocks.clear();
+                buffer.recording = recording;
+            }
+            buffer.blocks.push_back(std::make_unique<Block>());
+            buffer.current = buffer.blocks.back().get();
+        }
+        const size_t index = buffer.current->count.load(std::memory_order_relaxed);
+        buffer.current->events[index] = event;
+        buffer.current->count.store(index + 1, std::memory_order_release);
+    }
+
+    void writeJsonString(std::ostream& out, const char* text) {
+        out << '"';
+        for (const char* character = text ? text : ""; *character; ++character) {
+            switch (*character) {
+                case '"': out << "\\\""; break;
+                case '\\': out << "\\\\"; break;
+                case '\n': out << "\\n"; break;
+                case '\t': out << "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(*character) < 0x20) {
+                        char code[8];
+                        std::snprintf(code, sizeof(code), "\\u%04x", *character);
+                        out << code;
+                    } else {
+                        out << *character;
+                    }
+            }
+        }
+        out << '"';
+    }
+
+    // Chrome timestamps are in microseconds; three decimals keep the nanoseconds.
+    void writeMicroseconds(std::ostream& out, uint64_t nanoseconds) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%llu.%03llu", static_cast<unsigned long long>(nanoseconds / 1000),
+                      static_cast<unsigned long long>(nanoseconds % 1000));
+        out << text;
+    }
+
+    long processId() {
+#if defined(__unix__) || defined(__APPLE__)
+        return static_cast<long>(getpid());
+#else
+        return 1;
+#endif
+    }
+
+    bool startFromEnvironment() {
+        const char* path = std::getenv("HELLO_METAL_TRACE");
+        if (!path || path[0] == '\0')
+            return false;
+        registry().exitPath = path;
+        registry().origin.store(Trace::now(), std::memory_order_relaxed);
+        std::atexit([] {
+            Trace::stop();
+            if (Trace::writeChromeJson(registry().exitPath))
+                std::cerr << "Trace: " << Trace::eventCount() << " events written to " << registry().exitPath << std::endl;
+        });
+        return true;
+    }
+}
+
+std::atomic<bool> Trace::active{startFromEnvironment()};
+
+void Trace::start() {
+    Registry& shared = registry();
+    shared.recording.fetch_add(1, std::memory_order_acq_rel);
+    shared.origin.store(now(), std::memory_order_relaxed);
+    active.store(true, std::memory_order_release);
+}
+
+void Trace::stop() {
+    active.store(false, std::memory_order_release);
+}
+
+uint64_t Trace::now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void Trace::complete(const char* name, const char* category, uint64_t startTime, uint64_t endTime, Arg first, Arg second) {
+    append({name, category, 'X', startTime, endTime > startTime ? endTime - startTime : 0, 0, {first, second}});
+}
+
+void Trace::instant(const char* name, const char* category, Arg first, Arg second) {
+    append({name, category, 'i', now(), 0, 0, {first, second}});
+}
+
+void Trace::asyncBegin(const char* name, const char* category, uint64_t id, Arg first, Arg second) {
+    append({name, category, 'b', now(), 0, id, {first, second}});
+}
+
+void Trace::asyncEnd(const char* name, const char* category, uint64_t id) {
+    append({name, category, 'e', now(), 0, id, {}});
+}
+
+uint64_t Trace::newIds(uint64_t count) {
+    return registry().nextId.fetch_add(std::max<uint64_t>(count, 1), std::memory_order_relaxed);
+}
+
+void Trace::setThreadName(const std::string& name) {
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.threadName = name;
+}
+
+const char* Trace::intern(const std::string& text) {
+    Registry& shared = registry();
+    std::lock_guard<std::mutex> lock(shared.internMutex);
+    return shared.interned.insert(text).first->c_str();
+}
+
+size_t Trace::eventCount() {
+    Registry& shared = registry();
+    const uint64_t recording = shared.recording.load(std::memory_order_acquire);
+    size_t count = 0;
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    for (const auto& buffer : shared.buffers) {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        if (buffer->recording != recording)
+            continue;
+        for (const auto& block : buffer->blocks)
+            count += block->count.load(std::memory_order_acquire);
+    }
+    return count;
+}
+
+void Trace::writeChromeJson(std::ostream& out) {
+    Registry& shared = registry();
+    const uint64_t recording = shared.recording.load(std::memory_order_acquire);
+    const uint64_t origin = shared.origin.load(std::memory_order_relaxed);
+    const long pid = processId();
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    auto separator = [&out, &first]() {
+        out << (first ? "\n" : ",\n");
+        first = false;
+    };
+
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    for (const auto& buffer : shared.buffers) {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        if (!buffer->threadName.empty()) {
+            separator();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << buffer->threadId << ",\"args\":{\"name\":";
+            writeJsonString(out, buffer->threadName.c_str());
+            out << "}}";
+        }
+        if (buffer->recording != recording)
+            continue;
+
+        for (const auto& block : buffer->blocks) {
+            const size_t count = block->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; ++i) {
+                const Event& event = block->events[i];
+                // Spans begun before start() are clipped to it
+                const uint64_t timestamp = std::max(event.timestamp, origin);
+                const uint64_t clipped = timestamp - event.timestamp;
+
+                separator();
+                out << "{\"name\":";
+                writeJsonString(out, event.name);
+                out << ",\"cat\":";
+                writeJsonString(out, event.category);
+                out << ",\"ph\":\"" << event.phase << "\",\"ts\":";
+                writeMicroseconds(out, timestamp - origin);
+                if (event.phase == 'X') {
+                    out << ",\"dur\":";
+                    writeMicroseconds(out, event.duration > clipped ? event.duration - clipped : 0);
+                } else if (event.phase == 'i') {
+                    out << ",\"s\":\"t\"";
+                } else {
+                    out << ",\"id\":\"0x" << std::hex << event.id << std::dec << "\"";
+                }
+                out << ",\"pid\":" << pid << ",\"tid\":" << buffer->threadId;
+                if (event.args[0].name || event.args[1].name) {
+                    out << ",\"args\":{";
+                    bool firstArg = true;
+                    for (const Arg& arg : event.args) {
+                        if (!arg.name)
+                            continue;
+                        if (!firstArg)
+                            out << ',';
+                        writeJsonString(out, arg.name);
+                        out << ':' << arg.value;
+                        firstArg = false;
+                    }
+                    out << '}';
+                }
+                out << '}';
+            }
+        }
+    }
+    out << "\n]}\n";
+}
+
+bool Trace::writeChromeJson(const std::string& path) {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        std::cerr << "Trace: cannot write " << path << std::endl;
+        return false;
+    }
+    writeChromeJson(file);
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,90 @@
+//
+// Trace.h
+//
+
+#ifndef HELLO_METAL_TRACE_H
+#define HELLO_METAL_TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+// A named integer attached to an event.
+struct TraceArg {
+    const char* name = nullptr; // Unused when null
+    int64_t value = 0;
+};
+
+// Nanosecond timeline of what the compute code is doing, exported as Chrome trace-event JSON (load it in
+// chrome://tracing or ui.perfetto.dev). TraceScope records a span for a block on the current thread, and nested scopes
+// nest in the viewer. Async spans can begin on one thread and end on another, such as a chunk from staging to readback.
+//
+// Each thread appends to its own buffer, so recording an event takes no lock. While tracing is off, a scope costs one
+// relaxed atomic load. Setting HELLO_METAL_TRACE to a path records from startup and writes the trace there at exit.
+// start(), stop() and writeChromeJson() do the same from code.
+//
+// Names, categories and argument names are stored as pointers, so they must outlive the trace: use string literals,
+// or intern() for names built at run time.
+class Trace {
+public:
+    using Arg = TraceArg;
+
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+
+    // start() discards whatever an earlier recording left behind.
+    static void start();
+    static void stop();
+
+    // Steady clock, in nanoseconds.
+    static uint64_t now();
+
+    static void complete(const char* name, const char* category, uint64_t startTime, uint64_t endTime,
+                         Arg first = {}, Arg second = {});
+    static void instant(const char* name, const char* category, Arg first = {}, Arg second = {});
+    // Spans with the same category and id form one track; spans on a track must nest.
+    static void asyncBegin(const char* name, const char* category, uint64_t id, Arg first = {}, Arg second = {});
+    static void asyncEnd(const char* name, const char* category, uint64_t id);
+    // The first of count consecutive ids that are unique in this process. Never zero.
+    static uint64_t newIds(uint64_t count = 1);
+
+    // Label for the calling thread's track.
+    static void setThreadName(const std::string& name);
+    // A copy of text that lives as long as the process.
+    static const char* intern(const std::string& text);
+
+    // Events recorded since the last start().
+    static size_t eventCount();
+    static void writeChromeJson(std::ostream& out);
+    static bool writeChromeJson(const std::string& path);
+
+private:
+    static std::atomic<bool> active;
+};
+
+// Records a span from construction to destruction, if tracing was on at construction.
+class TraceScope {
+public:
+    explicit TraceScope(const char* name, const char* category = "compute", Trace::Arg first = {}, Trace::Arg second = {})
+            : name(name), category(category), first(first), second(second), recording(Trace::enabled()),
+              startTime(recording ? Trace::now() : 0) {}
+
+    ~TraceScope() {
+        if (recording)
+            Trace::complete(name, category, startTime, Trace::now(), first, second);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    const char* category;
+    Trace::Arg first;
+    Trace::Arg second;
+    bool recording;
+    uint64_t startTime;
+};
+
+#endif //HELLO_METAL_TRACE_H
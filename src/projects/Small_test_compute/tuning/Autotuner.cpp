@@ -0,0 +1,172 @@
+//
+// Autotuner.cpp
+//
+
+#include "Autotuner.h"
+#include "../ArrayAdder.h"
+#include "../device/ChunkPipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    std::vector<size_t> threadgroupCandidates(const compute::ComputePipelineState& pipelineState) {
+        const size_t width = std::max<size_t>(1, pipelineState.threadExecutionWidth());
+        const size_t maxThreads = std::max(width, pipelineState.maxTotalThreadsPerThreadgroup());
+
+        std::vector<size_t> candidates;
+        for (size_t threads = width; threads <= maxThreads; threads *= 2)
+            candidates.push_back(threads);
+        if (candidates.back() != maxThreads)
+            candidates.push_back(maxThreads);
+        return candidates;
+    }
+
+    std::vector<size_t> chunkCandidates(size_t vectorSize, size_t minChunkSize, size_t maxChunkSize) {
+        std::vector<size_t> candidates;
+        for (size_t chunk = minChunkSize; chunk < vectorSize && chunk <= maxChunkSize; chunk *= 4)
+            candidates.push_back(chunk);
+        // A single chunk covering the whole vector, when the device allows it
+        candidates.push_back(std::min(vectorSize, maxChunkSize));
+        return candidates;
+    }
+}
+
+double Autotuner::measure(compute::ComputePipelineState& pipelineState, const std::vector<float>& inA, const std::vector<float>& inB,
+                          std::vector<float>& outC, const TuningParameters& parameters) {
+    const size_t vectorSize = inA.size();
+    compute::ChunkPipeline chunkPipeline(session, parameters.inFlight, 3, parameters.chunkSize * sizeof(float));
+    if (!chunkPipeline.valid())
+        return -1.0;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t offset = 0; offset < vectorSize; offset += parameters.chunkSize) {
+        const size_t currentChunkSize = std::min(vectorSize - offset, parameters.chunkSize);
+        auto& slot = chunkPipeline.acquire();
+
+        memcpy(slot.buffer(0)->contents(), inA.data() + offset, currentChunkSize * sizeof(float));
+        memcpy(slot.buffer(1)->contents(), inB.data() + offset, currentChunkSize * sizeof(float));
+
+        auto commandBuffer = session.queue().commandBuffer();
+        auto computeCommandEncoder = commandBuffer->computeCommandEncoder();
+        computeCommandEncoder->setComputePipelineState(&pipelineState);
+        computeCommandEncoder->setBuffer(slot.buffer(0), 0, 0);
+        computeCommandEncoder->setBuffer(slot.buffer(1), 0, 1);
+        computeCommandEncoder->setBuffer(slot.buffer(2), 0, 2);
+        computeCommandEncoder->dispatchThreads({currentChunkSize, 1, 1},
+                                               {std::min(parameters.threadgroupSize, currentChunkSize), 1, 1});
+        computeCommandEncoder->endEncoding();
+
+        float* destination = outC.data() + offset;
+        chunkPipeline.releaseOnCompletion(*commandBuffer, slot, [destination, currentChunkSize](compute::ChunkPipeline::Slot& done) {
+            memcpy(destination, done.buffer(2)->contents(), currentChunkSize * sizeof(float));
+        });
+        commandBuffer->commit();
+    }
+    chunkPipeline.drain();
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+double Autotuner::bestOf(compute::ComputePipelineState& pipelineState, const std::vector<float>& inA, const std::vector<float>& inB,
+                         std::vector<float>& outC, const TuningParameters& parameters, size_t repetitions) {
+    // One untimed pass to fault in the staging buffers for this chunk size
+    if (measure(pipelineState, inA, inB, outC, parameters) < 0.0)
+        return -1.0;
+
+    double best = -1.0;
+    for (size_t i = 0; i < std::max<size_t>(1, repetitions); ++i) {
+        const double seconds = measure(pipelineState, inA, inB, outC, parameters);
+        if (seconds >= 0.0 && (best < 0.0 || seconds < best))
+            best = seconds;
+    }
+    return best;
+}
+
+TuningParameters Autotuner::tune(const std::string& kernelName, size_t vectorSize, const Options& options) {
+    TuningParameters best;
+    auto pipelineState = session.pipeline(kernelName);
+    if (!pipelineState || vectorSize == 0)
+        return best;
+
+    const size_t deviceMaxChunk = session.device().maxBufferLength() / sizeof(float);
+    const size_t maxChunkSize = std::min(options.maxChunkSize, deviceMaxChunk);
+
+    const std::vector<float> inA(vectorSize, 0.5f);
+    const std::vector<float> inB(vectorSize, 0.25f);
+    std::vector<float> outC(vectorSize);
+
+    // Start from the values ArrayAdder uses when it has no profile
+    best.threadgroupSize = pipelineState->threadExecutionWidth();
+    best.chunkSize = std::min({vectorSize, maxChunkSize, ArrayAdder::defaultChunkSize});
+    best.inFlight = ArrayAdder::defaultInFlight;
+    double bestSeconds = bestOf(*pipelineState, inA, inB, outC, best, options.repetitions);
+    if (bestSeconds < 0.0)
+        return TuningParameters();
+
+    auto sweep = [&](size_t TuningParameters::*field, const std::vector<size_t>& candidates) {
+        for (size_t candidate : candidates) {
+            if (candidate == best.*field)
+                continue;
+            TuningParameters trial = best;
+            trial.*field = candidate;
+            const double seconds = bestOf(*pipelineState, inA, inB, outC, trial, options.repetitions);
+            if (seconds >= 0.0 && seconds < bestSeconds) {
+                best = trial;
+                bestSeconds = seconds;
+            }
+        }
+    };
+
+    const auto chunkSizes = chunkCandidates(vectorSize, options.minChunkSize, maxChunkSize);
+    sweep(&TuningParameters::threadgroupSize, threadgroupCandidates(*pipelineState));
+    sweep(&TuningParameters::chunkSize, chunkSizes);
+    sweep(&TuningParameters::inFlight, options.inFlightCandidates);
+    sweep(&TuningParameters::chunkSize, chunkSizes);
+
+    best.gigabytesPerSecond = 3.0 * vectorSize * sizeof(float) / bestSeconds / 1e9;
+    if (options.verbose) {
+        std::cout << "Autotuner: " << kernelName << " n=" << vectorSize
+                  << " | chunkSize: " << best.chunkSize << " | inFlight: " << best.inFlight
+                  << " | threadgroupSize: " << best.threadgroupSize
+                  << " | " << best.gigabytesPerSecond << " GB/s" << std::endl;
+    }
+    return best;
+}
+
+TuningProfile Autotuner::run(const Options& options) {
+    TuningProfile profile;
+    const std::string machine = TuningProfile::machineKey(session.device());
+    if (options.verbose)
+        std::cout << "Autotuner: tuning for " << machine << std::endl;
+
+    for (const auto& kernelName : options.kernels) {
+        for (size_t vectorSize : options.vectorSizes) {
+            const TuningParameters parameters = tune(kernelName, vectorSize, options);
+            if (parameters.chunkSize == 0)
+                continue;
+            profile.set(machine, kernelName, TuningProfile::sizeBucket(vectorSize), parameters);
+        }
+    }
+    return profile;
+}
+
+bool Autotuner::tuneAndSave(compute::ComputeSession& session, const Options& options, const std::string& path) {
+    Autotuner tuner(session);
+    const TuningProfile tuned = tuner.run(options);
+
+    TuningProfile merged;
+    merged.load(path);
+    merged.merge(tuned);
+    if (!merged.save(path)) {
+        std::cerr << "Autotuner: failed to write the tuning file " << path << std::endl;
+        return false;
+    }
+
+    if (path == TuningProfile::defaultPath())
+        TuningProfile::reloadActive();
+    return true;
+}
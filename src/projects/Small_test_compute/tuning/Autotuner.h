@@ -0,0 +1,58 @@
+//
+// Autotuner.h
+//
+
+#ifndef HELLO_METAL_AUTOTUNER_H
+#define HELLO_METAL_AUTOTUNER_H
+
+#include "TuningProfile.h"
+#include "../device/ComputeSession.h"
+
+#include <string>
+#include <vector>
+
+// Finds the chunk size, in-flight depth and threadgroup size that give the best throughput for each kernel and
+// vector-size bucket on the session's device, and records them in a TuningProfile. ArrayAdder reads the profile in
+// place of its built-in defaults.
+//
+// Every candidate is timed through a compute::ChunkPipeline (copy in, dispatch, copy out in the completion handler) with
+// inFlight buffer sets in rotation, which is how the chunked ArrayAdder paths behave. Rather than the full cross
+// product, the search is coordinate descent: threadgroup size, then chunk size, then in-flight depth, then chunk
+// size again with the other two fixed.
+class Autotuner {
+public:
+    struct Options {
+        std::vector<std::string> kernels = {"add_arrays", "complex_operation"};
+        std::vector<size_t> vectorSizes = {size_t(1) << 16, size_t(1) << 20, size_t(1) << 24};
+        size_t repetitions = 3;       // Timed runs per candidate; the fastest is kept
+        size_t minChunkSize = size_t(1) << 12;
+        size_t maxChunkSize = size_t(1) << 26;
+        std::vector<size_t> inFlightCandidates = {1, 2, 3, 4, 6, 8};
+        bool verbose = true;
+    };
+
+    explicit Autotuner(compute::ComputeSession& session = compute::ComputeSession::shared()) : session(session) {}
+
+    // Tunes every kernel/size pair in options. Entries are keyed by TuningProfile::machineKey(session.device()).
+    TuningProfile run(const Options& options);
+    TuningProfile run() { return run(Options()); }
+
+    // Best parameters for a single kernel and vector size.
+    TuningParameters tune(const std::string& kernelName, size_t vectorSize, const Options& options);
+
+    // Runs the tuner, merges the result into the file at path (entries for other machines are kept) and makes it the
+    // active profile.
+    static bool tuneAndSave(compute::ComputeSession& session, const Options& options,
+                            const std::string& path = TuningProfile::defaultPath());
+
+private:
+    // Seconds for one pass over the vectors, or a negative value if the pipeline could not run.
+    double measure(compute::ComputePipelineState& pipelineState, const std::vector<float>& inA, const std::vector<float>& inB,
+                   std::vector<float>& outC, const TuningParameters& parameters);
+    double bestOf(compute::ComputePipelineState& pipelineState, const std::vector<float>& inA, const std::vector<float>& inB,
+                  std::vector<float>& outC, const TuningParameters& parameters, size_t repetitions);
+
+    compute::ComputeSession& session;
+};
+
+#endif //HELLO_METAL_AUTOTUNER_H
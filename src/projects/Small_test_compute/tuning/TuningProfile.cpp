@@ -0,0 +1,140 @@
+//
+// TuningProfile.cpp
+//
+
+#include "TuningProfile.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace {
+    std::mutex activeMutex;
+    std::shared_ptr<const TuningProfile> activeProfile;
+
+    std::string hostName() {
+#if defined(__unix__) || defined(__APPLE__)
+        char name[256] = {};
+        if (gethostname(name, sizeof(name) - 1) == 0 && name[0] != '\0')
+            return name;
+#endif
+        return "unknown-host";
+    }
+}
+
+std::string TuningProfile::defaultPath() {
+    if (const char* path = std::getenv("HELLO_METAL_TUNING_FILE"))
+        return path;
+    return "hello_metal_tuning.txt";
+}
+
+std::shared_ptr<const TuningProfile> TuningProfile::active() {
+    std::lock_guard<std::mutex> lock(activeMutex);
+    if (!activeProfile) {
+        auto loaded = std::make_shared<TuningProfile>();
+        loaded->load(defaultPath());
+        activeProfile = std::move(loaded);
+    }
+    return activeProfile;
+}
+
+void TuningProfile::reloadActive() {
+    auto reloaded = std::make_shared<TuningProfile>();
+    reloaded->load(defaultPath());
+    std::lock_guard<std::mutex> lock(activeMutex);
+    activeProfile = std::move(reloaded);
+}
+
+std::string TuningProfile::machineKey(const compute::Device& device) {
+    return hostName() + "/" + device.name();
+}
+
+int TuningProfile::sizeBucket(size_t vectorSize) {
+    int bucket = 0;
+    while (vectorSize > 1) {
+        vectorSize >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+bool TuningProfile::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream fields(line);
+        std::string machine, kernel, bucket, chunkSize, inFlight, threadgroupSize, throughput;
+        if (!std::getline(fields, machine, '\t') || !std::getline(fields, kernel, '\t') ||
+            !std::getline(fields, bucket, '\t') || !std::getline(fields, chunkSize, '\t') ||
+            !std::getline(fields, inFlight, '\t') || !std::getline(fields, threadgroupSize, '\t'))
+            continue; // Skip malformed lines rather than rejecting the whole file
+        std::getline(fields, throughput, '\t');
+
+        TuningParameters parameters;
+        parameters.chunkSize = std::strtoull(chunkSize.c_str(), nullptr, 10);
+        parameters.inFlight = std::strtoull(inFlight.c_str(), nullptr, 10);
+        parameters.threadgroupSize = std::strtoull(threadgroupSize.c_str(), nullptr, 10);
+        parameters.gigabytesPerSecond = std::strtod(throughput.c_str(), nullptr);
+        if (parameters.chunkSize == 0 || parameters.inFlight == 0 || parameters.threadgroupSize == 0)
+            continue;
+
+        set(machine, kernel, std::atoi(bucket.c_str()), parameters);
+    }
+    return true;
+}
+
+bool TuningProfile::save(const std::string& path) const {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file)
+        return false;
+
+    file << "# hello_metal tuning profile (written by Autotuner)\n"
+         << "# machine\tkernel\tbucket\tchunkSize\tinFlight\tthreadgroupSize\tGB/s\n";
+    for (const auto& entry : entries) {
+        const TuningParameters& parameters = entry.second;
+        file << std::get<0>(entry.first) << '\t' << std::get<1>(entry.first) << '\t' << std::get<2>(entry.first) << '\t'
+             << parameters.chunkSize << '\t' << parameters.inFlight << '\t' << parameters.threadgroupSize << '\t'
+             << parameters.gigabytesPerSecond << '\n';
+    }
+    return static_cast<bool>(file);
+}
+
+bool TuningProfile::lookup(const std::string& machine, const std::string& kernel, size_t vectorSize,
+                           TuningParameters& parameters) const {
+    const int wanted = sizeBucket(vectorSize);
+    bool found = false;
+    int bestDistance = 0;
+
+    auto it = entries.lower_bound(std::make_tuple(machine, kernel, std::numeric_limits<int>::min()));
+    for (; it != entries.end() && std::get<0>(it->first) == machine && std::get<1>(it->first) == kernel; ++it) {
+        const int distance = std::abs(std::get<2>(it->first) - wanted);
+        if (!found || distance < bestDistance) {
+            parameters = it->second;
+            bestDistance = distance;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void TuningProfile::set(const std::string& machine, const std::string& kernel, int bucket, const TuningParameters& parameters) {
+    entries[std::make_tuple(machine, kernel, bucket)] = parameters;
+}
+
+void TuningProfile::merge(const TuningProfile& other) {
+    for (const auto& entry : other.entries)
+        entries[entry.first] = entry.second;
+}
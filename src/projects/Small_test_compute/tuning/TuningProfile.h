@@ -0,0 +1,62 @@
+//
+// TuningProfile.h
+//
+
+#ifndef HELLO_METAL_TUNINGPROFILE_H
+#define HELLO_METAL_TUNINGPROFILE_H
+
+#include "../device/ComputeDevice.h"
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+
+// Launch parameters for the chunked ArrayAdder paths.
+struct TuningParameters {
+    size_t chunkSize = 0;       // Elements per chunk (one command buffer each)
+    size_t inFlight = 0;        // Chunks allowed on the device at once
+    size_t threadgroupSize = 0; // Threads per threadgroup in each dispatch
+    double gigabytesPerSecond = 0.0; // Throughput measured when these won
+};
+
+// Winning parameters from Autotuner runs, keyed by machine, kernel and vector-size bucket. Stored as a small
+// tab-separated text file so several machines can share one file:
+//
+//      # machine <TAB> kernel <TAB> bucket <TAB> chunkSize <TAB> inFlight <TAB> threadgroupSize <TAB> GB/s
+//
+class TuningProfile {
+public:
+    // HELLO_METAL_TUNING_FILE if set, otherwise hello_metal_tuning.txt in the working directory.
+    static std::string defaultPath();
+
+    // Loaded from defaultPath() on first use and kept for the rest of the process. Empty if there is no file.
+    // reloadActive() swaps in a freshly loaded profile; callers holding the previous one keep it alive until they
+    // drop it, so a reload never pulls a profile out from under a concurrent lookup.
+    static std::shared_ptr<const TuningProfile> active();
+    static void reloadActive();
+
+    // Host name plus device name, so a GPU and the CPU backend on one machine get separate entries.
+    static std::string machineKey(const compute::Device& device);
+
+    // Vector sizes are bucketed by floor(log2(n)).
+    static int sizeBucket(size_t vectorSize);
+
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+
+    // Entry for the nearest bucket tuned for this machine and kernel. False if the kernel was never tuned here.
+    bool lookup(const std::string& machine, const std::string& kernel, size_t vectorSize, TuningParameters& parameters) const;
+    void set(const std::string& machine, const std::string& kernel, int bucket, const TuningParameters& parameters);
+
+    // Copies in other's entries, replacing any with the same key.
+    void merge(const TuningProfile& other);
+
+    bool empty() const { return entries.empty(); }
+
+private:
+    std::map<std::tuple<std::string, std::string, int>, TuningParameters> entries;
+};
+
+#endif //HELLO_METAL_TUNINGPROFILE_H
@@ -0,0 +1,61 @@
+//
+// typed.metal
+//
+
+#include "elementwise.h"
+
+// The elementwise kernel (add_arrays, complex_operation, ...) for the element types other than float (see
+// types/ElementTypes.h), specialised for the operation like the float one. Storage is what the buffers hold, Compute
+// what the arithmetic runs in; host names follow typedKernelName in cpu/TypedKernels.h. There is no double on Metal, so
+// the f64 kernels only exist on the CPU backend.
+
+// bfloat16 is stored as its bits in a ushort and converted by hand, so the kernels do not depend on Metal 3.1's bfloat.
+struct bfloat16_bits {
+    ushort bits;
+};
+
+template <typename Compute, typename Storage>
+static Compute widen(Storage value) {
+    return static_cast<Compute>(value);
+}
+
+template <>
+float widen<float, bfloat16_bits>(bfloat16_bits value) {
+    return as_type<float>(static_cast<uint>(value.bits) << 16);
+}
+
+template <typename Storage, typename Compute>
+static Storage narrow(Compute value) {
+    return static_cast<Storage>(value);
+}
+
+template <>
+bfloat16_bits narrow<bfloat16_bits, float>(float value) {
+    const uint bits = as_type<uint>(value);
+    if (isnan(value)) {
+        return {static_cast<ushort>((bits >> 16) | 0x0040)};
+    }
+    // Round to nearest, ties to even, on the 16 bits that are dropped
+    const uint rounded = bits + 0x7fff + ((bits >> 16) & 1);
+    return {static_cast<ushort>(rounded >> 16)};
+}
+
+template <typename Storage, typename Compute>
+static void elementwise_typed(const device Storage* inA, const device Storage* inB, device Storage* outC, uint id) {
+    outC[id] = narrow<Storage, Compute>(elementwise_apply<Compute>(widen<Compute>(inA[id]), widen<Compute>(inB[id])));
+}
+
+#define TYPED_KERNEL(name, storage, compute)                                                         \
+kernel void name(const device storage* inA [[ buffer(0) ]],                                          \
+                 const device storage* inB [[ buffer(1) ]],                                          \
+                 device storage* outC [[ buffer(2) ]],                                               \
+                 uint id [[ thread_position_in_grid ]]) {                                            \
+    elementwise_typed<storage, compute>(inA, inB, outC, id);                                         \
+}
+
+TYPED_KERNEL(elementwise_f16, half, float)
+TYPED_KERNEL(elementwise_f16_f16, half, half)
+TYPED_KERNEL(elementwise_bf16, bfloat16_bits, float)
+// The CPU twins widen to int64_t / int32_t; the sum wraps to the same storage value either way
+TYPED_KERNEL(elementwise_i32, int, int)
+TYPED_KERNEL(elementwise_u8, uchar, int)
@@ -0,0 +1,185 @@
+//
+// ElementTypes.h
+//
+// Element types the typed kernels (cpu/TypedKernels.h, typed.metal) are specialised for, and the 16-bit float
+// storage formats the host has no native type for.
+//
+
+#ifndef HELLO_METAL_ELEMENTTYPES_H
+#define HELLO_METAL_ELEMENTTYPES_H
+
+#include <cstdint>
+#include <cstring>
+
+// IEEE binary16 <-> binary32, round-to-nearest-even, with subnormals, infinities and quiet NaNs handled like the
+// hardware converters (F16C, NEON, Metal) handle them.
+inline float halfBitsToFloat(uint16_t bits) {
+    const uint32_t sign = static_cast<uint32_t>(bits & 0x8000u) << 16;
+    const uint32_t exponent = (bits >> 10) & 0x1Fu;
+    const uint32_t mantissa = bits & 0x3FFu;
+
+    uint32_t result;
+    if (exponent == 0x1F) {
+        // Infinity, or a NaN quieted the way F16C and NEON conversions do
+        result = sign | 0x7F800000u | (mantissa << 13) | (mantissa ? 0x00400000u : 0u);
+    } else if (exponent != 0) {
+        result = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else {
+        // Zero or subnormal: mantissa * 2^-24 is exact in float
+        const float magnitude = static_cast<float>(mantissa) * 5.9604644775390625e-08f;
+        return sign ? -magnitude : magnitude;
+    }
+
+    float value;
+    std::memcpy(&value, &result, sizeof(value));
+    return value;
+}
+
+inline uint16_t floatToHalfBits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000u);
+    const uint32_t magnitude = bits & 0x7FFFFFFFu;
+
+    if (magnitude >= 0x7F800000u) // Infinity, or NaN with the quiet bit set
+        return sign | 0x7C00u | (magnitude > 0x7F800000u ? 0x200u | ((magnitude >> 13) & 0x3FFu) : 0u);
+    if (magnitude >= 0x477FF000u) // 65520 and above round to infinity
+        return sign | 0x7C00u;
+
+    if (magnitude < 0x38800000u) {
+        // Below the smallest normal half: a subnormal, or zero below 2^-25 (the tie at 2^-25 goes to even, i.e. zero)
+        if (magnitude <= 0x33000000u)
+            return sign;
+        const uint32_t shift = 126 - (magnitude >> 23);
+        const uint32_t significand = (magnitude & 0x7FFFFFu) | 0x800000u;
+        uint32_t half = significand >> shift;
+        const uint32_t remainder = significand & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1u)))
+            ++half;
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    // Rebias the exponent; a carry out of the mantissa correctly bumps the exponent
+    uint32_t half = (magnitude - 0x38000000u) >> 13;
+    const uint32_t remainder = magnitude & 0x1FFFu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u)))
+        ++half;
+    return static_cast<uint16_t>(sign | half);
+}
+
+// bfloat16 is the top half of a float, so widening is a shift. Narrowing rounds to nearest even and keeps NaNs quiet.
+inline float bfloat16BitsToFloat(uint16_t bits) {
+    const uint32_t widened = static_cast<uint32_t>(bits) << 16;
+    float value;
+    std::memcpy(&value, &widened, sizeof(value));
+    return value;
+}
+
+inline uint16_t floatToBfloat16Bits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7FFFFFFFu) > 0x7F800000u)
+        return static_cast<uint16_t>((bits >> 16) | 0x40u);
+    return static_cast<uint16_t>((bits + 0x7FFFu + ((bits >> 16) & 1u)) >> 16);
+}
+
+// Storage-only 16-bit floats. Arithmetic widens to float and rounds the result back, which is also what "compute in
+// half" means on the CPU.
+struct Half {
+    uint16_t bits = 0;
+
+    Half() = default;
+    explicit Half(float value) : bits(floatToHalfBits(value)) {}
+    explicit operator float() const { return halfBitsToFloat(bits); }
+};
+
+struct BFloat16 {
+    uint16_t bits = 0;
+
+    BFloat16() = default;
+    explicit BFloat16(float value) : bits(floatToBfloat16Bits(value)) {}
+    explicit operator float() const { return bfloat16BitsToFloat(bits); }
+};
+
+static_assert(sizeof(Half) == 2 && sizeof(BFloat16) == 2, "16-bit floats are read as arrays of uint16_t");
+
+inline Half operator+(Half a, Half b) { return Half(static_cast<float>(a) + static_cast<float>(b)); }
+inline Half operator-(Half a, Half b) { return Half(static_cast<float>(a) - static_cast<float>(b)); }
+inline Half operator*(Half a, Half b) { return Half(static_cast<float>(a) * static_cast<float>(b)); }
+inline Half operator/(Half a, Half b) { return Half(static_cast<float>(a) / static_cast<float>(b)); }
+
+inline BFloat16 operator+(BFloat16 a, BFloat16 b) { return BFloat16(static_cast<float>(a) + static_cast<float>(b)); }
+inline BFloat16 operator-(BFloat16 a, BFloat16 b) { return BFloat16(static_cast<float>(a) - static_cast<float>(b)); }
+inline BFloat16 operator*(BFloat16 a, BFloat16 b) { return BFloat16(static_cast<float>(a) * static_cast<float>(b)); }
+inline BFloat16 operator/(BFloat16 a, BFloat16 b) { return BFloat16(static_cast<float>(a) / static_cast<float>(b)); }
+
+enum class ElementType { Float32, Float64, Int32, Int64, UInt8, Float16, BFloat16 };
+
+// suffix names the type in kernel names (see typedKernelName in cpu/TypedKernels.h). Compute is the default type the
+// arithmetic runs in: 16-bit floats widen to float, so they move half the bytes of float data but round once per
+// result; integers widen so that overflow wraps like it does on the GPU.
+template<typename T>
+struct ElementTraits;
+
+template<>
+struct ElementTraits<float> {
+    static constexpr ElementType type = ElementType::Float32;
+    static constexpr const char* suffix = "f32";
+    static constexpr bool isFloatingPoint = true;
+    using Compute = float;
+};
+
+template<>
+struct ElementTraits<double> {
+    static constexpr ElementType type = ElementType::Float64;
+    static constexpr const char* suffix = "f64";
+    static constexpr bool isFloatingPoint = true;
+    using Compute = double;
+};
+
+template<>
+struct ElementTraits<int32_t> {
+    static constexpr ElementType type = ElementType::Int32;
+    static constexpr const char* suffix = "i32";
+    static constexpr bool isFloatingPoint = false;
+    using Compute = int64_t;
+};
+
+// Only used as a compute type (for int32_t)
+template<>
+struct ElementTraits<int64_t> {
+    static constexpr ElementType type = ElementType::Int64;
+    static constexpr const char* suffix = "i64";
+    static constexpr bool isFloatingPoint = false;
+    using Compute = int64_t;
+};
+
+template<>
+struct ElementTraits<uint8_t> {
+    static constexpr ElementType type = ElementType::UInt8;
+    static constexpr const char* suffix = "u8";
+    static constexpr bool isFloatingPoint = false;
+    using Compute = int32_t;
+};
+
+template<>
+struct ElementTraits<Half> {
+    static constexpr ElementType type = ElementType::Float16;
+    static constexpr const char* suffix = "f16";
+    static constexpr bool isFloatingPoint = true;
+    using Compute = float;
+};
+
+template<>
+struct ElementTraits<BFloat16> {
+    static constexpr ElementType type = ElementType::BFloat16;
+    static constexpr const char* suffix = "bf16";
+    static constexpr bool isFloatingPoint = true;
+    using Compute = float;
+};
+
+template<typename T>
+using ComputeTypeOf = typename ElementTraits<T>::Compute;
+
+#endif //HELLO_METAL_ELEMENTTYPES_H
@@ -0,0 +1,91 @@
+//
+// ElementwiseOp.h
+//
+// The element-wise operations on two vectors (add_arrays, complex_operation). Each backend has a single parameterised
+// kernel for all of them: the elementwise kernels in addition.metal and typed.metal read the operation from a function
+// constant, and their CPU twins take it as a template argument. Every variant is therefore compiled with one operation
+// and no branch on it, and adding an operation means adding it here, to elementwise.h next to the .metal files and, for
+// float data, to the SIMD table (see simdElementwise in cpu/TypedKernels.h).
+//
+
+#ifndef HELLO_METAL_ELEMENTWISEOP_H
+#define HELLO_METAL_ELEMENTWISEOP_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// Values are what the function constant holds, so they must match ELEMENTWISE_* in elementwise.h.
+enum class ElementwiseOp : uint32_t { Add = 0, Complex = 1 };
+
+constexpr uint32_t elementwiseOpCount = 2;
+
+// Index of the operation's [[function_constant]] in elementwise.h.
+constexpr uint32_t elementwiseOpConstant = 0;
+
+constexpr ElementwiseOp elementwiseOp(bool complexAddition) {
+    return complexAddition ? ElementwiseOp::Complex : ElementwiseOp::Add;
+}
+
+// name is also what the operation's kernels are registered as (see device/KernelRegistry.h), what tuning profiles are
+// keyed by and how calls are labelled. apply is the formula for one element in type T.
+template<ElementwiseOp Op>
+struct ElementwiseTraits;
+
+template<>
+struct ElementwiseTraits<ElementwiseOp::Add> {
+    static constexpr const char* name = "add_arrays";
+    static constexpr bool needsFloatingPoint = false;
+
+    template<typename T>
+    static T apply(T a, T b) { return a + b; }
+};
+
+// sin(a * b) + a
+template<>
+struct ElementwiseTraits<ElementwiseOp::Complex> {
+    static constexpr const char* name = "complex_operation";
+    static constexpr bool needsFloatingPoint = true;
+
+    template<typename T>
+    static T apply(T a, T b) {
+        if constexpr (std::is_same<T, double>::value)
+            return std::sin(a * b) + a;
+        else
+            // float, or a 16-bit type whose every intermediate is rounded back to the storage format
+            return T(std::sin(static_cast<float>(a * b))) + a;
+    }
+};
+
+// The one place a run-time operation becomes a compile-time one: calls visitor(std::integral_constant<ElementwiseOp,
+// Op>()) and returns its result, so the visitor's body is instantiated once per operation.
+template<typename Visitor>
+constexpr decltype(auto) visitElementwiseOp(ElementwiseOp op, Visitor&& visitor) {
+    switch (op) {
+        case ElementwiseOp::Complex:
+            return std::forward<Visitor>(visitor)(std::integral_constant<ElementwiseOp, ElementwiseOp::Complex>());
+        case ElementwiseOp::Add:
+        default:
+            return std::forward<Visitor>(visitor)(std::integral_constant<ElementwiseOp, ElementwiseOp::Add>());
+    }
+}
+
+constexpr const char* elementwiseOpName(ElementwiseOp op) {
+    return visitElementwiseOp(op, [](auto constant) { return ElementwiseTraits<decltype(constant)::value>::name; });
+}
+
+// Inverse of elementwiseOpName; false leaves op unchanged.
+constexpr bool parseElementwiseOp(std::string_view name, ElementwiseOp& op) {
+    for (uint32_t i = 0; i < elementwiseOpCount; ++i) {
+        if (name == elementwiseOpName(static_cast<ElementwiseOp>(i))) {
+            op = static_cast<ElementwiseOp>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif //HELLO_METAL_ELEMENTWISEOP_H
@@ -0,0 +1,103 @@
+//
+// ResultVerifier.cpp
+//
+
+#include "ResultVerifier.h"
+#include "../cpu/SimdKernels.h"
+
+#include <algorithm>
+
+ResultVerifier::Report ResultVerifier::compare(const float* expected, const float* actual, size_t n, const VerifierOptions& options,
+                                               ThreadPool& pool) {
+    Report result;
+    result.toleranceUlps = options.toleranceUlps;
+    std::mutex resultMutex;
+    pool.parallelFor(n, [&](size_t begin, size_t end) {
+        const Report part = compareRange(begin, expected + begin, actual + begin, end - begin, options);
+        std::lock_guard<std::mutex> lock(resultMutex);
+        merge(result, part, options.maxMismatches);
+    });
+    return result;
+}
+
+ResultVerifier::Report ResultVerifier::compare(const std::vector<float>& expected, const std::vector<float>& actual,
+                                               const VerifierOptions& options, ThreadPool& pool) {
+    if (expected.size() != actual.size()) {
+        std::cerr << "ResultVerifier: comparing " << expected.size() << " expected against " << actual.size()
+                  << " actual elements; only the first " << std::min(expected.size(), actual.size()) << " are checked." << std::endl;
+    }
+    return compare(expected.data(), actual.data(), std::min(expected.size(), actual.size()), options, pool);
+}
+
+void ResultVerifier::add(size_t offset, const float* expected, const float* actual, size_t n) {
+    const Report part = compareRange(offset, expected, actual, n, options);
+    std::lock_guard<std::mutex> lock(mutex);
+    merge(accumulated, part, options.maxMismatches);
+}
+
+ResultVerifier::Report ResultVerifier::report() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Report copy = accumulated;
+    copy.toleranceUlps = options.toleranceUlps;
+    return copy;
+}
+
+void ResultVerifier::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    accumulated = Report();
+}
+
+ResultVerifier::Report ResultVerifier::compareRange(size_t offset, const float* expected, const float* actual, size_t n,
+                                                    const VerifierOptions& options) {
+    const SimdKernelTable& kernels = SimdKernels::active();
+    Report result;
+    result.elements = n;
+    result.toleranceUlps = options.toleranceUlps;
+    for (size_t first = 0; first < n; first += blockSize) {
+        const size_t count = std::min(blockSize, n - first);
+        UlpComparison block;
+        kernels.compareUlp(expected + first, actual + first, count, options.toleranceUlps, &block);
+        result.sumUlps += block.sumUlps;
+        result.maxUlps = std::max(result.maxUlps, block.maxUlps);
+        result.outsideTolerance += block.outside;
+
+        // Only blocks known to hold a mismatch are searched for indices, and only until enough have been found
+        for (size_t i = first; block.outside > 0 && i < first + count && result.firstMismatches.size() < options.maxMismatches; ++i) {
+            const uint32_t ulps = SimdKernels::ulpDistance(expected[i], actual[i]);
+            if (ulps > options.toleranceUlps)
+                result.firstMismatches.push_back({offset + i, expected[i], actual[i], ulps});
+        }
+    }
+    return result;
+}
+
+void ResultVerifier::merge(Report& into, const Report& part, size_t maxMismatches) {
+    into.elements += part.elements;
+    into.sumUlps += part.sumUlps;
+    into.maxUlps = std::max(into.maxUlps, part.maxUlps);
+    into.outsideTolerance += part.outsideTolerance;
+
+    // Parts can arrive in any order; keep the lowest indices overall
+    into.firstMismatches.insert(into.firstMismatches.end(), part.firstMismatches.begin(), part.firstMismatches.end());
+    std::sort(into.firstMismatches.begin(), into.firstMismatches.end(),
+              [](const Mismatch& left, const Mismatch& right) { return left.index < right.index; });
+    if (into.firstMismatches.size() > maxMismatches)
+        into.firstMismatches.resize(maxMismatches);
+}
+
+void ResultVerifier::Report::print(std::ostream& out) const {
+    out << "----------------------------------------------------------------\n";
+    out << "Verification - " << (passed() ? "passed" : "FAILED") << "\n";
+    out << "\t" << elements << " elements | max " << maxUlps << " ULP | mean " << meanUlps() << " ULP | "
+        << outsideTolerance << " outside " << toleranceUlps << " ULP\n";
+    // Enough digits to tell neighbouring floats apart
+    const std::streamsize precision = out.precision(9);
+    for (const Mismatch& mismatch : firstMismatches) {
+        out << "\t[" << mismatch.index << "] expected " << mismatch.expected << " got " << mismatch.actual
+            << " (" << mismatch.ulps << " ULP)\n";
+    }
+    out.precision(precision);
+    if (outsideTolerance > firstMismatches.size())
+        out << "\t... and " << outsideTolerance - firstMismatches.size() << " more\n";
+    out << "----------------------------------------------------------------\n";
+}
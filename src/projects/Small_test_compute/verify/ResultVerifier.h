@@ -0,0 +1,77 @@
+//
+// ResultVerifier.h
+//
+
+#ifndef HELLO_METAL_RESULTVERIFIER_H
+#define HELLO_METAL_RESULTVERIFIER_H
+
+#include "../cpu/ThreadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+// Settings for ResultVerifier.
+struct VerifierOptions {
+    uint32_t toleranceUlps = 4;
+    size_t maxMismatches = 16; // How many of the first mismatching indices to keep
+};
+
+// Compares an output against a reference (e.g. resultGPU against resultCPU) element by element, in units in the last
+// place: how many floats lie between the two values (see SimdKernels::ulpDistance). Addition should match exactly;
+// operations built on sin differ between the device and the CPU kernels by a few ULPs, hence the tolerance.
+//
+// The comparison runs through SimdKernelTable::compareUlp, blockSize elements at a time, so it reads both arrays once
+// at memory speed. compare() splits a whole array across a ThreadPool. An instance accumulates chunks instead, in any
+// order and from any thread, so a pipeline can check each chunk as it completes (see StreamingOptions::verifier)
+// without holding the whole output.
+class ResultVerifier {
+public:
+    static constexpr size_t blockSize = 16384;
+
+    struct Mismatch {
+        size_t index = 0;
+        float expected = 0.0f;
+        float actual = 0.0f;
+        uint32_t ulps = 0;
+    };
+
+    struct Report {
+        size_t elements = 0;
+        uint32_t toleranceUlps = 0;
+        uint64_t sumUlps = 0;
+        uint32_t maxUlps = 0;
+        uint64_t outsideTolerance = 0;
+        std::vector<Mismatch> firstMismatches; // Lowest indices outside the tolerance, in index order
+
+        double meanUlps() const { return elements ? static_cast<double>(sumUlps) / static_cast<double>(elements) : 0.0; }
+        bool passed() const { return outsideTolerance == 0; }
+        void print(std::ostream& out = std::cout) const;
+    };
+
+    explicit ResultVerifier(const VerifierOptions& options = VerifierOptions()) : options(options) {}
+
+    // Compares the first n elements. Vectors of different lengths are compared over the shorter one, after a warning.
+    static Report compare(const float* expected, const float* actual, size_t n, const VerifierOptions& options = VerifierOptions(),
+                          ThreadPool& pool = ThreadPool::shared());
+    static Report compare(const std::vector<float>& expected, const std::vector<float>& actual, const VerifierOptions& options = VerifierOptions(),
+                          ThreadPool& pool = ThreadPool::shared());
+
+    // Adds the chunk [offset, offset + n) of the output, compared on the calling thread. Thread-safe.
+    void add(size_t offset, const float* expected, const float* actual, size_t n);
+    Report report() const;
+    void reset();
+
+private:
+    // Serial comparison of one range into a fresh report.
+    static Report compareRange(size_t offset, const float* expected, const float* actual, size_t n, const VerifierOptions& options);
+    static void merge(Report& into, const Report& part, size_t maxMismatches);
+
+    VerifierOptions options;
+    mutable std::mutex mutex;
+    Report accumulated;
+};
+
+#endif //HELLO_METAL_RESULTVERIFIER_H
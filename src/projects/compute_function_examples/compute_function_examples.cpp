@@ -4,59 +4,92 @@
 
 #include "compute_function_examples.h"
 
-void ComputeFunctionExamples::sumSimpleVectors() {
-    int count = 10;
-
-    // Create random vectors
-    std::random_device rd;  // Initialises seed engine
-    std::mt19937 rng(rd());  // Use Mersenne-Twister random-number engine
-    double real_min = 0.0, real_max = 1.0;
-    std::uniform_real_distribution<double> uni_rdm_real(real_min, real_max);
-
-    std::vector<double> vec1 = ComputeFunctionExamples::getRandomVector(count, rng, uni_rdm_real);
-    std::vector<double> vec2 = ComputeFunctionExamples::getRandomVector(count, rng, uni_rdm_real);
+void ComputeFunctionExamples::sumSimpleVectors(size_t count) {
+    // Create random vectors: one seed, one Philox stream per vector
+    const uint64_t seed = std::random_device()();
+    std::vector<double> vec1 = ComputeFunctionExamples::getRandomVector(count, Philox(seed, 0));
+    std::vector<double> vec2 = ComputeFunctionExamples::getRandomVector(count, Philox(seed, 1));
+    std::vector<double> sequentialResult(count);
+    std::vector<double> parallelResult(count);
 
     // Call out functions
-    std::cout << "Beginning to compute the sum of two vectors\n";
-    computeSequential(vec1, vec2);
-    computeParallel(vec1, vec2);
+    std::cout << "Beginning to compute the sum of two vectors of " << count << " elements\n";
+    computeSequential(vec1, vec2, sequentialResult);
+    computeParallel(vec1, vec2, parallelResult);
+
+    // Print a few of the results, now that the timing is done
+    const size_t shown = std::min<size_t>(count, 10);
+    for (size_t i = 0; i < shown; i++)
+        std::cout << "(" << vec1[i] << " + " << vec2[i] << " = " << parallelResult[i] << ")\n";
+    if (shown < count)
+        std::cout << "... " << count - shown << " more\n";
+
+    // Each sum is one rounding, so both paths must agree exactly
+    size_t mismatches = 0;
+    for (size_t i = 0; i < count; i++)
+        mismatches += sequentialResult[i] != parallelResult[i];
+    if (mismatches == 0)
+        std::cout << "Sequential and parallel results match" << std::endl;
+    else
+        std::cerr << "Sequential and parallel results differ in " << mismatches << " of " << count << " elements" << std::endl;
 }
 
-std::vector<double> ComputeFunctionExamples::getRandomVector( const int &count, std::mt19937 rng,
-                                                              std::uniform_real_distribution<double> uni_rdm_real ) {
-    std::vector<double> vec;
-
-    for (int i = 0; i < count; i++)
-        vec.push_back(uni_rdm_real(rng));
+std::vector<double> ComputeFunctionExamples::getRandomVector( size_t count, const Philox &generator ) {
+    // Sized up front and filled in parallel; uniform on [0, 1)
+    std::vector<double> vec(count);
+    generator.fillUniform(vec.data(), vec.size());
 
     return vec;
 }
 
-void ComputeFunctionExamples::computeSequential( std::vector<double> vector1, std::vector<double> vector2) {
-    std::cout << "Computing Sequentially" << std::endl;
+void ComputeFunctionExamples::computeSequential( std::span<const double> vector1, std::span<const double> vector2,
+                                                 std::span<double> result ) {
+    if (!sameLength(vector1, vector2, result))
+        return;
 
     // Begin process
     Timer timer;
     timer.setName("Sequential Timer");
 
-    std::vector<double> result(vector1.size());
-
-    timer.start(true);
-    for ( int i = 0; i < vector1.size(); i++)
+    timer.start();
+    for (size_t i = 0; i < result.size(); i++)
         result[i] = vector1[i] + vector2[i];
     timer.stop();
 
-    // Print the results
-    for (int i = 0; i < result.size(); i++)
-        std::cout << "(" << vector1[i] << " + " << vector2[i] << " = " << result[i] << ")\n";
-
     // Print out the time
     timer.print();
+}
+
+void ComputeFunctionExamples::computeParallel( std::span<const double> vector1, std::span<const double> vector2,
+                                               std::span<double> result, ThreadPool &pool ) {
+    if (!sameLength(vector1, vector2, result))
+        return;
 
+    Timer timer;
+    timer.setName("Parallel Timer (" + std::to_string(pool.threadCount()) + " threads)");
+
+    const double *first = vector1.data();
+    const double *second = vector2.data();
+    double *out = result.data();
+
+    timer.start();
+    pool.parallelFor(result.size(), [first, second, out](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            out[i] = first[i] + second[i];
+    });
+    timer.stop();
+
+    timer.print();
 }
 
-void ComputeFunctionExamples::computeParallel( std::vector<double> vector1, std::vector<double> vector2) {
-    std::cout << "Computing in Parallel" << std::endl;
+bool ComputeFunctionExamples::sameLength( std::span<const double> vector1, std::span<const double> vector2,
+                                          std::span<double> result ) {
+    if (vector1.size() != vector2.size() || vector1.size() != result.size()) {
+        std::cerr << "ComputeFunctionExamples: vector lengths differ (" << vector1.size() << ", " << vector2.size()
+                  << ", result " << result.size() << ")." << std::endl;
+        return false;
+    }
+    return true;
 }
 
 void addition_seq_compute_function(const float* vec1in, const float* vec2in, float* result, int length) {
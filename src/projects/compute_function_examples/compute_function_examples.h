@@ -6,78 +6,36 @@
 #define HELLO_METAL_COMPUTE_FUNCTION_EXAMPLES_H
 
 #include "../../../lib/config.h"
+#include "../Small_test_compute/cpu/ThreadPool.h"
+#include "../Small_test_compute/random/Philox.h"
+#include "../Small_test_compute/trace/Timer.h"
+#include <algorithm>
 #include <chrono>
+#include <cstddef>
 #include <iostream>
 #include <random>
+#include <span>
+#include <string>
 #include <vector>
 #include <cassert>
 
 class ComputeFunctionExamples {
 public:
-    void sumSimpleVectors();
+    // Adds two random vectors of count doubles both ways, times each, and checks that the results agree.
+    void sumSimpleVectors(size_t count = 10000000);
 
 private:
-    static std::vector<double> getRandomVector( const int &count, std::mt19937 rng,
-                                                std::uniform_real_distribution<double> uni_rdm_real );
-    void computeSequential( std::vector<double> vector1, std::vector<double> vector2);
-    void computeParallel( std::vector<double> vector1, std::vector<double> vector2);
+    static std::vector<double> getRandomVector( size_t count, const Philox &generator );
 
-    void addition_main();
-private:
-    struct Timer {
-        std::string timerName;
-        std::chrono::time_point<std::chrono::system_clock> startSolver;
-        std::chrono::time_point<std::chrono::system_clock> endSolver;
-        long long solverElapsedTime = 0;
-        bool useMilliseconds = false;
-
-        void start(bool useMs = false) {
-            if (useMs)
-                useMilliseconds = true;
-            startSolver = std::chrono::system_clock::now();
-        }
-
-        void stop() {
-            endSolver = std::chrono::system_clock::now();
-            if (useMilliseconds)
-                solverElapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endSolver - startSolver).count();
-            else
-                solverElapsedTime = std::chrono::duration_cast<std::chrono::seconds>(endSolver - startSolver).count();
-        }
-
-        void setName( const std::string &name ) {
-            timerName = name;
-        }
-
-        void cleanUp() {
-            solverElapsedTime = 0;
-            useMilliseconds = false;
-        }
+    // result[i] = vector1[i] + vector2[i]. The inputs are viewed, not copied, and result is written in place; all three
+    // must have the same length. Nothing is printed but the timer, so the timings are of the arithmetic alone.
+    static void computeSequential( std::span<const double> vector1, std::span<const double> vector2, std::span<double> result );
+    // Same, with [0, size) split across pool.
+    static void computeParallel( std::span<const double> vector1, std::span<const double> vector2, std::span<double> result,
+                                 ThreadPool &pool = ThreadPool::shared() );
+    static bool sameLength( std::span<const double> vector1, std::span<const double> vector2, std::span<double> result );
 
-        void print() {
-            auto printTimePoint = []( auto &timePoint) {
-                                        std::time_t printTime = std::chrono::system_clock::to_time_t(timePoint);
-                                        return std::ctime(&printTime);
-            };
-
-            std::cout << "----------------------------------------------------------------\n";
-            if ( !timerName.empty())
-                std::cout << "Timing Information - " << timerName << "\n";
-            else
-                std::cout << "\nTiming Information. \n";
-
-            std::cout << "\tStart: " << printTimePoint(startSolver);
-            std::cout << "\tEnd: " << printTimePoint(endSolver);
-            if (useMilliseconds)
-                std::cout << "\tElapsed: " << solverElapsedTime << " [milliseconds]" << std::endl;
-            else
-                std::cout << "\tElapsed: " << solverElapsedTime << " [seconds]" << std::endl;
-
-            std::cout << "----------------------------------------------------------------\n";
-
-            cleanUp();
-        }
-    };
+    void addition_main();
 };
 
 